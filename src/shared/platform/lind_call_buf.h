@@ -0,0 +1,93 @@
+/*
+ * lind_call_buf.h
+ *
+ * Fixed binary layout for handing a Lind call to a dispatcher.
+ *
+ * Each thread that makes Lind calls owns one LindCallBuf, allocated on
+ * its first call and reused for every call after that.  The runtime
+ * writes the request into it -- call number, cage id, typed arguments
+ * and their bytes -- and the dispatcher writes its response back into
+ * the same memory.  No objects are built per call on either side: the
+ * Python dispatcher sees the whole buffer as one writable buffer object
+ * (LindSyscallBuf(buf)) and a native backend gets a pointer to it.  A
+ * dispatcher without LindSyscallBuf is still called with objects, so a
+ * call goes through the buffer only when something can answer it from
+ * there: LindSyscallBuf, or a backend call hook that takes the call.
+ *
+ * All fields are host-endian.  Argument bytes are stored back to back in
+ * data[], each starting on an 8-byte boundary; strings are stored with
+ * their terminating NUL, which |len| does not count.  The response data
+ * goes at data[out_offset], after the arguments, and is laid out as the
+ * object protocol's response data was: for one output the bytes
+ * themselves, for several a table of num_outs int lengths followed by
+ * the bytes of each output in turn.  The buffer is freed when its thread
+ * exits, so the dispatcher must not hold on to it between calls.
+ */
+
+#ifndef LIND_CALL_BUF_H_
+#define LIND_CALL_BUF_H_
+
+#include <stdint.h>
+
+#define LIND_CALL_BUF_MAGIC             0x3142434cu  /* "LCB1" */
+#define LIND_CALL_MAX_ARGS              16
+#define LIND_CALL_DATA_SIZE             (256 * 1024)
+
+#define LIND_CALL_PAD(n)                (((n) + 7) & ~(uint32_t)7)
+
+enum LindCallArgType {
+    LIND_CALL_ARG_INT = 0,      /* |value| is the integer */
+    LIND_CALL_ARG_STRING = 1,   /* |len| bytes at data[value] */
+    LIND_CALL_ARG_DATA = 2,     /* |len| bytes at data[value] */
+    LIND_CALL_ARG_NONE = 3      /* an optional string or data left out */
+};
+
+struct LindCallArg {
+    uint32_t type;
+    uint32_t len;
+    int64_t value;
+};
+
+struct LindCallBuf {
+    /* request, written by the runtime */
+    uint32_t magic;
+    uint32_t call_num;
+    int32_t cage_id;
+    uint32_t num_args;
+    uint32_t num_outs;
+    uint32_t out_offset;        /* where in data[] the response goes */
+    uint32_t out_capacity;      /* bytes available there */
+    uint32_t reserved;
+    struct LindCallArg args[LIND_CALL_MAX_ARGS];
+    /* response, written by the dispatcher */
+    int32_t is_error;
+    int32_t code;               /* errno if is_error, else the result */
+    uint32_t out_len;           /* response bytes at data[out_offset] */
+    uint32_t reserved2;
+    uint8_t data[LIND_CALL_DATA_SIZE];
+};
+
+/*
+ * Returns the calling thread's buffer, or NULL if it cannot be allocated;
+ * the caller then goes through LindSyscall as before.
+ */
+struct LindCallBuf *LindCallBufGet(void);
+
+/*
+ * Returns nonzero if call |call_num| should go through a LindCallBuf:
+ * the dispatcher has LindSyscallBuf, or the file I/O backend's call hook
+ * may answer it.  Otherwise the buffer would only be unpacked back into
+ * the objects LindSyscall takes, which costs more than building them.
+ */
+int LindCallBufWanted(uint32_t call_num);
+
+/*
+ * Performs the call in |buf|, which must be the calling thread's.  It is
+ * first offered to the file I/O backend's call hook, without the GIL;
+ * otherwise the GIL is taken for the Python dispatcher, through
+ * LindSyscallBuf if it has one and LindSyscall if not.  Returns 1 with the
+ * response filled in, or 0 if the dispatcher raised an exception.
+ */
+int LindCallDispatch(struct LindCallBuf *buf);
+
+#endif /* LIND_CALL_BUF_H_ */
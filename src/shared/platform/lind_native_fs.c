@@ -0,0 +1,541 @@
+/*
+ * lind_native_fs.c
+ *
+ * In-process backend for Lind regular-file I/O.
+ *
+ * When a cage opens a regular file through the Repy dispatcher, we look up
+ * the host descriptor that backs it once, take a private dup of it and
+ * from then on serve read/write/lseek/fxstat for that Lind descriptor with
+ * positional host I/O against an offset kept here.  None of those calls
+ * take the GIL.  Anything we did not see being opened (stdio, sockets,
+ * pipes, directories, files opened O_APPEND) is left to the dispatcher.
+ *
+ * Open file objects are shared between descriptors the same way the
+ * dispatcher shares them: dup/dup2 and fcntl F_DUPFD alias the object and
+ * fork/exec copy the cage's table into the new cage, so the file offset
+ * stays shared.  Close-on-exec is kept per descriptor and O_APPEND, which
+ * F_SETFL may turn on later, per object.
+ *
+ * Descriptor tables are per cage, so cages doing I/O on their own files
+ * only ever touch their own table lock and file objects.
+ */
+
+/* avoid errors caused by conflicts with feature_test_macros(7) */
+#undef _POSIX_C_SOURCE
+#undef _XOPEN_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "native_client/src/include/nacl_macros.h"
+#include "native_client/src/shared/platform/lind_platform.h"
+#include "native_client/src/shared/platform/nacl_log.h"
+#include "native_client/src/shared/platform/nacl_sync.h"
+#include "native_client/src/shared/platform/nacl_sync_checked.h"
+
+#define LIND_NATIVE_FS_MAX_CAGES        1024
+#define LIND_NATIVE_FS_MAX_FDS          1024
+
+struct LindNativeFile {
+    struct NaClMutex mu;        /* serializes offset updates */
+    int refcount;               /* updated atomically */
+    int host_fd;                /* private dup of the dispatcher's host fd */
+    off_t pos;
+    int append;                 /* O_APPEND, set by F_SETFL; under mu */
+    struct lind_stat ident;     /* dispatcher's view at open time */
+};
+
+/*
+ * Each cage has its own descriptor table and lock, so lookups from
+ * different cages never contend.  Tables are created on first use and
+ * live until exit; lind_native_fs_mu only guards their creation.
+ */
+struct LindNativeFsCage {
+    struct NaClMutex mu;
+    struct LindNativeFile *fds[LIND_NATIVE_FS_MAX_FDS];
+    unsigned char cloexec[LIND_NATIVE_FS_MAX_FDS];
+};
+
+static struct NaClMutex lind_native_fs_mu;
+static struct LindNativeFsCage *volatile lind_native_fs_tbl[LIND_NATIVE_FS_MAX_CAGES];
+
+static int LindNativeFsValid(int fd, int cageid)
+{
+    return fd >= 0 && fd < LIND_NATIVE_FS_MAX_FDS &&
+           cageid >= 0 && cageid < LIND_NATIVE_FS_MAX_CAGES;
+}
+
+static struct LindNativeFsCage *LindNativeFsCageGet(int cageid, int create)
+{
+    struct LindNativeFsCage *cage = lind_native_fs_tbl[cageid];
+    if (cage || !create) {
+        return cage;
+    }
+    NaClXMutexLock(&lind_native_fs_mu);
+    cage = lind_native_fs_tbl[cageid];
+    if (!cage) {
+        cage = calloc(1, sizeof *cage);
+        if (!cage || !NaClMutexCtor(&cage->mu)) {
+            NaClLog(LOG_FATAL, "LindNativeFsCageGet: out of memory\n");
+        }
+        /* the table must be fully constructed before other threads see it */
+        __sync_synchronize();
+        lind_native_fs_tbl[cageid] = cage;
+    }
+    NaClXMutexUnlock(&lind_native_fs_mu);
+    return cage;
+}
+
+static struct LindNativeFile *LindNativeFileGet(int fd, int cageid)
+{
+    struct LindNativeFsCage *cage;
+    struct LindNativeFile *f = NULL;
+    if (!LindNativeFsValid(fd, cageid)) {
+        return NULL;
+    }
+    cage = LindNativeFsCageGet(cageid, 0);
+    if (!cage) {
+        return NULL;
+    }
+    NaClXMutexLock(&cage->mu);
+    f = cage->fds[fd];
+    if (f) {
+        __sync_fetch_and_add(&f->refcount, 1);
+    }
+    NaClXMutexUnlock(&cage->mu);
+    return f;
+}
+
+static void LindNativeFilePut(struct LindNativeFile *f)
+{
+    int saved_errno;
+    if (!f) {
+        return;
+    }
+    if (0 == __sync_sub_and_fetch(&f->refcount, 1)) {
+        saved_errno = errno;
+        close(f->host_fd);
+        NaClMutexDtor(&f->mu);
+        free(f);
+        errno = saved_errno;
+    }
+}
+
+/*
+ * Installs |f| (whose reference is consumed) at |fd| in |cageid|'s table,
+ * dropping whatever was there before, with close-on-exec as |cloexec|
+ * says.  |f| may be NULL to just clear.
+ */
+static void LindNativeFileInstall(int fd, int cageid, struct LindNativeFile *f,
+                                  int cloexec)
+{
+    struct LindNativeFsCage *cage;
+    struct LindNativeFile *old = NULL;
+    if (!LindNativeFsValid(fd, cageid)) {
+        LindNativeFilePut(f);
+        return;
+    }
+    cage = LindNativeFsCageGet(cageid, NULL != f);
+    if (!cage) {
+        return;
+    }
+    NaClXMutexLock(&cage->mu);
+    old = cage->fds[fd];
+    cage->fds[fd] = f;
+    cage->cloexec[fd] = f && cloexec;
+    NaClXMutexUnlock(&cage->mu);
+    LindNativeFilePut(old);
+}
+
+static int LindNativeFsInit(void)
+{
+    return NaClMutexCtor(&lind_native_fs_mu) && LindMmapNotifyInit();
+}
+
+static void LindNativeFsOpened(int fd, int flags, int cageid)
+{
+    struct LindNativeFile *f;
+    struct stat st;
+    int host_fd;
+
+    /* whatever |fd| was is gone, and lind_fxstat below must not find it */
+    LindNativeFileInstall(fd, cageid, NULL, 0);
+    if (!LindNativeFsValid(fd, cageid) || (flags & O_APPEND)) {
+        /* the dispatcher owns the seek-to-end for files opened appending */
+        return;
+    }
+    host_fd = GetHostFdFromLindFd(fd, cageid);
+    if (host_fd < 0 || fstat(host_fd, &st) != 0 || !S_ISREG(st.st_mode)) {
+        return;
+    }
+    f = malloc(sizeof *f);
+    if (!f) {
+        return;
+    }
+    if (lind_fxstat(fd, 1, &f->ident, cageid) == -1) {
+        free(f);
+        return;
+    }
+    f->host_fd = fcntl(host_fd, F_DUPFD_CLOEXEC, 0);
+    if (f->host_fd < 0 || !NaClMutexCtor(&f->mu)) {
+        if (f->host_fd >= 0) {
+            close(f->host_fd);
+        }
+        free(f);
+        return;
+    }
+    f->refcount = 1;
+    f->pos = 0;
+    f->append = 0;
+    NaClLog(3, "LindNativeFsOpened: lind_fd %d (cage %d) -> host_fd %d\n",
+            fd, cageid, f->host_fd);
+    LindNativeFileInstall(fd, cageid, f, 0 != (flags & O_CLOEXEC));
+}
+
+static void LindNativeFsDuped(int oldfd, int newfd, int cageid)
+{
+    if (oldfd == newfd) {
+        return;
+    }
+    /* dup and dup2 clear close-on-exec on the new descriptor */
+    LindNativeFileInstall(newfd, cageid, LindNativeFileGet(oldfd, cageid), 0);
+}
+
+static void LindNativeFsClosed(int fd, int cageid)
+{
+    LindNativeFileInstall(fd, cageid, NULL, 0);
+}
+
+/*
+ * fork copies the whole table; exec leaves out the close-on-exec
+ * descriptors, which the dispatcher closes for the new cage.
+ */
+static void LindNativeFsCloned(int newcageid, int cageid, int exec)
+{
+    struct LindNativeFile *copy[LIND_NATIVE_FS_MAX_FDS];
+    unsigned char cloexec[LIND_NATIVE_FS_MAX_FDS];
+    struct LindNativeFsCage *src;
+    struct LindNativeFsCage *dst;
+    struct LindNativeFile *old;
+    int fd;
+
+    if (!LindNativeFsValid(0, cageid) || !LindNativeFsValid(0, newcageid) ||
+        cageid == newcageid) {
+        return;
+    }
+    memset(copy, 0, sizeof copy);
+    memset(cloexec, 0, sizeof cloexec);
+    src = LindNativeFsCageGet(cageid, 0);
+    if (src) {
+        NaClXMutexLock(&src->mu);
+        for (fd = 0; fd < LIND_NATIVE_FS_MAX_FDS; ++fd) {
+            if (src->fds[fd] && !(exec && src->cloexec[fd])) {
+                __sync_fetch_and_add(&src->fds[fd]->refcount, 1);
+                copy[fd] = src->fds[fd];
+                cloexec[fd] = src->cloexec[fd];
+            }
+        }
+        NaClXMutexUnlock(&src->mu);
+    }
+
+    /* anything already in the new cage's table is stale from a reused id */
+    dst = LindNativeFsCageGet(newcageid, 1);
+    for (fd = 0; fd < LIND_NATIVE_FS_MAX_FDS; ++fd) {
+        NaClXMutexLock(&dst->mu);
+        old = dst->fds[fd];
+        dst->fds[fd] = copy[fd];
+        dst->cloexec[fd] = cloexec[fd];
+        NaClXMutexUnlock(&dst->mu);
+        LindNativeFilePut(old);
+    }
+}
+
+/*
+ * Follows the fcntl calls that change what a descriptor refers to or how
+ * it behaves.  The dispatcher has already made them, and answered |ret|.
+ */
+static void LindNativeFsFcntled(int fd, int cmd, long arg, int ret, int cageid)
+{
+    struct LindNativeFsCage *cage;
+    struct LindNativeFile *f;
+
+    switch (cmd) {
+        case F_DUPFD:
+        case F_DUPFD_CLOEXEC:
+            LindNativeFileInstall(ret, cageid, LindNativeFileGet(fd, cageid),
+                                  cmd == F_DUPFD_CLOEXEC);
+            break;
+        case F_SETFD:
+            cage = LindNativeFsValid(fd, cageid) ? LindNativeFsCageGet(cageid, 0) : NULL;
+            if (cage) {
+                NaClXMutexLock(&cage->mu);
+                cage->cloexec[fd] = cage->fds[fd] && (arg & FD_CLOEXEC);
+                NaClXMutexUnlock(&cage->mu);
+            }
+            break;
+        case F_SETFL:
+            f = LindNativeFileGet(fd, cageid);
+            if (f) {
+                NaClXMutexLock(&f->mu);
+                f->append = 0 != (arg & O_APPEND);
+                NaClXMutexUnlock(&f->mu);
+                LindNativeFilePut(f);
+            }
+            break;
+        default:
+            break;
+    }
+}
+
+static int LindNativeFsRead(int fd, int size, void *buf, int cageid)
+{
+    struct LindNativeFile *f = LindNativeFileGet(fd, cageid);
+    ssize_t ret;
+    if (!f) {
+        return LIND_FS_FALLBACK;
+    }
+    NaClXMutexLock(&f->mu);
+    ret = pread(f->host_fd, buf, size, f->pos);
+    if (ret > 0) {
+        f->pos += ret;
+    }
+    NaClXMutexUnlock(&f->mu);
+    LindNativeFilePut(f);
+    return (int) ret;
+}
+
+static int LindNativeFsWrite(int fd, size_t count, const void *buf, int cageid)
+{
+    struct LindNativeFile *f = LindNativeFileGet(fd, cageid);
+    struct stat st;
+    ssize_t ret;
+    if (!f) {
+        return LIND_FS_FALLBACK;
+    }
+    NaClXMutexLock(&f->mu);
+    if (f->append) {
+        /*
+         * As the dispatcher does it: not atomic against writers outside
+         * the cages sharing this file.
+         */
+        if (fstat(f->host_fd, &st) != 0) {
+            NaClXMutexUnlock(&f->mu);
+            LindNativeFilePut(f);
+            return -1;
+        }
+        f->pos = st.st_size;
+    }
+    ret = pwrite(f->host_fd, buf, count, f->pos);
+    if (ret > 0) {
+        f->pos += ret;
+    }
+    NaClXMutexUnlock(&f->mu);
+    LindNativeFilePut(f);
+    return (int) ret;
+}
+
+/* Positional transfers never touch |pos|, so they need no per-file lock. */
+static int LindNativeFsPRead(int fd, void *buf, int count, off_t offset, int cageid)
+{
+    struct LindNativeFile *f = LindNativeFileGet(fd, cageid);
+    ssize_t ret;
+    if (!f) {
+        return LIND_FS_FALLBACK;
+    }
+    ret = pread(f->host_fd, buf, count, offset);
+    LindNativeFilePut(f);
+    return (int) ret;
+}
+
+static int LindNativeFsPWrite(int fd, const void *buf, int count, off_t offset, int cageid)
+{
+    struct LindNativeFile *f = LindNativeFileGet(fd, cageid);
+    ssize_t ret;
+    if (!f) {
+        return LIND_FS_FALLBACK;
+    }
+    ret = pwrite(f->host_fd, buf, count, offset);
+    LindNativeFilePut(f);
+    return (int) ret;
+}
+
+static int LindNativeFsLseek(off_t offset, int fd, int whence, off_t *ret, int cageid)
+{
+    struct LindNativeFile *f = LindNativeFileGet(fd, cageid);
+    struct stat st;
+    off_t base;
+    int retval = 0;
+    if (!f) {
+        return LIND_FS_FALLBACK;
+    }
+    NaClXMutexLock(&f->mu);
+    switch (whence) {
+        case SEEK_SET:
+            base = 0;
+            break;
+        case SEEK_CUR:
+            base = f->pos;
+            break;
+        case SEEK_END:
+            if (fstat(f->host_fd, &st) != 0) {
+                retval = -1;
+                goto unlock;
+            }
+            base = st.st_size;
+            break;
+        default:
+            errno = EINVAL;
+            retval = -1;
+            goto unlock;
+    }
+    if (base + offset < 0) {
+        errno = EINVAL;
+        retval = -1;
+        goto unlock;
+    }
+    f->pos = base + offset;
+    if (ret) {
+        *ret = f->pos;
+    }
+unlock:
+    NaClXMutexUnlock(&f->mu);
+    LindNativeFilePut(f);
+    return retval;
+}
+
+/*
+ * Identity fields (device, inode, mode, ownership) come from the
+ * dispatcher at open time so that they agree with lind_xstat on the same
+ * path; size, blocks and timestamps are live from the host file.
+ */
+static int LindNativeFsFxstat(int fd, int version, struct lind_stat *buf, int cageid)
+{
+    struct LindNativeFile *f = LindNativeFileGet(fd, cageid);
+    struct stat st;
+    UNREFERENCED_PARAMETER(version);
+    if (!f) {
+        return LIND_FS_FALLBACK;
+    }
+    if (fstat(f->host_fd, &st) != 0) {
+        LindNativeFilePut(f);
+        return -1;
+    }
+    *buf = f->ident;
+    buf->st_size = st.st_size;
+    buf->st_blksize = st.st_blksize;
+    buf->st_blocks = st.st_blocks;
+#if NACL_LINUX
+    buf->st_atim.tv_sec = st.st_atim.tv_sec;
+    buf->st_atim.tv_nsec = st.st_atim.tv_nsec;
+    buf->st_mtim.tv_sec = st.st_mtim.tv_sec;
+    buf->st_mtim.tv_nsec = st.st_mtim.tv_nsec;
+    buf->st_ctim.tv_sec = st.st_ctim.tv_sec;
+    buf->st_ctim.tv_nsec = st.st_ctim.tv_nsec;
+#endif
+    LindNativeFilePut(f);
+    return 0;
+}
+
+/*
+ * Mappings are always MAP_FIXED inside the cage's sandbox, so we can make
+ * them ourselves rather than have the dispatcher do it under the GIL; it
+ * only hears about them afterwards, for its accounting.
+ */
+static void *LindNativeFsMmap(void *addr, size_t length, int prot, int flags,
+                              int fd, off_t offset, int cageid)
+{
+    void *map_addr = mmap(addr, length, prot, flags, fd, offset);
+    if (MAP_FAILED != map_addr) {
+        lind_mmap_notify(map_addr, length, prot, flags, fd, offset, cageid);
+    }
+    return map_addr;
+}
+
+/*
+ * Answers fxstat, pread and pwrite on our files straight from the calling
+ * thread's call buffer, reading arguments from it and writing results
+ * into it, so these never reach the dispatcher or take the GIL.
+ */
+static int LindNativeFsCall(struct LindCallBuf *buf)
+{
+    struct LindCallArg const *args = buf->args;
+    uint8_t *out = buf->data + buf->out_offset;
+    int ret;
+
+    switch (buf->call_num) {
+        case LIND_safe_fs_fxstat:
+            if (buf->num_args != 2 || buf->num_outs != 1 ||
+                args[0].type != LIND_CALL_ARG_INT ||
+                args[1].type != LIND_CALL_ARG_INT ||
+                buf->out_capacity < sizeof(struct lind_stat)) {
+                return LIND_FS_FALLBACK;
+            }
+            ret = LindNativeFsFxstat((int) args[0].value, (int) args[1].value,
+                                     (struct lind_stat *) out, buf->cage_id);
+            buf->out_len = ret == 0 ? sizeof(struct lind_stat) : 0;
+            break;
+        case LIND_safe_fs_pread:
+            if (buf->num_args != 3 || buf->num_outs != 1 ||
+                args[0].type != LIND_CALL_ARG_INT ||
+                args[1].type != LIND_CALL_ARG_INT ||
+                args[2].type != LIND_CALL_ARG_INT ||
+                args[1].value < 0 || args[1].value > buf->out_capacity) {
+                return LIND_FS_FALLBACK;
+            }
+            ret = LindNativeFsPRead((int) args[0].value, out, (int) args[1].value,
+                                    (off_t) args[2].value, buf->cage_id);
+            buf->out_len = ret > 0 ? (uint32_t) ret : 0;
+            break;
+        case LIND_safe_fs_pwrite:
+            if (buf->num_args != 4 || buf->num_outs != 0 ||
+                args[0].type != LIND_CALL_ARG_INT ||
+                args[2].type != LIND_CALL_ARG_DATA ||
+                args[3].type != LIND_CALL_ARG_INT) {
+                return LIND_FS_FALLBACK;
+            }
+            ret = LindNativeFsPWrite((int) args[0].value, buf->data + args[2].value,
+                                     (int) args[2].len, (off_t) args[3].value,
+                                     buf->cage_id);
+            buf->out_len = 0;
+            break;
+        default:
+            return LIND_FS_FALLBACK;
+    }
+    if (ret == LIND_FS_FALLBACK) {
+        return LIND_FS_FALLBACK;
+    }
+    buf->is_error = ret < 0;
+    buf->code = ret < 0 ? errno : ret;
+    return 0;
+}
+
+static int LindNativeFsAnswers(uint32_t call_num)
+{
+    return call_num == LIND_safe_fs_fxstat ||
+           call_num == LIND_safe_fs_pread ||
+           call_num == LIND_safe_fs_pwrite;
+}
+
+struct LindFsBackend const lind_native_fs_backend = {
+    "native",
+    LindNativeFsInit,
+    LindNativeFsRead,
+    LindNativeFsWrite,
+    LindNativeFsLseek,
+    LindNativeFsPRead,
+    LindNativeFsPWrite,
+    LindNativeFsFxstat,
+    LindNativeFsOpened,
+    LindNativeFsDuped,
+    LindNativeFsClosed,
+    LindNativeFsCloned,
+    LindNativeFsFcntled,
+    LindNativeFsMmap,
+    LindNativeFsCall,
+    LindNativeFsAnswers
+};
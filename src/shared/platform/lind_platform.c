@@ -12,21 +12,67 @@
 #include <stdio.h>
 #include <Python.h>
 #include <errno.h>
+#include <pthread.h>
+#include <stddef.h>
+#include <sys/mman.h>
 
 #include "native_client/src/shared/platform/lind_platform.h"
 #include "native_client/src/shared/platform/nacl_log.h"
-#include "native_client/src/trusted/service_runtime/include/bits/nacl_syscalls.h"
-
-int lind_syscall_counter;
-int lind_syscall_invoked_times[NACL_MAX_SYSCALLS];
-double lind_syscall_execution_time[NACL_MAX_SYSCALLS];
+#include "native_client/src/shared/platform/nacl_sync.h"
+#include "native_client/src/shared/platform/nacl_sync_checked.h"
+#include "native_client/src/shared/platform/nacl_threads.h"
 
 PyObject *py_repylib;
 PyObject *py_code;
 PyObject *py_context;
 
+/* the dispatcher's LindSyscallBuf, a borrowed reference; NULL if none */
+static PyObject *py_lind_syscall_buf;
+
 static int initialized;
 
+struct LindFsBackend const lind_python_fs_backend = {
+    "python",
+    NULL,
+    NULL, NULL, NULL, NULL, NULL, NULL,
+    NULL, NULL, NULL, NULL, NULL,
+    NULL,
+    NULL, NULL
+};
+
+static struct LindFsBackend const *lind_fs_backend = &lind_python_fs_backend;
+
+int LindFsSetBackend(const char *name)
+{
+    static struct LindFsBackend const *const backends[] = {
+        &lind_python_fs_backend,
+        &lind_native_fs_backend,
+    };
+    size_t i;
+    for (i = 0; i < sizeof backends / sizeof backends[0]; ++i) {
+        if (!strcmp(name, backends[i]->name)) {
+            if (backends[i]->init && !backends[i]->init()) {
+                NaClLog(LOG_ERROR, "Lind file I/O backend %s failed to initialize\n", name);
+                return 0;
+            }
+            lind_fs_backend = backends[i];
+            NaClLog(1, "Lind file I/O backend: %s\n", name);
+            return 1;
+        }
+    }
+    return 0;
+}
+
+const char *LindFsGetBackendName(void)
+{
+    return lind_fs_backend->name;
+}
+
+struct LindFsBackend const *LindFsGetBackend(void)
+{
+    return lind_fs_backend;
+}
+
 /* wrap goto statement to guard against early if/else termination */
 #define GOTO_ERROR_IF_NULL(x) do { if (!(x)) goto error; } while (0)
 
@@ -122,6 +168,9 @@ int LindPythonInit(void)
     GOTO_ERROR_IF_NULL(result);
     result = PyEval_EvalCode((PyCodeObject *)py_code, py_context, py_context);
     UNREFERENCED_PARAMETER(result);
+    py_lind_syscall_buf = PyDict_GetItemString(py_context, "LindSyscallBuf");
+    NaClLog(1, "Lind dispatcher takes %s\n",
+            py_lind_syscall_buf ? "binary call buffers" : "call objects only");
     PyEval_ReleaseLock();
     return 1;
 
@@ -150,6 +199,7 @@ int LindPythonFinalize(void)
     repy_finalize_args = Py_BuildValue("()");
     result = PyObject_CallObject(repy_finalize_func, repy_finalize_args);
     GOTO_ERROR_IF_NULL(result);
+    py_lind_syscall_buf = NULL;
     Py_Finalize();
     initialized = 0;
     retval = 1;
@@ -252,6 +302,175 @@ cleanup:
     return retval;
 }
 
+/*
+ * A thread's call buffer, with the (buffer,) argument tuple the Python
+ * dispatcher is called with; the tuple is made on the first call that
+ * reaches Python and kept as long as the thread.
+ */
+struct LindCallSlot {
+    PyObject *py_args;
+    struct LindCallBuf buf;
+};
+
+static pthread_key_t lind_call_key;
+static pthread_once_t lind_call_key_once = PTHREAD_ONCE_INIT;
+
+static void LindCallSlotFree(void *arg)
+{
+    struct LindCallSlot *slot = arg;
+    PyGILState_STATE gstate;
+    /* after LindPythonFinalize the tuple went with the interpreter */
+    if (slot->py_args && initialized) {
+        gstate = PyGILState_Ensure();
+        Py_DECREF(slot->py_args);
+        PyGILState_Release(gstate);
+    }
+    free(slot);
+}
+
+static void LindCallKeyCreate(void)
+{
+    if (pthread_key_create(&lind_call_key, LindCallSlotFree)) {
+        NaClLog(LOG_FATAL, "LindCallKeyCreate: pthread_key_create failed\n");
+    }
+}
+
+struct LindCallBuf *LindCallBufGet(void)
+{
+    struct LindCallSlot *slot;
+    pthread_once(&lind_call_key_once, LindCallKeyCreate);
+    slot = pthread_getspecific(lind_call_key);
+    if (!slot) {
+        slot = malloc(sizeof *slot);
+        if (!slot) {
+            return NULL;
+        }
+        slot->py_args = NULL;
+        if (pthread_setspecific(lind_call_key, slot)) {
+            free(slot);
+            return NULL;
+        }
+    }
+    return &slot->buf;
+}
+
+/*
+ * The dispatcher step for a dispatcher without LindSyscallBuf: the call
+ * in |buf| is made through LindSyscall with the objects it takes, and the
+ * response is copied back into |buf|.  Caller holds the GIL.  Returns 1,
+ * or 0 on a Python error or a response too large for |buf|.
+ */
+static int LindCallDispatchObjects(struct LindCallBuf *buf)
+{
+    struct LindCallArg const *arg;
+    PyObject *callArgs = NULL;
+    PyObject *apiArg = NULL;
+    PyObject *response = NULL;
+    PyObject *item = NULL;
+    int isError = 0;
+    int code = 0;
+    char *data = NULL;
+    int len = 0;
+    uint32_t i;
+    int retval = 0;
+
+    callArgs = PyList_New(0);
+    GOTO_ERROR_IF_NULL(callArgs);
+    for (i = 0; i <= buf->num_args; ++i) {
+        arg = i < buf->num_args ? &buf->args[i] : NULL;
+        if (!arg) {
+            /* the cage id goes last, as LindSyscallLocked sends it */
+            item = PyInt_FromLong(buf->cage_id);
+        } else if (arg->type == LIND_CALL_ARG_INT) {
+            item = PyInt_FromLong((long)arg->value);
+        } else if (arg->type == LIND_CALL_ARG_STRING || arg->type == LIND_CALL_ARG_DATA) {
+            item = PyString_FromStringAndSize((char *)buf->data + arg->value, arg->len);
+        } else {
+            item = Py_None;
+            Py_INCREF(item);
+        }
+        GOTO_ERROR_IF_NULL(item);
+        if (PyList_Append(callArgs, item)) {
+            goto error;
+        }
+        Py_DECREF(item);
+        item = NULL;
+    }
+    apiArg = Py_BuildValue("(iO)", buf->call_num, callArgs);
+    GOTO_ERROR_IF_NULL(apiArg);
+    response = CallPythonFunc(py_context, "LindSyscall", apiArg);
+    GOTO_ERROR_IF_NULL(response);
+    if (!ParseResponse(response, &isError, &code, &data, &len)) {
+        goto cleanup;
+    }
+    buf->is_error = isError;
+    buf->code = code;
+    buf->out_len = 0;
+    if (!isError && data && len > 0) {
+        if ((uint32_t)len > buf->out_capacity) {
+            NaClLog(LOG_ERROR, "LindCallDispatchObjects: %d response bytes for call %u"
+                    " do not fit\n", len, buf->call_num);
+            goto cleanup;
+        }
+        memcpy(buf->data + buf->out_offset, data, len);
+        buf->out_len = (uint32_t)len;
+    }
+    retval = 1;
+    goto cleanup;
+error:
+    PyErr_Print();
+cleanup:
+    Py_XDECREF(item);
+    Py_XDECREF(callArgs);
+    Py_XDECREF(apiArg);
+    Py_XDECREF(response);
+    return retval;
+}
+
+int LindCallBufWanted(uint32_t call_num)
+{
+    if (py_lind_syscall_buf) {
+        return 1;
+    }
+    return lind_fs_backend->call && lind_fs_backend->answers &&
+           lind_fs_backend->answers(call_num);
+}
+
+int LindCallDispatch(struct LindCallBuf *buf)
+{
+    struct LindCallSlot *slot = (struct LindCallSlot *)
+        ((char *)buf - offsetof(struct LindCallSlot, buf));
+    PyObject *view = NULL;
+    PyObject *result = NULL;
+    PyGILState_STATE gstate;
+    int retval = 0;
+
+    if (lind_fs_backend->call && LIND_FS_FALLBACK != lind_fs_backend->call(buf)) {
+        return 1;
+    }
+    gstate = PyGILState_Ensure();
+    if (!py_lind_syscall_buf) {
+        retval = LindCallDispatchObjects(buf);
+        goto cleanup;
+    }
+    if (!slot->py_args) {
+        view = PyBuffer_FromReadWriteMemory(buf, sizeof *buf);
+        GOTO_ERROR_IF_NULL(view);
+        slot->py_args = PyTuple_Pack(1, view);
+        Py_DECREF(view);
+        GOTO_ERROR_IF_NULL(slot->py_args);
+    }
+    result = PyObject_CallObject(py_lind_syscall_buf, slot->py_args);
+    GOTO_ERROR_IF_NULL(result);
+    Py_DECREF(result);
+    retval = 1;
+    goto cleanup;
+error:
+    PyErr_Print();
+cleanup:
+    PyGILState_Release(gstate);
+    return retval;
+}
 
 #define CHECK_NOT_NULL(x) do { if (!(x)) return -EINVAL; } while (0)
 
@@ -313,26 +532,249 @@ cleanup:
             _offset += ((int*)_data)[(current)];                        \
         }
 
+/*
+ * Calls that older dispatchers may not know.  Their LindSyscall raises
+ * when it looks up a call number it has no handler for, which
+ * CallPythonFunc reports as a NULL response.  LindSyscallOptional tells
+ * such an answer -- a NotImplementedError, KeyError or IndexError, or an
+ * ENOSYS error response -- apart from other failures and latches
+ * *unsupported for it, so the caller stops sending the call.  Any other
+ * exception fails just this call with EIO.
+ */
+static void LindLatchUnsupported(volatile int *unsupported, int callnum)
+{
+    if (!__sync_lock_test_and_set(unsupported, 1)) {
+        NaClLog(LOG_WARNING, "Lind dispatcher does not support call %d\n",
+                callnum);
+    }
+}
+
+static PyObject *LindSyscallOptional(PyObject *callArgs, int callnum,
+                                     volatile int *unsupported)
+{
+    PyObject *func_obj;
+    PyObject *response;
+    int unknown;
+
+    func_obj = PyDict_GetItemString(py_context, "LindSyscall");
+    if (!func_obj) {
+        errno = ENOSYS;
+        return NULL;
+    }
+    response = PyObject_CallObject(func_obj, callArgs);
+    if (response) {
+        return response;
+    }
+    unknown = PyErr_ExceptionMatches(PyExc_NotImplementedError) ||
+              PyErr_ExceptionMatches(PyExc_KeyError) ||
+              PyErr_ExceptionMatches(PyExc_IndexError);
+    if (unknown) {
+        PyErr_Clear();
+        LindLatchUnsupported(unsupported, callnum);
+        errno = ENOSYS;
+    } else {
+        PyErr_Print();
+        errno = EIO;
+    }
+    return NULL;
+}
+
+#define LIND_API_PART2_OPTIONAL(callnum, unsupported)                   \
+        if (!py_context) {                                              \
+            retval = -1;                                                \
+            errno = ENOSYS;                                             \
+            goto cleanup;                                               \
+        }                                                               \
+        GOTO_ERROR_IF_NULL(callArgs);                                   \
+        response = LindSyscallOptional(callArgs, (callnum), &(unsupported)); \
+        if (!response) {                                                \
+            retval = -1;                                                \
+            goto cleanup;                                               \
+        }                                                               \
+        ParseResponse(response, &_isError, &_code, &_data, &_len);      \
+        if (_isError && ENOSYS == _code) {                              \
+            LindLatchUnsupported(&(unsupported), (callnum));            \
+        }                                                               \
+        errno = _isError ? _code : 0;                                   \
+        retval = _isError ? -1 : _code;                                 \
+        UNREFERENCED_PARAMETER(_offset)
+
+/*
+ * Positional I/O is a single dispatcher call; the file offset shared by
+ * other threads and dup'ed descriptors is never touched.  Dispatchers
+ * older than LIND_safe_fs_pread/LIND_safe_fs_pwrite do not know the call;
+ * lind_py_pio_unsupported then latches, and the calls are emulated with
+ * lseek and read/write.
+ */
+static volatile int lind_py_pio_unsupported;
+
+/*
+ * Once pread and pwrite are emulated, each emulated call holds its
+ * (cage, fd) exclusively, and each read, write, lseek and getdents sent to
+ * the dispatcher holds it shared.  So nothing sees or moves the file
+ * offset while an emulated call has moved it, and reads and writes on
+ * the same descriptor still run side by side.  Only that exact
+ * descriptor is held: a read blocked on one descriptor never holds up
+ * another.  Descriptors sharing an offset through dup or fork are not
+ * covered.  Callers put their LindFdPos on their stack.
+ */
+struct LindFdPos {
+    int cageid;
+    int fd;
+    int exclusive;
+    int active;
+    int held;
+    struct LindFdPos *next;
+};
+
+static pthread_mutex_t lind_fd_pos_mu = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t lind_fd_pos_cv = PTHREAD_COND_INITIALIZER;
+static struct LindFdPos *lind_fd_pos_list;
+
+static int LindFdPosMustWait(struct LindFdPos const *self)
+{
+    struct LindFdPos const *p;
+
+    for (p = lind_fd_pos_list; NULL != p; p = p->next) {
+        if (p == self || p->fd != self->fd || p->cageid != self->cageid) {
+            continue;
+        }
+        /* exclusive waits for holders; shared waits for any exclusive */
+        if (self->exclusive ? p->active : p->exclusive) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+static void LindFdPosEnter(struct LindFdPos *self, int fd, int cageid,
+                           int exclusive)
+{
+    self->held = lind_py_pio_unsupported;
+    if (!self->held) {
+        return;
+    }
+    self->fd = fd;
+    self->cageid = cageid;
+    self->exclusive = exclusive;
+    self->active = 0;
+    pthread_mutex_lock(&lind_fd_pos_mu);
+    self->next = lind_fd_pos_list;
+    lind_fd_pos_list = self;
+    while (LindFdPosMustWait(self)) {
+        pthread_cond_wait(&lind_fd_pos_cv, &lind_fd_pos_mu);
+    }
+    self->active = 1;
+    pthread_mutex_unlock(&lind_fd_pos_mu);
+}
+
+static void LindFdPosExit(struct LindFdPos *self)
+{
+    struct LindFdPos **pp;
+
+    if (!self->held) {
+        return;
+    }
+    pthread_mutex_lock(&lind_fd_pos_mu);
+    for (pp = &lind_fd_pos_list; *pp != self; pp = &(*pp)->next) {
+    }
+    *pp = self->next;
+    pthread_cond_broadcast(&lind_fd_pos_cv);
+    pthread_mutex_unlock(&lind_fd_pos_mu);
+}
+
+static int lind_py_read (int fd, int size, void *buf, int cageid);
+static int lind_py_write (int fd, size_t count, const void *buf, int cageid);
+static int lind_py_lseek (off_t offset, int fd, int whence, off_t * ret, int cageid);
+
+static int lind_py_pread(int fd, void *buf, int count, off_t offset, int cageid)
+{
+    LIND_API_PART1;
+    callArgs = Py_BuildValue("(i[iiLi])", LIND_safe_fs_pread, fd, count, (PY_LONG_LONG) offset, cageid);
+    LIND_API_PART2_OPTIONAL(LIND_safe_fs_pread, lind_py_pio_unsupported);
+    COPY_DATA(buf, count)
+    LIND_API_PART3;
+}
+
+/* Atomic with respect to the other users of fd; see LindFdPos. */
+static int lind_py_pread_emulated(int fd, void *buf, int count, off_t offset, int cageid)
+{
+    struct LindFdPos pos;
+    off_t cur_pos = 0;
+    int ret;
+
+    LindFdPosEnter(&pos, fd, cageid, 1);
+    ret = lind_py_lseek(0, fd, SEEK_CUR, &cur_pos, cageid);
+    if (ret >= 0) {
+        ret = lind_py_lseek(offset, fd, SEEK_SET, NULL, cageid);
+    }
+    if (ret >= 0) {
+        ret = lind_py_read(fd, count, buf, cageid);
+        lind_py_lseek(cur_pos, fd, SEEK_SET, NULL, cageid);
+    }
+    LindFdPosExit(&pos);
+    return ret;
+}
+
 int lind_pread(int fd, void *buf, int count, off_t offset, int cageid)
 {
-    off_t cur_pos=0;
-    int ret = 0;
-    cur_pos = lind_lseek (0, fd, SEEK_CUR, cageid);
-    lind_lseek(offset, fd, SEEK_SET, cageid);
-    ret = lind_read(fd, count, buf, cageid);
-    lind_lseek(cur_pos, fd, SEEK_SET, cageid);
+    int ret;
+    if (lind_fs_backend->pread &&
+        LIND_FS_FALLBACK != (ret = lind_fs_backend->pread(fd, buf, count, offset, cageid))) {
+        return ret;
+    }
+    if (!lind_py_pio_unsupported) {
+        ret = lind_py_pread(fd, buf, count, offset, cageid);
+        if (!lind_py_pio_unsupported) {
+            return ret;
+        }
+    }
+    return lind_py_pread_emulated(fd, buf, count, offset, cageid);
+}
+
+static int lind_py_pwrite(int fd, const void *buf, int count, off_t offset, int cageid)
+{
+    LIND_API_PART1;
+    CHECK_NOT_NULL(buf);
+    callArgs = Py_BuildValue("(i[iis#Li])", LIND_safe_fs_pwrite, fd, count, buf, count, (PY_LONG_LONG) offset, cageid);
+    LIND_API_PART2_OPTIONAL(LIND_safe_fs_pwrite, lind_py_pio_unsupported);
+    LIND_API_PART3;
+}
+
+/* Atomic with respect to the other users of fd; see LindFdPos. */
+static int lind_py_pwrite_emulated(int fd, const void *buf, int count, off_t offset, int cageid)
+{
+    struct LindFdPos pos;
+    off_t cur_pos = 0;
+    int ret;
+
+    LindFdPosEnter(&pos, fd, cageid, 1);
+    ret = lind_py_lseek(0, fd, SEEK_CUR, &cur_pos, cageid);
+    if (ret >= 0) {
+        ret = lind_py_lseek(offset, fd, SEEK_SET, NULL, cageid);
+    }
+    if (ret >= 0) {
+        ret = lind_py_write(fd, count, buf, cageid);
+        lind_py_lseek(cur_pos, fd, SEEK_SET, NULL, cageid);
+    }
+    LindFdPosExit(&pos);
     return ret;
 }
 
 int lind_pwrite(int fd, const void *buf, int count, off_t offset, int cageid)
 {
-    off_t cur_pos=0;
-    int ret = 0;
-    cur_pos = lind_lseek (0, fd, SEEK_CUR, cageid);
-    lind_lseek(offset, fd, SEEK_SET, cageid);
-    ret = lind_write(fd, count, buf, cageid);
-    lind_lseek(cur_pos, fd, SEEK_SET, cageid);
-    return ret;
+    int ret;
+    if (lind_fs_backend->pwrite &&
+        LIND_FS_FALLBACK != (ret = lind_fs_backend->pwrite(fd, buf, count, offset, cageid))) {
+        return ret;
+    }
+    if (!lind_py_pio_unsupported) {
+        ret = lind_py_pwrite(fd, buf, count, offset, cageid);
+        if (!lind_py_pio_unsupported) {
+            return ret;
+        }
+    }
+    return lind_py_pwrite_emulated(fd, buf, count, offset, cageid);
 }
 
 int lind_access (int version, const char *file)
@@ -392,7 +834,7 @@ int lind_xstat (int version, const char *path, struct lind_stat *buf, int cageid
     LIND_API_PART3;
 }
 
-int lind_open (int flags, int mode, const char *path, int cageid)
+static int lind_py_open (int flags, int mode, const char *path, int cageid)
 {
     LIND_API_PART1;
     callArgs = Py_BuildValue("(i[iisi])", LIND_safe_fs_open, flags, mode, path, cageid);
@@ -400,7 +842,16 @@ int lind_open (int flags, int mode, const char *path, int cageid)
     LIND_API_PART3;
 }
 
-int lind_close (int fd, int cageid)
+int lind_open (int flags, int mode, const char *path, int cageid)
+{
+    int fd = lind_py_open(flags, mode, path, cageid);
+    if (fd >= 0 && lind_fs_backend->opened) {
+        lind_fs_backend->opened(fd, flags, cageid);
+    }
+    return fd;
+}
+
+static int lind_py_close (int fd, int cageid)
 {
     LIND_API_PART1;
     callArgs = Py_BuildValue("(i[ii])", LIND_safe_fs_close, fd, cageid);
@@ -408,7 +859,16 @@ int lind_close (int fd, int cageid)
     LIND_API_PART3;
 }
 
-int lind_read (int fd, int size, void *buf, int cageid)
+int lind_close (int fd, int cageid)
+{
+    int ret = lind_py_close(fd, cageid);
+    if (ret != -1 && lind_fs_backend->closed) {
+        lind_fs_backend->closed(fd, cageid);
+    }
+    return ret;
+}
+
+static int lind_py_read (int fd, int size, void *buf, int cageid)
 { 
     LIND_API_PART1;
     callArgs = Py_BuildValue("(i[iii])", LIND_safe_fs_read, fd, size, cageid);
@@ -417,7 +877,21 @@ int lind_read (int fd, int size, void *buf, int cageid)
     LIND_API_PART3;
 }
 
-int lind_write (int fd, size_t count, const void *buf, int cageid)
+int lind_read (int fd, int size, void *buf, int cageid)
+{
+    struct LindFdPos pos;
+    int ret;
+    if (lind_fs_backend->read &&
+        LIND_FS_FALLBACK != (ret = lind_fs_backend->read(fd, size, buf, cageid))) {
+        return ret;
+    }
+    LindFdPosEnter(&pos, fd, cageid, 0);
+    ret = lind_py_read(fd, size, buf, cageid);
+    LindFdPosExit(&pos);
+    return ret;
+}
+
+static int lind_py_write (int fd, size_t count, const void *buf, int cageid)
 { 
     LIND_API_PART1;
     CHECK_NOT_NULL(buf);
@@ -426,7 +900,21 @@ int lind_write (int fd, size_t count, const void *buf, int cageid)
     LIND_API_PART3;
 }
 
-int _lind_lseek (off_t offset, int fd, int whence, off_t * ret, int cageid)
+int lind_write (int fd, size_t count, const void *buf, int cageid)
+{
+    struct LindFdPos pos;
+    int ret;
+    if (lind_fs_backend->write &&
+        LIND_FS_FALLBACK != (ret = lind_fs_backend->write(fd, count, buf, cageid))) {
+        return ret;
+    }
+    LindFdPosEnter(&pos, fd, cageid, 0);
+    ret = lind_py_write(fd, count, buf, cageid);
+    LindFdPosExit(&pos);
+    return ret;
+}
+
+static int lind_py_lseek (off_t offset, int fd, int whence, off_t * ret, int cageid)
 {
     LIND_API_PART1;
     callArgs = Py_BuildValue("(i[iiii])", LIND_safe_fs_lseek, offset, fd, whence, cageid);
@@ -435,6 +923,20 @@ int _lind_lseek (off_t offset, int fd, int whence, off_t * ret, int cageid)
     LIND_API_PART3;
 }
 
+int _lind_lseek (off_t offset, int fd, int whence, off_t * ret, int cageid)
+{
+    struct LindFdPos pos;
+    int retval;
+    if (lind_fs_backend->lseek &&
+        LIND_FS_FALLBACK != (retval = lind_fs_backend->lseek(offset, fd, whence, ret, cageid))) {
+        return retval;
+    }
+    LindFdPosEnter(&pos, fd, cageid, 0);
+    retval = lind_py_lseek(offset, fd, whence, ret, cageid);
+    LindFdPosExit(&pos);
+    return retval;
+}
+
 int lind_lseek (off_t offset, int fd, int whence, int cageid)
 {
     off_t ret_off=0;
@@ -446,7 +948,7 @@ int lind_lseek (off_t offset, int fd, int whence, int cageid)
     return ret_off;
 }
 
-int lind_fxstat (int fd, int version, struct lind_stat *buf, int cageid)
+static int lind_py_fxstat (int fd, int version, struct lind_stat *buf, int cageid)
 {
     LIND_API_PART1;
     callArgs = Py_BuildValue("(i[iii])", LIND_safe_fs_fxstat, fd, version, cageid);
@@ -455,6 +957,16 @@ int lind_fxstat (int fd, int version, struct lind_stat *buf, int cageid)
     LIND_API_PART3;
 }
 
+int lind_fxstat (int fd, int version, struct lind_stat *buf, int cageid)
+{
+    int ret;
+    if (lind_fs_backend->fxstat &&
+        LIND_FS_FALLBACK != (ret = lind_fs_backend->fxstat(fd, version, buf, cageid))) {
+        return ret;
+    }
+    return lind_py_fxstat(fd, version, buf, cageid);
+}
+
 int lind_fstatfs (int fd, struct lind_statfs *buf)
 {
     LIND_API_PART1;
@@ -490,7 +1002,7 @@ int lind_getpid (pid_t *buf)
     LIND_API_PART3;
 }
 
-int lind_dup (int oldfd, int cageid)
+static int lind_py_dup (int oldfd, int cageid)
 {
     LIND_API_PART1;
     callArgs = Py_BuildValue("(i[ii])", LIND_safe_fs_dup, oldfd, cageid);
@@ -498,7 +1010,16 @@ int lind_dup (int oldfd, int cageid)
     LIND_API_PART3;
 }
 
-int lind_dup2 (int oldfd, int newfd, int cageid)
+int lind_dup (int oldfd, int cageid)
+{
+    int newfd = lind_py_dup(oldfd, cageid);
+    if (newfd >= 0 && lind_fs_backend->duped) {
+        lind_fs_backend->duped(oldfd, newfd, cageid);
+    }
+    return newfd;
+}
+
+static int lind_py_dup2 (int oldfd, int newfd, int cageid)
 {
     LIND_API_PART1;
     callArgs = Py_BuildValue("(i[iii])", LIND_safe_fs_dup2, oldfd, newfd, cageid);
@@ -506,7 +1027,16 @@ int lind_dup2 (int oldfd, int newfd, int cageid)
     LIND_API_PART3;
 }
 
-int lind_getdents (int fd, size_t nbytes, char *buf, int cageid)
+int lind_dup2 (int oldfd, int newfd, int cageid)
+{
+    int ret = lind_py_dup2(oldfd, newfd, cageid);
+    if (ret >= 0 && lind_fs_backend->duped) {
+        lind_fs_backend->duped(oldfd, ret, cageid);
+    }
+    return ret;
+}
+
+static int lind_py_getdents (int fd, size_t nbytes, char *buf, int cageid)
 {
     LIND_API_PART1;
     callArgs = Py_BuildValue("(i[iii])", LIND_safe_fs_getdents, fd, nbytes, cageid);
@@ -515,6 +1045,17 @@ int lind_getdents (int fd, size_t nbytes, char *buf, int cageid)
     LIND_API_PART3;
 }
 
+int lind_getdents (int fd, size_t nbytes, char *buf, int cageid)
+{
+    struct LindFdPos pos;
+    int ret;
+
+    LindFdPosEnter(&pos, fd, cageid, 0);
+    ret = lind_py_getdents(fd, nbytes, buf, cageid);
+    LindFdPosExit(&pos);
+    return ret;
+}
+
 int lind_fcntl_get (int fd, int cmd)
 {
     LIND_API_PART1;
@@ -782,13 +1323,200 @@ int lind_pipe2(int* pipefds, int flags, int cageid){
     LIND_API_PART3;
 }
 
-int lind_fork(int newcageid, int cageid){
+void *lind_mmap_fixed(void *addr, size_t length, int prot, int flags, int fd, off_t offset, int cageid){
+    unsigned long topbits;
+    unsigned int mapbottom;
+
+    if (lind_fs_backend->mmap) {
+        return lind_fs_backend->mmap(addr, length, prot, flags, fd, offset, cageid);
+    }
+    /* The RPC interface can only return ints, not longs. This means
+     * we can't get the top 32 bits of the address. Thankfully, the
+     * top 32 bits of the address, a cage invariant, are already
+     * specified because MAP_FIXED is set, so we bitmask them from the
+     * start address.
+     */
+    topbits = (unsigned long) addr & 0xffffffff00000000UL;
+    mapbottom = lind_mmap(addr, length, prot, flags, fd, offset, cageid);
+    if (mapbottom == (unsigned int) -1) {
+        return MAP_FAILED;
+    }
+    return (void *) (topbits | (unsigned long) mapbottom);
+}
+
+/*
+ * Mapping notifications from backends that map memory themselves.  The
+ * cage does not wait for the dispatcher: notes are appended to a queue
+ * and a helper thread, started on first use, sends them in order, taking
+ * the GIL once per batch.
+ */
+#define LIND_MMAP_NOTIFY_STACK_SIZE     (1 << 20)
+
+struct LindMmapNote {
+    void *addr;
+    size_t length;
+    int prot;
+    int flags;
+    int fd;
+    off_t offset;
+    int cageid;
+};
+
+static struct NaClMutex lind_mmap_notify_mu;
+static struct NaClCondVar lind_mmap_notify_work_cv;
+static struct NaClCondVar lind_mmap_notify_idle_cv;
+static struct LindMmapNote *lind_mmap_notify_queue;
+static size_t lind_mmap_notify_len;
+static size_t lind_mmap_notify_size;
+static size_t lind_mmap_notify_sending;  /* taken by the thread, not yet sent */
+static int lind_mmap_notify_initialized;
+static int lind_mmap_notify_started;
+static struct NaClThread lind_mmap_notify_thread;
+/* Set once the dispatcher turns LIND_safe_fs_mmap_notify down. */
+static volatile int lind_mmap_notify_unsupported;
+
+static int lind_py_mmap_notify(struct LindMmapNote const *note)
+{
+    LIND_API_PART1;
+    callArgs = Py_BuildValue("(i[lliiiLi])", LIND_safe_fs_mmap_notify,
+                             (long) note->addr, (long) note->length,
+                             note->prot, note->flags, note->fd,
+                             (PY_LONG_LONG) note->offset, note->cageid);
+    LIND_API_PART2_OPTIONAL(LIND_safe_fs_mmap_notify,
+                            lind_mmap_notify_unsupported);
+    LIND_API_PART3;
+}
+
+static void WINAPI LindMmapNotifyThread(void *state)
+{
+    struct LindMmapNote *batch;
+    size_t len;
+    size_t i;
+    PyGILState_STATE gstate;
+
+    UNREFERENCED_PARAMETER(state);
+    for (;;) {
+        NaClXMutexLock(&lind_mmap_notify_mu);
+        lind_mmap_notify_sending = 0;
+        NaClXCondVarBroadcast(&lind_mmap_notify_idle_cv);
+        while (0 == lind_mmap_notify_len) {
+            NaClXCondVarWait(&lind_mmap_notify_work_cv, &lind_mmap_notify_mu);
+        }
+        batch = lind_mmap_notify_queue;
+        len = lind_mmap_notify_len;
+        lind_mmap_notify_queue = NULL;
+        lind_mmap_notify_len = 0;
+        lind_mmap_notify_size = 0;
+        lind_mmap_notify_sending = len;
+        NaClXMutexUnlock(&lind_mmap_notify_mu);
+
+        gstate = PyGILState_Ensure();
+        for (i = 0; i < len && !lind_mmap_notify_unsupported; ++i) {
+            if (-1 == lind_py_mmap_notify(&batch[i]) &&
+                !lind_mmap_notify_unsupported) {
+                NaClLog(LOG_WARNING,
+                        "lind_mmap_notify(%p, %"NACL_PRIuS"): dispatcher"
+                        " returned errno %d, mapping not recorded\n",
+                        batch[i].addr, batch[i].length, errno);
+            }
+        }
+        PyGILState_Release(gstate);
+        free(batch);
+    }
+}
+
+int LindMmapNotifyInit(void)
+{
+    if (lind_mmap_notify_initialized) {
+        return 1;
+    }
+    if (!NaClMutexCtor(&lind_mmap_notify_mu)) {
+        return 0;
+    }
+    if (!NaClCondVarCtor(&lind_mmap_notify_work_cv)) {
+        NaClMutexDtor(&lind_mmap_notify_mu);
+        return 0;
+    }
+    if (!NaClCondVarCtor(&lind_mmap_notify_idle_cv)) {
+        NaClCondVarDtor(&lind_mmap_notify_work_cv);
+        NaClMutexDtor(&lind_mmap_notify_mu);
+        return 0;
+    }
+    lind_mmap_notify_initialized = 1;
+    return 1;
+}
+
+void lind_mmap_notify(void *addr, size_t length, int prot, int flags, int fd,
+                      off_t offset, int cageid)
+{
+    struct LindMmapNote *note;
+
+    if (lind_mmap_notify_unsupported) {
+        return;
+    }
+    NaClXMutexLock(&lind_mmap_notify_mu);
+    if (!lind_mmap_notify_started) {
+        if (!NaClThreadCtor(&lind_mmap_notify_thread, LindMmapNotifyThread,
+                            NULL, LIND_MMAP_NOTIFY_STACK_SIZE)) {
+            NaClLog(LOG_FATAL, "lind_mmap_notify: could not start thread\n");
+        }
+        lind_mmap_notify_started = 1;
+    }
+    if (lind_mmap_notify_len == lind_mmap_notify_size) {
+        size_t size = lind_mmap_notify_size ? 2 * lind_mmap_notify_size : 64;
+        note = realloc(lind_mmap_notify_queue, size * sizeof *note);
+        if (!note) {
+            NaClLog(LOG_FATAL, "lind_mmap_notify: out of memory\n");
+        }
+        lind_mmap_notify_queue = note;
+        lind_mmap_notify_size = size;
+    }
+    note = &lind_mmap_notify_queue[lind_mmap_notify_len++];
+    note->addr = addr;
+    note->length = length;
+    note->prot = prot;
+    note->flags = flags;
+    note->fd = fd;
+    note->offset = offset;
+    note->cageid = cageid;
+    NaClXCondVarSignal(&lind_mmap_notify_work_cv);
+    NaClXMutexUnlock(&lind_mmap_notify_mu);
+}
+
+/*
+ * Waits until every queued notification has reached the dispatcher.  fork
+ * and exec call this first, as the dispatcher copies the old cage's
+ * accounting into the new cage.
+ */
+static void LindMmapNotifyDrain(void)
+{
+    if (!lind_mmap_notify_initialized) {
+        return;
+    }
+    NaClXMutexLock(&lind_mmap_notify_mu);
+    while (0 != lind_mmap_notify_len || 0 != lind_mmap_notify_sending) {
+        NaClXCondVarWait(&lind_mmap_notify_idle_cv, &lind_mmap_notify_mu);
+    }
+    NaClXMutexUnlock(&lind_mmap_notify_mu);
+}
+
+static int lind_py_fork(int newcageid, int cageid){
     LIND_API_PART1;
     callArgs = Py_BuildValue("(i[ii])", LIND_safe_fs_fork, newcageid, cageid);
     LIND_API_PART2;
     LIND_API_PART3;
 }
 
+int lind_fork(int newcageid, int cageid){
+    int ret;
+    LindMmapNotifyDrain();
+    ret = lind_py_fork(newcageid, cageid);
+    if (ret != -1 && lind_fs_backend->cloned) {
+        lind_fs_backend->cloned(newcageid, cageid, 0);
+    }
+    return ret;
+}
+
 int lind_mmap(void *addr, size_t length, int prot, int flags, int fd, off_t offset, int cageid){
     LIND_API_PART1;
     callArgs = Py_BuildValue("(l[lliiili])", LIND_safe_fs_mmap, (long) addr, length, prot, flags, fd, offset, cageid);
@@ -803,9 +1531,19 @@ int lind_munmap(void *addr, size_t length, int cageid){
     LIND_API_PART3;
 }
 
-int lind_exec(int newcageid, int cageid){
+static int lind_py_exec(int newcageid, int cageid){
     LIND_API_PART1;
     callArgs = Py_BuildValue("(i[ii])", LIND_safe_fs_exec, newcageid, cageid);
     LIND_API_PART2;
     LIND_API_PART3;
 }
+
+int lind_exec(int newcageid, int cageid){
+    int ret;
+    LindMmapNotifyDrain();
+    ret = lind_py_exec(newcageid, cageid);
+    if (ret != -1 && lind_fs_backend->cloned) {
+        lind_fs_backend->cloned(newcageid, cageid, 1);
+    }
+    return ret;
+}
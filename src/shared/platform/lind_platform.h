@@ -25,6 +25,7 @@
 #include <stdint.h>
 #include <Python.h>
 
+#include "native_client/src/shared/platform/lind_call_buf.h"
 #include "native_client/src/shared/platform/lind_stat.h"
 
 #if NACL_OSX
@@ -89,6 +90,10 @@
 #define LIND_safe_fs_fork               68
 #define LIND_safe_fs_exec               69
 
+#define LIND_safe_fs_pread              126
+#define LIND_safe_fs_pwrite             127
+#define LIND_safe_fs_mmap_notify        128
+
 
 
 #define LIND_comp_cia                   105
@@ -106,6 +111,86 @@ struct select_results {
 
 int GetHostFdFromLindFd(int lindFd, int cageid);
 
+/*
+ * Lind file I/O backends.
+ *
+ * The regular-file calls (read, write, lseek, fxstat) are first offered to
+ * the backend selected at sel_ldr startup.  A backend hook returns
+ * LIND_FS_FALLBACK for any descriptor it does not own, in which case the
+ * call goes through the Repy dispatcher as before.  Otherwise the hook has
+ * the same contract as the lind_* wrapper: -1 with errno set on failure.
+ *
+ * |buf| is handed through unchanged from the NaClDesc layer, so for
+ * NaClSysRead/NaClSysWrite and the ELF loader it is the already-validated
+ * untrusted sysaddr range; a backend should transfer into it directly
+ * rather than staging the data.  pread/pwrite do not move the file offset.
+ *
+ * The descriptor-lifetime hooks are invoked after the dispatcher has
+ * successfully performed the corresponding call so that a backend can keep
+ * its own view of the cage's file table in sync.  fork and exec both copy
+ * the old cage's table into the new cage; exec (|exec| set) leaves out the
+ * descriptors that are close-on-exec.  The fcntl hook hears of every
+ * fcntl(|fd|, |cmd|, |arg|) the dispatcher answered with |ret| >= 0, so
+ * that it can follow F_DUPFD, F_DUPFD_CLOEXEC, F_SETFD and F_SETFL.
+ *
+ * The mmap hook, if present, makes every host mapping for the cages in
+ * place of lind_mmap.  It is only asked for MAP_FIXED mappings inside a
+ * cage's sandbox, with |fd| a host descriptor or -1, and returns what
+ * mmap(2) would.  It should report each mapping with lind_mmap_notify so
+ * the dispatcher's accounting stays in step.
+ *
+ * The call hook, if present, is offered every NaClSysLindSyscall made
+ * through the calling thread's LindCallBuf before the GIL is taken.  It
+ * returns LIND_FS_FALLBACK to pass, or 0 after filling in the response.
+ * The answers hook says which call numbers the call hook may answer; the
+ * others skip the buffer unless the dispatcher has LindSyscallBuf.
+ */
+#define LIND_FS_FALLBACK                (-2)
+
+struct LindFsBackend {
+    const char *name;
+    int (*init)(void);
+    int (*read)(int fd, int size, void *buf, int cageid);
+    int (*write)(int fd, size_t count, const void *buf, int cageid);
+    int (*lseek)(off_t offset, int fd, int whence, off_t *ret, int cageid);
+    int (*pread)(int fd, void *buf, int count, off_t offset, int cageid);
+    int (*pwrite)(int fd, const void *buf, int count, off_t offset, int cageid);
+    int (*fxstat)(int fd, int version, struct lind_stat *buf, int cageid);
+    void (*opened)(int fd, int flags, int cageid);
+    void (*duped)(int oldfd, int newfd, int cageid);
+    void (*closed)(int fd, int cageid);
+    void (*cloned)(int newcageid, int cageid, int exec);
+    void (*fcntled)(int fd, int cmd, long arg, int ret, int cageid);
+    void *(*mmap)(void *addr, size_t length, int prot, int flags, int fd,
+                  off_t offset, int cageid);
+    int (*call)(struct LindCallBuf *buf);
+    int (*answers)(uint32_t call_num);
+};
+
+extern struct LindFsBackend const lind_python_fs_backend;
+extern struct LindFsBackend const lind_native_fs_backend;
+
+/*
+ * Selects the backend by name ("python" or "native").  Must be called
+ * before the first cage is started.  Returns 1 on success, 0 if the name
+ * is not recognised or the backend failed to initialize.
+ */
+int LindFsSetBackend(const char *name);
+const char *LindFsGetBackendName(void);
+struct LindFsBackend const *LindFsGetBackend(void);
+
+/*
+ * Tells the dispatcher about a mapping a backend made itself.  Returns at
+ * once: notifications are queued and sent in order by a helper thread,
+ * and fork and exec wait for the queue to drain before going to the
+ * dispatcher.  A dispatcher without LIND_safe_fs_mmap_notify turns the
+ * notifications off for the rest of the run after the first attempt.
+ * LindMmapNotifyInit must have been called first.
+ */
+int LindMmapNotifyInit(void);
+void lind_mmap_notify(void *addr, size_t length, int prot, int flags, int fd,
+                      off_t offset, int cageid);
+
 int LindPythonInit(void);
 int LindPythonFinalize(void);
 
@@ -162,6 +247,12 @@ int lind_pipe(int* pipefds, int cageid);
 int lind_pipe2(int* pipefds, int flags, int cageid);  /* unimplemented */
 int lind_fork(int newcageid, int cageid);
 int lind_mmap(void *addr, size_t length, int prot, int flags, int fd, off_t offset, int cageid);
+/*
+ * MAP_FIXED mmap for a cage, through the backend's mmap hook if it has one
+ * and lind_mmap otherwise.  Returns the full address, or MAP_FAILED with
+ * errno set.
+ */
+void *lind_mmap_fixed(void *addr, size_t length, int prot, int flags, int fd, off_t offset, int cageid);
 int lind_munmap(void *addr, size_t length, int cageid);
 int lind_exec(int newcageid, int cageid);
 
@@ -0,0 +1,69 @@
+/*
+ * Copyright (c) 2017 The Native Client Authors. All rights reserved.
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file.
+ */
+
+/*
+ * NaCl futex implementation (Linux): the host futex, process-private.
+ */
+
+#include <errno.h>
+#include <linux/futex.h>
+#include <stdint.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "native_client/src/shared/platform/nacl_futex.h"
+#include "native_client/src/trusted/service_runtime/include/sys/errno.h"
+
+static int XlateFutexErrno(int err) {
+  switch (err) {
+    case EAGAIN:
+      return -NACL_ABI_EAGAIN;
+    case ETIMEDOUT:
+      return -NACL_ABI_ETIMEDOUT;
+    case EINTR:
+      return -NACL_ABI_EINTR;
+    case EFAULT:
+      return -NACL_ABI_EFAULT;
+    default:
+      return -NACL_ABI_EINVAL;
+  }
+}
+
+int NaClFutexWait(volatile int32_t *addr, int32_t value,
+                  struct nacl_abi_timespec const *rel_timeout) {
+  struct timespec ts;
+  struct timespec *tsp = NULL;
+
+  if (NULL != rel_timeout) {
+    ts.tv_sec = rel_timeout->tv_sec;
+    ts.tv_nsec = rel_timeout->tv_nsec;
+    tsp = &ts;
+  }
+  if (0 == syscall(SYS_futex, addr, FUTEX_WAIT_PRIVATE, value, tsp,
+                   NULL, 0)) {
+    return 0;
+  }
+  return XlateFutexErrno(errno);
+}
+
+int NaClFutexWake(volatile int32_t *addr, int32_t nwake) {
+  long woken = syscall(SYS_futex, addr, FUTEX_WAKE_PRIVATE, nwake, NULL,
+                       NULL, 0);
+
+  return woken < 0 ? 0 : (int) woken;
+}
+
+int NaClFutexCmpRequeue(volatile int32_t *addr, int32_t nwake,
+                        int32_t nrequeue, volatile int32_t *addr2,
+                        int32_t value) {
+  /* the kernel takes the requeue limit in place of a timeout */
+  long moved = syscall(SYS_futex, addr, FUTEX_CMP_REQUEUE_PRIVATE, nwake,
+                       (struct timespec *) (uintptr_t) nrequeue, addr2,
+                       value);
+
+  return moved < 0 ? XlateFutexErrno(errno) : (int) moved;
+}
@@ -0,0 +1,48 @@
+/*
+ * Copyright (c) 2017 The Native Client Authors. All rights reserved.
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file.
+ */
+
+/*
+ * NaCl futex abstraction: wait on and wake a 32-bit word in this process,
+ * trusted memory or a cage's.  On Linux this is the host futex; elsewhere
+ * waiters queue by address in a hashed table.  A waiter may return early
+ * without a matching wake, so callers must recheck their condition in a
+ * loop.
+ */
+#ifndef NATIVE_CLIENT_SRC_SHARED_PLATFORM_NACL_FUTEX_H_
+#define NATIVE_CLIENT_SRC_SHARED_PLATFORM_NACL_FUTEX_H_
+
+#include "native_client/src/include/nacl_base.h"
+#include "native_client/src/include/portability.h"
+
+#include "native_client/src/trusted/service_runtime/include/sys/time.h"
+
+EXTERN_C_BEGIN
+
+/*
+ * If *addr still holds |value|, sleeps until woken by NaClFutexWake on
+ * |addr| or until |rel_timeout| (NULL for none) has passed.  Returns 0,
+ * or -NACL_ABI_EAGAIN if *addr did not hold |value|, -NACL_ABI_ETIMEDOUT,
+ * -NACL_ABI_EINTR or -NACL_ABI_EFAULT.
+ */
+int NaClFutexWait(volatile int32_t *addr, int32_t value,
+                  struct nacl_abi_timespec const *rel_timeout);
+
+/* Wakes up to |nwake| threads waiting on |addr|.  Returns the number woken. */
+int NaClFutexWake(volatile int32_t *addr, int32_t nwake);
+
+/*
+ * If *addr still holds |value|, wakes up to |nwake| threads waiting on
+ * |addr| and moves up to |nrequeue| of the others to wait on |addr2|.
+ * Returns the number woken plus the number moved, or -NACL_ABI_EAGAIN if
+ * *addr did not hold |value|, or -NACL_ABI_EFAULT.
+ */
+int NaClFutexCmpRequeue(volatile int32_t *addr, int32_t nwake,
+                        int32_t nrequeue, volatile int32_t *addr2,
+                        int32_t value);
+
+EXTERN_C_END
+
+#endif  /* NATIVE_CLIENT_SRC_SHARED_PLATFORM_NACL_FUTEX_H_ */
@@ -94,6 +94,23 @@ static int              timestamp_enabled = 1;
 /* global, but explicitly not exposed in non-test header file */
 void (*gNaClLogAbortBehavior)(void) = NaClAbort;
 
+int (*volatile gNaClLogBinarySink)(int         detail_level,
+                                   int         tagged,
+                                   char const  *fmt,
+                                   va_list     ap) = NULL;
+
+/*
+ * Hands the message to the binary logging backend, if it is on.
+ * Returns nonzero if there is nothing left to do.
+ */
+static INLINE int NaClLogToBinarySink(int         detail_level,
+                                      char const  *fmt,
+                                      va_list     ap) {
+  int (*sink)(int, int, char const *, va_list) = gNaClLogBinarySink;
+
+  return NULL != sink && (*sink)(detail_level, timestamp_enabled, fmt, ap);
+}
+
 /*
  * For now, we use a simple linked list.  New entries are pushed to
  * the front; search starts at front.  So last entry for a particular
@@ -530,6 +547,9 @@ void NaClLogV(int         detail_level,
   if (detail_level > verbosity) {
     return;
   }
+  if (NaClLogToBinarySink(detail_level, fmt, ap)) {
+    return;
+  }
 #endif
   NaClLogLock();
   NaClLogV_mu(detail_level, fmt, ap);
@@ -603,7 +623,8 @@ static void NaClLogDoLogAndUnsetModuleV(int        detail_level,
   int module_verbosity;
 
   module_verbosity = NaClLogGetModuleVerbosity_mu(gTls_ModuleName);
-  if (detail_level <= module_verbosity) {
+  if (detail_level <= module_verbosity &&
+      !NaClLogToBinarySink(detail_level, fmt, ap)) {
     NaClLogLock();
     NaClLogDoLogV_mu(detail_level, fmt, ap);
     NaClLogUnlock();
@@ -624,7 +645,8 @@ static void NaClLogDoLogAndUnsetModuleV(int        detail_level,
   int         module_verbosity;
 
   module_verbosity = NaClLogGetModuleVerbosity_mu(module_name);
-  if (detail_level <= module_verbosity) {
+  if (detail_level <= module_verbosity &&
+      !NaClLogToBinarySink(detail_level, fmt, ap)) {
     NaClLogLock();
     NaClLogDoLogV_mu(detail_level, fmt, ap);
     NaClLogUnlock();
@@ -674,6 +696,16 @@ void NaClLog(int         detail_level,
   if (NACL_LIKELY(detail_level > verbosity)) {
     return;
   }
+  if (NULL != gNaClLogBinarySink) {
+    int done;
+
+    va_start(ap, fmt);
+    done = NaClLogToBinarySink(detail_level, fmt, ap);
+    va_end(ap);
+    if (done) {
+      return;
+    }
+  }
 #endif
 
   NaClLogLock();
@@ -0,0 +1,140 @@
+/*
+ * Copyright (c) 2017 The Native Client Authors. All rights reserved.
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file.
+ */
+
+/*
+ * Binary logging backend for NaClLog (POSIX only).
+ *
+ * When the NACLLOGBINARY environment variable names a file, NaClLog
+ * calls at detail levels 0 and up are not formatted.  Instead each
+ * thread appends a compact record -- the format string's address, the
+ * raw arguments and a timestamp -- to its own ring buffer, without
+ * taking a lock.  A background thread drains the rings to the file.
+ * nacl_log_decode turns the file back into the text NaClLog would
+ * have written.  LOG_INFO and more severe messages still go to the
+ * text log, after whatever is buffered has been written out.
+ *
+ * A format string is written out in full the first time a thread logs
+ * with it, so the dump does not depend on the binary's addresses.  The
+ * format must stay valid and unchanged while it is in use, which holds
+ * for the string literals NaClLog is called with.  %s arguments are
+ * copied, up to NACL_LOG_BINARY_MAX_STRING bytes.  A record that does
+ * not fit in its thread's ring is dropped and counted, never waited
+ * for.
+ *
+ * Each thread's records are in the order it logged them, but the drain
+ * thread copies out one ring at a time, so lines from different threads
+ * are grouped rather than interleaved as they would be in a text log.
+ * The timestamps give the true order.
+ */
+
+#ifndef NATIVE_CLIENT_SRC_SHARED_PLATFORM_NACL_LOG_BINARY_H_
+#define NATIVE_CLIENT_SRC_SHARED_PLATFORM_NACL_LOG_BINARY_H_
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include "native_client/src/include/nacl_base.h"
+
+EXTERN_C_BEGIN
+
+#define NACL_LOG_BINARY_MAGIC       "NACLBLOG"
+#define NACL_LOG_BINARY_VERSION     1
+
+#define NACL_LOG_BINARY_RING_SIZE   (256 * 1024)
+#define NACL_LOG_BINARY_MAX_RECORD  4096
+#define NACL_LOG_BINARY_MAX_STRING  1024
+
+/* the file starts with this, and then holds records back to back */
+struct NaClLogBinaryFileHeader {
+  char      magic[8];
+  uint32_t  version;
+  int32_t   pid;
+};
+
+enum NaClLogBinaryRecordType {
+  NACL_LOG_BINARY_FORMAT = 1,   /* body: the NUL-terminated format */
+  NACL_LOG_BINARY_MESSAGE = 2,  /* body: the arguments */
+  NACL_LOG_BINARY_DROPPED = 3   /* body: uint64_t count of records lost */
+};
+
+/* no tag was written, see NaClLogDisableTimestamp */
+#define NACL_LOG_BINARY_UNTAGGED 0x1
+
+/*
+ * Every record is a multiple of 8 bytes long.  In a message, each
+ * argument, and each '*' width or precision, takes 8 bytes, except %s,
+ * which is a uint32_t length (UINT32_MAX for NULL) followed by the
+ * bytes, padded to 8.
+ */
+struct NaClLogBinaryRecord {
+  uint16_t  type;
+  uint16_t  flags;
+  uint32_t  size;           /* including this header */
+  uint64_t  fmt;            /* the key that ties messages to formats */
+  uint32_t  tid;            /* NaClThreadId() */
+  int32_t   detail_level;
+  uint64_t  usec;           /* gettimeofday, in microseconds */
+};
+
+enum NaClLogArgType {
+  NACL_LOG_ARG_NONE,        /* "%%" */
+  NACL_LOG_ARG_INT,
+  NACL_LOG_ARG_LONG,
+  NACL_LOG_ARG_LONG_LONG,
+  NACL_LOG_ARG_SIZE,
+  NACL_LOG_ARG_PTRDIFF,
+  NACL_LOG_ARG_INTMAX,
+  NACL_LOG_ARG_POINTER,
+  NACL_LOG_ARG_DOUBLE,
+  NACL_LOG_ARG_LONG_DOUBLE,
+  NACL_LOG_ARG_STRING,
+  NACL_LOG_ARG_UNSUPPORTED  /* %n, %ls and the like */
+};
+
+struct NaClLogConversion {
+  char const          *start;     /* the '%' */
+  char const          *end;       /* just past the conversion character */
+  int                 num_stars;  /* '*' arguments that come first */
+  int                 precision;  /* -1 if none, -2 if '*' */
+  enum NaClLogArgType type;
+};
+
+/*
+ * Finds the first conversion in |fmt|.  Returns a pointer just past it,
+ * or NULL if there is none.  Shared by the encoder and the decoder, so
+ * that both walk the arguments the same way.
+ */
+char const *NaClLogNextConversion(char const               *fmt,
+                                  struct NaClLogConversion *conv);
+
+/*
+ * Starts binary logging to |path| and the drain thread.  Returns 0 and
+ * leaves text logging alone on failure.
+ */
+int NaClLogBinaryStart(char const *path);
+
+/* Starts binary logging if NACLLOGBINARY is set. */
+void NaClLogBinaryModuleInit(void);
+
+/*
+ * Writes out everything buffered so far.  Call before exiting with
+ * NaClExit, which skips atexit handlers.
+ */
+void NaClLogBinaryFlush(void);
+
+/* Flushes, stops the drain thread and goes back to text logging. */
+void NaClLogBinaryModuleFini(void);
+
+/*
+ * Rewrites a binary log read from |in| as NaClLog text on |out|.
+ * Returns 0 on success, or -1 if |in| is not a binary log or is
+ * corrupt; what was decoded before that point has been written.
+ */
+int NaClLogBinaryDecode(FILE *in, FILE *out);
+
+EXTERN_C_END
+
+#endif  /* NATIVE_CLIENT_SRC_SHARED_PLATFORM_NACL_LOG_BINARY_H_ */
@@ -0,0 +1,203 @@
+/*
+ * Copyright (c) 2017 The Native Client Authors. All rights reserved.
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file.
+ */
+
+/*
+ * Logs through the binary backend from several threads, decodes the
+ * dump and checks it against what the text backend would have written.
+ */
+
+#include <limits.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "native_client/src/include/portability.h"
+#include "native_client/src/shared/platform/nacl_log.h"
+#include "native_client/src/shared/platform/nacl_log_binary.h"
+#include "native_client/src/shared/platform/platform_init.h"
+
+#define NUM_THREADS         4
+#define MESSAGES_PER_THREAD 2000
+
+static char const kLongString[] =
+    "0123456789abcdef0123456789abcdef0123456789abcdef0123456789abcdef";
+
+static void *LogThread(void *arg) {
+  int id = (int) (intptr_t) arg;
+  int i;
+
+  for (i = 0; i < MESSAGES_PER_THREAD; ++i) {
+    NaClLog(1, "thread %d message %d\n", id, i);
+    /*
+     * On a loaded machine the drain thread may not run before a ring
+     * fills; flush now and then so that nothing is dropped.
+     */
+    if (0 == (i + 1) % 256) {
+      NaClLogBinaryFlush();
+    }
+  }
+  return NULL;
+}
+
+/* Logs a fixed set of messages and writes the expected text to |out|. */
+static void LogAndExpect(FILE *out) {
+  int64_t big = -((int64_t) 1 << 40);
+  size_t size = 12345;
+
+#define CHECK_LOG(...)              \
+  do {                              \
+    NaClLog(1, __VA_ARGS__);        \
+    fprintf(out, __VA_ARGS__);      \
+  } while (0)
+
+  CHECK_LOG("plain text\n");
+  CHECK_LOG("%d %u %x %5d|%-5d|%05d\n", -7, 7u, 0xbeef, 42, 42, 42);
+  CHECK_LOG("%"NACL_PRId64" %"NACL_PRIx64"\n", big, (uint64_t) big);
+  CHECK_LOG("%"NACL_PRIuS" %"NACL_PRIxPTR"\n", size, (uintptr_t) &size);
+  CHECK_LOG("%p %c%c %%\n", (void *) &size, 'o', 'k');
+  CHECK_LOG("%.3f %g %e\n", 3.14159, 0.5, 1e10);
+  CHECK_LOG("[%s] [%10s] [%.4s] [%.*s]\n", "str", "pad", kLongString,
+            5, kLongString);
+  CHECK_LOG("[%*d] [%-*.*s]\n", 6, 17, 8, 3, kLongString);
+  CHECK_LOG("plain text\n");
+
+#undef CHECK_LOG
+}
+
+static char *ReadAll(FILE *f, size_t *len) {
+  char *buf;
+  long size;
+
+  fflush(f);
+  fseek(f, 0, SEEK_END);
+  size = ftell(f);
+  rewind(f);
+  buf = malloc(size + 1);
+  if (NULL == buf || (size_t) size != fread(buf, 1, size, f)) {
+    fprintf(stderr, "cannot read back temporary file\n");
+    exit(1);
+  }
+  buf[size] = '\0';
+  *len = size;
+  return buf;
+}
+
+int main(int ac, char **av) {
+  char const *test_dir_name = "/tmp";
+  char log_name[PATH_MAX];
+  pthread_t tids[NUM_THREADS];
+  FILE *expected = tmpfile();
+  FILE *decoded = tmpfile();
+  FILE *bin;
+  char *expected_text;
+  char *decoded_text;
+  char *main_text;
+  size_t main_len;
+  size_t expected_len;
+  size_t decoded_len;
+  int next[NUM_THREADS] = { 0 };
+  char *line;
+  int errors = 0;
+  int opt;
+  int i;
+
+  while (EOF != (opt = getopt(ac, av, "t:"))) {
+    switch (opt) {
+      case 't':
+        test_dir_name = optarg;
+        break;
+      default:
+        fprintf(stderr, "Usage: nacl_log_binary_test [-t test_temp_dir]\n");
+        return 1;
+    }
+  }
+  if (NULL == expected || NULL == decoded) {
+    fprintf(stderr, "tmpfile failed\n");
+    return 1;
+  }
+  snprintf(log_name, sizeof log_name, "%s/nacl_log_binary_test.bin",
+           test_dir_name);
+
+  NaClPlatformInit();
+  NaClLogSetVerbosity(1);
+  NaClLogDisableTimestamp();
+  if (!NaClLogBinaryStart(log_name)) {
+    fprintf(stderr, "NaClLogBinaryStart failed\n");
+    return 1;
+  }
+  LogAndExpect(expected);
+  for (i = 0; i < NUM_THREADS; ++i) {
+    pthread_create(&tids[i], NULL, LogThread, (void *) (intptr_t) i);
+  }
+  for (i = 0; i < NUM_THREADS; ++i) {
+    pthread_join(tids[i], NULL);
+  }
+  /* filtered out, so it must not show up */
+  NaClLog(2, "too verbose\n");
+  NaClLogBinaryModuleFini();
+
+  bin = fopen(log_name, "rb");
+  if (NULL == bin || 0 != NaClLogBinaryDecode(bin, decoded)) {
+    fprintf(stderr, "decoding %s failed\n", log_name);
+    return 1;
+  }
+  fclose(bin);
+  unlink(log_name);
+
+  expected_text = ReadAll(expected, &expected_len);
+  decoded_text = ReadAll(decoded, &decoded_len);
+  /*
+   * Each thread's messages come out complete and in order, but the
+   * threads' rings are drained one after another, so the lines of
+   * different threads are not interleaved as they were logged.
+   */
+  main_text = malloc(decoded_len + 1);
+  if (NULL == main_text) {
+    fprintf(stderr, "out of memory\n");
+    return 1;
+  }
+  main_len = 0;
+  for (line = strtok(decoded_text, "\n");
+       NULL != line;
+       line = strtok(NULL, "\n")) {
+    int id;
+    int n;
+
+    if (0 != strncmp(line, "thread ", 7)) {
+      main_len += sprintf(main_text + main_len, "%s\n", line);
+      continue;
+    }
+    if (2 != sscanf(line, "thread %d message %d", &id, &n) ||
+        id < 0 || id >= NUM_THREADS || n != next[id]) {
+      fprintf(stderr, "unexpected line: %s\n", line);
+      ++errors;
+      break;
+    }
+    ++next[id];
+  }
+  if (main_len != expected_len ||
+      0 != memcmp(expected_text, main_text, expected_len)) {
+    fprintf(stderr, "decoded text differs; expected:\n%s\ngot:\n%s\n",
+            expected_text, main_text);
+    ++errors;
+  }
+  for (i = 0; i < NUM_THREADS; ++i) {
+    if (MESSAGES_PER_THREAD != next[i]) {
+      fprintf(stderr, "thread %d: %d messages, expected %d\n",
+              i, next[i], MESSAGES_PER_THREAD);
+      ++errors;
+    }
+  }
+
+  free(expected_text);
+  free(decoded_text);
+  free(main_text);
+  NaClPlatformFini();
+  printf("%s\n", 0 == errors ? "PASSED" : "FAILED");
+  return 0 == errors ? 0 : 1;
+}
@@ -0,0 +1,48 @@
+/*
+ * Copyright (c) 2017 The Native Client Authors. All rights reserved.
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file.
+ */
+
+/*
+ * Turns a binary log written with NACLLOGBINARY=<file> back into the
+ * text NaClLog would have written.
+ *
+ *   nacl_log_decode [binary_log [text_log]]
+ *
+ * reads standard input and writes standard output by default.  It must
+ * run on the architecture that wrote the log, since %p and the integer
+ * conversions are printed at the writer's widths.
+ */
+
+#include <stdio.h>
+
+#include "native_client/src/shared/platform/nacl_log_binary.h"
+
+int main(int ac, char **av) {
+  FILE *in = stdin;
+  FILE *out = stdout;
+  int rv;
+
+  if (ac > 3) {
+    fprintf(stderr, "Usage: nacl_log_decode [binary_log [text_log]]\n");
+    return 1;
+  }
+  if (ac > 1 && NULL == (in = fopen(av[1], "rb"))) {
+    perror(av[1]);
+    return 1;
+  }
+  if (ac > 2 && NULL == (out = fopen(av[2], "w"))) {
+    perror(av[2]);
+    return 1;
+  }
+  rv = NaClLogBinaryDecode(in, out);
+  if (0 != rv) {
+    fprintf(stderr, "nacl_log_decode: not a binary log, or corrupt\n");
+  }
+  if (0 != fclose(out)) {
+    perror("nacl_log_decode");
+    return 1;
+  }
+  return 0 == rv ? 0 : 1;
+}
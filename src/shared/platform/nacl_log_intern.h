@@ -11,6 +11,8 @@
 #ifndef NATIVE_CLIENT_SRC_TRUSTED_PLATFORM_NACL_LOG_INTERN_H__
 #define NATIVE_CLIENT_SRC_TRUSTED_PLATFORM_NACL_LOG_INTERN_H__
 
+#include <stdarg.h>
+
 #include "native_client/src/include/nacl_base.h"
 
 EXTERN_C_BEGIN
@@ -35,6 +37,18 @@ EXTERN_C_BEGIN
  */
 extern void (*gNaClLogAbortBehavior)(void);
 
+/*
+ * Set while binary logging is on (see nacl_log_binary.h).  NaClLog
+ * offers each message to it before taking the log lock; a nonzero
+ * return means the message has been dealt with.  The sink must not
+ * consume |ap|.  |tagged| is nonzero if text output would be prefixed
+ * with the pid, thread id and timestamp.
+ */
+extern int (*volatile gNaClLogBinarySink)(int         detail_level,
+                                          int         tagged,
+                                          char const  *fmt,
+                                          va_list     ap);
+
 EXTERN_C_END
 
 #endif  /* NATIVE_CLIENT_SRC_TRUSTED_PLATFORM_NACL_LOG_INTERN_H__ */
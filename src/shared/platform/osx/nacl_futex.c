@@ -0,0 +1,205 @@
+/*
+ * Copyright (c) 2017 The Native Client Authors. All rights reserved.
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file.
+ */
+
+/*
+ * NaCl futex implementation (OSX).  There is no public futex, so waiters
+ * queue in a fixed table of buckets chosen by address hash.  Each waiter
+ * has its own condition variable and records the address it waits on, so
+ * a wake signals exactly the threads waiting on that address, in FIFO
+ * order, and a requeue moves waiters between buckets without waking them.
+ */
+
+#include <errno.h>
+#include <pthread.h>
+#include <stddef.h>
+#include <sys/time.h>
+
+#include "native_client/src/shared/platform/nacl_futex.h"
+#include "native_client/src/trusted/service_runtime/include/sys/errno.h"
+
+#define NACL_FUTEX_BUCKETS 256
+
+struct NaClFutexWaiter {
+  struct NaClFutexWaiter *next;
+  struct NaClFutexWaiter *prev;
+  volatile int32_t       *addr;     /* changed by a requeue */
+  int                    bucket;    /* changed by a requeue */
+  int                    queued;    /* cleared when woken */
+  pthread_cond_t         cv;
+};
+
+/* a circular list through the sentinel |head| */
+static struct {
+  pthread_mutex_t        mu;
+  struct NaClFutexWaiter head;
+} g_buckets[NACL_FUTEX_BUCKETS];
+
+static pthread_once_t g_init_once = PTHREAD_ONCE_INIT;
+
+static void InitBuckets(void) {
+  int i;
+
+  for (i = 0; i < NACL_FUTEX_BUCKETS; ++i) {
+    pthread_mutex_init(&g_buckets[i].mu, NULL);
+    g_buckets[i].head.next = &g_buckets[i].head;
+    g_buckets[i].head.prev = &g_buckets[i].head;
+  }
+}
+
+static int BucketOf(volatile int32_t *addr) {
+  uintptr_t a = (uintptr_t) addr;
+
+  return (int) (((a >> 2) ^ (a >> 12)) % NACL_FUTEX_BUCKETS);
+}
+
+static void Enqueue(int b, struct NaClFutexWaiter *w) {
+  struct NaClFutexWaiter *head = &g_buckets[b].head;
+
+  w->bucket = b;
+  w->next = head;
+  w->prev = head->prev;
+  head->prev->next = w;
+  head->prev = w;
+}
+
+static void Unlink(struct NaClFutexWaiter *w) {
+  w->prev->next = w->next;
+  w->next->prev = w->prev;
+}
+
+/* Wakes up to |nwake| waiters on |addr| in bucket |b|, which is locked. */
+static int WakeLocked(int b, volatile int32_t *addr, int32_t nwake) {
+  struct NaClFutexWaiter *head = &g_buckets[b].head;
+  struct NaClFutexWaiter *w = head->next;
+  int woken = 0;
+
+  while (w != head && woken < nwake) {
+    struct NaClFutexWaiter *next = w->next;
+
+    if (w->addr == addr) {
+      Unlink(w);
+      w->queued = 0;
+      pthread_cond_signal(&w->cv);
+      ++woken;
+    }
+    w = next;
+  }
+  return woken;
+}
+
+int NaClFutexWait(volatile int32_t *addr, int32_t value,
+                  struct nacl_abi_timespec const *rel_timeout) {
+  struct NaClFutexWaiter self;
+  struct timespec deadline;
+  int b = BucketOf(addr);
+  int rv = 0;
+
+  pthread_once(&g_init_once, InitBuckets);
+  if (NULL != rel_timeout) {
+    struct timeval now;
+
+    gettimeofday(&now, NULL);
+    deadline.tv_sec = now.tv_sec + rel_timeout->tv_sec;
+    deadline.tv_nsec = now.tv_usec * 1000 + rel_timeout->tv_nsec;
+    if (deadline.tv_nsec >= 1000000000) {
+      deadline.tv_sec += 1;
+      deadline.tv_nsec -= 1000000000;
+    }
+  }
+  pthread_mutex_lock(&g_buckets[b].mu);
+  /* the check and the enqueue are atomic with respect to wakes */
+  if (*addr != value) {
+    pthread_mutex_unlock(&g_buckets[b].mu);
+    return -NACL_ABI_EAGAIN;
+  }
+  self.addr = addr;
+  self.queued = 1;
+  pthread_cond_init(&self.cv, NULL);
+  Enqueue(b, &self);
+  for (;;) {
+    int err;
+
+    if (NULL == rel_timeout) {
+      err = pthread_cond_wait(&self.cv, &g_buckets[b].mu);
+    } else {
+      err = pthread_cond_timedwait(&self.cv, &g_buckets[b].mu, &deadline);
+    }
+    /* a requeue may have moved us while we slept */
+    while (self.bucket != b) {
+      int moved_to = self.bucket;
+
+      pthread_mutex_unlock(&g_buckets[b].mu);
+      pthread_mutex_lock(&g_buckets[moved_to].mu);
+      b = moved_to;
+    }
+    if (!self.queued) {
+      break;
+    }
+    if (ETIMEDOUT == err) {
+      Unlink(&self);
+      rv = -NACL_ABI_ETIMEDOUT;
+      break;
+    }
+  }
+  pthread_mutex_unlock(&g_buckets[b].mu);
+  pthread_cond_destroy(&self.cv);
+  return rv;
+}
+
+int NaClFutexWake(volatile int32_t *addr, int32_t nwake) {
+  int b = BucketOf(addr);
+  int woken;
+
+  pthread_once(&g_init_once, InitBuckets);
+  pthread_mutex_lock(&g_buckets[b].mu);
+  woken = WakeLocked(b, addr, nwake);
+  pthread_mutex_unlock(&g_buckets[b].mu);
+  return woken;
+}
+
+int NaClFutexCmpRequeue(volatile int32_t *addr, int32_t nwake,
+                        int32_t nrequeue, volatile int32_t *addr2,
+                        int32_t value) {
+  int b1 = BucketOf(addr);
+  int b2 = BucketOf(addr2);
+  int lo = b1 < b2 ? b1 : b2;
+  int hi = b1 < b2 ? b2 : b1;
+  int moved = 0;
+  int rv;
+
+  pthread_once(&g_init_once, InitBuckets);
+  /* buckets are always locked in index order */
+  pthread_mutex_lock(&g_buckets[lo].mu);
+  if (hi != lo) {
+    pthread_mutex_lock(&g_buckets[hi].mu);
+  }
+  if (*addr != value) {
+    rv = -NACL_ABI_EAGAIN;
+  } else {
+    struct NaClFutexWaiter *head = &g_buckets[b1].head;
+    struct NaClFutexWaiter *w;
+
+    rv = WakeLocked(b1, addr, nwake);
+    w = head->next;
+    while (w != head && moved < nrequeue) {
+      struct NaClFutexWaiter *next = w->next;
+
+      if (w->addr == addr) {
+        Unlink(w);
+        w->addr = addr2;
+        Enqueue(b2, w);
+        ++moved;
+      }
+      w = next;
+    }
+    rv += moved;
+  }
+  if (hi != lo) {
+    pthread_mutex_unlock(&g_buckets[hi].mu);
+  }
+  pthread_mutex_unlock(&g_buckets[lo].mu);
+  return rv;
+}
@@ -39,6 +39,7 @@
       ['OS=="linux"', {
         'platform_sources': [
           'linux/nacl_clock.c',
+          'linux/nacl_futex.c',
           'linux/nacl_host_dir.c',
           'linux/nacl_semaphore.c',
         ],
@@ -46,6 +47,7 @@
       ['OS=="mac"', {
         'platform_sources': [
           'osx/nacl_clock.c',
+          'osx/nacl_futex.c',
           'osx/nacl_host_dir.c',
           'osx/nacl_semaphore.c',
           'osx/strnlen_osx.c',
@@ -60,6 +62,7 @@
           'posix/nacl_fast_mutex.c',
           'posix/nacl_find_addrsp.c',
           'posix/nacl_host_desc.c',
+          'posix/nacl_log_binary.c',
           'posix/nacl_secure_random.c',
           'posix/nacl_thread_id.c',
           'posix/nacl_threads.c',
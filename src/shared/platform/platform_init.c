@@ -6,12 +6,18 @@
 
 #include "native_client/src/shared/platform/nacl_clock.h"
 #include "native_client/src/shared/platform/nacl_log.h"
+#if NACL_LINUX || NACL_OSX
+# include "native_client/src/shared/platform/nacl_log_binary.h"
+#endif
 #include "native_client/src/shared/platform/nacl_time.h"
 #include "native_client/src/shared/platform/nacl_secure_random.h"
 #include "native_client/src/shared/platform/nacl_global_secure_random.h"
 
 void NaClPlatformInit(void) {
   NaClLogModuleInit();
+#if NACL_LINUX || NACL_OSX
+  NaClLogBinaryModuleInit();
+#endif
   NaClTimeInit();
   if (!NaClClockInit()) {
     NaClLog(LOG_FATAL, "NaClPlatformInit: NaClClockInit failed\n");
@@ -25,5 +31,8 @@ void NaClPlatformFini(void) {
   NaClSecureRngModuleFini();
   NaClClockFini();
   NaClTimeFini();
+#if NACL_LINUX || NACL_OSX
+  NaClLogBinaryModuleFini();
+#endif
   NaClLogModuleFini();
 }
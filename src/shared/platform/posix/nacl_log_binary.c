@@ -0,0 +1,905 @@
+/*
+ * Copyright (c) 2017 The Native Client Authors. All rights reserved.
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file.
+ */
+
+/*
+ * NaCl Server Runtime binary logging backend.  See nacl_log_binary.h.
+ */
+
+#include <ctype.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "native_client/src/shared/platform/nacl_log.h"
+#include "native_client/src/shared/platform/nacl_log_binary.h"
+#include "native_client/src/shared/platform/nacl_log_intern.h"
+#include "native_client/src/shared/platform/nacl_threads.h"
+
+/* how often the drain thread wakes up, in milliseconds */
+#define NACL_LOG_BINARY_DRAIN_MS  5
+
+/* format strings a thread remembers having written out */
+#define NACL_LOG_BINARY_FORMATS   512
+
+#define NACL_LOG_BINARY_PAD(n)    (((n) + 7) & ~(size_t) 7)
+
+/*
+ * A single-producer, single-consumer byte ring.  The owning thread
+ * advances head and the drain thread advances tail; both only ever
+ * grow, and wrap modulo 2**32.  Rings are never freed: when a thread
+ * exits, its ring goes to the next thread that logs.
+ */
+struct NaClLogRing {
+  struct NaClLogRing  *next;
+  int volatile        in_use;
+  uint32_t volatile   head;
+  uint32_t volatile   tail;
+  /* the rest is only touched by the owning thread */
+  uint64_t            dropped;
+  uintptr_t           formats[NACL_LOG_BINARY_FORMATS];
+  uint8_t             buf[NACL_LOG_BINARY_RING_SIZE];
+};
+
+static struct NaClLogRing *volatile g_rings = NULL;
+static pthread_key_t                g_ring_key;
+static pthread_once_t               g_ring_key_once = PTHREAD_ONCE_INIT;
+
+/* g_drain_mu serializes writes to g_file and protects g_stop */
+static pthread_mutex_t  g_drain_mu = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t   g_drain_cv = PTHREAD_COND_INITIALIZER;
+static FILE             *g_file = NULL;
+static int              g_stop = 0;
+static pthread_t        g_drain_thread;
+
+/* records lost by threads that exited before they could report them */
+static uint64_t volatile g_dropped = 0;
+
+char const *NaClLogNextConversion(char const               *fmt,
+                                  struct NaClLogConversion *conv) {
+  enum { MOD_NONE, MOD_H, MOD_L, MOD_LL, MOD_BIG_L, MOD_Z, MOD_J, MOD_T }
+      mod = MOD_NONE;
+  char const *p = strchr(fmt, '%');
+
+  if (NULL == p) {
+    return NULL;
+  }
+  conv->start = p++;
+  conv->num_stars = 0;
+  conv->precision = -1;
+  if ('%' == *p) {
+    conv->type = NACL_LOG_ARG_NONE;
+    conv->end = p + 1;
+    return conv->end;
+  }
+  while ('\0' != *p && NULL != strchr("-+ #0'", *p)) {
+    ++p;
+  }
+  if ('*' == *p) {
+    ++conv->num_stars;
+    ++p;
+  } else {
+    while (isdigit((unsigned char) *p)) {
+      ++p;
+    }
+  }
+  if ('.' == *p) {
+    ++p;
+    if ('*' == *p) {
+      ++conv->num_stars;
+      conv->precision = -2;
+      ++p;
+    } else {
+      conv->precision = 0;
+      while (isdigit((unsigned char) *p)) {
+        conv->precision = conv->precision * 10 + (*p++ - '0');
+      }
+    }
+  }
+  switch (*p) {
+    case 'h':
+      mod = MOD_H;
+      p += ('h' == p[1]) ? 2 : 1;
+      break;
+    case 'l':
+      mod = ('l' == p[1]) ? MOD_LL : MOD_L;
+      p += ('l' == p[1]) ? 2 : 1;
+      break;
+    case 'q':
+      mod = MOD_LL;
+      ++p;
+      break;
+    case 'L':
+      mod = MOD_BIG_L;
+      ++p;
+      break;
+    case 'z':
+      mod = MOD_Z;
+      ++p;
+      break;
+    case 'j':
+      mod = MOD_J;
+      ++p;
+      break;
+    case 't':
+      mod = MOD_T;
+      ++p;
+      break;
+  }
+  conv->type = NACL_LOG_ARG_UNSUPPORTED;
+  switch (*p) {
+    case 'd': case 'i': case 'o': case 'u': case 'x': case 'X':
+      switch (mod) {
+        case MOD_NONE: case MOD_H: conv->type = NACL_LOG_ARG_INT; break;
+        case MOD_L: conv->type = NACL_LOG_ARG_LONG; break;
+        case MOD_LL: conv->type = NACL_LOG_ARG_LONG_LONG; break;
+        case MOD_Z: conv->type = NACL_LOG_ARG_SIZE; break;
+        case MOD_J: conv->type = NACL_LOG_ARG_INTMAX; break;
+        case MOD_T: conv->type = NACL_LOG_ARG_PTRDIFF; break;
+        case MOD_BIG_L: break;
+      }
+      break;
+    case 'c':
+      if (MOD_NONE == mod) {
+        conv->type = NACL_LOG_ARG_INT;
+      }
+      break;
+    case 'e': case 'E': case 'f': case 'F':
+    case 'g': case 'G': case 'a': case 'A':
+      if (MOD_BIG_L == mod) {
+        conv->type = NACL_LOG_ARG_LONG_DOUBLE;
+      } else if (MOD_NONE == mod || MOD_L == mod) {
+        conv->type = NACL_LOG_ARG_DOUBLE;
+      }
+      break;
+    case 's':
+      if (MOD_NONE == mod) {
+        conv->type = NACL_LOG_ARG_STRING;
+      }
+      break;
+    case 'p':
+      if (MOD_NONE == mod) {
+        conv->type = NACL_LOG_ARG_POINTER;
+      }
+      break;
+  }
+  if ('\0' == *p) {
+    conv->type = NACL_LOG_ARG_UNSUPPORTED;
+    conv->end = p;
+  } else {
+    conv->end = p + 1;
+  }
+  return conv->end;
+}
+
+/*
+ * A thread that exits gives its ring to the next thread that logs, and
+ * leaves its count of dropped records for the drain thread to report.
+ */
+static void NaClLogRingRelease(void *arg) {
+  struct NaClLogRing *ring = (struct NaClLogRing *) arg;
+
+  if (0 != ring->dropped) {
+    (void) __sync_fetch_and_add(&g_dropped, ring->dropped);
+    ring->dropped = 0;
+  }
+  __sync_lock_release(&ring->in_use);
+}
+
+static void NaClLogRingKeyCreate(void) {
+  (void) pthread_key_create(&g_ring_key, NaClLogRingRelease);
+}
+
+static struct NaClLogRing *NaClLogThreadRing(void) {
+  struct NaClLogRing *ring = pthread_getspecific(g_ring_key);
+
+  if (NULL != ring) {
+    return ring;
+  }
+  for (ring = g_rings; NULL != ring; ring = ring->next) {
+    if (__sync_bool_compare_and_swap(&ring->in_use, 0, 1)) {
+      break;
+    }
+  }
+  if (NULL == ring) {
+    ring = calloc(1, sizeof *ring);
+    if (NULL == ring) {
+      return NULL;
+    }
+    ring->in_use = 1;
+    do {
+      ring->next = g_rings;
+    } while (!__sync_bool_compare_and_swap(&g_rings, ring->next, ring));
+  }
+  /* formats the last owner wrote out are in the dump, but forget them */
+  memset(ring->formats, 0, sizeof ring->formats);
+  (void) pthread_setspecific(g_ring_key, ring);
+  return ring;
+}
+
+/* Returns nonzero if this thread has written out |fmt| already. */
+static int NaClLogRingFormatKnown(struct NaClLogRing *ring,
+                                  char const *fmt) {
+  uintptr_t key = (uintptr_t) fmt;
+  size_t slot = (key >> 3) % NACL_LOG_BINARY_FORMATS;
+  size_t probe;
+
+  for (probe = 0; probe < 8; ++probe) {
+    uintptr_t *entry =
+        &ring->formats[(slot + probe) % NACL_LOG_BINARY_FORMATS];
+
+    if (key == *entry) {
+      return 1;
+    }
+    if (0 == *entry) {
+      return 0;
+    }
+  }
+  return 0;
+}
+
+static void NaClLogRingFormatRemember(struct NaClLogRing *ring,
+                                      char const *fmt) {
+  uintptr_t key = (uintptr_t) fmt;
+  size_t slot = (key >> 3) % NACL_LOG_BINARY_FORMATS;
+  size_t probe;
+
+  for (probe = 0; probe < 8; ++probe) {
+    uintptr_t *entry =
+        &ring->formats[(slot + probe) % NACL_LOG_BINARY_FORMATS];
+
+    if (0 == *entry) {
+      *entry = key;
+      return;
+    }
+  }
+  /* a full neighbourhood just means writing the format out again */
+}
+
+static void NaClLogRingCopyIn(struct NaClLogRing *ring, uint32_t pos,
+                              void const *src, size_t len) {
+  size_t off = pos & (NACL_LOG_BINARY_RING_SIZE - 1);
+  size_t first = NACL_LOG_BINARY_RING_SIZE - off;
+
+  if (first > len) {
+    first = len;
+  }
+  memcpy(ring->buf + off, src, first);
+  memcpy(ring->buf, (uint8_t const *) src + first, len - first);
+}
+
+static void NaClLogPut64(uint8_t *rec, size_t *len, uint64_t value) {
+  memcpy(rec + *len, &value, sizeof value);
+  *len += sizeof value;
+}
+
+static void NaClLogFillHeader(uint8_t *rec, uint16_t type, uint16_t flags,
+                              size_t size, char const *fmt,
+                              int detail_level, uint64_t usec) {
+  struct NaClLogBinaryRecord hdr;
+
+  hdr.type = type;
+  hdr.flags = flags;
+  hdr.size = (uint32_t) size;
+  hdr.fmt = (uintptr_t) fmt;
+  hdr.tid = NaClThreadId();
+  hdr.detail_level = detail_level;
+  hdr.usec = usec;
+  memcpy(rec, &hdr, sizeof hdr);
+}
+
+/*
+ * Encodes the arguments of a message into |rec| after the header.
+ * Returns the record length, or 0 if the format cannot be encoded.
+ */
+static size_t NaClLogEncodeArgs(uint8_t *rec, char const *fmt,
+                                va_list ap) {
+  struct NaClLogConversion conv;
+  size_t len = sizeof(struct NaClLogBinaryRecord);
+  char const *p = fmt;
+
+  while (NULL != (p = NaClLogNextConversion(p, &conv))) {
+    int precision = conv.precision;
+    uint64_t value = 0;
+    int i;
+
+    if (len + 8 * (conv.num_stars + 1) > NACL_LOG_BINARY_MAX_RECORD) {
+      return 0;
+    }
+    for (i = 0; i < conv.num_stars; ++i) {
+      int star = va_arg(ap, int);
+
+      NaClLogPut64(rec, &len, (uint64_t) (int64_t) star);
+      if (-2 == conv.precision && i == conv.num_stars - 1) {
+        precision = star;
+      }
+    }
+    switch (conv.type) {
+      case NACL_LOG_ARG_NONE:
+        continue;
+      case NACL_LOG_ARG_INT:
+        value = (uint64_t) (int64_t) va_arg(ap, int);
+        break;
+      case NACL_LOG_ARG_LONG:
+        value = (uint64_t) (int64_t) va_arg(ap, long);
+        break;
+      case NACL_LOG_ARG_LONG_LONG:
+        value = (uint64_t) va_arg(ap, long long);
+        break;
+      case NACL_LOG_ARG_SIZE:
+        value = (uint64_t) va_arg(ap, size_t);
+        break;
+      case NACL_LOG_ARG_PTRDIFF:
+        value = (uint64_t) (int64_t) va_arg(ap, ptrdiff_t);
+        break;
+      case NACL_LOG_ARG_INTMAX:
+        value = (uint64_t) va_arg(ap, intmax_t);
+        break;
+      case NACL_LOG_ARG_POINTER:
+        value = (uintptr_t) va_arg(ap, void *);
+        break;
+      case NACL_LOG_ARG_DOUBLE: {
+        double d = va_arg(ap, double);
+        memcpy(&value, &d, sizeof value);
+        break;
+      }
+      case NACL_LOG_ARG_LONG_DOUBLE: {
+        double d = (double) va_arg(ap, long double);
+        memcpy(&value, &d, sizeof value);
+        break;
+      }
+      case NACL_LOG_ARG_STRING: {
+        char const *s = va_arg(ap, char const *);
+        size_t room = NACL_LOG_BINARY_MAX_RECORD - len - sizeof(uint32_t);
+        size_t max = NACL_LOG_BINARY_MAX_STRING;
+        uint32_t slen;
+
+        if (room < max) {
+          max = room;
+        }
+        if (precision >= 0 && (size_t) precision < max) {
+          max = precision;
+        }
+        slen = (NULL == s) ? UINT32_MAX : (uint32_t) strnlen(s, max);
+        memcpy(rec + len, &slen, sizeof slen);
+        if (NULL != s) {
+          memcpy(rec + len + sizeof slen, s, slen);
+          len += NACL_LOG_BINARY_PAD(sizeof slen + slen);
+        } else {
+          len += NACL_LOG_BINARY_PAD(sizeof slen);
+        }
+        continue;
+      }
+      case NACL_LOG_ARG_UNSUPPORTED:
+        return 0;
+    }
+    NaClLogPut64(rec, &len, value);
+  }
+  return len;
+}
+
+/*
+ * The NaClLog hook.  Returns nonzero if the message has been taken care
+ * of, and 0 if NaClLog should write it as text.  |ap| is left alone.
+ */
+static int NaClLogBinarySink(int detail_level, int tagged,
+                             char const *fmt, va_list ap) {
+  union {
+    uint64_t  align;
+    uint8_t   bytes[NACL_LOG_BINARY_MAX_RECORD];
+  } msg;
+  uint8_t fmt_rec[NACL_LOG_BINARY_MAX_RECORD];
+  uint8_t drop_rec[sizeof(struct NaClLogBinaryRecord) + sizeof(uint64_t)];
+  struct NaClLogRing *ring;
+  struct timeval tv;
+  size_t msg_len;
+  size_t fmt_len = 0;
+  size_t drop_len = 0;
+  uint32_t head;
+  uint32_t used;
+  uint64_t usec;
+  va_list aq;
+
+  if (detail_level < 0) {
+    /* keep the binary log ahead of warnings, errors and aborts */
+    NaClLogBinaryFlush();
+    return 0;
+  }
+  ring = NaClLogThreadRing();
+  if (NULL == ring) {
+    return 0;
+  }
+  va_copy(aq, ap);
+  msg_len = NaClLogEncodeArgs(msg.bytes, fmt, aq);
+  va_end(aq);
+  if (0 == msg_len) {
+    return 0;
+  }
+  (void) gettimeofday(&tv, NULL);
+  usec = (uint64_t) tv.tv_sec * 1000000 + tv.tv_usec;
+  NaClLogFillHeader(msg.bytes, NACL_LOG_BINARY_MESSAGE,
+                    tagged ? 0 : NACL_LOG_BINARY_UNTAGGED,
+                    msg_len, fmt, detail_level, usec);
+
+  if (!NaClLogRingFormatKnown(ring, fmt)) {
+    size_t text_len = strlen(fmt) + 1;
+
+    fmt_len = sizeof(struct NaClLogBinaryRecord) +
+        NACL_LOG_BINARY_PAD(text_len);
+    if (fmt_len > sizeof fmt_rec) {
+      return 0;
+    }
+    memset(fmt_rec, 0, fmt_len);
+    NaClLogFillHeader(fmt_rec, NACL_LOG_BINARY_FORMAT, 0, fmt_len, fmt,
+                      detail_level, usec);
+    memcpy(fmt_rec + sizeof(struct NaClLogBinaryRecord), fmt, text_len);
+  }
+  if (0 != ring->dropped) {
+    drop_len = sizeof drop_rec;
+    NaClLogFillHeader(drop_rec, NACL_LOG_BINARY_DROPPED, 0, drop_len, NULL,
+                      detail_level, usec);
+    memcpy(drop_rec + sizeof(struct NaClLogBinaryRecord), &ring->dropped,
+           sizeof ring->dropped);
+  }
+
+  head = ring->head;
+  __sync_synchronize();
+  used = head - ring->tail;
+  if (NACL_LOG_BINARY_RING_SIZE - used < drop_len + fmt_len + msg_len) {
+    if (0 == ring->dropped++) {
+      (void) pthread_cond_signal(&g_drain_cv);
+    }
+    return 1;
+  }
+  if (0 != drop_len) {
+    NaClLogRingCopyIn(ring, head, drop_rec, drop_len);
+    head += (uint32_t) drop_len;
+    ring->dropped = 0;
+  }
+  if (0 != fmt_len) {
+    NaClLogRingCopyIn(ring, head, fmt_rec, fmt_len);
+    head += (uint32_t) fmt_len;
+    NaClLogRingFormatRemember(ring, fmt);
+  }
+  NaClLogRingCopyIn(ring, head, msg.bytes, msg_len);
+  head += (uint32_t) msg_len;
+  /* the records must be in place before the drain thread can see them */
+  __sync_synchronize();
+  ring->head = head;
+  /*
+   * Wake the drain thread early once the ring is half full rather than
+   * wait out its period.  Signalling without g_drain_mu can be missed,
+   * which only costs the drain thread's usual delay.
+   */
+  if (used < NACL_LOG_BINARY_RING_SIZE / 2 &&
+      used + drop_len + fmt_len + msg_len >= NACL_LOG_BINARY_RING_SIZE / 2) {
+    (void) pthread_cond_signal(&g_drain_cv);
+  }
+  return 1;
+}
+
+/* Writes out every ring's complete records.  Caller holds g_drain_mu. */
+static void NaClLogDrainRings_mu(void) {
+  struct NaClLogRing *ring;
+  uint64_t dropped;
+
+  if (NULL == g_file) {
+    return;
+  }
+  dropped = __sync_lock_test_and_set(&g_dropped, 0);
+  if (0 != dropped) {
+    uint8_t rec[sizeof(struct NaClLogBinaryRecord) + sizeof dropped];
+    struct timeval tv;
+
+    (void) gettimeofday(&tv, NULL);
+    NaClLogFillHeader(rec, NACL_LOG_BINARY_DROPPED, 0, sizeof rec, NULL, 0,
+                      (uint64_t) tv.tv_sec * 1000000 + tv.tv_usec);
+    memcpy(rec + sizeof(struct NaClLogBinaryRecord), &dropped,
+           sizeof dropped);
+    (void) fwrite(rec, 1, sizeof rec, g_file);
+  }
+  for (ring = g_rings; NULL != ring; ring = ring->next) {
+    uint32_t head = ring->head;
+    uint32_t tail = ring->tail;
+    size_t off = tail & (NACL_LOG_BINARY_RING_SIZE - 1);
+    size_t len = head - tail;
+    size_t first = NACL_LOG_BINARY_RING_SIZE - off;
+
+    __sync_synchronize();
+    if (0 == len) {
+      continue;
+    }
+    if (first > len) {
+      first = len;
+    }
+    (void) fwrite(ring->buf + off, 1, first, g_file);
+    (void) fwrite(ring->buf, 1, len - first, g_file);
+    /* the bytes must be copied out before the producer may reuse them */
+    __sync_synchronize();
+    ring->tail = head;
+  }
+  (void) fflush(g_file);
+}
+
+static void *NaClLogDrainThread(void *arg) {
+  UNREFERENCED_PARAMETER(arg);
+
+  pthread_mutex_lock(&g_drain_mu);
+  while (!g_stop) {
+    struct timeval now;
+    struct timespec deadline;
+
+    NaClLogDrainRings_mu();
+    (void) gettimeofday(&now, NULL);
+    deadline.tv_sec = now.tv_sec;
+    deadline.tv_nsec = now.tv_usec * 1000 +
+        NACL_LOG_BINARY_DRAIN_MS * 1000 * 1000;
+    if (deadline.tv_nsec >= 1000000000) {
+      ++deadline.tv_sec;
+      deadline.tv_nsec -= 1000000000;
+    }
+    (void) pthread_cond_timedwait(&g_drain_cv, &g_drain_mu, &deadline);
+  }
+  NaClLogDrainRings_mu();
+  pthread_mutex_unlock(&g_drain_mu);
+  return NULL;
+}
+
+int NaClLogBinaryStart(char const *path) {
+  struct NaClLogBinaryFileHeader hdr;
+  FILE *file;
+  sigset_t all_signals;
+  sigset_t old_signals;
+  int err;
+
+  if (NULL != gNaClLogBinarySink) {
+    return 1;
+  }
+  (void) pthread_once(&g_ring_key_once, NaClLogRingKeyCreate);
+  file = fopen(path, "wb");
+  if (NULL == file) {
+    NaClLog(LOG_ERROR, "NaClLogBinaryStart: cannot open %s\n", path);
+    return 0;
+  }
+  memset(&hdr, 0, sizeof hdr);
+  memcpy(hdr.magic, NACL_LOG_BINARY_MAGIC, sizeof hdr.magic);
+  hdr.version = NACL_LOG_BINARY_VERSION;
+  hdr.pid = getpid();
+  if (1 != fwrite(&hdr, sizeof hdr, 1, file)) {
+    NaClLog(LOG_ERROR, "NaClLogBinaryStart: cannot write %s\n", path);
+    fclose(file);
+    return 0;
+  }
+  pthread_mutex_lock(&g_drain_mu);
+  g_file = file;
+  g_stop = 0;
+  pthread_mutex_unlock(&g_drain_mu);
+  /*
+   * This runs from NaClAllModulesInit, before sel_ldr sets up its signal
+   * handling (e.g. blocking the profiler's SIGUSR2).  The drain thread
+   * inherits our mask, so block everything while creating it: signals
+   * meant for untrusted code or for sel_ldr's own threads must never be
+   * delivered to it.
+   */
+  sigfillset(&all_signals);
+  (void) pthread_sigmask(SIG_SETMASK, &all_signals, &old_signals);
+  err = pthread_create(&g_drain_thread, NULL, NaClLogDrainThread, NULL);
+  (void) pthread_sigmask(SIG_SETMASK, &old_signals, NULL);
+  if (0 != err) {
+    NaClLog(LOG_ERROR, "NaClLogBinaryStart: cannot start drain thread\n");
+    pthread_mutex_lock(&g_drain_mu);
+    g_file = NULL;
+    pthread_mutex_unlock(&g_drain_mu);
+    fclose(file);
+    return 0;
+  }
+  gNaClLogBinarySink = NaClLogBinarySink;
+  return 1;
+}
+
+void NaClLogBinaryModuleInit(void) {
+  char const *path = getenv("NACLLOGBINARY");
+
+  if (NULL != path && '\0' != *path) {
+    (void) NaClLogBinaryStart(path);
+  }
+}
+
+void NaClLogBinaryFlush(void) {
+  pthread_mutex_lock(&g_drain_mu);
+  NaClLogDrainRings_mu();
+  pthread_mutex_unlock(&g_drain_mu);
+}
+
+void NaClLogBinaryModuleFini(void) {
+  if (NULL == gNaClLogBinarySink) {
+    return;
+  }
+  gNaClLogBinarySink = NULL;
+  pthread_mutex_lock(&g_drain_mu);
+  g_stop = 1;
+  pthread_cond_signal(&g_drain_cv);
+  pthread_mutex_unlock(&g_drain_mu);
+  pthread_join(g_drain_thread, NULL);
+  pthread_mutex_lock(&g_drain_mu);
+  fclose(g_file);
+  g_file = NULL;
+  pthread_mutex_unlock(&g_drain_mu);
+}
+
+/*
+ * Decoding.  Formats are looked up by address in an open-addressed
+ * table that grows as needed; a later definition for the same address
+ * replaces an earlier one.
+ */
+struct NaClLogFormatTable {
+  size_t    capacity;   /* a power of 2 */
+  size_t    count;
+  uint64_t  *keys;
+  char      **texts;
+};
+
+static char **NaClLogFormatSlot(struct NaClLogFormatTable *table,
+                                uint64_t key) {
+  size_t i = (size_t) (key >> 3) & (table->capacity - 1);
+
+  while (NULL != table->texts[i] && table->keys[i] != key) {
+    i = (i + 1) & (table->capacity - 1);
+  }
+  table->keys[i] = key;
+  return &table->texts[i];
+}
+
+static int NaClLogFormatTableGrow(struct NaClLogFormatTable *table) {
+  struct NaClLogFormatTable bigger;
+  size_t i;
+
+  bigger.capacity = 0 == table->capacity ? 256 : 2 * table->capacity;
+  bigger.count = table->count;
+  bigger.keys = calloc(bigger.capacity, sizeof *bigger.keys);
+  bigger.texts = calloc(bigger.capacity, sizeof *bigger.texts);
+  if (NULL == bigger.keys || NULL == bigger.texts) {
+    free(bigger.keys);
+    free(bigger.texts);
+    return 0;
+  }
+  for (i = 0; i < table->capacity; ++i) {
+    if (NULL != table->texts[i]) {
+      *NaClLogFormatSlot(&bigger, table->keys[i]) = table->texts[i];
+    }
+  }
+  free(table->keys);
+  free(table->texts);
+  *table = bigger;
+  return 1;
+}
+
+static uint64_t NaClLogGet64(uint8_t const *body, size_t body_len,
+                             size_t *pos, int *ok) {
+  uint64_t value = 0;
+
+  if (*pos + sizeof value > body_len) {
+    *ok = 0;
+    return 0;
+  }
+  memcpy(&value, body + *pos, sizeof value);
+  *pos += sizeof value;
+  return value;
+}
+
+#define NACL_LOG_EMIT(value)                                          \
+  do {                                                                \
+    switch (conv.num_stars) {                                         \
+      case 0: fprintf(out, spec, value); break;                       \
+      case 1: fprintf(out, spec, stars[0], value); break;             \
+      default: fprintf(out, spec, stars[0], stars[1], value); break;  \
+    }                                                                 \
+  } while (0)
+
+/* Returns 0 if the arguments do not match the format. */
+static int NaClLogFormatMessage(FILE *out, char const *fmt,
+                                uint8_t const *body, size_t body_len) {
+  struct NaClLogConversion conv;
+  char const *p = fmt;
+  char const *next;
+  size_t pos = 0;
+  int ok = 1;
+
+  while (ok && NULL != (next = NaClLogNextConversion(p, &conv))) {
+    char spec[64];
+    int stars[2] = { 0, 0 };
+    size_t spec_len = conv.end - conv.start;
+    uint64_t value;
+    double d;
+    int i;
+
+    (void) fwrite(p, 1, conv.start - p, out);
+    p = next;
+    if (spec_len >= sizeof spec || conv.num_stars > 2 ||
+        NACL_LOG_ARG_UNSUPPORTED == conv.type) {
+      return 0;
+    }
+    memcpy(spec, conv.start, spec_len);
+    spec[spec_len] = '\0';
+    for (i = 0; i < conv.num_stars; ++i) {
+      stars[i] = (int) NaClLogGet64(body, body_len, &pos, &ok);
+    }
+    if (NACL_LOG_ARG_STRING == conv.type) {
+      uint32_t slen;
+      char *s;
+
+      if (pos + sizeof slen > body_len) {
+        return 0;
+      }
+      memcpy(&slen, body + pos, sizeof slen);
+      if (UINT32_MAX == slen) {
+        NACL_LOG_EMIT("(null)");
+        pos += NACL_LOG_BINARY_PAD(sizeof slen);
+        continue;
+      }
+      if (pos + sizeof slen + slen > body_len) {
+        return 0;
+      }
+      s = malloc(slen + 1);
+      if (NULL == s) {
+        return 0;
+      }
+      memcpy(s, body + pos + sizeof slen, slen);
+      s[slen] = '\0';
+      NACL_LOG_EMIT(s);
+      free(s);
+      pos += NACL_LOG_BINARY_PAD(sizeof slen + slen);
+      continue;
+    }
+    if (NACL_LOG_ARG_NONE == conv.type) {
+      fputc('%', out);
+      continue;
+    }
+    value = NaClLogGet64(body, body_len, &pos, &ok);
+    if (!ok) {
+      return 0;
+    }
+    switch (conv.type) {
+      case NACL_LOG_ARG_INT:
+        NACL_LOG_EMIT((int) value);
+        break;
+      case NACL_LOG_ARG_LONG:
+        NACL_LOG_EMIT((long) value);
+        break;
+      case NACL_LOG_ARG_LONG_LONG:
+        NACL_LOG_EMIT((long long) value);
+        break;
+      case NACL_LOG_ARG_SIZE:
+        NACL_LOG_EMIT((size_t) value);
+        break;
+      case NACL_LOG_ARG_PTRDIFF:
+        NACL_LOG_EMIT((ptrdiff_t) value);
+        break;
+      case NACL_LOG_ARG_INTMAX:
+        NACL_LOG_EMIT((intmax_t) value);
+        break;
+      case NACL_LOG_ARG_POINTER:
+        NACL_LOG_EMIT((void *) (uintptr_t) value);
+        break;
+      case NACL_LOG_ARG_DOUBLE:
+        memcpy(&d, &value, sizeof d);
+        NACL_LOG_EMIT(d);
+        break;
+      case NACL_LOG_ARG_LONG_DOUBLE:
+        memcpy(&d, &value, sizeof d);
+        NACL_LOG_EMIT((long double) d);
+        break;
+      default:
+        return 0;
+    }
+  }
+  if (ok) {
+    fputs(p, out);
+  }
+  return ok;
+}
+
+#undef NACL_LOG_EMIT
+
+int NaClLogBinaryDecode(FILE *in, FILE *out) {
+  struct NaClLogBinaryFileHeader file_hdr;
+  struct NaClLogFormatTable table = { 0, 0, NULL, NULL };
+  uint8_t body[NACL_LOG_BINARY_MAX_RECORD];
+  int rv = -1;
+  size_t i;
+
+  if (1 != fread(&file_hdr, sizeof file_hdr, 1, in) ||
+      0 != memcmp(file_hdr.magic, NACL_LOG_BINARY_MAGIC,
+                  sizeof file_hdr.magic) ||
+      NACL_LOG_BINARY_VERSION != file_hdr.version) {
+    return -1;
+  }
+  for (;;) {
+    struct NaClLogBinaryRecord hdr;
+    size_t body_len;
+
+    if (1 != fread(&hdr, sizeof hdr, 1, in)) {
+      rv = feof(in) ? 0 : -1;
+      break;
+    }
+    if (hdr.size < sizeof hdr || hdr.size > NACL_LOG_BINARY_MAX_RECORD ||
+        0 != (hdr.size & 7)) {
+      break;
+    }
+    body_len = hdr.size - sizeof hdr;
+    if (body_len != fread(body, 1, body_len, in)) {
+      break;
+    }
+    if (NACL_LOG_BINARY_FORMAT == hdr.type) {
+      char **slot;
+      char *text;
+
+      if (0 == body_len || '\0' != body[body_len - 1]) {
+        break;
+      }
+      text = strdup((char const *) body);
+      if (NULL == text) {
+        break;
+      }
+      if (2 * (table.count + 1) > table.capacity &&
+          !NaClLogFormatTableGrow(&table)) {
+        free(text);
+        break;
+      }
+      slot = NaClLogFormatSlot(&table, hdr.fmt);
+      if (NULL == *slot) {
+        ++table.count;
+      }
+      free(*slot);
+      *slot = text;
+    } else if (NACL_LOG_BINARY_MESSAGE == hdr.type) {
+      char const *fmt;
+
+      if (0 == table.capacity) {
+        break;
+      }
+      fmt = *NaClLogFormatSlot(&table, hdr.fmt);
+      if (NULL == fmt) {
+        break;
+      }
+      if (0 == (hdr.flags & NACL_LOG_BINARY_UNTAGGED)) {
+        time_t secs = (time_t) (hdr.usec / 1000000);
+        struct tm bdt;
+
+        (void) localtime_r(&secs, &bdt);
+        fprintf(out, "[%d,%u:%02d:%02d:%02d.%06d] ",
+                file_hdr.pid, hdr.tid, bdt.tm_hour, bdt.tm_min, bdt.tm_sec,
+                (int) (hdr.usec % 1000000));
+      }
+      if (!NaClLogFormatMessage(out, fmt, body, body_len)) {
+        break;
+      }
+    } else if (NACL_LOG_BINARY_DROPPED == hdr.type) {
+      uint64_t dropped;
+
+      if (body_len < sizeof dropped) {
+        break;
+      }
+      memcpy(&dropped, body, sizeof dropped);
+      fprintf(out, "[%d,%u] nacl_log_decode: %llu records dropped\n",
+              file_hdr.pid, hdr.tid, (unsigned long long) dropped);
+    } else {
+      break;
+    }
+  }
+  for (i = 0; i < table.capacity; ++i) {
+    free(table.texts[i]);
+  }
+  free(table.keys);
+  free(table.texts);
+  return rv;
+}
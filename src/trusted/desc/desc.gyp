@@ -64,6 +64,8 @@
           'nacl_desc_mutex.h',
           'nacl_desc_null.c',
           'nacl_desc_null.h',
+          'nacl_desc_pipe.c',
+          'nacl_desc_pipe.h',
           'nacl_desc_rng.c',
           'nacl_desc_rng.h',
           'nacl_desc_quota.c',
@@ -221,6 +221,7 @@ int (*NaClDescInternalize[NACL_DESC_TYPE_MAX])(
   NaClDescInternalizeNotImplemented,  /* device: postmessage */
   NaClDescInternalizeNotImplemented,  /* custom */
   NaClDescNullInternalize,
+  NaClDescInternalizeNotImplemented,  /* pipes stay within the runtime */
 };
 
 char const *NaClDescTypeString(enum NaClDescTypeTag type_tag) {
@@ -247,6 +248,7 @@ char const *NaClDescTypeString(enum NaClDescTypeTag type_tag) {
     MAP(NACL_DESC_DEVICE_POSTMESSAGE);
     MAP(NACL_DESC_CUSTOM);
     MAP(NACL_DESC_NULL);
+    MAP(NACL_DESC_PIPE);
   }
   return "BAD TYPE TAG";
 }
@@ -92,7 +92,8 @@ enum NaClDescTypeTag {
   NACL_DESC_DEVICE_RNG,
   NACL_DESC_DEVICE_POSTMESSAGE,
   NACL_DESC_CUSTOM,
-  NACL_DESC_NULL
+  NACL_DESC_NULL,
+  NACL_DESC_PIPE
   /*
    * Add new NaClDesc subclasses here.
    *
@@ -100,7 +101,7 @@ enum NaClDescTypeTag {
    * also be updated to add new internalization functions.
    */
 };
-#define NACL_DESC_TYPE_MAX      (NACL_DESC_NULL + 1)
+#define NACL_DESC_TYPE_MAX      (NACL_DESC_PIPE + 1)
 #define NACL_DESC_TYPE_END_TAG  (0xff)
 
 struct NaClInternalRealHeader {
@@ -14,8 +14,11 @@
 #if NACL_WINDOWS
 # include "io.h"
 # include "fcntl.h"
+#else
+# include <unistd.h>
 #endif
 
+#include <stdlib.h>
 #include <string.h>
 
 #include "native_client/src/include/nacl_macros.h"
@@ -51,6 +54,10 @@ static int NaClDescIoDescSubclassCtor(struct NaClDescIoDesc  *self,
   struct NaClDesc *basep = (struct NaClDesc *) self;
 
   self->hd = hd;
+  self->path = NULL;
+  self->direct_fd = -1;
+  self->direct_ok = 0;
+  self->nonblock = 0;
   basep->base.vtbl = (struct NaClRefCountVtbl const *) &kNaClDescIoDescVtbl;
   return 1;
 }
@@ -90,6 +97,14 @@ static void NaClDescIoDescDtor(struct NaClRefCount *vself) {
   }
   free(self->hd);
   self->hd = NULL;
+  free(self->path);
+  self->path = NULL;
+#if !NACL_WINDOWS
+  if (self->direct_fd >= 0) {
+    (void) close(self->direct_fd);
+  }
+#endif
+  self->direct_fd = -1;
   vself->vtbl = (struct NaClRefCountVtbl const *) &kNaClDescVtbl;
   (*vself->vtbl->Dtor)(vself);
 }
@@ -114,6 +129,17 @@ struct NaClDescIoDesc *NaClDescIoDescMake(struct NaClHostDesc *nhdp) {
   return ndp;
 }
 
+void NaClDescIoDescSetPath(struct NaClDescIoDesc *self, char const *path) {
+  free(self->path);
+  self->path = NULL;
+  if (NULL != path) {
+    self->path = strdup(path);
+    if (NULL == self->path) {
+      NaClLog(LOG_WARNING, "NaClDescIoDescSetPath: no memory for %s\n", path);
+    }
+  }
+}
+
 /*
  * DEPRECATED, here for backwards compatibility.  See header file for
  * details.
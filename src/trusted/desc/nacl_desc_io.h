@@ -35,6 +35,24 @@ struct NaClDescIoDesc {
    * If we later added state that needs locking, beware lock order.
    */
   struct NaClHostDesc       *hd;
+  /*
+   * The path a file opened for writing was opened by, so that writes can
+   * drop what the service runtime has cached about it; NULL otherwise.
+   * Owned; set before the descriptor is shared.
+   */
+  char                      *path;
+  /*
+   * For a Lind socket: a host descriptor for the socket under hd->d,
+   * which the service runtime sends and receives on directly once the
+   * socket is connected.  Owned, and kept open until the descriptor is
+   * destroyed, so that a thread still using it never sees the number
+   * reused.  -1 if there is none.  direct_ok is 1 while it may be used,
+   * and -1 for good once hd->d may no longer name that socket.
+   */
+  int volatile              direct_fd;
+  int volatile              direct_ok;
+  /* whether the cage has made the Lind descriptor non-blocking */
+  int volatile              nonblock;
 };
 
 int NaClDescIoInternalize(struct NaClDesc               **baseptr,
@@ -47,6 +65,14 @@ int NaClDescIoDescCtor(struct NaClDescIoDesc  *self,
 
 struct NaClDescIoDesc *NaClDescIoDescMake(struct NaClHostDesc *nhdp);
 
+/*
+ * Gives |self| its own copy of |path| (which may be NULL), replacing any
+ * it had.  Descriptors that share a host file opened by path, such as
+ * dups, should carry the same path.  If there is no memory for the copy,
+ * |self| is left without a path.
+ */
+void NaClDescIoDescSetPath(struct NaClDescIoDesc *self, char const *path);
+
 /*
  * DEPRECATED.  NaClDescIoDescMakeFromHandle always claims that the
  * handle was opened for NACL_ABI_O_RDWR.  On Windows, this breaks
@@ -0,0 +1,422 @@
+/*
+ * Copyright (c) 2017 The Native Client Authors. All rights reserved.
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file.
+ */
+
+/*
+ * In-runtime pipes.  See nacl_desc_pipe.h.
+ */
+
+#include "native_client/src/trusted/desc/nacl_desc_pipe.h"
+
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "native_client/src/shared/platform/nacl_futex.h"
+#include "native_client/src/shared/platform/nacl_log.h"
+#include "native_client/src/shared/platform/nacl_sync.h"
+#include "native_client/src/shared/platform/nacl_sync_checked.h"
+#include "native_client/src/trusted/service_runtime/include/sys/errno.h"
+#include "native_client/src/trusted/service_runtime/include/sys/fcntl.h"
+#include "native_client/src/trusted/service_runtime/include/sys/stat.h"
+
+#define RING_MASK (NACL_DESC_PIPE_RING_SIZE - 1)
+
+/*
+ * head and tail count bytes written and read; they wrap, and head - tail
+ * is the number of bytes in the ring.  Each is stored by one side only,
+ * and they sit on separate cache lines so the two sides do not contend.
+ */
+struct NaClDescPipeRing {
+  volatile uint32_t head;
+  char              pad0[60];
+  volatile uint32_t tail;
+  char              pad1[60];
+
+  /* futex words, bumped to wake the reader and the writer */
+  volatile int32_t  data_seq;
+  volatile int32_t  space_seq;
+  volatile int32_t  reader_waiting;
+  volatile int32_t  writer_waiting;
+  volatile int32_t  read_closed;
+  volatile int32_t  write_closed;
+  int32_t           refs;
+
+  struct NaClMutex  read_mu;
+  struct NaClMutex  write_mu;
+  char              buf[NACL_DESC_PIPE_RING_SIZE];
+};
+
+static struct NaClDescVtbl const kNaClDescPipeVtbl;  /* fwd */
+
+/*
+ * Shared by all pipes: poll_seq is bumped on any change while pollers is
+ * non-zero.  As with the per-ring words, pollers is raised before the
+ * ends are checked and read after a change is published.
+ */
+static volatile int32_t g_poll_seq;
+static volatile int32_t g_pollers;
+
+static void WakeAll(volatile int32_t *seq) {
+  __sync_fetch_and_add(seq, 1);
+  NaClFutexWake(seq, INT32_MAX);
+}
+
+static void WakePollers(void) {
+  if (g_pollers) {
+    WakeAll(&g_poll_seq);
+  }
+}
+
+/*
+ * Sleeps until |seq| moves on, unless |ready| says there is no need.  The
+ * waiting flag is raised before |ready| is checked, and the other side
+ * checks the flag after publishing, so one of the two always sees the
+ * other.
+ */
+static void WaitFor(volatile int32_t *seq, volatile int32_t *waiting,
+                    int (*ready)(struct NaClDescPipeRing *, uint32_t),
+                    struct NaClDescPipeRing *ring,
+                    uint32_t need) {
+  int32_t seen = *seq;
+
+  __sync_fetch_and_add(waiting, 1);
+  if (!(*ready)(ring, need)) {
+    NaClFutexWait(seq, seen, NULL);
+  }
+  __sync_fetch_and_sub(waiting, 1);
+}
+
+/* |need| is the number of bytes the reader wants; always 1 */
+static int ReaderReady(struct NaClDescPipeRing *ring, uint32_t need) {
+  return ring->head - ring->tail >= need || ring->write_closed;
+}
+
+/* |need| is the number of free bytes the writer wants */
+static int WriterReady(struct NaClDescPipeRing *ring, uint32_t need) {
+  return NACL_DESC_PIPE_RING_SIZE - (ring->head - ring->tail) >= need ||
+      ring->read_closed;
+}
+
+static void RingUnref(struct NaClDescPipeRing *ring) {
+  if (0 == __sync_sub_and_fetch(&ring->refs, 1)) {
+    NaClMutexDtor(&ring->read_mu);
+    NaClMutexDtor(&ring->write_mu);
+    free(ring);
+  }
+}
+
+static int NaClDescPipeCtor(struct NaClDescPipe *self,
+                            struct NaClDescPipeRing *ring,
+                            int is_write_end,
+                            int flags) {
+  if (!NaClDescCtor((struct NaClDesc *) self)) {
+    return 0;
+  }
+  self->ring = ring;
+  self->is_write_end = is_write_end;
+  NACL_VTBL(NaClRefCount, self) =
+      (struct NaClRefCountVtbl *) &kNaClDescPipeVtbl;
+  NaClDescSetFlags((struct NaClDesc *) self,
+                   (is_write_end ? NACL_ABI_O_WRONLY : NACL_ABI_O_RDONLY) |
+                   (flags & NACL_ABI_O_NONBLOCK));
+  return 1;
+}
+
+int NaClDescPipeMake(struct NaClDesc *ends[2], int flags) {
+  struct NaClDescPipeRing *ring;
+  struct NaClDescPipe *rd = NULL;
+  struct NaClDescPipe *wr = NULL;
+
+  ring = malloc(sizeof *ring);
+  if (NULL == ring) {
+    return -NACL_ABI_ENOMEM;
+  }
+  memset(ring, 0, offsetof(struct NaClDescPipeRing, buf));
+  if (!NaClMutexCtor(&ring->read_mu)) {
+    goto cleanup_ring;
+  }
+  if (!NaClMutexCtor(&ring->write_mu)) {
+    goto cleanup_read_mu;
+  }
+  rd = malloc(sizeof *rd);
+  wr = malloc(sizeof *wr);
+  if (NULL == rd || NULL == wr) {
+    goto cleanup_write_mu;
+  }
+  if (!NaClDescPipeCtor(rd, ring, 0, flags)) {
+    goto cleanup_write_mu;
+  }
+  ring->refs = 1;
+  if (!NaClDescPipeCtor(wr, ring, 1, flags)) {
+    /* the read end's Dtor frees the ring */
+    NaClDescUnref((struct NaClDesc *) rd);
+    free(wr);
+    return -NACL_ABI_ENOMEM;
+  }
+  ring->refs = 2;
+  ends[0] = (struct NaClDesc *) rd;
+  ends[1] = (struct NaClDesc *) wr;
+  return 0;
+
+ cleanup_write_mu:
+  free(rd);
+  free(wr);
+  NaClMutexDtor(&ring->write_mu);
+ cleanup_read_mu:
+  NaClMutexDtor(&ring->read_mu);
+ cleanup_ring:
+  free(ring);
+  return -NACL_ABI_ENOMEM;
+}
+
+static void NaClDescPipeDtor(struct NaClRefCount *vself) {
+  struct NaClDescPipe *self = (struct NaClDescPipe *) vself;
+  struct NaClDescPipeRing *ring = self->ring;
+
+  /* the last reference to this end is gone: wake the other side */
+  if (self->is_write_end) {
+    ring->write_closed = 1;
+    WakeAll(&ring->data_seq);
+  } else {
+    ring->read_closed = 1;
+    WakeAll(&ring->space_seq);
+  }
+  WakePollers();
+  RingUnref(ring);
+  self->ring = NULL;
+  NACL_VTBL(NaClDesc, self) = &kNaClDescVtbl;
+  (*NACL_VTBL(NaClRefCount, self)->Dtor)(vself);
+}
+
+static int IsNonblocking(struct NaClDesc *vself) {
+  return 0 != (NaClDescGetFlags(vself) & NACL_ABI_O_NONBLOCK);
+}
+
+static ssize_t NaClDescPipeRead(struct NaClDesc *vself,
+                                void *buf,
+                                size_t len) {
+  struct NaClDescPipe *self = (struct NaClDescPipe *) vself;
+  struct NaClDescPipeRing *ring = self->ring;
+  uint32_t tail;
+  uint32_t avail;
+  uint32_t off;
+  uint32_t first;
+  ssize_t rv;
+
+  if (self->is_write_end) {
+    return -NACL_ABI_EBADF;
+  }
+  if (0 == len) {
+    return 0;
+  }
+  NaClXMutexLock(&ring->read_mu);
+  tail = ring->tail;
+  for (;;) {
+    avail = ring->head - tail;
+    if (0 != avail) {
+      break;
+    }
+    if (ring->write_closed) {
+      /* recheck: the last write may have landed just before the close */
+      __sync_synchronize();
+      if (ring->head != tail) {
+        continue;
+      }
+      rv = 0;
+      goto done;
+    }
+    if (IsNonblocking(vself)) {
+      rv = -NACL_ABI_EAGAIN;
+      goto done;
+    }
+    WaitFor(&ring->data_seq, &ring->reader_waiting, ReaderReady, ring, 1);
+  }
+  /* the bytes up to head are published before head is */
+  __sync_synchronize();
+  if (len > avail) {
+    len = avail;
+  }
+  off = tail & RING_MASK;
+  first = NACL_DESC_PIPE_RING_SIZE - off;
+  if (first > len) {
+    first = (uint32_t) len;
+  }
+  memcpy(buf, ring->buf + off, first);
+  memcpy((char *) buf + first, ring->buf, len - first);
+  /* finish reading the bytes before handing their space back */
+  __sync_synchronize();
+  ring->tail = tail + (uint32_t) len;
+  __sync_synchronize();
+  if (ring->writer_waiting) {
+    WakeAll(&ring->space_seq);
+  }
+  WakePollers();
+  rv = (ssize_t) len;
+ done:
+  NaClXMutexUnlock(&ring->read_mu);
+  return rv;
+}
+
+static ssize_t NaClDescPipeWrite(struct NaClDesc *vself,
+                                 void const *buf,
+                                 size_t len) {
+  struct NaClDescPipe *self = (struct NaClDescPipe *) vself;
+  struct NaClDescPipeRing *ring = self->ring;
+  /* small writes go in whole, so that concurrent writers do not mix */
+  size_t need = len <= NACL_DESC_PIPE_BUF ? len : 1;
+  size_t done = 0;
+  uint32_t head;
+  uint32_t space;
+  uint32_t off;
+  uint32_t first;
+  size_t n;
+
+  if (!self->is_write_end) {
+    return -NACL_ABI_EBADF;
+  }
+  NaClXMutexLock(&ring->write_mu);
+  head = ring->head;
+  while (done < len) {
+    if (ring->read_closed) {
+      break;
+    }
+    space = NACL_DESC_PIPE_RING_SIZE - (head - ring->tail);
+    if (space < need) {
+      if (IsNonblocking(vself)) {
+        break;
+      }
+      WaitFor(&ring->space_seq, &ring->writer_waiting, WriterReady, ring,
+              (uint32_t) need);
+      continue;
+    }
+    /* the space up to tail has been read before tail moved */
+    __sync_synchronize();
+    n = len - done;
+    if (n > space) {
+      n = space;
+    }
+    off = head & RING_MASK;
+    first = NACL_DESC_PIPE_RING_SIZE - off;
+    if (first > n) {
+      first = (uint32_t) n;
+    }
+    memcpy(ring->buf + off, (char const *) buf + done, first);
+    memcpy(ring->buf, (char const *) buf + done + first, n - first);
+    __sync_synchronize();
+    head += (uint32_t) n;
+    ring->head = head;
+    __sync_synchronize();
+    if (ring->reader_waiting) {
+      WakeAll(&ring->data_seq);
+    }
+    WakePollers();
+    done += n;
+    need = 1;
+  }
+  NaClXMutexUnlock(&ring->write_mu);
+  if (0 != done || 0 == len) {
+    return (ssize_t) done;
+  }
+  return ring->read_closed ? -NACL_ABI_EPIPE : -NACL_ABI_EAGAIN;
+}
+
+static int NaClDescPipeFstat(struct NaClDesc *vself,
+                             struct nacl_abi_stat *statbuf) {
+  struct NaClDescPipe *self = (struct NaClDescPipe *) vself;
+
+  memset(statbuf, 0, sizeof *statbuf);
+  statbuf->nacl_abi_st_mode = NACL_ABI_S_IFIFO |
+      (self->is_write_end ? NACL_ABI_S_IWUSR : NACL_ABI_S_IRUSR);
+  statbuf->nacl_abi_st_nlink = 1;
+  statbuf->nacl_abi_st_uid = -1;
+  statbuf->nacl_abi_st_gid = -1;
+  statbuf->nacl_abi_st_blksize = NACL_DESC_PIPE_BUF;
+  return 0;
+}
+
+int NaClDescPipePoll(struct NaClDesc *d) {
+  struct NaClDescPipe *self = (struct NaClDescPipe *) d;
+  struct NaClDescPipeRing *ring;
+  uint32_t used;
+  int bits = 0;
+
+  if (NACL_VTBL(NaClDesc, d) != &kNaClDescPipeVtbl) {
+    return 0;
+  }
+  ring = self->ring;
+  used = ring->head - ring->tail;
+  if (self->is_write_end) {
+    if (NACL_DESC_PIPE_RING_SIZE - used >= NACL_DESC_PIPE_BUF) {
+      bits |= NACL_DESC_PIPE_WRITABLE;
+    }
+    if (ring->read_closed) {
+      bits |= NACL_DESC_PIPE_HANGUP;
+    }
+  } else {
+    if (0 != used) {
+      bits |= NACL_DESC_PIPE_READABLE;
+    }
+    if (ring->write_closed) {
+      bits |= NACL_DESC_PIPE_HANGUP;
+    }
+  }
+  return bits;
+}
+
+int32_t NaClDescPipePollBegin(void) {
+  int32_t seen = g_poll_seq;
+
+  __sync_fetch_and_add(&g_pollers, 1);
+  return seen;
+}
+
+int NaClDescPipePollWait(int32_t seen,
+                         struct nacl_abi_timespec const *rel_timeout) {
+  return NaClFutexWait(&g_poll_seq, seen, rel_timeout);
+}
+
+void NaClDescPipePollEnd(void) {
+  __sync_fetch_and_sub(&g_pollers, 1);
+}
+
+static struct NaClDescVtbl const kNaClDescPipeVtbl = {
+  {
+    NaClDescPipeDtor,
+  },
+  NaClDescMapNotImplemented,
+  NACL_DESC_UNMAP_NOT_IMPLEMENTED
+  NaClDescPipeRead,
+  NaClDescPipeWrite,
+  NaClDescSeekNotImplemented,
+  NaClDescPReadNotImplemented,
+  NaClDescPWriteNotImplemented,
+  NaClDescIoctlNotImplemented,
+  NaClDescPipeFstat,
+  NaClDescGetdentsNotImplemented,
+  NaClDescExternalizeSizeNotImplemented,
+  NaClDescExternalizeNotImplemented,
+  NaClDescLockNotImplemented,
+  NaClDescTryLockNotImplemented,
+  NaClDescUnlockNotImplemented,
+  NaClDescWaitNotImplemented,
+  NaClDescTimedWaitAbsNotImplemented,
+  NaClDescSignalNotImplemented,
+  NaClDescBroadcastNotImplemented,
+  NaClDescSendMsgNotImplemented,
+  NaClDescRecvMsgNotImplemented,
+  NaClDescLowLevelSendMsgNotImplemented,
+  NaClDescLowLevelRecvMsgNotImplemented,
+  NaClDescConnectAddrNotImplemented,
+  NaClDescAcceptConnNotImplemented,
+  NaClDescPostNotImplemented,
+  NaClDescSemWaitNotImplemented,
+  NaClDescGetValueNotImplemented,
+  NaClDescSetMetadata,
+  NaClDescGetMetadata,
+  NaClDescSetFlags,
+  NaClDescGetFlags,
+  NACL_DESC_PIPE,
+};
@@ -0,0 +1,81 @@
+/*
+ * Copyright (c) 2017 The Native Client Authors. All rights reserved.
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file.
+ */
+
+/*
+ * A NaClDesc subclass for pipes kept inside the runtime, so that data
+ * written by one cage is copied once into a ring buffer and once out of it
+ * by another, without a host pipe or the Lind dispatcher in between.
+ *
+ * The two ends share a single-producer, single-consumer ring: writers are
+ * serialized by one mutex and readers by another, and the producer and
+ * consumer then move the ring's head and tail without a common lock.  A
+ * side that finds the ring full or empty sleeps on a futex word that the
+ * other side bumps only when it knows someone is waiting.
+ *
+ * Each end is a single NaClDesc; dup and fork share it by reference, as
+ * they share an open file description on POSIX, so the O_NONBLOCK flag of
+ * an end is seen by every fd that refers to it.  Readers see EOF once the
+ * write end has been destroyed and the ring is empty; writers get EPIPE
+ * once the read end has been destroyed.
+ */
+
+#ifndef NATIVE_CLIENT_SRC_TRUSTED_DESC_NACL_DESC_PIPE_H_
+#define NATIVE_CLIENT_SRC_TRUSTED_DESC_NACL_DESC_PIPE_H_
+
+#include "native_client/src/include/portability.h"
+#include "native_client/src/trusted/desc/nacl_desc_base.h"
+#include "native_client/src/trusted/service_runtime/include/sys/time.h"
+
+EXTERN_C_BEGIN
+
+/* Must be a power of two. */
+#define NACL_DESC_PIPE_RING_SIZE  (256 << 10)
+
+/* Writes of at most this many bytes are not interleaved with others. */
+#define NACL_DESC_PIPE_BUF        4096
+
+struct NaClDescPipeRing;
+
+struct NaClDescPipe {
+  struct NaClDesc         base NACL_IS_REFCOUNT_SUBCLASS;
+  struct NaClDescPipeRing *ring;
+  int                     is_write_end;
+};
+
+/*
+ * Makes a connected pair: ends[0] is the read end and ends[1] the write
+ * end.  |flags| may hold NACL_ABI_O_NONBLOCK, which is set on both.
+ * Returns 0 or a negative NaCl errno.
+ */
+int NaClDescPipeMake(struct NaClDesc *ends[2], int flags) NACL_WUR;
+
+/* What NaClDescPipePoll reports of an end. */
+#define NACL_DESC_PIPE_READABLE  0x1  /* a read would not block */
+#define NACL_DESC_PIPE_WRITABLE  0x2  /* a NACL_DESC_PIPE_BUF write would not */
+#define NACL_DESC_PIPE_HANGUP    0x4  /* the other end has been destroyed */
+
+/*
+ * Returns the NACL_DESC_PIPE_* bits that hold for the pipe end |d| now, or
+ * 0 if |d| is not a pipe end.
+ */
+int NaClDescPipePoll(struct NaClDesc *d);
+
+/*
+ * For waiting on several ends at once.  NaClDescPipePollBegin returns a
+ * sequence number that moves on whenever any pipe changes while someone
+ * polls; having found no end ready with NaClDescPipePoll, the caller
+ * sleeps in NaClDescPipePollWait until the number moves on from |seen| or
+ * |rel_timeout| (NULL for none) has passed, and then checks again.  Each
+ * Begin is matched by an End.  Wait returns as NaClFutexWait does.
+ */
+int32_t NaClDescPipePollBegin(void);
+int NaClDescPipePollWait(int32_t seen,
+                         struct nacl_abi_timespec const *rel_timeout);
+void NaClDescPipePollEnd(void);
+
+EXTERN_C_END
+
+#endif  /* NATIVE_CLIENT_SRC_TRUSTED_DESC_NACL_DESC_PIPE_H_ */
@@ -0,0 +1,186 @@
+/*
+ * Copyright (c) 2017 The Native Client Authors. All rights reserved.
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file.
+ */
+
+/*
+ * Exercise NaClDescPipe: EOF and EPIPE when an end goes away, the
+ * nonblocking paths, polling, and a threaded transfer that wraps the ring
+ * many times with the reader and the writer each having to wait.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "native_client/src/include/nacl_macros.h"
+#include "native_client/src/include/portability.h"
+#include "native_client/src/shared/platform/nacl_check.h"
+#include "native_client/src/shared/platform/nacl_threads.h"
+#include "native_client/src/shared/platform/platform_init.h"
+#include "native_client/src/trusted/desc/nacl_desc_base.h"
+#include "native_client/src/trusted/desc/nacl_desc_pipe.h"
+#include "native_client/src/trusted/service_runtime/include/sys/errno.h"
+#include "native_client/src/trusted/service_runtime/include/sys/fcntl.h"
+
+#define TRANSFER_BYTES (64 << 20)
+
+static ssize_t PipeRead(struct NaClDesc *d, void *buf, size_t len) {
+  return (*NACL_VTBL(NaClDesc, d)->Read)(d, buf, len);
+}
+
+static ssize_t PipeWrite(struct NaClDesc *d, void const *buf, size_t len) {
+  return (*NACL_VTBL(NaClDesc, d)->Write)(d, buf, len);
+}
+
+static void TestEof(void) {
+  struct NaClDesc *ends[2];
+  char buf[16];
+
+  CHECK(0 == NaClDescPipeMake(ends, 0));
+  CHECK(NACL_DESC_PIPE == NACL_VTBL(NaClDesc, ends[0])->typeTag);
+  CHECK(5 == PipeWrite(ends[1], "hello", 5));
+  CHECK(-NACL_ABI_EBADF == PipeRead(ends[1], buf, sizeof buf));
+  NaClDescUnref(ends[1]);
+  /* data written before the close is still read, then EOF */
+  CHECK(5 == PipeRead(ends[0], buf, sizeof buf));
+  CHECK(0 == memcmp(buf, "hello", 5));
+  CHECK(0 == PipeRead(ends[0], buf, sizeof buf));
+  NaClDescUnref(ends[0]);
+}
+
+static void TestEpipe(void) {
+  struct NaClDesc *ends[2];
+
+  CHECK(0 == NaClDescPipeMake(ends, 0));
+  NaClDescUnref(ends[0]);
+  CHECK(-NACL_ABI_EPIPE == PipeWrite(ends[1], "x", 1));
+  NaClDescUnref(ends[1]);
+}
+
+static void TestNonblocking(void) {
+  struct NaClDesc *ends[2];
+  char *big = calloc(1, NACL_DESC_PIPE_RING_SIZE);
+  char buf[NACL_DESC_PIPE_BUF];
+
+  CHECK(NULL != big);
+  CHECK(0 == NaClDescPipeMake(ends, NACL_ABI_O_NONBLOCK));
+  CHECK(0 != (NaClDescGetFlags(ends[0]) & NACL_ABI_O_NONBLOCK));
+  CHECK(-NACL_ABI_EAGAIN == PipeRead(ends[0], buf, sizeof buf));
+
+  /* a large write is cut short, then refused once the ring is full */
+  CHECK(NACL_DESC_PIPE_RING_SIZE - 10 ==
+        PipeWrite(ends[1], big, NACL_DESC_PIPE_RING_SIZE - 10));
+  CHECK(10 == PipeWrite(ends[1], big, NACL_DESC_PIPE_RING_SIZE));
+  CHECK(-NACL_ABI_EAGAIN == PipeWrite(ends[1], big, 1));
+
+  /* a write of at most NACL_DESC_PIPE_BUF goes in whole or not at all */
+  CHECK(100 == PipeRead(ends[0], buf, 100));
+  CHECK(-NACL_ABI_EAGAIN == PipeWrite(ends[1], big, 101));
+  CHECK(100 == PipeWrite(ends[1], big, 100));
+
+  NaClDescUnref(ends[0]);
+  NaClDescUnref(ends[1]);
+  free(big);
+}
+
+static void TestPoll(void) {
+  struct NaClDesc *ends[2];
+  struct nacl_abi_timespec zero = { 0, 0 };
+  char buf[16];
+  int32_t seen;
+
+  CHECK(0 == NaClDescPipeMake(ends, 0));
+  CHECK(0 == NaClDescPipePoll(ends[0]));
+  CHECK(NACL_DESC_PIPE_WRITABLE == NaClDescPipePoll(ends[1]));
+
+  /* a write moves the sequence of a poller that found nothing ready */
+  seen = NaClDescPipePollBegin();
+  CHECK(-NACL_ABI_ETIMEDOUT == NaClDescPipePollWait(seen, &zero));
+  CHECK(5 == PipeWrite(ends[1], "hello", 5));
+  CHECK(-NACL_ABI_EAGAIN == NaClDescPipePollWait(seen, &zero));
+  NaClDescPipePollEnd();
+  CHECK(NACL_DESC_PIPE_READABLE == NaClDescPipePoll(ends[0]));
+
+  /* so does the close of an end; the data is still there to read */
+  seen = NaClDescPipePollBegin();
+  NaClDescUnref(ends[1]);
+  CHECK(-NACL_ABI_EAGAIN == NaClDescPipePollWait(seen, &zero));
+  NaClDescPipePollEnd();
+  CHECK((NACL_DESC_PIPE_READABLE | NACL_DESC_PIPE_HANGUP) ==
+        NaClDescPipePoll(ends[0]));
+  CHECK(5 == PipeRead(ends[0], buf, sizeof buf));
+  CHECK(NACL_DESC_PIPE_HANGUP == NaClDescPipePoll(ends[0]));
+  NaClDescUnref(ends[0]);
+}
+
+struct WriterState {
+  struct NaClDesc *end;
+  size_t bytes;
+};
+
+static unsigned char PatternByte(size_t offset) {
+  return (unsigned char) (offset * 7 + (offset >> 13));
+}
+
+static void WINAPI WriterThread(void *arg) {
+  struct WriterState *state = (struct WriterState *) arg;
+  unsigned char chunk[10007];
+  size_t offset = 0;
+
+  while (offset < state->bytes) {
+    size_t n = sizeof chunk;
+    size_t i;
+    ssize_t written;
+
+    if (n > state->bytes - offset) {
+      n = state->bytes - offset;
+    }
+    for (i = 0; i < n; ++i) {
+      chunk[i] = PatternByte(offset + i);
+    }
+    written = PipeWrite(state->end, chunk, n);
+    CHECK(written == (ssize_t) n);
+    offset += n;
+  }
+  NaClDescUnref(state->end);
+}
+
+static void TestTransfer(void) {
+  struct NaClDesc *ends[2];
+  struct WriterState state;
+  struct NaClThread thread;
+  unsigned char buf[3001];
+  size_t offset = 0;
+  ssize_t got;
+
+  CHECK(0 == NaClDescPipeMake(ends, 0));
+  state.end = ends[1];
+  state.bytes = TRANSFER_BYTES;
+  CHECK(NaClThreadCreateJoinable(&thread, WriterThread, &state, 64 << 10));
+  while ((got = PipeRead(ends[0], buf, sizeof buf)) > 0) {
+    ssize_t i;
+
+    for (i = 0; i < got; ++i) {
+      CHECK(buf[i] == PatternByte(offset + i));
+    }
+    offset += got;
+  }
+  CHECK(0 == got);
+  CHECK(TRANSFER_BYTES == offset);
+  NaClThreadJoin(&thread);
+  NaClDescUnref(ends[0]);
+}
+
+int main(void) {
+  NaClPlatformInit();
+  TestEof();
+  TestEpipe();
+  TestNonblocking();
+  TestPoll();
+  TestTransfer();
+  NaClPlatformFini();
+  printf("PASSED\n");
+  return 0;
+}
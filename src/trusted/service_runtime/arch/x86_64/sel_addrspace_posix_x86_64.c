@@ -5,6 +5,7 @@
  */
 
 #include <errno.h>
+#include <stdlib.h>
 #include <sys/mman.h>
 #if NACL_LINUX
 /*
@@ -26,6 +27,7 @@
 #define ALIGN_BITS  32
 #define MAX_ADDRESS_RANDOMIZATION_ATTEMPTS  8
 #define MSGWIDTH    "25"
+#define SANDBOX_POOL_PRERESERVE  8
 
 
 /*
@@ -61,10 +63,11 @@ static void *NaClAllocatePow2AlignedMemory(size_t mem_sz,
     found_memory = NaClFindAddressSpace(&unrounded_addr, request_size);
   }
   if (!found_memory) {
-    NaClLog(LOG_FATAL,
+    NaClLog(LOG_ERROR,
             "NaClAllocatePow2AlignedMemory: Failed to reserve %"NACL_PRIxS
             " bytes of address space\n",
             request_size);
+    return NULL;
   }
 
   NaClLog(4,
@@ -117,6 +120,45 @@ static void *NaClAllocatePow2AlignedMemory(size_t mem_sz,
   return (void *) rounded_addr;
 }
 
+/*
+ * Sets aside sandbox regions for cages forked later, so that creating one
+ * pops a reservation from the pool; exiting cages put theirs back.  Done
+ * once, when the main cage's sandbox is allocated.  NACL_SANDBOX_POOL_SIZE
+ * overrides how many regions are reserved up front.
+ */
+static void NaClPrereserveSandboxPool(size_t mem_sz,
+                                      enum NaClAslrMode aslr_mode) {
+  static int done;
+  char const *env = getenv("NACL_SANDBOX_POOL_SIZE");
+  int count = SANDBOX_POOL_PRERESERVE;
+  int i;
+
+  if (done) {
+    return;
+  }
+  done = 1;
+  if (NULL != env) {
+    count = atoi(env);
+  }
+  NaClAddrSpacePoolEnable(mem_sz);
+  for (i = 0; i < count; ++i) {
+    void *region = NaClAllocatePow2AlignedMemory(mem_sz, ALIGN_BITS,
+                                                 aslr_mode);
+    if (NULL == region) {
+      break;
+    }
+    if (!NaClAddrSpacePoolGive(region, mem_sz)) {
+      if (-1 == munmap(region, mem_sz)) {
+        NaClLog(LOG_FATAL,
+                "NaClPrereserveSandboxPool: munmap failed, errno %d\n",
+                errno);
+      }
+      break;
+    }
+  }
+  NaClLog(4, "NaClPrereserveSandboxPool: %d regions reserved\n", i);
+}
+
 NaClErrorCode NaClAllocateSpaceAslr(void **mem, size_t addrsp_size,
                                     enum NaClAslrMode aslr_mode) {
   /* 40G guard on each side */
@@ -183,7 +225,12 @@ NaClErrorCode NaClAllocateSpaceAslr(void **mem, size_t addrsp_size,
   NaClAddrSpaceBeforeAlloc(mem_sz);
 
   errno = 0;
-  mem_ptr = NaClAllocatePow2AlignedMemory(mem_sz, log_align, aslr_mode);
+  if (NaClAddrSpacePoolTake(&mem_ptr, mem_sz)) {
+    NaClLog(4, "NaClAllocateSpace: region 0x%016"NACL_PRIxPTR" from pool\n",
+            (uintptr_t) mem_ptr);
+  } else {
+    mem_ptr = NaClAllocatePow2AlignedMemory(mem_sz, log_align, aslr_mode);
+  }
   if (NULL == mem_ptr) {
     if (0 != errno) {
       perror("NaClAllocatePow2AlignedMemory");
@@ -237,6 +284,7 @@ NaClErrorCode NaClAllocateSpaceAslr(void **mem, size_t addrsp_size,
    * The module lives in the middle FOURGIG of the allocated region --
    * we skip over an initial 40G guard.
    */
+  NaClPrereserveSandboxPool(mem_sz, aslr_mode);
   *mem = (void *) (((char *) mem_ptr) + NACL_ADDRSPACE_LOWER_GUARD_SIZE);
   NaClLog(4,
           "NaClAllocateSpace: addr space at 0x%016"NACL_PRIxPTR"\n",
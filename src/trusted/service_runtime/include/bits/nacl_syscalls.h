@@ -123,6 +123,13 @@
 #define NACL_sys_wait4                  122
 #define NACL_sys_sigprocmask            123
 #define NACL_sys_lstat                  124
+#define NACL_sys_pread                  125
+#define NACL_sys_pwrite                 126
+#define NACL_sys_lind_ring_enter        127
+#define NACL_sys_futex_wait             128
+#define NACL_sys_futex_wake             129
+#define NACL_sys_futex_cmp_requeue      130
+#define NACL_sys_dyncode_create_batch   131
 
 #define NACL_MAX_SYSCALLS               256
 
@@ -0,0 +1,39 @@
+/*
+ * Copyright (c) 2017 The Native Client Authors. All rights reserved.
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file.
+ */
+
+/*
+ * Argument layout of NACL_sys_dyncode_create_batch.
+ *
+ * The cage passes the untrusted address of an array of chunks and their
+ * number.  Each chunk is what one NACL_sys_dyncode_create would take, and
+ * is validated and installed the same way; the runtime goes through them
+ * in order and stops at the first that fails.  The call returns how many
+ * chunks were installed, or the negated errno of the first chunk if none
+ * was.  Chunks are copied in and installed in groups of
+ * at most NACL_DYNCODE_BATCH_GROUP chunks and NACL_DYNCODE_BATCH_BYTES of
+ * code, taking the dynamic code lock once per group.
+ */
+
+#ifndef _NATIVE_CLIENT_SRC_SERVICE_RUNTIME_INCLUDE_SYS_DYNCODE_BATCH_H_
+#define _NATIVE_CLIENT_SRC_SERVICE_RUNTIME_INCLUDE_SYS_DYNCODE_BATCH_H_ 1
+
+#if defined(__native_client__)
+# include <stdint.h>
+#else
+# include "native_client/src/include/portability.h"
+#endif
+
+#define NACL_DYNCODE_BATCH_MAX    4096
+#define NACL_DYNCODE_BATCH_GROUP  64
+#define NACL_DYNCODE_BATCH_BYTES  (1024 * 1024)
+
+struct NaClDyncodeChunk {
+  uint32_t dest;        /* untrusted address in the dynamic code area */
+  uint32_t src;         /* untrusted address of the code */
+  uint32_t size;        /* a multiple of the bundle size */
+};
+
+#endif /* _NATIVE_CLIENT_SRC_SERVICE_RUNTIME_INCLUDE_SYS_DYNCODE_BATCH_H_ */
@@ -34,6 +34,7 @@
 #define NACL_ABI_O_SYNC      010000
 #define NACL_ABI_O_FSYNC       NACL_ABI_O_SYNC
 #define NACL_ABI_O_ASYNC     020000
+#define NACL_ABI_O_CLOEXEC 02000000  /* pipe2 only */
 
 /* XXX close on exec request; must match UF_EXCLOSE in user.h */
 #define FD_CLOEXEC  1 /* posix */
@@ -0,0 +1,57 @@
+/*
+ * Copyright (c) 2017 The Native Client Authors. All rights reserved.
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file.
+ */
+
+/*
+ * Lind submission ring, shared between a cage and the service runtime.
+ *
+ * The cage fills submission entries (one Lind call each, encoded exactly
+ * like the arguments of NACL_sys_lind_syscall), advances sq_tail and calls
+ * NACL_sys_lind_ring_enter.  The runtime dispatches up to the requested
+ * number of entries in order, writes one completion per entry, then
+ * advances cq_tail and sq_head.  The cage reaps completions by advancing
+ * cq_head.  All indices are free-running and wrap modulo 2^32; the slot is
+ * index & (entries - 1).
+ */
+
+#ifndef _NATIVE_CLIENT_SRC_SERVICE_RUNTIME_INCLUDE_SYS_LIND_RING_H_
+#define _NATIVE_CLIENT_SRC_SERVICE_RUNTIME_INCLUDE_SYS_LIND_RING_H_ 1
+
+#if defined(__native_client__)
+# include <stdint.h>
+#else
+# include "native_client/src/include/portability.h"
+#endif
+
+#define NACL_LIND_RING_MAX_ENTRIES 4096
+
+struct NaClLindRingSqe {
+  uint32_t call_num;
+  uint32_t in_num;
+  uint32_t in_args;     /* untrusted address of LindArg[in_num] */
+  uint32_t out_num;
+  uint32_t out_args;    /* untrusted address of LindArg[out_num] */
+  uint32_t reserved;
+  uint64_t user_data;   /* copied to the matching completion */
+};
+
+struct NaClLindRingCqe {
+  uint64_t user_data;
+  int32_t result;       /* same as NACL_sys_lind_syscall's return value */
+  uint32_t reserved;
+};
+
+struct NaClLindRing {
+  uint32_t sq_head;     /* written by the runtime */
+  uint32_t sq_tail;     /* written by the cage */
+  uint32_t cq_head;     /* written by the cage */
+  uint32_t cq_tail;     /* written by the runtime */
+  uint32_t entries;     /* power of two, at most NACL_LIND_RING_MAX_ENTRIES */
+  uint32_t sqes;        /* untrusted address of NaClLindRingSqe[entries] */
+  uint32_t cqes;        /* untrusted address of NaClLindRingCqe[entries] */
+  uint32_t flags;       /* must be zero */
+};
+
+#endif /* _NATIVE_CLIENT_SRC_SERVICE_RUNTIME_INCLUDE_SYS_LIND_RING_H_ */
@@ -14,25 +14,35 @@
 
 #include <Python.h>
 #include <sys/mman.h>
+#include <sys/socket.h>
+#include <errno.h>
 #include <fcntl.h>
+#include <poll.h>
 #include <stdlib.h>
 #include <unistd.h>
 #include <string.h>
+#include <time.h>
 
 #include "native_client/src/shared/platform/nacl_sync_checked.h"
 #include "native_client/src/shared/platform/nacl_log.h"
 #include "native_client/src/shared/platform/nacl_host_desc.h"
+#include "native_client/src/shared/platform/lind_call_buf.h"
 #include "native_client/src/shared/platform/lind_platform.h"
 
 #include "native_client/src/include/portability.h"
 
 #include "native_client/src/trusted/desc/nacl_desc_io.h"
+#include "native_client/src/trusted/desc/nacl_desc_pipe.h"
 #include "native_client/src/trusted/service_runtime/include/sys/errno.h"
 #include "native_client/src/trusted/service_runtime/include/sys/fcntl.h"
 #include "native_client/src/trusted/service_runtime/nacl_config.h"
 #include "native_client/src/trusted/service_runtime/nacl_app_thread.h"
 #include "native_client/src/trusted/service_runtime/nacl_copy.h"
+#include "native_client/src/trusted/service_runtime/nacl_stat_cache.h"
+#include "native_client/src/trusted/service_runtime/sel_ldr.h"
+#include "native_client/src/trusted/service_runtime/nacl_syscall_profile.h"
 #include "native_client/src/trusted/service_runtime/lind_syscalls.h"
+#include "native_client/src/trusted/service_runtime/include/sys/lind_ring.h"
 
 extern PyObject *py_context;
 
@@ -73,18 +83,7 @@ typedef int(*CleanupType)(struct NaClApp*, uint32_t, LindArg*, void*);
 typedef struct _StubType {PreprocessType pre; PostprocessType post; CleanupType clean;} StubType;
 
 static int NaClFdToRepyFD(struct NaClApp *nap, int NaClFd) {
-        struct NaClDesc *ndp;
-        int retval;
-        NaClFastMutexLock(&nap->desc_mu);
-        ndp = NaClGetDescMu(nap, NaClFd);
-        NaClFastMutexUnlock(&nap->desc_mu);
-        if(!ndp || ndp->base.vtbl != (struct NaClRefCountVtbl const *)&kNaClDescIoDescVtbl) {
-                retval = -1;
-                goto cleanup;
-        }
-        retval = ((struct NaClDescIoDesc *)ndp)->hd->d;
-cleanup:
-        NaClDescSafeUnref(ndp);
+        int retval = NaClFdTableGet(&nap->host_fd_tbl, NaClFd);
         NaClLog(1, "NaClFdToRepyFD: %d->%d\n", NaClFd, retval);
         return retval;
 }
@@ -98,36 +97,42 @@ static int NaClHostDescCtor(struct NaClHostDesc  *d,
   return 0;
 }
 
+/*
+ * Per-call state of the fcntl stub, in the LindStubState that
+ * LindSyscallLocked and LindSyscallShared pass.  nhd is only allocated
+ * for F_DUPFD and F_DUPFD_CLOEXEC, and given to the new desc on success.
+ */
 struct FcntlExchangeData {
         struct NaClHostDesc *nhd;
         int minFd;
+        int lindFd;
+        int cmd;
+        long arg;
 };
 
 int LindFcntlPreprocess(struct NaClApp *nap, uint32_t inNum, LindArg *inArgs, void** xchangedata) {
+        struct FcntlExchangeData *state = *xchangedata;
         int retval;
         int lindFd;
         NaClLog(1, "Entered LindFcntlPreprocess inNum=%8u\n", inNum);
-        *xchangedata = 0;
+        state->nhd = NULL;
         lindFd = NaClFdToRepyFD(nap, (int)(*(int64_t*)&inArgs[0].ptr));
         if(lindFd<0) {
                 retval = -NACL_ABI_EINVAL;
                 goto cleanup;
         }
         inArgs[0].ptr = lindFd;
-        if(inNum>=3 && (inArgs[1].ptr == 0 /*F_DUPFD*/ || inArgs[1].ptr == 1030 /*F_DUPFD_CLOEXEC*/)) {
-                *xchangedata = (struct FcntlExchangeData*)malloc(sizeof(struct FcntlExchangeData));
-                if(!*xchangedata) {
+        state->lindFd = lindFd;
+        state->cmd = inNum>=2 ? (int)(*(int64_t *)&inArgs[1].ptr) : -1;
+        state->arg = inNum>=3 ? (long)(*(int64_t *)&inArgs[2].ptr) : 0;
+        if(inNum>=3 && (state->cmd == 0 /*F_DUPFD*/ || state->cmd == 1030 /*F_DUPFD_CLOEXEC*/)) {
+                state->nhd = (struct NaClHostDesc*)malloc(sizeof(struct NaClHostDesc));
+                if(!state->nhd) {
                         retval = -NACL_ABI_ENOMEM;
                         goto cleanup;
                 }
-                ((struct FcntlExchangeData*)(*xchangedata))->nhd = (struct NaClHostDesc*)malloc(sizeof(struct NaClHostDesc));
-                if(!((struct FcntlExchangeData*)(*xchangedata))->nhd) {
-                        retval = -NACL_ABI_ENOMEM;
-                        free(*xchangedata);
-                        goto cleanup;
-                }
-                ((struct FcntlExchangeData*)(*xchangedata))->minFd = (int)(*(int64_t *)&inArgs[2].ptr);
-                NaClLog(1, "MinFD: %d\n", ((struct FcntlExchangeData*)(*xchangedata))->minFd);
+                state->minFd = (int)state->arg;
+                NaClLog(1, "MinFD: %d\n", state->minFd);
         }
         retval = 0;
 cleanup:
@@ -141,30 +146,31 @@ int LindFcntlPostprocess(struct NaClApp *nap,
                          char *data,
                          int len,
                          void *xchangedata) {
+        struct FcntlExchangeData *state = xchangedata;
+        struct LindFsBackend const *backend = LindFsGetBackend();
         struct NaClHostDesc  *hd;
         int minFd;
-        UNREFERENCED_PARAMETER(nap);
         UNREFERENCED_PARAMETER(iserror);
         UNREFERENCED_PARAMETER(data);
         UNREFERENCED_PARAMETER(len);
         NaClLog(1, "%s\n", "Entered LindFcntlPostprocess");
-        if(xchangedata) {
-                hd = ((struct FcntlExchangeData*)xchangedata)->nhd;
+        /* the file I/O backend follows dups and flag changes in its own table */
+        if(backend->fcntled) {
+                backend->fcntled(state->lindFd, state->cmd, state->arg, *code, nap->cage_id);
+        }
+        if(state->nhd) {
+                hd = state->nhd;
+                state->nhd = NULL;
                 NaClHostDescCtor(hd, *code, NACL_ABI_O_RDWR);
-                minFd = ((struct FcntlExchangeData*)xchangedata)->minFd;
+                minFd = state->minFd;
                 NaClLog(1, "Try to find a valid FD: %d\n", minFd);
                 NaClFastMutexLock(&nap->desc_mu);
                 while(DynArrayGet(&nap->desc_tbl, minFd)) {
                         ++minFd;
                 }
                 NaClLog(1, "Found a valid FD: %d\n", minFd);
-                if (!DynArraySet(&nap->desc_tbl, minFd, ((struct NaClDesc *) NaClDescIoDescMake(hd)))) {
-                NaClLog(LOG_FATAL,
-                                "NaClSetDesc: could not set descriptor %d to 0x%08"
-                                NACL_PRIxPTR"\n",
-                                minFd,
-                                (uintptr_t) hd);
-                }
+                /* NaClSetDescMu, not DynArraySet, to keep host_fd_tbl current */
+                NaClSetDescMu(nap, minFd, (struct NaClDesc *) NaClDescIoDescMake(hd));
                 NaClFastMutexUnlock(&nap->desc_mu);
                 *code = minFd;
         }
@@ -173,138 +179,100 @@ int LindFcntlPostprocess(struct NaClApp *nap,
 }
 
 int LindFcntlCleanup(struct NaClApp *nap, uint32_t inNum, LindArg *inArgs, void *xchangedata) {
+        struct FcntlExchangeData *state = xchangedata;
         UNREFERENCED_PARAMETER(nap);
         UNREFERENCED_PARAMETER(inNum);
         UNREFERENCED_PARAMETER(inArgs);
-        if(xchangedata) {
-                free(xchangedata);
-        }
+        /* still ours if the call failed */
+        free(state->nhd);
         return 0;
 }
 
 
-int LindSelectCleanup(struct NaClApp *nap, uint32_t inNum, LindArg *inArgs, void *xchangedata)
-{
-    UNREFERENCED_PARAMETER(nap);
-    UNREFERENCED_PARAMETER(inNum);
-    if (xchangedata) {
-        free((void *)inArgs[1].ptr);
-        free((void *)inArgs[2].ptr);
-        free((void *)inArgs[3].ptr);
-        free(xchangedata);
-    }
-    return 0;
-}
+/*
+ * Per-call state of the select and poll stubs.  LindSyscallLocked passes
+ * one on its stack in *xchangedata, so these calls allocate nothing unless
+ * a poll has more than LIND_POLL_SMALL fds.  The cage's fd numbers are
+ * desc_tbl indices, translated to host fds with nap->host_fd_tbl.
+ */
+#define LIND_POLL_SMALL 32
+
+struct LindSelectState {
+    fd_set host_sets[3];
+    fd_set const *user_sets[3];  /* the cage's sets, NULL if not passed */
+    int max_fd;
+    int max_hfd;
+};
+
+struct LindPollState {
+    struct pollfd const *user_pfds;
+    struct pollfd *pfds;
+    int nfds;
+    struct pollfd small[LIND_POLL_SMALL];
+};
+
+union LindStubState {
+    struct FcntlExchangeData fcntl;
+    struct LindSelectState select;
+    struct LindPollState poll;
+};
 
 int LindSelectPreprocess(struct NaClApp *nap, uint32_t inNum, LindArg *inArgs, void** xchangedata)
 {
-    struct NaClDesc *ndp = NULL;
+    struct LindSelectState *state = *xchangedata;
+    int max_fd;
+    int max_hfd = -1;
     int hfd;
-    int retval = 0;
-    int *mapdata;
-    fd_set rs;
-    fd_set ws;
-    fd_set es;
-    int64_t max_fd;
-    int64_t max_hfd = -1;
-    NaClLog(1, "Entered LindSelectPreprocess inNum=%8u\n", inNum);
-    max_fd = *(int64_t*)&inArgs[0].ptr;
-    if (inArgs[1].ptr) {
-        rs = *(fd_set*)inArgs[1].ptr;
-        inArgs[1].ptr = (uintptr_t)malloc(sizeof(fd_set));
-        if (!inArgs[1].ptr) {
-            retval = -NACL_ABI_ENOMEM;
-            goto finish;
-        }
-        FD_ZERO((fd_set*)inArgs[1].ptr);
-    }
-    if(inArgs[2].ptr) {
-        ws = *(fd_set*)inArgs[2].ptr;
-        inArgs[2].ptr = (uintptr_t)malloc(sizeof(fd_set));
-        if (!inArgs[2].ptr) {
-            retval = -NACL_ABI_ENOMEM;
-            goto cleanup_rs;
-        }
-        FD_ZERO((fd_set*)inArgs[2].ptr);
-    }
-    if(inArgs[3].ptr) {
-        es = *(fd_set*)inArgs[3].ptr;
-        inArgs[3].ptr = (uintptr_t)malloc(sizeof(fd_set));
-        if (!inArgs[3].ptr) {
-            retval = -NACL_ABI_ENOMEM;
-            goto cleanup_ws;
-        }
-        FD_ZERO((fd_set*)inArgs[3].ptr);
-    }
-    *xchangedata = malloc(sizeof(int) * (FD_SETSIZE + 1));
-    if (!*xchangedata) {
-        retval = -NACL_ABI_ENOMEM;
-        goto cleanup_es;
+    int i;
+    int k;
+    UNREFERENCED_PARAMETER(inNum);
+    max_fd = (int)*(int64_t*)&inArgs[0].ptr;
+    if (max_fd < 0) {
+        return -NACL_ABI_EINVAL;
     }
-    memset(*xchangedata, 0xFF, sizeof(int) * FD_SETSIZE);
-    mapdata = &((int*)(*xchangedata))[1];
-    NaClFastMutexLock(&nap->desc_mu);
-    for(int i=0; i<max_fd; ++i) {
-        ndp = NULL;
-        if((inArgs[1].ptr && FD_ISSET(i, &rs)) ||
-                (inArgs[2].ptr && FD_ISSET(i, &ws)) ||
-                (inArgs[3].ptr && FD_ISSET(i, &es))) {
-            ndp = NaClGetDescMu(nap, i);
-            if(ndp && ndp->base.vtbl == (struct NaClRefCountVtbl const *)&kNaClDescIoDescVtbl) {
-                hfd = ((struct NaClDescIoDesc*)ndp)->hd->d;
-                NaClDescUnref(ndp);
-                if(hfd<FD_SETSIZE) {
-                    if(hfd > max_hfd) {
-                        max_hfd = hfd;
-                    }
-                    mapdata[hfd]=i;
-                } else {
-                    NaClLog(LOG_ERROR, "Host desc too large: %d->%d\n", i, hfd);
-                    retval = -NACL_ABI_EINVAL;
-                    goto cleanup_xdata;
-                }
-            } else {
-                NaClLog(LOG_ERROR, "Invalid NaCl desc: %d\n", i);
-                NaClDescSafeUnref(ndp);
-                retval = -NACL_ABI_EINVAL;
-                goto cleanup_xdata;
-            }
-            if(inArgs[1].ptr && FD_ISSET(i, &rs)) {
-                NaClLog(1, "%d in RS with host desc %d\n", i, hfd);
-                FD_SET(hfd, (fd_set*)inArgs[1].ptr);
-            }
-            if(inArgs[2].ptr && FD_ISSET(i, &ws)) {
-                NaClLog(1, "%d in WS with host desc %d\n", i, hfd);
-                FD_SET(hfd, (fd_set*)inArgs[2].ptr);
-            }
-            if(inArgs[3].ptr && FD_ISSET(i, &es)) {
-                NaClLog(1, "%d in ES with host desc %d\n", i, hfd);
-                FD_SET(hfd, (fd_set*)inArgs[3].ptr);
+    if (max_fd > FD_SETSIZE) {
+        max_fd = FD_SETSIZE;
+    }
+    for (k = 0; k < 3; ++k) {
+        state->user_sets[k] = (fd_set const *)(uintptr_t)inArgs[k + 1].ptr;
+        FD_ZERO(&state->host_sets[k]);
+    }
+    for (i = 0; i < max_fd; ++i) {
+        int requested = 0;
+        for (k = 0; k < 3; ++k) {
+            requested |= state->user_sets[k] && FD_ISSET(i, state->user_sets[k]);
+        }
+        if (!requested) {
+            continue;
+        }
+        hfd = NaClFdTableGet(&nap->host_fd_tbl, i);
+        if (hfd < 0) {
+            NaClLog(LOG_ERROR, "Invalid NaCl desc: %d\n", i);
+            return -NACL_ABI_EINVAL;
+        }
+        if (hfd >= FD_SETSIZE) {
+            NaClLog(LOG_ERROR, "Host desc too large: %d->%d\n", i, hfd);
+            return -NACL_ABI_EINVAL;
+        }
+        if (hfd > max_hfd) {
+            max_hfd = hfd;
+        }
+        for (k = 0; k < 3; ++k) {
+            if (state->user_sets[k] && FD_ISSET(i, state->user_sets[k])) {
+                FD_SET(hfd, &state->host_sets[k]);
             }
         }
     }
+    for (k = 0; k < 3; ++k) {
+        if (state->user_sets[k]) {
+            inArgs[k + 1].ptr = (uintptr_t)&state->host_sets[k];
+        }
+    }
+    state->max_fd = max_fd;
+    state->max_hfd = max_hfd;
     *(int64_t *)&inArgs[0].ptr = max_hfd + 1;
-    ((int *)(*xchangedata))[0] = max_hfd + 1;
-    NaClLog(1, "max_fd is set to %"NACL_PRId64" was %"NACL_PRId64"\n", *(int64_t *)&inArgs[0].ptr, max_fd);
-    NaClFastMutexUnlock(&nap->desc_mu);
-    goto finish;
-cleanup_xdata:
-    free(*xchangedata);
-cleanup_es:
-    if(inArgs[3].ptr) {
-        free((void *)inArgs[3].ptr);
-    }
-cleanup_ws:
-    if(inArgs[2].ptr) {
-        free((void *)inArgs[2].ptr);
-    }
-cleanup_rs:
-    if(inArgs[1].ptr) {
-        free((void *)inArgs[1].ptr);
-    }
-finish:
-    NaClLog(1, "%s\n", "Exiting LindSelectPreprocess");
-    return retval;
+    NaClLog(1, "max_fd is set to %d was %d\n", max_hfd + 1, max_fd);
+    return 0;
 }
 
 int LindSelectPostprocess(struct NaClApp *nap,
@@ -313,51 +281,43 @@ int LindSelectPostprocess(struct NaClApp *nap,
                           char *data,
                           int len,
                           void *xchangedata) {
-    int *mapdata;
-    int max_hfd;
-    int retval = 0;
-    fd_set rs;
-    fd_set ws;
-    fd_set es;
-    UNREFERENCED_PARAMETER(nap);
+    struct LindSelectState *state = xchangedata;
+    struct select_results *results = (struct select_results *)data;
+    fd_set *result_sets[3];
+    fd_set sets[3];
+    int hfd;
+    int i;
+    int k;
     UNREFERENCED_PARAMETER(iserror);
     UNREFERENCED_PARAMETER(code);
     UNREFERENCED_PARAMETER(len);
-    FD_ZERO(&rs);
-    FD_ZERO(&ws);
-    FD_ZERO(&es);
-    max_hfd = ((int*)xchangedata)[0];
-    mapdata = &((int*)xchangedata)[1];
-    for(int i=0; i<max_hfd; ++i) {
-        if(FD_ISSET(i, &((struct select_results*)data)->r)) {
-            if(-1 != mapdata[i]) {
-                NaClLog(1, "%d in RS with nacl desc %d\n", i, mapdata[i]);
-                FD_SET(mapdata[i], &rs);
-            } else {
-                NaClLog(1, "%d in RS not valid, ignored\n", i);
-            }
+    result_sets[0] = &results->r;
+    result_sets[1] = &results->w;
+    result_sets[2] = &results->e;
+    for (k = 0; k < 3; ++k) {
+        FD_ZERO(&sets[k]);
+    }
+    /*
+     * Walk the cage's fds rather than the host's, so that dups of one host
+     * fd are each reported.  Only host fds that were asked about count.
+     */
+    for (i = 0; i < state->max_fd; ++i) {
+        hfd = NaClFdTableGet(&nap->host_fd_tbl, i);
+        if (hfd < 0 || hfd > state->max_hfd) {
+            continue;
         }
-        if(FD_ISSET(i, &((struct select_results*)data)->w)) {
-            if(-1 != mapdata[i]) {
-                NaClLog(1, "%d in WS with nacl desc %d\n", i, mapdata[i]);
-                FD_SET(mapdata[i], &ws);
-            } else {
-                NaClLog(1, "%d in WS not valid, ignored\n", i);
-            }
-        }
-        if(FD_ISSET(i, &((struct select_results*)data)->e)) {
-            if(-1 != mapdata[i]) {
-                NaClLog(1, "%d in ES with nacl desc %d\n", i, mapdata[i]);
-                FD_SET(mapdata[i], &es);
-            } else {
-                NaClLog(1, "%d in ES not valid, ignored\n", i);
+        for (k = 0; k < 3; ++k) {
+            if (state->user_sets[k] && FD_ISSET(i, state->user_sets[k]) &&
+                FD_ISSET(hfd, &state->host_sets[k]) &&
+                FD_ISSET(hfd, result_sets[k])) {
+                FD_SET(i, &sets[k]);
             }
         }
     }
-    ((struct select_results*)data)->r = rs;
-    ((struct select_results*)data)->w = ws;
-    ((struct select_results*)data)->e = es;
-    return retval;
+    for (k = 0; k < 3; ++k) {
+        *result_sets[k] = sets[k];
+    }
+    return 0;
 }
 
 #define CONVERT_NACL_DESC_TO_LIND_START	                                                        \
@@ -514,35 +474,21 @@ int LindEpollWaitPostprocess(struct NaClApp *nap,
                              int len,
                              void *xchangedata)
 {
-    int retval = 0;
     int nfds;
     struct epoll_event *pfds;
-    struct NaClDesc * ndp;
-    int hfd;
-    UNREFERENCED_PARAMETER(nap);
+    int d;
     UNREFERENCED_PARAMETER(iserror);
-    UNREFERENCED_PARAMETER(code);
     UNREFERENCED_PARAMETER(len);
     UNREFERENCED_PARAMETER(xchangedata);
-    nfds=*code;
+    nfds = *code;
     pfds = (struct epoll_event*)data;
-    for(int i=0; i<nfds; ++i) {
-        for(int j=0; j<1024; ++j) {
-            NaClFastMutexLock(&nap->desc_mu);
-            ndp = NaClGetDescMu(nap, j);
-            NaClFastMutexUnlock(&nap->desc_mu);
-            if(!ndp || ndp->base.vtbl != (struct NaClRefCountVtbl const *)&kNaClDescIoDescVtbl) {
-                NaClDescSafeUnref(ndp);
-                continue;
-            }
-            hfd = ((struct NaClDescIoDesc *)ndp)->hd->d;
-            if(pfds[i].data.fd == hfd) {
-                pfds[i].data.fd = j;
-            }
-            NaClDescUnref(ndp);
+    for (int i = 0; i < nfds; ++i) {
+        d = NaClDescOfHostFd(nap, pfds[i].data.fd);
+        if (d >= 0) {
+            pfds[i].data.fd = d;
         }
     }
-    return retval;
+    return 0;
 }
 
 int LindSocketPairPreprocess(struct NaClApp *nap, uint32_t inNum, LindArg *inArgs, void** xchangedata)
@@ -582,66 +528,43 @@ int LindSocketPairPostprocess(struct NaClApp *nap,
     return retval;
 }
 
-struct poll_map
-{
-    int nacl_fd;
-    int lind_fd;
-};
-
 int LindPollPreprocess(struct NaClApp *nap, uint32_t inNum, LindArg *inArgs, void** xchangedata)
 {
-    int retval = 0;
+    struct LindPollState *state = *xchangedata;
+    struct pollfd const *inpfds;
     struct pollfd *pfds;
-    struct pollfd *inpfds;
-    struct poll_map *mapdata;
     int nfds;
-    struct NaClDesc *ndp;
+    int hfd;
     UNREFERENCED_PARAMETER(inNum);
     nfds = (int)inArgs[0].ptr;
-    if(nfds <= 0) {
-        retval = -NACL_ABI_EINVAL;
-        goto finish;
+    inpfds = (struct pollfd const *)(uintptr_t)inArgs[2].ptr;
+    if (nfds <= 0 || !inpfds) {
+        return -NACL_ABI_EINVAL;
     }
-    inpfds = (struct pollfd*)inArgs[2].ptr;
-    if(!inpfds) {
-        retval = -NACL_ABI_EINVAL;
-        goto finish;
-    }
-    *xchangedata = malloc(sizeof(int)+sizeof(struct poll_map)*nfds);
-    if (!*xchangedata) {
-      retval = -NACL_ABI_ENOMEM;
-      goto finish;
-    }
-    ((int*)(*xchangedata))[0] = nfds; //first sizeof(int) bytes contains # of fds
-    mapdata = (struct poll_map*)&((int*)(*xchangedata))[1]; //map data begins after sizeof(int) bytes
-    pfds = malloc(sizeof *pfds * nfds);
-    if (!pfds) {
-      retval = -NACL_ABI_ENOMEM;
-      goto cleanup_xdata;
+    if (nfds <= LIND_POLL_SMALL) {
+        pfds = state->small;
+    } else {
+        pfds = malloc(sizeof *pfds * nfds);
+        if (!pfds) {
+            return -NACL_ABI_ENOMEM;
+        }
     }
-    NaClFastMutexLock(&nap->desc_mu);
-    for(int i=0; i<nfds; ++i) {
+    for (int i = 0; i < nfds; ++i) {
         pfds[i] = inpfds[i];
-        ndp = NaClGetDescMu(nap, inpfds[i].fd);
-        if(!ndp || ndp->base.vtbl != (struct NaClRefCountVtbl const *)&kNaClDescIoDescVtbl) {
-            NaClDescSafeUnref(ndp);
-            retval = -NACL_ABI_EINVAL;
-            goto cleanup_pfds;
+        hfd = NaClFdTableGet(&nap->host_fd_tbl, inpfds[i].fd);
+        if (hfd < 0) {
+            if (pfds != state->small) {
+                free(pfds);
+            }
+            return -NACL_ABI_EINVAL;
         }
-        pfds[i].fd = ((struct NaClDescIoDesc*)ndp)->hd->d;
-        mapdata[i].nacl_fd = inpfds[i].fd;
-        mapdata[i].lind_fd = pfds[i].fd;
-        NaClDescUnref(ndp);
+        pfds[i].fd = hfd;
     }
-    NaClFastMutexUnlock(&nap->desc_mu);
+    state->user_pfds = inpfds;
+    state->pfds = pfds;
+    state->nfds = nfds;
     inArgs[2].ptr = (uint64_t)(uintptr_t)pfds;
-    goto finish;
-cleanup_pfds:
-    free(pfds);
-cleanup_xdata:
-    free(*xchangedata);
-finish:
-    return retval;
+    return 0;
 }
 
 int LindPollPostprocess(struct NaClApp *nap,
@@ -651,36 +574,37 @@ int LindPollPostprocess(struct NaClApp *nap,
                         int len,
                         void *xchangedata)
 {
-    int retval = 0;
-    struct poll_map *mapdata;
-    int nfds;
-    struct pollfd *pfds;
-    UNREFERENCED_PARAMETER(nap);
+    struct LindPollState *state = xchangedata;
+    struct pollfd *pfds = (struct pollfd*)data;
+    int nfds = len / (int)sizeof *pfds;
+    int d;
     UNREFERENCED_PARAMETER(iserror);
     UNREFERENCED_PARAMETER(code);
-    UNREFERENCED_PARAMETER(len);
-    /* first sizeof(int) bytes contains # of fds */
-    nfds = ((int *)xchangedata)[0];
-    /* map data begins after sizeof(int) bytes */
-    mapdata = (struct poll_map*)&((int *)xchangedata)[1];
-    pfds = (struct pollfd*)data;
-    for(int i = 0; i < nfds; ++i) {
-        for(int j = 0; j < nfds; ++j) {
-            if(pfds[i].fd == mapdata[j].lind_fd) {
-                pfds[i].fd = mapdata[j].nacl_fd;
+    if (nfds > state->nfds) {
+        nfds = state->nfds;
+    }
+    /* the dispatcher returns the array in the order it was given */
+    for (int i = 0; i < nfds; ++i) {
+        if (pfds[i].fd == state->pfds[i].fd) {
+            pfds[i].fd = state->user_pfds[i].fd;
+        } else {
+            d = NaClDescOfHostFd(nap, pfds[i].fd);
+            if (d >= 0) {
+                pfds[i].fd = d;
             }
         }
     }
-    return retval;
+    return 0;
 }
 
 int LindPollCleanup(struct NaClApp *nap, uint32_t inNum, LindArg *inArgs, void *xchangedata)
 {
+    struct LindPollState *state = xchangedata;
     UNREFERENCED_PARAMETER(nap);
     UNREFERENCED_PARAMETER(inNum);
-    if(xchangedata) {
-        free((void*)inArgs[2].ptr);
-        free(xchangedata);
+    UNREFERENCED_PARAMETER(inArgs);
+    if (state->pfds != state->small) {
+        free(state->pfds);
     }
     return 0;
 }
@@ -732,7 +656,7 @@ StubType stubs[] = {
         {LindCommonPreprocess, 0, 0}, /* 43 LIND_safe_net_getsockopt */
         {LindCommonPreprocess, 0, 0}, /* 44 LIND_safe_net_setsockopt */
         {LindCommonPreprocess, 0, 0}, /* 45 LIND_safe_net_shutdown */
-        {LindSelectPreprocess, LindSelectPostprocess, LindSelectCleanup}, /* 46 LIND_safe_net_select */
+        {LindSelectPreprocess, LindSelectPostprocess, 0}, /* 46 LIND_safe_net_select */
         {0}, /* 47 */
         {LindPollPreprocess, LindPollPostprocess, LindPollCleanup}, /* 48 LIND_safe_net_poll */
         {LindSocketPairPreprocess, LindSocketPairPostprocess, 0}, /* 49 LIND_safe_net_socketpair */
@@ -775,56 +699,58 @@ static int NaClCopyZStr(struct NaClApp *nap,
   return 1;
 }
 
-int32_t NaClSysLindSyscall(struct NaClAppThread *natp,
-                           uint32_t callNum,
-                           uint32_t inNum,
-                           void *inArgs,
-                           uint32_t outNum,
-                           void *outArgs)
+/*
+ * Lind calls that can be answered from the runtime's own state.  These are
+ * served on the calling thread without entering the Repy dispatcher, so
+ * they never take the GIL and cages making them run fully in parallel.
+ * Returns 1 and stores the result in |retval| if the call was handled.
+ */
+static int LindSyscallDirect(struct NaClApp *nap,
+                             uint32_t callNum,
+                             uint32_t inNum,
+                             uint32_t outNum,
+                             int32_t *retval)
 {
-    struct NaClApp *nap = natp->nap;
-    int retval = -NACL_ABI_EINVAL;
-    uintptr_t argSysAddr = 0;
-    char stringArg[NACL_CONFIG_PATH_MAX] = {0};
-    LindArg inArgSys[MAX_INARGS] = {0};
-    LindArg outArgSys[MAX_OUTARGS] = {0};
-    PyObject *callArgs = NULL;
-    PyObject *apiArg = NULL;
-    PyObject *response = NULL;
-    PyGILState_STATE gstate = {0};
-    unsigned int i = 0;
-    int offset = 0;
-    int _code = 0;
-    int _isError = 0;
-    char *_data = NULL;
-    int _len = 0;
-    void *xchangeData = NULL;
-    clock_t lind_sys_begin = 0;
-    clock_t lind_sys_finish = 0;
-
-    NaClLog(1, "[NaClSysLindSyscall] Entered: callNum=%u inNum=%u outNum=%u\n", callNum, inNum, outNum);
-
-    // yiwen: start recording time for making a Lind system call, this includes the time to parse and prepare the argument passing right now
-    lind_sys_begin = clock();
+    switch (callNum) {
+    case LIND_sys_getpid:
+        if (inNum || outNum) {
+            return 0;
+        }
+        *retval = nap->cage_id;
+        return 1;
+    default:
+        return 0;
+    }
+}
 
-    gstate = PyGILState_Ensure();
+/*
+ * Copies in and validates the argument descriptors of a Lind call.  The
+ * addresses of the in-arguments are translated to system addresses.
+ * Returns 0 or a negated NaCl errno.
+ */
+static int LindSyscallCheckArgs(struct NaClApp *nap,
+                                uint32_t inNum,
+                                void *inArgs,
+                                uint32_t outNum,
+                                void *outArgs,
+                                LindArg *inArgSys,
+                                LindArg *outArgSys)
+{
+    uintptr_t argSysAddr = 0;
 
     if (inNum>MAX_INARGS || outNum>MAX_OUTARGS) {
         NaClLog(LOG_ERROR, "NaClSysLindSyscall: Number of in/out arguments too large\n");
-        retval = -NACL_ABI_EINVAL;
-        goto cleanup;
+        return -NACL_ABI_EINVAL;
     }
 
     if ((inNum && !inArgs) || (outNum && !outArgs)) {
         NaClLog(LOG_ERROR, "NaClSysLindSyscall: in/out arguments are NULL\n");
-        retval = -NACL_ABI_EFAULT;
-        goto cleanup;
+        return -NACL_ABI_EFAULT;
     }
 
     if (inNum && !NaClCopyInFromUser(nap, inArgSys, (uintptr_t)inArgs, sizeof(LindArg)*inNum)) {
-        retval = -NACL_ABI_EFAULT;
         NaClLog(LOG_ERROR, "NaClSysLindSyscall: invalid input argument address\n");
-        goto cleanup;
+        return -NACL_ABI_EFAULT;
     }
 
     for (uint32_t j = 0; j<inNum; ++j) {
@@ -833,38 +759,115 @@ int32_t NaClSysLindSyscall(struct NaClAppThread *natp,
                 argSysAddr = NaClUserToSysAddrRange(nap, (uintptr_t)inArgSys[j].ptr, inArgSys[j].len);
                 if(kNaClBadAddress == argSysAddr) {
                     NaClLog(LOG_ERROR, "NaClSysLindSyscall: invalid input data address\n");
-                    retval = -NACL_ABI_EFAULT;
-                    goto cleanup;
+                    return -NACL_ABI_EFAULT;
                 }
                 inArgSys[j].ptr = argSysAddr;
             } else if(inArgSys[j].type == AT_DATA || inArgSys[j].type == AT_STRING) {
                 NaClLog(LOG_ERROR, "NaClSysLindSyscall: mandatory input is NULL\n");
-                retval = -NACL_ABI_EFAULT;
-                goto cleanup;
+                return -NACL_ABI_EFAULT;
             }
         }
     }
 
     if (outNum && !NaClCopyInFromUser(nap, outArgSys, (uintptr_t)outArgs, sizeof(LindArg)*outNum)) {
         NaClLog(LOG_ERROR, "NaClSysLindSyscall: invalid output argument address\n");
-        retval = -NACL_ABI_EFAULT;
-        goto cleanup;
+        return -NACL_ABI_EFAULT;
     }
 
     for (uint32_t j = 0; j < outNum; ++j) {
         /* mandatory output address is zero */
         if(outArgSys[j].type == AT_INT || (!outArgSys[j].ptr && outArgSys[j].type == AT_DATA)) {
-                retval = -NACL_ABI_EFAULT;
-                goto cleanup;
+                return -NACL_ABI_EFAULT;
+        }
+    }
+    return 0;
+}
+
+/*
+ * Copies the data of a successful call out to the cage's output
+ * arguments.  Returns 0 or -NACL_ABI_EFAULT.
+ */
+static int LindSyscallCopyOut(struct NaClApp *nap,
+                              uint32_t outNum,
+                              LindArg const *outArgSys,
+                              char *data,
+                              int len)
+{
+    unsigned int i = 0;
+    int offset = 0;
+
+    if(outNum == 1) {
+        assert(((unsigned int)len)<=outArgSys[0].len);
+        if(outArgSys[0].ptr && !NaClCopyOutToUser(nap,
+                                                  (uintptr_t)outArgSys[0].ptr,
+                                                  data,
+                                                  len)) {
+             return -NACL_ABI_EFAULT;
         }
+    } else if (outNum > 1) {
+        for(i=0; i<outNum; ++i) {
+            NaClLog(1, "Out#%d, len = %" NACL_PRIu32
+                    "maxlen=%" NACL_PRIu64 "\n",
+                    i, (unsigned int)(((int *)data)[i]),
+                    outArgSys[i].len);
+            CHECK(((unsigned int)(((int*)data)[i])) <= outArgSys[i].len);
+            if(outArgSys[i].ptr && !NaClCopyOutToUser(nap,
+                                                      (uintptr_t)outArgSys[i].ptr,
+                                                      data + sizeof(int) * outNum+offset,
+                                                      ((int *)data)[i])) {
+                return -NACL_ABI_EFAULT;
+            }
+            offset += ((int *)data)[i];
+        }
+    }
+    return 0;
+}
+
+/*
+ * Performs one Lind call for |nap|.  The caller holds the GIL; it is
+ * dropped around the points where we may block on nap->mu so that a
+ * thread holding nap->mu and waiting for the GIL cannot deadlock us.
+ */
+static int32_t LindSyscallLocked(struct NaClApp *nap,
+                                 uint32_t callNum,
+                                 uint32_t inNum,
+                                 void *inArgs,
+                                 uint32_t outNum,
+                                 void *outArgs)
+{
+    static StubType const noStub = {0};
+    StubType const *stub = callNum < NACL_ARRAY_SIZE(stubs) ? &stubs[callNum] : &noStub;
+    int retval = -NACL_ABI_EINVAL;
+    int err;
+    char stringArg[NACL_CONFIG_PATH_MAX] = {0};
+    LindArg inArgSys[MAX_INARGS] = {0};
+    LindArg outArgSys[MAX_OUTARGS] = {0};
+    PyObject *callArgs = NULL;
+    PyObject *apiArg = NULL;
+    PyObject *response = NULL;
+    PyThreadState *save = NULL;
+    unsigned int i = 0;
+    int _code = 0;
+    int _isError = 0;
+    char *_data = NULL;
+    int _len = 0;
+    union LindStubState stubState;
+    void *xchangeData = &stubState;
+    int stubReady = 0;
+
+    err = LindSyscallCheckArgs(nap, inNum, inArgs, outNum, outArgs, inArgSys, outArgSys);
+    if (err) {
+        retval = err;
+        goto cleanup;
     }
 
-    if (stubs[callNum].pre) {
-        retval = stubs[callNum].pre(nap, inNum, inArgSys, &xchangeData);
+    if (stub->pre) {
+        retval = stub->pre(nap, inNum, inArgSys, &xchangeData);
         if (retval) {
             goto cleanup;
         }
     }
+    stubReady = 1;
 
     callArgs = PyList_New(0);
     apiArg = PyTuple_New(2);
@@ -882,9 +885,9 @@ int32_t NaClSysLindSyscall(struct NaClAppThread *natp,
         case AT_STRING:
         case AT_STRING_OPTIONAL:
             if(inArgSys[i].ptr) {
-                PyGILState_Release(gstate);
+                save = PyEval_SaveThread();
                 if (!NaClCopyZStr(nap, stringArg, sizeof(stringArg), (uintptr_t)inArgSys[i].ptr)) {
-                    gstate = PyGILState_Ensure();
+                    PyEval_RestoreThread(save);
                     if (stringArg[0] == '\0') {
                         NaClLog(LOG_ERROR, "NaClSysLindSyscall: input string is empty\n");
                         retval = -NACL_ABI_EFAULT;
@@ -896,7 +899,7 @@ int32_t NaClSysLindSyscall(struct NaClAppThread *natp,
                     }
                     goto cleanup;
                 }
-                gstate = PyGILState_Ensure();
+                PyEval_RestoreThread(save);
                 NaClLog(1, "String argument: %s\n", stringArg);
                 PyList_Append(callArgs, PyString_FromString(stringArg));
             } else if(inArgSys[i].type == AT_STRING_OPTIONAL) {
@@ -913,9 +916,9 @@ int32_t NaClSysLindSyscall(struct NaClAppThread *natp,
         case AT_DATA_OPTIONAL:
             if(inArgSys[i].ptr) {
                 NaClLog(1, "Data argument of length: %u\n", (unsigned int)inArgSys[i].len);
-                PyGILState_Release(gstate);
+                save = PyEval_SaveThread();
                 NaClXMutexLock(&nap->mu);
-                gstate = PyGILState_Ensure();
+                PyEval_RestoreThread(save);
                 PyList_Append(callArgs,
                               PyString_FromStringAndSize((char *)inArgSys[i].ptr,
                               inArgSys[i].len));
@@ -948,61 +951,958 @@ int32_t NaClSysLindSyscall(struct NaClAppThread *natp,
 
     ParseResponse(response, &_isError, &_code, &_data, &_len);
     if(!_isError) {
-        if(stubs[callNum].post) {
-            stubs[callNum].post(nap, _isError, &_code, _data, _len, xchangeData);
+        if(stub->post) {
+            stub->post(nap, _isError, &_code, _data, _len, xchangeData);
         }
-        if(outNum == 1) {
-            assert(((unsigned int)_len)<=outArgSys[0].len);
-            PyGILState_Release(gstate);
-            if(outArgSys[0].ptr && !NaClCopyOutToUser(nap,
-                                                      (uintptr_t)outArgSys[0].ptr,
-                                                      _data,
-                                                      _len)) {
-                 gstate = PyGILState_Ensure();
-                 retval = -NACL_ABI_EFAULT;
-                 goto cleanup;
-            }
-            gstate = PyGILState_Ensure();
-        } else if (outNum > 1) {
-            offset = 0;
-            for(i=0; i<outNum; ++i) {
-                NaClLog(1, "Out#%d, len = %" NACL_PRIu32
-                        "maxlen=%" NACL_PRIu64 "\n",
-                        i, (unsigned int)(((int *)_data)[i]),
-                        outArgSys[i].len);
-                CHECK(((unsigned int)(((int*)_data)[i])) <= outArgSys[i].len);
-                PyGILState_Release(gstate);
-                if(outArgSys[i].ptr && !NaClCopyOutToUser(nap,
-                                                          (uintptr_t)outArgSys[i].ptr,
-                                                          _data + sizeof(int) * outNum+offset,
-                                                          ((int *)_data)[i])) {
-                    gstate = PyGILState_Ensure();
-                    retval = -NACL_ABI_EFAULT;
-                    goto cleanup;
-                }
-                gstate = PyGILState_Ensure();
-                offset += ((int *)_data)[i];
-            }
+        save = PyEval_SaveThread();
+        err = LindSyscallCopyOut(nap, outNum, outArgSys, _data, _len);
+        PyEval_RestoreThread(save);
+        if (err) {
+            retval = err;
+            goto cleanup;
         }
     }
-    if(stubs[callNum].clean) {
-        stubs[callNum].clean(nap, inNum, inArgSys, xchangeData);
-    }
     retval = _isError?-_code:_code;
     goto cleanup;
 error:
     PyErr_Print();
     NaClLog(LOG_ERROR, "NaClSysLindSyscall: Python error\n");
 cleanup:
+    /* also on failure, so that poll's and fcntl's allocations are freed */
+    if(stubReady && stub->clean) {
+        stub->clean(nap, inNum, inArgSys, xchangeData);
+    }
     Py_XDECREF(apiArg);
     Py_XDECREF(response);
-    PyGILState_Release(gstate);
-
-    // yiwen: record the ending time of the Lind system call, this includes the post-processing of arguments right now
-    lind_sys_finish = clock();
-    // yiwen: record Lind system call timing info
-    lind_syscall_counter++;
-    lind_syscall_invoked_times[callNum]++;
-    lind_syscall_execution_time[callNum] += (double)(lind_sys_finish - lind_sys_begin) / CLOCKS_PER_SEC;
     return retval;
 }
+
+/*
+ * Performs one Lind call for |nap| through the calling thread's
+ * LindCallBuf.  The arguments are copied straight into the buffer and the
+ * results straight out of it, with no Python objects built; the GIL is
+ * only taken inside LindCallDispatch, and only if the file I/O backend
+ * does not answer the call itself.  The caller must not hold the GIL.
+ *
+ * Returns 1 and stores the result in |retval| if the call was handled,
+ * or 0 if it must go through LindSyscallLocked instead: nothing can
+ * answer the call from a buffer (LindCallBufWanted), there is no buffer,
+ * or the arguments and results may not fit.
+ */
+static int LindSyscallShared(struct NaClApp *nap,
+                             uint32_t callNum,
+                             uint32_t inNum,
+                             void *inArgs,
+                             uint32_t outNum,
+                             void *outArgs,
+                             int32_t *retval)
+{
+    static StubType const noStub = {0};
+    StubType const *stub = callNum < NACL_ARRAY_SIZE(stubs) ? &stubs[callNum] : &noStub;
+    struct LindCallBuf *buf;
+    LindArg inArgSys[MAX_INARGS] = {0};
+    LindArg outArgSys[MAX_OUTARGS] = {0};
+    union LindStubState stubState;
+    void *xchangeData = &stubState;
+    uint64_t need = 0;
+    uint32_t used = 0;
+    uint32_t i;
+    int err;
+
+    if (!LindCallBufWanted(callNum)) {
+        return 0;
+    }
+    buf = LindCallBufGet();
+    if (!buf) {
+        return 0;
+    }
+    err = LindSyscallCheckArgs(nap, inNum, inArgs, outNum, outArgs, inArgSys, outArgSys);
+    if (err) {
+        *retval = err;
+        return 1;
+    }
+
+    /* strings are measured only as they are copied, so allow the most */
+    for (i = 0; i < inNum; ++i) {
+        if (inArgSys[i].type == AT_STRING || inArgSys[i].type == AT_STRING_OPTIONAL) {
+            need += LIND_CALL_PAD(NACL_CONFIG_PATH_MAX);
+        } else if (inArgSys[i].type != AT_INT) {
+            if (inArgSys[i].len > LIND_CALL_DATA_SIZE) {
+                return 0;
+            }
+            need += LIND_CALL_PAD((uint32_t)inArgSys[i].len);
+        }
+    }
+    need += sizeof(int) * outNum;
+    for (i = 0; i < outNum; ++i) {
+        need += outArgSys[i].len;
+    }
+    if (need > LIND_CALL_DATA_SIZE) {
+        return 0;
+    }
+
+    if (stub->pre) {
+        err = stub->pre(nap, inNum, inArgSys, &xchangeData);
+        if (err) {
+            *retval = err;
+            return 1;
+        }
+    }
+
+    buf->magic = LIND_CALL_BUF_MAGIC;
+    buf->call_num = callNum;
+    buf->cage_id = nap->cage_id;
+    buf->num_args = inNum;
+    buf->num_outs = outNum;
+    for (i = 0; i < inNum; ++i) {
+        struct LindCallArg *arg = &buf->args[i];
+        char *dst = (char *)buf->data + used;
+        switch(inArgSys[i].type) {
+        case AT_INT:
+            arg->type = LIND_CALL_ARG_INT;
+            arg->len = 0;
+            arg->value = *(int64_t *)&inArgSys[i].ptr;
+            continue;
+        case AT_STRING:
+        case AT_STRING_OPTIONAL:
+            if (!inArgSys[i].ptr) {
+                break;
+            }
+            if (!NaClCopyZStr(nap, dst, NACL_CONFIG_PATH_MAX, (uintptr_t)inArgSys[i].ptr)) {
+                if (dst[0] == '\0') {
+                    NaClLog(LOG_ERROR, "NaClSysLindSyscall: input string is empty\n");
+                    err = -NACL_ABI_EFAULT;
+                } else {
+                    NaClLog(LOG_ERROR,
+                            "NaClSysLindSyscall: input string is too long (>%d)\n",
+                            NACL_CONFIG_PATH_MAX);
+                    err = -NACL_ABI_ENAMETOOLONG;
+                }
+                goto cleanup;
+            }
+            arg->type = LIND_CALL_ARG_STRING;
+            arg->len = (uint32_t)strlen(dst);
+            arg->value = used;
+            used += LIND_CALL_PAD(arg->len + 1);
+            continue;
+        case AT_DATA:
+        case AT_DATA_OPTIONAL:
+            if (!inArgSys[i].ptr) {
+                break;
+            }
+            NaClXMutexLock(&nap->mu);
+            memcpy(dst, (void *)(uintptr_t)inArgSys[i].ptr, (size_t)inArgSys[i].len);
+            NaClXMutexUnlock(&nap->mu);
+            arg->type = LIND_CALL_ARG_DATA;
+            arg->len = (uint32_t)inArgSys[i].len;
+            arg->value = used;
+            used += LIND_CALL_PAD(arg->len);
+            continue;
+        default:
+            NaClLog(LOG_ERROR, "NaClSysLindSyscall: invalid input data type\n");
+            err = -NACL_ABI_EINVAL;
+            goto cleanup;
+        }
+        /* LindSyscallCheckArgs has refused missing mandatory arguments */
+        arg->type = LIND_CALL_ARG_NONE;
+        arg->len = 0;
+        arg->value = 0;
+    }
+    buf->out_offset = used;
+    buf->out_capacity = LIND_CALL_DATA_SIZE - used;
+    buf->is_error = 0;
+    buf->code = 0;
+    buf->out_len = 0;
+
+    if (!LindCallDispatch(buf)) {
+        NaClLog(LOG_ERROR, "NaClSysLindSyscall: Python error\n");
+        err = -NACL_ABI_EINVAL;
+        goto cleanup;
+    }
+    if (!buf->is_error) {
+        char *data = (char *)buf->data + buf->out_offset;
+        CHECK(buf->out_len <= buf->out_capacity);
+        if (stub->post) {
+            stub->post(nap, 0, &buf->code, data, (int)buf->out_len, xchangeData);
+        }
+        err = LindSyscallCopyOut(nap, outNum, outArgSys, data, (int)buf->out_len);
+        if (err) {
+            goto cleanup;
+        }
+    }
+    err = buf->is_error ? -buf->code : buf->code;
+cleanup:
+    if (stub->clean) {
+        stub->clean(nap, inNum, inArgSys, xchangeData);
+    }
+    *retval = err;
+    return 1;
+}
+
+/*
+ * Direct socket path.  With it on, a Lind socket that the dispatcher has
+ * connected or accepted gets a dup of the host socket under it, and send
+ * and recv on it are made on that host socket by the calling thread,
+ * with no GIL and no dispatcher.  Policy is enforced by the dispatcher's
+ * connect and accept only: the data sent and received afterwards never
+ * reaches it.  Everything else -- socket options, shutdown, select, poll,
+ * close -- still goes through the dispatcher, which shares the socket.
+ */
+int lind_direct_sockets;
+
+/* flags the host is given as they are; anything else goes the slow way */
+#define LIND_DIRECT_SEND_FLAGS (MSG_OOB | MSG_DONTWAIT | MSG_EOR | MSG_NOSIGNAL | MSG_MORE)
+#define LIND_DIRECT_RECV_FLAGS (MSG_OOB | MSG_PEEK | MSG_DONTWAIT | MSG_TRUNC | MSG_WAITALL)
+
+/* Returns a reference to the socket desc |fd| of |nap|, or NULL. */
+static struct NaClDescIoDesc *LindSocketDesc(struct NaClApp *nap, int fd)
+{
+    struct NaClDesc *ndp;
+
+    NaClFastMutexLock(&nap->desc_mu);
+    ndp = NaClGetDescMu(nap, fd);
+    NaClFastMutexUnlock(&nap->desc_mu);
+    if (ndp && ndp->base.vtbl != (struct NaClRefCountVtbl const *)&kNaClDescIoDescVtbl) {
+        NaClDescUnref(ndp);
+        return NULL;
+    }
+    return (struct NaClDescIoDesc *)ndp;
+}
+
+/* Gives socket |fd| its host socket, once the dispatcher has connected it. */
+static void LindSocketEnableDirect(struct NaClApp *nap, int fd)
+{
+    struct NaClDescIoDesc *iod = LindSocketDesc(nap, fd);
+    int hostFd;
+    int directFd;
+    int type;
+    socklen_t len = sizeof type;
+
+    if (!iod) {
+        return;
+    }
+    if (iod->direct_ok == 0 && iod->direct_fd < 0) {
+        hostFd = GetHostFdFromLindFd(iod->hd->d, nap->cage_id);
+        if (hostFd >= 0 && getsockopt(hostFd, SOL_SOCKET, SO_TYPE, &type, &len) == 0) {
+            directFd = fcntl(hostFd, F_DUPFD_CLOEXEC, 0);
+            if (directFd >= 0 &&
+                !__sync_bool_compare_and_swap(&iod->direct_fd, -1, directFd)) {
+                close(directFd);
+            }
+        }
+    }
+    if (iod->direct_ok == 0 && iod->direct_fd >= 0) {
+        iod->direct_ok = 1;
+        NaClLog(2, "LindSocketEnableDirect: cage %d fd %d -> host fd %d\n",
+                nap->cage_id, fd, iod->direct_fd);
+    }
+    NaClDescUnref((struct NaClDesc *)iod);
+}
+
+/*
+ * Keeps track of what the direct path needs to know after a Lind call
+ * returned |retval|: which sockets are connected, and which the cage has
+ * made non-blocking.  |inArgs| is the cage's argument array.
+ */
+static void LindSocketNoteCall(struct NaClApp *nap,
+                               uint32_t callNum,
+                               uint32_t inNum,
+                               void *inArgs,
+                               int32_t retval)
+{
+    LindArg args[3];
+    struct NaClDescIoDesc *iod;
+
+    if (!lind_direct_sockets) {
+        return;
+    }
+    switch (callNum) {
+    case LIND_safe_net_socket:
+    case LIND_safe_fs_fcntl:
+    case LIND_fs_ioctl:
+    case LIND_safe_net_connect:
+        if (retval < 0 && !(callNum == LIND_safe_net_connect &&
+                            retval == -NACL_ABI_EINPROGRESS)) {
+            return;
+        }
+        break;
+    case LIND_safe_net_accept:
+        if (retval >= 0) {
+            LindSocketEnableDirect(nap, retval);
+        }
+        return;
+    default:
+        return;
+    }
+    if (inNum > NACL_ARRAY_SIZE(args)) {
+        inNum = NACL_ARRAY_SIZE(args);
+    }
+    if (inNum < 1 || !NaClCopyInFromUser(nap, args, (uintptr_t)inArgs, sizeof(LindArg) * inNum)) {
+        return;
+    }
+    switch (callNum) {
+    case LIND_safe_net_socket:
+        /* SOCK_NONBLOCK is O_NONBLOCK */
+        if (inNum >= 2 && (iod = LindSocketDesc(nap, retval))) {
+            iod->nonblock = !!(args[1].ptr & NACL_ABI_O_NONBLOCK);
+            NaClDescUnref((struct NaClDesc *)iod);
+        }
+        break;
+    case LIND_safe_fs_fcntl:
+        if (inNum >= 3 && args[1].ptr == 4 /*F_SETFL*/ &&
+            (iod = LindSocketDesc(nap, (int)*(int64_t *)&args[0].ptr))) {
+            iod->nonblock = !!(args[2].ptr & NACL_ABI_O_NONBLOCK);
+            NaClDescUnref((struct NaClDesc *)iod);
+        }
+        break;
+    case LIND_fs_ioctl:
+        /* FIONBIO and the like are not parsed: leave it to the dispatcher */
+        if ((iod = LindSocketDesc(nap, (int)*(int64_t *)&args[0].ptr))) {
+            iod->direct_ok = -1;
+            NaClDescUnref((struct NaClDesc *)iod);
+        }
+        break;
+    case LIND_safe_net_connect:
+        if (retval == -NACL_ABI_EINPROGRESS &&
+            (iod = LindSocketDesc(nap, (int)*(int64_t *)&args[0].ptr))) {
+            iod->nonblock = 1;
+            NaClDescUnref((struct NaClDesc *)iod);
+        }
+        LindSocketEnableDirect(nap, (int)*(int64_t *)&args[0].ptr);
+        break;
+    default:
+        break;
+    }
+}
+
+/*
+ * Serves send and recv on a socket with a direct host socket.  A recv or
+ * send that the cage expects to block waits in poll, since the host
+ * socket may be non-blocking for the dispatcher's own use.  Returns 1
+ * with the result in |retval|, or 0 if the call must go the usual way.
+ * Must not be called with the GIL held: it may block.
+ */
+static int LindSocketDirect(struct NaClAppThread *natp,
+                            uint32_t callNum,
+                            uint32_t inNum,
+                            void *inArgs,
+                            uint32_t outNum,
+                            void *outArgs,
+                            int32_t *retval)
+{
+    struct NaClApp *nap = natp->nap;
+    LindArg inArgSys[MAX_INARGS] = {0};
+    LindArg outArgSys[MAX_OUTARGS] = {0};
+    struct NaClDescIoDesc *iod;
+    struct pollfd pfd;
+    uintptr_t sysaddr;
+    uint32_t usraddr;
+    int64_t len;
+    int flags;
+    int isSend;
+    ssize_t n;
+    int err;
+
+    if (!lind_direct_sockets) {
+        return 0;
+    }
+    switch (callNum) {
+    case LIND_safe_net_send:
+        if (inNum != 4 || outNum != 0) {
+            return 0;
+        }
+        isSend = 1;
+        break;
+    case LIND_safe_net_recv:
+        if (inNum != 3 || outNum != 1) {
+            return 0;
+        }
+        isSend = 0;
+        break;
+    default:
+        return 0;
+    }
+    /* bad arguments are reported by the usual path */
+    if (LindSyscallCheckArgs(nap, inNum, inArgs, outNum, outArgs, inArgSys, outArgSys) ||
+        inArgSys[0].type != AT_INT || inArgSys[1].type != AT_INT ||
+        inArgSys[2].type != AT_INT) {
+        return 0;
+    }
+    len = *(int64_t *)&inArgSys[1].ptr;
+    flags = (int)*(int64_t *)&inArgSys[2].ptr;
+    if (len < 0) {
+        return 0;
+    }
+    if (isSend) {
+        if (inArgSys[3].type != AT_DATA || (flags & ~LIND_DIRECT_SEND_FLAGS)) {
+            return 0;
+        }
+        if ((uint64_t)len > inArgSys[3].len) {
+            len = (int64_t)inArgSys[3].len;
+        }
+        sysaddr = (uintptr_t)inArgSys[3].ptr;
+        flags |= MSG_NOSIGNAL;
+    } else {
+        if (outArgSys[0].type != AT_DATA || (flags & ~LIND_DIRECT_RECV_FLAGS)) {
+            return 0;
+        }
+        if ((uint64_t)len > outArgSys[0].len) {
+            len = (int64_t)outArgSys[0].len;
+        }
+        sysaddr = NaClUserToSysAddrRange(nap, (uintptr_t)outArgSys[0].ptr, (size_t)len);
+        if (kNaClBadAddress == sysaddr) {
+            return 0;
+        }
+    }
+    if (len > INT32_MAX) {
+        len = INT32_MAX;
+    }
+
+    iod = LindSocketDesc(nap, (int)*(int64_t *)&inArgSys[0].ptr);
+    if (!iod) {
+        return 0;
+    }
+    if (iod->direct_ok != 1) {
+        NaClDescUnref((struct NaClDesc *)iod);
+        return 0;
+    }
+    if (iod->nonblock) {
+        flags |= MSG_DONTWAIT;
+    }
+    usraddr = (uint32_t)NaClSysToUser(nap, sysaddr);
+    if (len) {
+        NaClVmIoWillStart(natp, usraddr, usraddr + (uint32_t)len - 1);
+    }
+    for (;;) {
+        if (isSend) {
+            n = send(iod->direct_fd, (void *)sysaddr, (size_t)len, flags);
+        } else {
+            n = recv(iod->direct_fd, (void *)sysaddr, (size_t)len, flags);
+        }
+        if (n >= 0) {
+            err = (int32_t)n;
+            break;
+        }
+        if (errno == EINTR) {
+            continue;
+        }
+        if ((errno == EAGAIN || errno == EWOULDBLOCK) && !(flags & MSG_DONTWAIT)) {
+            pfd.fd = iod->direct_fd;
+            pfd.events = isSend ? POLLOUT : POLLIN;
+            pfd.revents = 0;
+            (void)poll(&pfd, 1, -1);
+            continue;
+        }
+        err = -NaClXlateErrno(errno);
+        break;
+    }
+    if (len) {
+        NaClVmIoHasEnded(natp, usraddr, usraddr + (uint32_t)len - 1);
+    }
+    NaClDescUnref((struct NaClDesc *)iod);
+    *retval = err;
+    return 1;
+}
+
+/*
+ * The paths of Lind calls are not parsed here, so one that may have
+ * changed what a path names, or a file's size and times, drops everything
+ * the runtime has cached about paths.
+ */
+static void LindStatCacheNoteCall(uint32_t callNum, int32_t retval)
+{
+    if (retval < 0) {
+        return;
+    }
+    switch (callNum) {
+    case LIND_safe_fs_unlink:
+    case LIND_safe_fs_link:
+    case LIND_safe_fs_mkdir:
+    case LIND_safe_fs_rmdir:
+    case LIND_safe_fs_open:
+    case LIND_safe_fs_write:
+    case LIND_safe_fs_rename:
+    case LIND_safe_fs_pwrite:
+        NaClStatCacheFlush();
+        break;
+    default:
+        break;
+    }
+}
+
+/*
+ * Pipe ends live in the runtime (see nacl_desc_pipe.h) and the dispatcher
+ * knows nothing of them, so fcntl on a pipe fd, and poll on a set that
+ * holds one, are served here.  As for read and write, a pipe fd is a
+ * number in the cage's fd_table.
+ */
+
+/* How long a poll mixing pipes and dispatcher fds leaves the pipes unchecked. */
+#define LIND_PIPE_POLL_SLICE_MS 10
+
+/*
+ * Returns a reference to the pipe end that cage fd |fd| refers to, and
+ * its desc_tbl index in |d|, or NULL.  Caller holds nap->desc_mu.
+ */
+static struct NaClDesc *LindPipeDescMu(struct NaClApp *nap, int fd, int *d)
+{
+    struct NaClDesc *ndp;
+
+    *d = NaClFdTableGet(&nap->fd_table, fd);
+    if (*d < 0) {
+        return NULL;
+    }
+    ndp = NaClGetDescMu(nap, *d);
+    if (ndp && NACL_VTBL(NaClDesc, ndp)->typeTag != NACL_DESC_PIPE) {
+        NaClDescUnref(ndp);
+        return NULL;
+    }
+    return ndp;
+}
+
+/* Returns 1 with the result in |retval| if |fd| is a pipe fd, else 0. */
+static int LindPipeFcntl(struct NaClApp *nap,
+                         int fd,
+                         int cmd,
+                         int64_t arg,
+                         int32_t *retval)
+{
+    struct NaClDesc *ndp;
+    int d;
+    int newfd;
+
+    NaClFastMutexLock(&nap->desc_mu);
+    ndp = LindPipeDescMu(nap, fd, &d);
+    if (!ndp) {
+        NaClFastMutexUnlock(&nap->desc_mu);
+        return 0;
+    }
+    /* the cage's fcntl commands and flags are Linux's */
+    switch (cmd) {
+    case F_GETFD:
+        *retval = NaClFdTableGet(&nap->fd_cloexec, fd) >= 0 ? FD_CLOEXEC : 0;
+        break;
+    case F_SETFD:
+        NaClFdTableSet(&nap->fd_cloexec, fd, (arg & FD_CLOEXEC) ? d : NACL_BAD_FD);
+        *retval = 0;
+        break;
+    case F_GETFL:
+        *retval = NaClDescGetFlags(ndp);
+        break;
+    case F_SETFL:
+        /* of the flags F_SETFL may change, only O_NONBLOCK means anything here */
+        NaClDescSetFlags(ndp, (NaClDescGetFlags(ndp) & ~NACL_ABI_O_NONBLOCK) |
+                              (arg & NACL_ABI_O_NONBLOCK));
+        *retval = 0;
+        break;
+    case F_DUPFD:
+    case F_DUPFD_CLOEXEC:
+        if (arg < 0 || arg >= NACL_FD_TABLE_MAX) {
+            *retval = -NACL_ABI_EINVAL;
+            break;
+        }
+        /* the new fd shares the end, as dup does; the table takes our reference */
+        d = NaClSetAvailMu(nap, ndp);
+        ndp = NULL;
+        newfd = NaClFdTableAllocFrom(&nap->fd_table, (int)arg, d);
+        if (newfd < 0) {
+            NaClSetDescMu(nap, d, NULL);
+            *retval = newfd;
+            break;
+        }
+        NaClFdTableSet(&nap->fd_cloexec, newfd,
+                       cmd == F_DUPFD_CLOEXEC ? d : NACL_BAD_FD);
+        *retval = newfd;
+        break;
+    default:
+        *retval = -NACL_ABI_EINVAL;
+        break;
+    }
+    NaClFastMutexUnlock(&nap->desc_mu);
+    NaClDescSafeUnref(ndp);
+    return 1;
+}
+
+static short LindPipeRevents(struct NaClDesc *end, short events)
+{
+    int bits = NaClDescPipePoll(end);
+    short revents = 0;
+
+    if (bits & NACL_DESC_PIPE_READABLE) {
+        revents |= events & (POLLIN | POLLRDNORM);
+    }
+    if (bits & NACL_DESC_PIPE_WRITABLE) {
+        revents |= events & (POLLOUT | POLLWRNORM);
+    }
+    /* as on Linux: a lone read end hangs up, a lone write end errs */
+    if (bits & NACL_DESC_PIPE_HANGUP) {
+        revents |= ((struct NaClDescPipe *)end)->is_write_end ? POLLERR : POLLHUP;
+    }
+    return revents;
+}
+
+static int64_t LindPipeNowMs(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+/*
+ * Serves a poll whose set holds a pipe fd.  Pipe ends are checked here;
+ * any other fds go to the dispatcher without blocking, and while there
+ * are some the wait is cut into slices of LIND_PIPE_POLL_SLICE_MS.
+ * Returns 1 with the result in |retval|, or 0 if there is no pipe fd in
+ * the set.  Must not be called with the GIL held.
+ */
+static int LindPipePoll(struct NaClApp *nap,
+                        LindArg const *inArgSys,
+                        LindArg const *outArgSys,
+                        int32_t *retval)
+{
+    struct pollfd *pfds = (struct pollfd *)(uintptr_t)inArgSys[2].ptr;
+    struct pollfd *out = NULL;
+    struct pollfd *others = NULL;
+    struct NaClDesc **ends = NULL;
+    int *slot = NULL;
+    int64_t nfds = *(int64_t *)&inArgSys[0].ptr;
+    int64_t timeout = *(int64_t *)&inArgSys[1].ptr;
+    int64_t deadline = 0;
+    int64_t left;
+    struct nacl_abi_timespec rel;
+    int num_pipes = 0;
+    int num_others = 0;
+    int32_t seen;
+    int ready;
+    int rc;
+    int d;
+    int i;
+
+    if (nfds <= 0 || nfds > NACL_FD_TABLE_MAX ||
+        inArgSys[2].len < sizeof *pfds * nfds ||
+        outArgSys[0].len < sizeof *pfds * nfds) {
+        return 0;
+    }
+    ends = calloc(nfds, sizeof *ends);
+    if (!ends) {
+        return 0;
+    }
+    NaClFastMutexLock(&nap->desc_mu);
+    for (i = 0; i < nfds; ++i) {
+        if (pfds[i].fd >= 0 && (ends[i] = LindPipeDescMu(nap, pfds[i].fd, &d))) {
+            ++num_pipes;
+        }
+    }
+    NaClFastMutexUnlock(&nap->desc_mu);
+    if (!num_pipes) {
+        free(ends);
+        return 0;
+    }
+
+    out = malloc(sizeof *out * nfds * 2);
+    slot = malloc(sizeof *slot * nfds);
+    if (!out || !slot) {
+        *retval = -NACL_ABI_ENOMEM;
+        goto done;
+    }
+    others = out + nfds;
+    /* the others in dispatcher terms, as LindPollPreprocess makes them */
+    for (i = 0; i < nfds; ++i) {
+        out[i] = pfds[i];
+        out[i].revents = 0;
+        slot[i] = -1;
+        if (ends[i] || pfds[i].fd < 0) {
+            continue;
+        }
+        others[num_others] = pfds[i];
+        others[num_others].fd = NaClFdTableGet(&nap->host_fd_tbl, pfds[i].fd);
+        others[num_others].revents = 0;
+        if (others[num_others].fd < 0) {
+            out[i].revents = POLLNVAL;
+            continue;
+        }
+        slot[i] = num_others++;
+    }
+    if (timeout > 0) {
+        deadline = LindPipeNowMs() + timeout;
+    }
+
+    for (;;) {
+        seen = NaClDescPipePollBegin();
+        ready = 0;
+        for (i = 0; i < nfds; ++i) {
+            if (ends[i]) {
+                out[i].revents = LindPipeRevents(ends[i], out[i].events);
+            }
+            if (slot[i] < 0 && out[i].revents) {
+                ++ready;
+            }
+        }
+        left = timeout < 0 ? -1 : timeout == 0 ? 0 : deadline - LindPipeNowMs();
+        if (left < 0 && timeout >= 0) {
+            left = 0;
+        }
+        if (num_others) {
+            if (ready || left == 0) {
+                rc = lind_poll(num_others, 0, others, others);
+            } else if (left < 0 || left > LIND_PIPE_POLL_SLICE_MS) {
+                rc = lind_poll(num_others, LIND_PIPE_POLL_SLICE_MS, others, others);
+            } else {
+                rc = lind_poll(num_others, (int)left, others, others);
+            }
+            if (rc < 0) {
+                NaClDescPipePollEnd();
+                *retval = -NaClXlateErrno(errno);
+                goto done;
+            }
+            for (i = 0; i < nfds; ++i) {
+                if (slot[i] >= 0 && (out[i].revents = others[slot[i]].revents)) {
+                    ++ready;
+                }
+            }
+        } else if (!ready && left != 0) {
+            if (left > 0) {
+                rel.tv_sec = left / 1000;
+                rel.tv_nsec = (left % 1000) * 1000000;
+            }
+            NaClDescPipePollWait(seen, left > 0 ? &rel : NULL);
+        }
+        NaClDescPipePollEnd();
+        if (ready || (timeout >= 0 && LindPipeNowMs() >= deadline)) {
+            break;
+        }
+    }
+    if (!NaClCopyOutToUser(nap, (uintptr_t)outArgSys[0].ptr, out, sizeof *out * nfds)) {
+        *retval = -NACL_ABI_EFAULT;
+        goto done;
+    }
+    *retval = ready;
+
+done:
+    for (i = 0; i < nfds; ++i) {
+        NaClDescSafeUnref(ends[i]);
+    }
+    free(ends);
+    free(out);
+    free(slot);
+    return 1;
+}
+
+/*
+ * Serves fcntl on a pipe fd and poll on a set with a pipe fd.  Returns 1
+ * with the result in |retval|, or 0 if the call must go the usual way.
+ */
+static int LindPipeDirect(struct NaClApp *nap,
+                          uint32_t callNum,
+                          uint32_t inNum,
+                          void *inArgs,
+                          uint32_t outNum,
+                          void *outArgs,
+                          int32_t *retval)
+{
+    LindArg inArgSys[MAX_INARGS] = {0};
+    LindArg outArgSys[MAX_OUTARGS] = {0};
+
+    switch (callNum) {
+    case LIND_safe_fs_fcntl:
+        if (inNum < 2) {
+            return 0;
+        }
+        break;
+    case LIND_safe_net_poll:
+        if (inNum != 3 || outNum != 1) {
+            return 0;
+        }
+        break;
+    default:
+        return 0;
+    }
+    /* bad arguments are reported by the usual path */
+    if (LindSyscallCheckArgs(nap, inNum, inArgs, outNum, outArgs, inArgSys, outArgSys) ||
+        inArgSys[0].type != AT_INT || inArgSys[1].type != AT_INT) {
+        return 0;
+    }
+    if (callNum == LIND_safe_fs_fcntl) {
+        return LindPipeFcntl(nap, (int)*(int64_t *)&inArgSys[0].ptr,
+                             (int)*(int64_t *)&inArgSys[1].ptr,
+                             inNum >= 3 ? *(int64_t *)&inArgSys[2].ptr : 0,
+                             retval);
+    }
+    if (inArgSys[2].type == AT_INT || !inArgSys[2].ptr || !outArgSys[0].ptr) {
+        return 0;
+    }
+    return LindPipePoll(nap, inArgSys, outArgSys, retval);
+}
+
+int32_t NaClSysLindSyscall(struct NaClAppThread *natp,
+                           uint32_t callNum,
+                           uint32_t inNum,
+                           void *inArgs,
+                           uint32_t outNum,
+                           void *outArgs)
+{
+    int32_t retval;
+    PyGILState_STATE gstate;
+    uint64_t profileBegin;
+
+    NaClLog(1, "[NaClSysLindSyscall] Entered: callNum=%u inNum=%u outNum=%u\n", callNum, inNum, outNum);
+
+    /* includes parsing the arguments and copying the results out */
+    profileBegin = NaClSyscallProfileBegin();
+
+    if (!LindSyscallDirect(natp->nap, callNum, inNum, outNum, &retval) &&
+        !LindSocketDirect(natp, callNum, inNum, inArgs, outNum, outArgs, &retval) &&
+        !LindPipeDirect(natp->nap, callNum, inNum, inArgs, outNum, outArgs, &retval) &&
+        !LindSyscallShared(natp->nap, callNum, inNum, inArgs, outNum, outArgs, &retval)) {
+        gstate = PyGILState_Ensure();
+        retval = LindSyscallLocked(natp->nap, callNum, inNum, inArgs, outNum, outArgs);
+        PyGILState_Release(gstate);
+    }
+    LindStatCacheNoteCall(callNum, retval);
+    LindSocketNoteCall(natp->nap, callNum, inNum, inArgs, retval);
+
+    if (profileBegin) {
+        NaClSyscallProfileEnd(natp, NACL_SYSCALL_PROFILE_LIND, callNum,
+                              profileBegin, retval);
+    }
+    return retval;
+}
+
+/*
+ * Number of submissions copied into trusted memory and dispatched per GIL
+ * acquisition.  Bounds the stack footprint and how long one cage can hold
+ * the dispatcher when it submits a very large batch.
+ */
+#define LIND_RING_CHUNK 64
+
+int32_t NaClSysLindRingEnter(struct NaClAppThread *natp,
+                             void *ring,
+                             uint32_t toSubmit)
+{
+    struct NaClApp *nap = natp->nap;
+    struct NaClLindRing hdr;
+    struct NaClLindRingSqe sqes[LIND_RING_CHUNK];
+    struct NaClLindRingCqe cqes[LIND_RING_CHUNK];
+    uintptr_t ringAddr = (uintptr_t)ring;
+    uint32_t mask;
+    uint32_t pending;
+    uint32_t cqFree;
+    uint32_t chunk;
+    uint32_t j;
+    uint32_t done = 0;
+    int locked;
+    PyGILState_STATE gstate = PyGILState_UNLOCKED;
+    uint64_t profileBegin;
+
+    NaClLog(1, "[NaClSysLindRingEnter] Entered: ring=0x%08"NACL_PRIxPTR" toSubmit=%u\n",
+            ringAddr, toSubmit);
+
+    if (!NaClCopyInFromUser(nap, &hdr, ringAddr, sizeof hdr)) {
+        return -NACL_ABI_EFAULT;
+    }
+    if (0 != hdr.flags || 0 == hdr.entries ||
+        hdr.entries > NACL_LIND_RING_MAX_ENTRIES ||
+        0 != (hdr.entries & (hdr.entries - 1))) {
+        return -NACL_ABI_EINVAL;
+    }
+    mask = hdr.entries - 1;
+    pending = hdr.sq_tail - hdr.sq_head;
+    cqFree = hdr.entries - (hdr.cq_tail - hdr.cq_head);
+    if (pending > hdr.entries || cqFree > hdr.entries) {
+        return -NACL_ABI_EINVAL;
+    }
+    if (toSubmit > pending) {
+        toSubmit = pending;
+    }
+    /* never overwrite completions the cage has not reaped yet */
+    if (toSubmit > cqFree) {
+        toSubmit = cqFree;
+    }
+
+    while (done < toSubmit) {
+        chunk = toSubmit - done;
+        if (chunk > LIND_RING_CHUNK) {
+            chunk = LIND_RING_CHUNK;
+        }
+        for (j = 0; j < chunk; ++j) {
+            uint32_t slot = (hdr.sq_head + done + j) & mask;
+            if (!NaClCopyInFromUser(nap, &sqes[j],
+                                    hdr.sqes + slot * sizeof sqes[0],
+                                    sizeof sqes[0])) {
+                return done ? (int32_t)done : -NACL_ABI_EFAULT;
+            }
+        }
+
+        /*
+         * The GIL is only taken if some entry in the chunk needs the
+         * object protocol, and from then on the rest of the chunk uses it
+         * too: LindSyscallShared must not be called with the GIL held.
+         */
+        locked = 0;
+        for (j = 0; j < chunk; ++j) {
+            profileBegin = NaClSyscallProfileBegin();
+            cqes[j].user_data = sqes[j].user_data;
+            cqes[j].reserved = 0;
+            if (!LindSyscallDirect(nap, sqes[j].call_num, sqes[j].in_num,
+                                   sqes[j].out_num, &cqes[j].result) &&
+                (locked ||
+                 (!LindSocketDirect(natp, sqes[j].call_num, sqes[j].in_num,
+                                    (void *)(uintptr_t)sqes[j].in_args,
+                                    sqes[j].out_num,
+                                    (void *)(uintptr_t)sqes[j].out_args,
+                                    &cqes[j].result) &&
+                  !LindSyscallShared(nap, sqes[j].call_num, sqes[j].in_num,
+                                     (void *)(uintptr_t)sqes[j].in_args,
+                                     sqes[j].out_num,
+                                     (void *)(uintptr_t)sqes[j].out_args,
+                                     &cqes[j].result)))) {
+                if (!locked) {
+                    gstate = PyGILState_Ensure();
+                    locked = 1;
+                }
+                cqes[j].result = LindSyscallLocked(nap, sqes[j].call_num,
+                                                   sqes[j].in_num,
+                                                   (void *)(uintptr_t)sqes[j].in_args,
+                                                   sqes[j].out_num,
+                                                   (void *)(uintptr_t)sqes[j].out_args);
+            }
+            LindStatCacheNoteCall(sqes[j].call_num, cqes[j].result);
+            LindSocketNoteCall(nap, sqes[j].call_num, sqes[j].in_num,
+                               (void *)(uintptr_t)sqes[j].in_args,
+                               cqes[j].result);
+            if (profileBegin) {
+                NaClSyscallProfileEnd(natp, NACL_SYSCALL_PROFILE_LIND,
+                                      sqes[j].call_num, profileBegin,
+                                      cqes[j].result);
+            }
+        }
+        if (locked) {
+            PyGILState_Release(gstate);
+        }
+
+        for (j = 0; j < chunk; ++j) {
+            uint32_t slot = (hdr.cq_tail + done + j) & mask;
+            if (!NaClCopyOutToUser(nap, hdr.cqes + slot * sizeof cqes[0],
+                                   &cqes[j], sizeof cqes[0])) {
+                return -NACL_ABI_EFAULT;
+            }
+        }
+        done += chunk;
+
+        /*
+         * Publish completions before consuming submissions so that a cage
+         * polling sq_head never sees a slot freed without its completion.
+         */
+        hdr.cq_tail += chunk;
+        hdr.sq_head += chunk;
+        __sync_synchronize();
+        if (!NaClCopyOutToUser(nap, ringAddr + offsetof(struct NaClLindRing, cq_tail),
+                               &hdr.cq_tail, sizeof hdr.cq_tail) ||
+            !NaClCopyOutToUser(nap, ringAddr + offsetof(struct NaClLindRing, sq_head),
+                               &hdr.sq_head, sizeof hdr.sq_head)) {
+            return -NACL_ABI_EFAULT;
+        }
+    }
+    return (int32_t)done;
+}
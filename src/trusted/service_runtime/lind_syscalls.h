@@ -11,6 +11,13 @@
 #include "native_client/src/shared/platform/lind_platform.h"
 #include "native_client/src/trusted/service_runtime/nacl_app_thread.h"
 
+/*
+ * Nonzero to send and receive on connected Lind sockets directly on the
+ * host socket, skipping the dispatcher; see LindSocketDirect.  Set before
+ * the first cage runs.
+ */
+extern int lind_direct_sockets;
+
 int32_t NaClSysLindSyscall(struct NaClAppThread *natp,
                            uint32_t callNum,
                            uint32_t inNum,
@@ -18,4 +25,8 @@ int32_t NaClSysLindSyscall(struct NaClAppThread *natp,
                            uint32_t outNum,
                            void* outArgs);
 
+int32_t NaClSysLindRingEnter(struct NaClAppThread *natp,
+                             void *ring,
+                             uint32_t toSubmit);
+
 #endif /* LIND_API_H_ */
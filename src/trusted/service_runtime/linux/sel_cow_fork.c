@@ -0,0 +1,415 @@
+/*
+ * Copyright (c) 2017 The Native Client Authors. All rights reserved.
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file.
+ */
+
+/*
+ * Copy-on-write fork of anonymous cage memory.
+ *
+ * A cage's anonymous mmap and brk memory, and the data and stack of the
+ * image it loaded, live in its anon_shm: a sparse shared memory object the
+ * size of the address space, mapped MAP_SHARED at the offset equal to the
+ * user address, so the pages are the object's own.  When such a region is
+ * forked, the parent remaps it MAP_PRIVATE from the object and the child
+ * maps the same range of it MAP_PRIVATE.  Nothing is copied, and the
+ * parent's other threads lose nothing to the remap, since every write
+ * made before it is in the object and stays visible through the new
+ * mapping.  From then on nothing writes the object, and both vmmap
+ * entries are flagged NACL_MAP_COW; the parent starts a new object for
+ * the memory it maps next.
+ *
+ * When a cage forks a NACL_MAP_COW region, its child maps the same object,
+ * and only the pages the forking cage has written since are copied;
+ * /proc/self/pagemap finds them, because they are anonymous rather than
+ * file pages.  Anonymous regions that never made it into an object are
+ * copied into a new one, present and swapped pages only, which the child
+ * maps MAP_PRIVATE.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <linux/falloc.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "native_client/src/include/nacl_macros.h"
+#include "native_client/src/shared/platform/nacl_check.h"
+#include "native_client/src/shared/platform/nacl_host_desc.h"
+#include "native_client/src/shared/platform/nacl_log.h"
+#include "native_client/src/shared/platform/nacl_sync_checked.h"
+#include "native_client/src/trusted/desc/nacl_desc_imc_shm.h"
+#include "native_client/src/trusted/service_runtime/include/bits/mman.h"
+#include "native_client/src/trusted/service_runtime/sel_ldr.h"
+#include "native_client/src/trusted/service_runtime/sel_mem.h"
+
+#define NACL_PAGEMAP_PRESENT    (1ULL << 63)
+#define NACL_PAGEMAP_SWAPPED    (1ULL << 62)
+#define NACL_PAGEMAP_FILE       (1ULL << 61)
+#define NACL_PAGEMAP_BATCH      512
+
+int NaClVmCowEligible(struct NaClVmmapEntry const *entry) {
+  /* text is validated and copied by the caller, never shared */
+  if (entry->prot & NACL_ABI_PROT_EXEC) {
+    return 0;
+  }
+  if (entry->flags & (NACL_MAP_COW | NACL_MAP_SHM_ANON)) {
+    return 1;
+  }
+  return NULL == entry->desc && 0 == (entry->flags & NACL_ABI_MAP_SHARED);
+}
+
+/*
+ * Copies the pages at |addr| that /proc/self/pagemap reports as present or
+ * swapped into |host_fd| at |file_off|.  Other pages were never touched,
+ * so they are left as holes, which read back as zero just like untouched
+ * anonymous memory.  The mapping at |addr| is not changed.
+ */
+static int NaClVmCowCopyPresent(int pagemap_fd, uintptr_t addr, size_t size,
+                                int prot, int host_fd, off_t file_off) {
+  uint64_t ents[NACL_PAGEMAP_BATCH];
+  size_t npages = size >> NACL_PAGESHIFT;
+  size_t base;
+  size_t i;
+  size_t run;
+  int in_use;
+  int ok = 0;
+
+  if (0 == (prot & NACL_ABI_PROT_READ) &&
+      0 != mprotect((void *) addr, size, PROT_READ)) {
+    return 0;
+  }
+  for (base = 0; base < npages; base += NACL_PAGEMAP_BATCH) {
+    size_t batch = npages - base < NACL_PAGEMAP_BATCH ? npages - base : NACL_PAGEMAP_BATCH;
+    off_t pos = (off_t) (((addr >> NACL_PAGESHIFT) + base) * sizeof ents[0]);
+    if (pread(pagemap_fd, ents, batch * sizeof ents[0], pos)
+        != (ssize_t) (batch * sizeof ents[0])) {
+      goto done;
+    }
+    for (i = 0; i < batch; i += run) {
+      size_t off = (base + i) << NACL_PAGESHIFT;
+      in_use = 0 != (ents[i] & (NACL_PAGEMAP_PRESENT | NACL_PAGEMAP_SWAPPED));
+      for (run = 1;
+           i + run < batch &&
+           (0 != (ents[i + run] & (NACL_PAGEMAP_PRESENT |
+                                   NACL_PAGEMAP_SWAPPED))) == in_use;
+           ++run) {
+      }
+      if (!in_use) {
+        continue;
+      }
+      if (pwrite(host_fd, (void *) (addr + off), run << NACL_PAGESHIFT,
+                 file_off + (off_t) off) != (ssize_t) (run << NACL_PAGESHIFT)) {
+        goto done;
+      }
+    }
+  }
+  ok = 1;
+done:
+  if (0 == (prot & NACL_ABI_PROT_READ) &&
+      0 != mprotect((void *) addr, size, NaClProtMap(prot))) {
+    NaClLog(LOG_FATAL, "NaClVmCowCopyPresent: restoring protection of"
+            " 0x%"NACL_PRIxPTR" failed, errno %d\n", addr, errno);
+  }
+  return ok;
+}
+
+/* Copies the region at |addr| into a new shared memory object. */
+static struct NaClDesc *NaClVmCowSnapshot(int pagemap_fd, uintptr_t addr,
+                                          size_t size, int prot) {
+  struct NaClDescImcShm *shm;
+
+  shm = malloc(sizeof *shm);
+  if (NULL == shm) {
+    return NULL;
+  }
+  if (!NaClDescImcShmAllocCtor(shm, size, /* executable= */ 0)) {
+    free(shm);
+    return NULL;
+  }
+  if (!NaClVmCowCopyPresent(pagemap_fd, addr, size, prot, shm->h, 0)) {
+    NaClLog(1, "NaClVmCowSnapshot: 0x%"NACL_PRIxPTR" not snapshotted,"
+            " errno %d\n", addr, errno);
+    NaClDescUnref(&shm->base);
+    return NULL;
+  }
+  return &shm->base;
+}
+
+/*
+ * Copies into |child_addr| every page of |parent_addr| that the parent has
+ * written since it was mapped from the snapshot.  Both ranges must be
+ * readable and the child's writable.
+ */
+static int NaClVmCowCopyDirty(int pagemap_fd, uintptr_t parent_addr,
+                              uintptr_t child_addr, size_t size) {
+  uint64_t ents[NACL_PAGEMAP_BATCH];
+  size_t npages = size >> NACL_PAGESHIFT;
+  size_t base;
+  size_t i;
+
+  for (base = 0; base < npages; base += NACL_PAGEMAP_BATCH) {
+    size_t batch = npages - base < NACL_PAGEMAP_BATCH ? npages - base : NACL_PAGEMAP_BATCH;
+    off_t pos = (off_t) (((parent_addr >> NACL_PAGESHIFT) + base)
+                         * sizeof ents[0]);
+    if (pread(pagemap_fd, ents, batch * sizeof ents[0], pos)
+        != (ssize_t) (batch * sizeof ents[0])) {
+      return 0;
+    }
+    for (i = 0; i < batch; ++i) {
+      uintptr_t off = (base + i) << NACL_PAGESHIFT;
+      if (0 == (ents[i] & (NACL_PAGEMAP_PRESENT | NACL_PAGEMAP_SWAPPED)) ||
+          0 != (ents[i] & NACL_PAGEMAP_FILE)) {
+        continue;
+      }
+      memcpy((void *) (child_addr + off), (void *) (parent_addr + off),
+             NACL_PAGESIZE);
+    }
+  }
+  return 1;
+}
+
+/* Opened once and kept for the life of sel_ldr. */
+static int NaClVmCowPagemapFd(void) {
+  static int pagemap_fd = -1;
+  int fd = pagemap_fd;
+
+  if (fd < 0) {
+    fd = open("/proc/self/pagemap", O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+      NaClLog(LOG_WARNING, "NaClVmCowPagemapFd: cannot open pagemap, errno %d;"
+              " falling back to copying fork\n", errno);
+      return -1;
+    }
+    if (!__sync_bool_compare_and_swap(&pagemap_fd, -1, fd)) {
+      close(fd);
+      fd = pagemap_fd;
+    }
+  }
+  return fd;
+}
+
+static int NaClVmCowAnonFd(struct NaClApp *nap) {
+  struct NaClDescImcShm *shm;
+
+  if (NULL == nap->anon_shm) {
+    shm = malloc(sizeof *shm);
+    if (NULL == shm) {
+      return -1;
+    }
+    /* sparse: only the pages the cage touches take memory */
+    if (!NaClDescImcShmAllocCtor(shm, (nacl_off64_t) 1 << nap->addr_bits,
+                                 /* executable= */ 0)) {
+      free(shm);
+      NaClLog(LOG_WARNING, "NaClVmCowAnonFd: cannot create the anonymous"
+              " memory object of cage %d; forks will copy\n", nap->cage_id);
+      return -1;
+    }
+    nap->anon_shm = &shm->base;
+  }
+  return ((struct NaClDescImcShm *) nap->anon_shm)->h;
+}
+
+struct NaClDesc *NaClVmCowAnonMap(struct NaClApp *nap, uintptr_t usraddr,
+                                  size_t size, int prot) {
+  uintptr_t sysaddr = NaClUserToSys(nap, usraddr);
+  int host_fd = NaClVmCowAnonFd(nap);
+
+  if (host_fd < 0) {
+    return NULL;
+  }
+  /* normally a hole already, unless a discard failed */
+  if (0 != fallocate(host_fd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE,
+                     (off_t) usraddr, (off_t) size)) {
+    NaClLog(1, "NaClVmCowAnonMap: cannot clear 0x%"NACL_PRIxPTR", errno %d\n",
+            usraddr, errno);
+    return NULL;
+  }
+  if (MAP_FAILED == mmap((void *) sysaddr, size, NaClProtMap(prot),
+                         MAP_SHARED | MAP_FIXED, host_fd, (off_t) usraddr)) {
+    NaClLog(LOG_FATAL, "NaClVmCowAnonMap: mmap at 0x%"NACL_PRIxPTR
+            " failed, errno %d\n", sysaddr, errno);
+  }
+  return NaClDescRef(nap->anon_shm);
+}
+
+void NaClVmCowAnonDiscard(struct NaClApp *nap, uintptr_t usraddr,
+                          size_t size) {
+  int host_fd;
+
+  if (NULL == nap->anon_shm) {
+    return;
+  }
+  host_fd = ((struct NaClDescImcShm *) nap->anon_shm)->h;
+  if (0 != fallocate(host_fd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE,
+                     (off_t) usraddr, (off_t) size)) {
+    NaClLog(1, "NaClVmCowAnonDiscard: 0x%"NACL_PRIxPTR" kept, errno %d\n",
+            usraddr, errno);
+  }
+}
+
+#define NACL_COW_ADOPT_MAX 16
+
+struct NaClVmCowAdoptState {
+  struct {
+    uintptr_t page_num;
+    size_t npages;
+    int prot;
+    int flags;
+  } regions[NACL_COW_ADOPT_MAX];
+  size_t count;
+};
+
+static void NaClVmCowAdoptVisit(void *statev, struct NaClVmmapEntry *entry) {
+  struct NaClVmCowAdoptState *state = statev;
+
+  if (!NaClVmCowEligible(entry) ||
+      0 != (entry->flags & (NACL_MAP_COW | NACL_MAP_SHM_ANON)) ||
+      NACL_ABI_PROT_NONE == entry->prot ||
+      state->count == NACL_COW_ADOPT_MAX) {
+    return;
+  }
+  /* the loader may record a region twice; it is moved once */
+  if (state->count > 0 &&
+      state->regions[state->count - 1].page_num == entry->page_num) {
+    return;
+  }
+  state->regions[state->count].page_num = entry->page_num;
+  state->regions[state->count].npages = entry->npages;
+  state->regions[state->count].prot = entry->prot;
+  state->regions[state->count].flags = entry->flags;
+  ++state->count;
+}
+
+void NaClVmCowAnonAdopt(struct NaClApp *nap) {
+  struct NaClVmCowAdoptState state;
+  int pagemap_fd = NaClVmCowPagemapFd();
+  size_t i;
+
+  NaClXMutexLock(&nap->mu);
+  /* a fresh image has no object yet, so every page it has is copied */
+  if (NULL != nap->anon_shm || pagemap_fd < 0) {
+    NaClXMutexUnlock(&nap->mu);
+    return;
+  }
+  state.count = 0;
+  NaClVmmapVisit(&nap->mem_map, NaClVmCowAdoptVisit, &state);
+  for (i = 0; i < state.count; ++i) {
+    uintptr_t page_num = state.regions[i].page_num;
+    size_t npages = state.regions[i].npages;
+    int prot = state.regions[i].prot;
+    int flags = state.regions[i].flags;
+    uintptr_t usraddr = page_num << NACL_PAGESHIFT;
+    uintptr_t sysaddr = NaClUserToSys(nap, usraddr);
+    size_t size = npages << NACL_PAGESHIFT;
+    int host_fd = NaClVmCowAnonFd(nap);
+
+    if (host_fd < 0 ||
+        !NaClVmCowCopyPresent(pagemap_fd, sysaddr, size, prot,
+                              host_fd, (off_t) usraddr)) {
+      break;
+    }
+    if (MAP_FAILED == mmap((void *) sysaddr, size, NaClProtMap(prot),
+                           MAP_SHARED | MAP_FIXED, host_fd, (off_t) usraddr)) {
+      NaClLog(LOG_FATAL, "NaClVmCowAnonAdopt: mmap at 0x%"NACL_PRIxPTR
+              " failed, errno %d\n", sysaddr, errno);
+    }
+    /* this also replaces any duplicate entry for the region */
+    NaClVmmapAddWithOverwrite(&nap->mem_map, page_num, npages, prot,
+                              flags | NACL_MAP_SHM_ANON, nap->anon_shm,
+                              usraddr, (nacl_off64_t) 1 << nap->addr_bits);
+  }
+  NaClXMutexUnlock(&nap->mu);
+}
+
+int NaClVmCowCopyEntry(struct NaClApp *parent, struct NaClApp *child,
+                       struct NaClVmmapEntry *entry) {
+  int pagemap_fd = NaClVmCowPagemapFd();
+  uintptr_t parent_addr = (entry->page_num << NACL_PAGESHIFT) | parent->mem_start;
+  uintptr_t child_addr = (entry->page_num << NACL_PAGESHIFT) | child->mem_start;
+  size_t size = entry->npages << NACL_PAGESHIFT;
+  struct NaClDesc *desc;
+  nacl_off64_t offset;
+  nacl_off64_t file_size;
+  int host_fd;
+  int fresh = 0;
+
+  if (!NaClVmCowEligible(entry)) {
+    return 0;
+  }
+  if (0 != (entry->flags & NACL_MAP_SHM_ANON)) {
+    /*
+     * Freeze the parent's pages where they are: the object stops being
+     * written once no cage maps it shared, and the caller drops the
+     * parent's hold on it as its anon_shm once every entry is copied.
+     */
+    desc = NaClDescRef(entry->desc);
+    offset = entry->offset;
+    file_size = entry->file_size;
+    host_fd = ((struct NaClDescImcShm *) desc)->h;
+    if (MAP_FAILED == mmap((void *) parent_addr, size,
+                           NaClProtMap(entry->prot),
+                           MAP_PRIVATE | MAP_FIXED, host_fd, (off_t) offset)) {
+      NaClLog(LOG_FATAL, "NaClVmCowCopyEntry: parent mmap at 0x%"NACL_PRIxPTR
+              " failed, errno %d\n", parent_addr, errno);
+    }
+    entry->flags = (entry->flags & ~NACL_MAP_SHM_ANON) | NACL_MAP_COW;
+    fresh = 1;
+  } else if (pagemap_fd < 0) {
+    return 0;
+  } else if (0 == (entry->flags & NACL_MAP_COW)) {
+    desc = NaClVmCowSnapshot(pagemap_fd, parent_addr, size, entry->prot);
+    if (NULL == desc) {
+      return 0;
+    }
+    offset = 0;
+    file_size = size;
+    fresh = 1;
+  } else {
+    desc = NaClDescRef(entry->desc);
+    offset = entry->offset;
+    file_size = entry->file_size;
+  }
+  host_fd = ((struct NaClDescImcShm *) desc)->h;
+
+  if (MAP_FAILED == mmap((void *) child_addr, size, PROT_READ | PROT_WRITE,
+                         MAP_PRIVATE | MAP_FIXED, host_fd, (off_t) offset)) {
+    NaClLog(LOG_FATAL, "NaClVmCowCopyEntry: child mmap at 0x%"NACL_PRIxPTR
+            " failed, errno %d\n", child_addr, errno);
+  }
+  /* the child's entry takes its own reference */
+  NaClVmmapAddWithOverwrite(&child->mem_map,
+                            entry->page_num,
+                            entry->npages,
+                            entry->prot,
+                            entry->flags | NACL_MAP_COW | NACL_ABI_MAP_PRIVATE,
+                            desc,
+                            offset,
+                            file_size);
+  NaClDescUnref(desc);
+
+  /* a region that was just frozen or snapshotted has no private pages */
+  if (!fresh) {
+    if (0 == (entry->prot & NACL_ABI_PROT_READ) &&
+        0 != mprotect((void *) parent_addr, size, PROT_READ)) {
+      NaClLog(LOG_FATAL, "NaClVmCowCopyEntry: parent mprotect failed\n");
+    }
+    if (!NaClVmCowCopyDirty(pagemap_fd, parent_addr, child_addr, size)) {
+      NaClLog(LOG_FATAL, "NaClVmCowCopyEntry: reading pagemap failed\n");
+    }
+    if (0 == (entry->prot & NACL_ABI_PROT_READ) &&
+        0 != mprotect((void *) parent_addr, size, NaClProtMap(entry->prot))) {
+      NaClLog(LOG_FATAL, "NaClVmCowCopyEntry: parent mprotect failed\n");
+    }
+  }
+
+  if (0 != mprotect((void *) child_addr, size, NaClProtMap(entry->prot))) {
+    NaClLog(LOG_FATAL, "NaClVmCowCopyEntry: child mprotect failed\n");
+  }
+  NaClLog(2, "NaClVmCowCopyEntry: %zu page(s) at 0x%"NACL_PRIxPTR
+          " shared copy-on-write\n", entry->npages, entry->page_num);
+  return 1;
+}
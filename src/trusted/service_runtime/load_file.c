@@ -9,6 +9,7 @@
 #include "native_client/src/trusted/desc/nacl_desc_base.h"
 #include "native_client/src/trusted/desc/nacl_desc_io.h"
 #include "native_client/src/trusted/service_runtime/include/sys/fcntl.h"
+#include "native_client/src/trusted/service_runtime/nacl_image_cache.h"
 #include "native_client/src/trusted/service_runtime/nacl_valgrind_hooks.h"
 #include "native_client/src/trusted/service_runtime/sel_ldr.h"
 
@@ -16,6 +17,9 @@
 NaClErrorCode NaClAppLoadFileFromFilename(struct NaClApp *nap,
                                           const char *filename) {
   struct NaClDesc *nd;
+  struct NaClStaticImage const *image;
+  struct NaClStaticImageKey key;
+  int have_key;
   NaClErrorCode err;
 
   NaClFileNameForValgrind(filename);
@@ -26,12 +30,25 @@ NaClErrorCode NaClAppLoadFileFromFilename(struct NaClApp *nap,
     return LOAD_OPEN_ERROR;
   }
 
+  /* fork and execve load the same nexe over and over */
+  have_key = NaClImageCacheKeyFromDesc(nd, &key);
+  image = have_key ? NaClImageCacheLookup(nap, &key) : NULL;
+  if (NULL != image) {
+    NaClLog(2, "NaClAppLoadFileFromFilename: %s found in image cache\n",
+            filename);
+    NaClDescUnref(nd);
+    return NaClAppLoadStaticImage(image, nap);
+  }
+
   err = NaClAppLoadFile(nd, nap);
   NaClDescUnref(nd);
 
   if (err != LOAD_OK) {
     return err;
   }
+  if (have_key) {
+    NaClImageCacheRecord(nap, &key, filename);
+  }
 
   return err;
 }
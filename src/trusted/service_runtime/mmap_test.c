@@ -40,17 +40,41 @@ static void InitThread(struct NaClApp *nap, struct NaClAppThread *natp) {
   natp->nap = nap;
 }
 
+struct NthEntryState {
+  size_t                ix;
+  struct NaClVmmapEntry *entry;
+};
+
+static void FindNthEntry(void *state, struct NaClVmmapEntry *entry) {
+  struct NthEntryState *nth = (struct NthEntryState *) state;
+
+  if (0 == nth->ix--) {
+    nth->entry = entry;
+  }
+}
+
+/* Returns the ix'th mapping in address order. */
+static struct NaClVmmapEntry *GetEntry(struct NaClVmmap *mem_map, size_t ix) {
+  struct NthEntryState nth;
+
+  nth.ix = ix;
+  nth.entry = NULL;
+  NaClVmmapVisit(mem_map, FindNthEntry, &nth);
+  ASSERT_NE(nth.entry, NULL);
+  return nth.entry;
+}
+
 void CheckLowerMappings(struct NaClVmmap *mem_map) {
   ASSERT(mem_map->nvalid >= 4);
   /* Zero page. */
-  ASSERT_EQ(mem_map->vmentry[0]->prot, NACL_ABI_PROT_NONE);
+  ASSERT_EQ(GetEntry(mem_map, 0)->prot, NACL_ABI_PROT_NONE);
   /* Trampolines and static code. */
-  ASSERT_EQ(mem_map->vmentry[1]->prot,
+  ASSERT_EQ(GetEntry(mem_map, 1)->prot,
             NACL_ABI_PROT_READ | NACL_ABI_PROT_EXEC);
   /* Read-only data segment. */
-  ASSERT_EQ(mem_map->vmentry[2]->prot, NACL_ABI_PROT_READ);
+  ASSERT_EQ(GetEntry(mem_map, 2)->prot, NACL_ABI_PROT_READ);
   /* Writable data segment. */
-  ASSERT_EQ(mem_map->vmentry[3]->prot,
+  ASSERT_EQ(GetEntry(mem_map, 3)->prot,
             NACL_ABI_PROT_READ | NACL_ABI_PROT_WRITE);
 }
 
@@ -183,19 +207,19 @@ int main(int argc, char **argv) {
   CheckLowerMappings(mem_map);
   NaClVmmapDebug(mem_map, "After allocations");
   /* Skip mappings 0, 1, 2 and 3. */
-  ASSERT_EQ(mem_map->vmentry[4]->page_num,
+  ASSERT_EQ(GetEntry(mem_map, 4)->page_num,
             (initial_addr - NACL_MAP_PAGESIZE) >> NACL_PAGESHIFT);
-  ASSERT_EQ(mem_map->vmentry[4]->npages,
+  ASSERT_EQ(GetEntry(mem_map, 4)->npages,
             NACL_PAGES_PER_MAP);
 
-  ASSERT_EQ(mem_map->vmentry[5]->page_num,
+  ASSERT_EQ(GetEntry(mem_map, 5)->page_num,
             initial_addr >> NACL_PAGESHIFT);
-  ASSERT_EQ(mem_map->vmentry[5]->npages,
+  ASSERT_EQ(GetEntry(mem_map, 5)->npages,
             2 * NACL_PAGES_PER_MAP);
 
-  ASSERT_EQ(mem_map->vmentry[6]->page_num,
+  ASSERT_EQ(GetEntry(mem_map, 6)->page_num,
             (initial_addr +  2 * NACL_MAP_PAGESIZE) >> NACL_PAGESHIFT);
-  ASSERT_EQ(mem_map->vmentry[6]->npages,
+  ASSERT_EQ(GetEntry(mem_map, 6)->npages,
             NACL_PAGES_PER_MAP);
 
   /*
@@ -262,19 +286,19 @@ int main(int argc, char **argv) {
   ASSERT_EQ(mem_map->nvalid, 8);
   CheckLowerMappings(mem_map);
 
-  ASSERT_EQ(mem_map->vmentry[4]->page_num,
+  ASSERT_EQ(GetEntry(mem_map, 4)->page_num,
             initial_addr >> NACL_PAGESHIFT);
-  ASSERT_EQ(mem_map->vmentry[4]->npages,
+  ASSERT_EQ(GetEntry(mem_map, 4)->npages,
             2 * NACL_PAGES_PER_MAP);
 
-  ASSERT_EQ(mem_map->vmentry[5]->page_num,
+  ASSERT_EQ(GetEntry(mem_map, 5)->page_num,
             (initial_addr + 2 * NACL_MAP_PAGESIZE) >> NACL_PAGESHIFT);
-  ASSERT_EQ(mem_map->vmentry[5]->npages,
+  ASSERT_EQ(GetEntry(mem_map, 5)->npages,
             3 * NACL_PAGES_PER_MAP);
 
-  ASSERT_EQ(mem_map->vmentry[6]->page_num,
+  ASSERT_EQ(GetEntry(mem_map, 6)->page_num,
             (initial_addr + 5 * NACL_MAP_PAGESIZE) >> NACL_PAGESHIFT);
-  ASSERT_EQ(mem_map->vmentry[6]->npages,
+  ASSERT_EQ(GetEntry(mem_map, 6)->npages,
             4 * NACL_PAGES_PER_MAP);
 
 
@@ -302,29 +326,29 @@ int main(int argc, char **argv) {
   ASSERT_EQ(mem_map->nvalid, 10);
   CheckLowerMappings(mem_map);
 
-  ASSERT_EQ(mem_map->vmentry[4]->npages,
+  ASSERT_EQ(GetEntry(mem_map, 4)->npages,
             1 * NACL_PAGES_PER_MAP);
-  ASSERT_EQ(mem_map->vmentry[4]->prot,
+  ASSERT_EQ(GetEntry(mem_map, 4)->prot,
             NACL_ABI_PROT_READ | NACL_ABI_PROT_WRITE);
 
-  ASSERT_EQ(mem_map->vmentry[5]->npages,
+  ASSERT_EQ(GetEntry(mem_map, 5)->npages,
             1 * NACL_PAGES_PER_MAP);
-  ASSERT_EQ(mem_map->vmentry[5]->prot,
+  ASSERT_EQ(GetEntry(mem_map, 5)->prot,
             NACL_ABI_PROT_READ);
 
-  ASSERT_EQ(mem_map->vmentry[6]->npages,
+  ASSERT_EQ(GetEntry(mem_map, 6)->npages,
             3 * NACL_PAGES_PER_MAP);
-  ASSERT_EQ(mem_map->vmentry[6]->prot,
+  ASSERT_EQ(GetEntry(mem_map, 6)->prot,
             NACL_ABI_PROT_READ);
 
-  ASSERT_EQ(mem_map->vmentry[7]->npages,
+  ASSERT_EQ(GetEntry(mem_map, 7)->npages,
             1 * NACL_PAGES_PER_MAP);
-  ASSERT_EQ(mem_map->vmentry[7]->prot,
+  ASSERT_EQ(GetEntry(mem_map, 7)->prot,
             NACL_ABI_PROT_READ);
 
-  ASSERT_EQ(mem_map->vmentry[8]->npages,
+  ASSERT_EQ(GetEntry(mem_map, 8)->npages,
             3 * NACL_PAGES_PER_MAP);
-  ASSERT_EQ(mem_map->vmentry[8]->prot,
+  ASSERT_EQ(GetEntry(mem_map, 8)->prot,
             NACL_ABI_PROT_READ | NACL_ABI_PROT_WRITE);
 
 
@@ -352,29 +376,29 @@ int main(int argc, char **argv) {
   ASSERT_EQ(mem_map->nvalid, 10);
   CheckLowerMappings(mem_map);
 
-  ASSERT_EQ(mem_map->vmentry[4]->npages,
+  ASSERT_EQ(GetEntry(mem_map, 4)->npages,
             1 * NACL_PAGES_PER_MAP);
-  ASSERT_EQ(mem_map->vmentry[4]->prot,
+  ASSERT_EQ(GetEntry(mem_map, 4)->prot,
             NACL_ABI_PROT_READ | NACL_ABI_PROT_WRITE);
 
-  ASSERT_EQ(mem_map->vmentry[5]->npages,
+  ASSERT_EQ(GetEntry(mem_map, 5)->npages,
             1 * NACL_PAGES_PER_MAP);
-  ASSERT_EQ(mem_map->vmentry[5]->prot,
+  ASSERT_EQ(GetEntry(mem_map, 5)->prot,
             NACL_ABI_PROT_READ);
 
-  ASSERT_EQ(mem_map->vmentry[6]->npages,
+  ASSERT_EQ(GetEntry(mem_map, 6)->npages,
             3 * NACL_PAGES_PER_MAP);
-  ASSERT_EQ(mem_map->vmentry[6]->prot,
+  ASSERT_EQ(GetEntry(mem_map, 6)->prot,
             NACL_ABI_PROT_NONE);
 
-  ASSERT_EQ(mem_map->vmentry[7]->npages,
+  ASSERT_EQ(GetEntry(mem_map, 7)->npages,
             1 * NACL_PAGES_PER_MAP);
-  ASSERT_EQ(mem_map->vmentry[7]->prot,
+  ASSERT_EQ(GetEntry(mem_map, 7)->prot,
             NACL_ABI_PROT_READ);
 
-  ASSERT_EQ(mem_map->vmentry[8]->npages,
+  ASSERT_EQ(GetEntry(mem_map, 8)->npages,
             3 * NACL_PAGES_PER_MAP);
-  ASSERT_EQ(mem_map->vmentry[8]->prot,
+  ASSERT_EQ(GetEntry(mem_map, 8)->prot,
             NACL_ABI_PROT_READ | NACL_ABI_PROT_WRITE);
 
 
@@ -447,7 +471,7 @@ int main(int argc, char **argv) {
   ASSERT_EQ(errcode, 0);
 
   /* Check that we cannot make the read-only data segment writable */
-  ent = mem_map->vmentry[2];
+  ent = GetEntry(mem_map, 2);
   errcode = NaClSysMprotectInternal(nap, (uint32_t) (ent->page_num <<
                                                      NACL_PAGESHIFT),
                                     ent->npages * NACL_MAP_PAGESIZE,
@@ -12,6 +12,8 @@
 #include "native_client/src/trusted/desc/nrd_all_modules.h"
 #include "native_client/src/trusted/fault_injection/fault_injection.h"
 #include "native_client/src/trusted/service_runtime/nacl_globals.h"
+#include "native_client/src/trusted/service_runtime/nacl_image_cache.h"
+#include "native_client/src/trusted/service_runtime/nacl_stat_cache.h"
 #include "native_client/src/trusted/service_runtime/nacl_syscall_handlers.h"
 #include "native_client/src/trusted/service_runtime/nacl_thread_nice.h"
 #include "native_client/src/trusted/service_runtime/nacl_tls.h"
@@ -21,6 +23,8 @@ void  NaClAllModulesInit(void) {
   NaClNrdAllModulesInit();
   NaClFaultInjectionModuleInit();
   NaClGlobalModuleInit();  /* various global variables */
+  NaClImageCacheModuleInit();
+  NaClStatCacheModuleInit();
   NaClSrpcModuleInit();
   NaClTlsInit();
   NaClSyscallTableInit();
@@ -31,6 +35,8 @@ void  NaClAllModulesInit(void) {
 void NaClAllModulesFini(void) {
   NaClTlsFini();
   NaClSrpcModuleFini();
+  NaClStatCacheModuleFini();
+  NaClImageCacheModuleFini();
   NaClGlobalModuleFini();
   NaClNrdAllModulesFini();
 }
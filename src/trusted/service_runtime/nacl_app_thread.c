@@ -23,6 +23,7 @@
 #include "native_client/src/trusted/service_runtime/nacl_stack_safety.h"
 #include "native_client/src/trusted/service_runtime/nacl_switch_to_app.h"
 #include "native_client/src/trusted/service_runtime/nacl_syscall_common.h"
+#include "native_client/src/trusted/service_runtime/nacl_syscall_profile.h"
 #include "native_client/src/trusted/service_runtime/nacl_tls.h"
 #include "native_client/src/trusted/service_runtime/osx/mach_thread_map.h"
 
@@ -50,14 +51,22 @@ struct NaClThreadContext *master_ctx;
  * used in NaClSysFork()
  */
 struct NaClApp *NaClChildNapCtor(struct NaClApp *nap) {
-  struct NaClApp *nap_child = NaClAlignedMalloc(sizeof(*nap_child), __alignof(struct NaClApp));
+  struct NaClApp *nap_child = NULL;
   struct NaClApp *nap_master = ((struct NaClAppThread *)master_ctx)->nap;
   struct NaClApp *nap_parent = nap;
   struct NaClApp *nap_arr[] = {nap_master, nap_parent};
   NaClErrorCode *mod_status = NULL;
+  int cage_id;
 
   CHECK(nap_master);
   CHECK(nap_parent);
+
+  cage_id = NaClCageIdAlloc();
+  if (cage_id < 0) {
+    NaClLog(LOG_ERROR, "NaClChildNapCtor: all %d cage ids are in use\n", CAGE_MAX - 1);
+    return NULL;
+  }
+  nap_child = NaClAlignedMalloc(sizeof(*nap_child), __alignof(struct NaClApp));
   CHECK(nap_child);
 
   NaClLog(1, "%s\n", "Entered NaClChildNapCtor()");
@@ -73,6 +82,7 @@ struct NaClApp *NaClChildNapCtor(struct NaClApp *nap) {
   nap_child->nacl_file = nap_parent->nacl_file ? nap_parent->nacl_file : LD_FILE;
   nap_child->enable_exception_handling = nap_parent->enable_exception_handling;
   nap_child->validator_stub_out_mode = nap_parent->validator_stub_out_mode;
+  nap_child->validation_cache = nap_parent->validation_cache;
   nap_child->ignore_validator_result = nap_parent->ignore_validator_result;
   nap_child->skip_validator = nap_parent->skip_validator;
   nap_child->user_entry_pt = nap_parent->user_entry_pt;
@@ -92,10 +102,11 @@ struct NaClApp *NaClChildNapCtor(struct NaClApp *nap) {
     NaClXMutexLock(&nap_parent->children_mu);
   }
   /*
-   * increment fork generation count and generate child
-   * cage_id (both master and parent mutexes need to be held
+   * increment fork generation count and set up the child under its
+   * recycled cage_id (both master and parent mutexes need to be held)
    */
-  InitializeCage(nap_child, nap_master->cage_id + ++fork_num);
+  ++fork_num;
+  InitializeCage(nap_child, cage_id);
   /* store cage_ids in both master and parent to provide redundancy and avoid orphans */
   for (size_t i = 0; i < sizeof(nap_arr) / sizeof(*nap_arr); i++) {
     if (!nap_arr[i]) {
@@ -113,6 +124,7 @@ struct NaClApp *NaClChildNapCtor(struct NaClApp *nap) {
     }
     NaClLog(1, "[nap %d] new child count: %d\n", nap_arr[i]->cage_id, nap_arr[i]->num_children);
   }
+  nap_parent->num_running_children++;
   /* don't unlock master twice */
   NaClXMutexUnlock(&nap_master->children_mu);
   if (nap_parent != nap_master) {
@@ -148,12 +160,12 @@ struct NaClApp *NaClChildNapCtor(struct NaClApp *nap) {
   /* duplicate file descriptor table starting at child_fd = 3 (0-2 setup previously)*/
   NaClXMutexLock(&nap_parent->mu);
 
-  for (int fd = 0; fd <= FILE_DESC_MAX; fd++) {
+  for (int fd = 0; fd < NaClFdTableSize(&nap_parent->fd_table); fd++) {
 
     /* Retrive the host fd we had stored in the Cage Table for the parent */
-    int parent_host_fd = fd_cage_table[nap_parent->cage_id][fd];
+    int parent_host_fd = NaClFdTableGet(&nap_parent->fd_table, fd);
     if (parent_host_fd == NACL_BAD_FD) {
-      fd_cage_table[nap_child->cage_id][fd] = NACL_BAD_FD;
+      NaClFdTableSet(&nap_child->fd_table, fd, NACL_BAD_FD);
       continue;
     }
     /* Retrieve Parent NaCl Descriptor based on current child fd in the parent */
@@ -163,6 +175,17 @@ struct NaClApp *NaClChildNapCtor(struct NaClApp *nap) {
       continue;
     }
 
+    /* in-runtime pipe ends are shared with the child, which takes our ref */
+    if (NACL_DESC_PIPE == NACL_VTBL(NaClDesc, parent_nd)->typeTag) {
+      int child_host_fd = NaClSetAvail(nap_child, parent_nd);
+
+      NaClFdTableSet(&nap_child->fd_table, fd, child_host_fd);
+      if (NaClFdTableGet(&nap_parent->fd_cloexec, fd) >= 0) {
+        NaClFdTableSet(&nap_child->fd_cloexec, fd, child_host_fd);
+      }
+      continue;
+    }
+
     /* Translate from NaCl Desc to Host Desc */
     struct NaClDescIoDesc *self = (struct NaClDescIoDesc *) &parent_nd->base;
     struct NaClHostDesc *parent_hd = self->hd;
@@ -179,13 +202,15 @@ struct NaClApp *NaClChildNapCtor(struct NaClApp *nap) {
     child_hd->cageid = nap_child->cage_id;
 
     /* Create and set new NaClDesc from Child HD in Child nap */
-    int child_host_fd = NaClSetAvail(nap_child, ((struct NaClDesc *) NaClDescIoDescMake(child_hd)));
+    struct NaClDescIoDesc *child_self = NaClDescIoDescMake(child_hd);
+    NaClDescIoDescSetPath(child_self, self->path);
+    int child_host_fd = NaClSetAvail(nap_child, (struct NaClDesc *) child_self);
 
     /* We've got to put that parent NaClDescriptor back in there... */
     NaClSetDesc(nap_parent, parent_host_fd, parent_nd);
 
     /* Set childs cage table with the current fd to the old parent host fd */
-    fd_cage_table[nap_child->cage_id][fd] = child_host_fd;
+    NaClFdTableSet(&nap_child->fd_table, fd, child_host_fd);
 
 
     NaClLog(1, "NaClGetDesc() copied parent fd [%d] to child fd [%d]\n", fd);
@@ -232,7 +257,11 @@ void WINAPI NaClAppThreadLauncher(void *state) {
     */
     NaClXMutexLock(&nap->threads_mu);
     NaClXMutexLock(&nap->children_mu);
-    nap->num_threads = thread_idx + 1;
+    /*
+     * The slot is picked from the tls index, which for a fork thread is
+     * the cage id; num_threads still counts the threads that are running.
+     */
+    ++nap->num_threads;
     natp->thread_num = thread_idx + 1;
     if (!DynArraySet(&nap->threads, natp->thread_num, natp)) {
       NaClLog(LOG_FATAL, "NaClAddThreadMu: DynArraySet at position %d failed\n", natp->thread_num);
@@ -325,6 +354,46 @@ void WINAPI NaClAppThreadLauncher(void *state) {
   }
 }
 
+/*
+ * Called when the last of |nap|'s threads has left the sandbox: nothing
+ * will wait for its children any more.  Those that already exited are
+ * reaped here; the master takes over those still running, which reap
+ * themselves when they exit.
+ */
+static void NaClReparentChildren(struct NaClApp *nap,
+                                 struct NaClApp *nap_master) {
+  struct NaClApp  *exited;
+  struct NaClApp  *child;
+  size_t          id;
+
+  NaClXMutexLock(&nap_master->children_mu);
+  NaClXMutexLock(&nap->children_mu);
+  for (id = 0; id < nap->children.num_entries; ++id) {
+    child = DynArrayGet(&nap->children, id);
+    if (NULL == child || child->parent != nap) {
+      continue;
+    }
+    child->parent = nap_master;
+    child->parent_id = nap_master->cage_id;
+    child->reparented = 1;
+    (void) DynArraySet(&nap->children, id, NULL);
+    nap->num_children--;
+  }
+  exited = nap->exited_children;
+  nap->exited_children = NULL;
+  nap->exited_children_tail = NULL;
+  nap->num_running_children = 0;
+  NaClXMutexUnlock(&nap->children_mu);
+  NaClXMutexUnlock(&nap_master->children_mu);
+
+  while (NULL != exited) {
+    child = exited;
+    exited = child->next_exited_child;
+    child->next_exited_child = NULL;
+    NaClCageRelease(child, NACL_CAGE_REAPED);
+  }
+}
+
 /*
  * preconditions:
  * * natp must be thread_self(), called while holding no locks.
@@ -332,8 +401,11 @@ void WINAPI NaClAppThreadLauncher(void *state) {
 void NaClAppThreadTeardown(struct NaClAppThread *natp) {
   struct NaClApp  *nap = natp->nap;
   struct NaClApp  *nap_master = NULL;
-  struct NaClApp  *nap_parent = nap->parent;
+  struct NaClApp  *nap_parent;
   size_t          thread_idx;
+  int             last_out;
+  int             reap = 0;
+  int             gone;
 
   if (master_ctx) {
     nap_master = ((struct NaClAppThread *)master_ctx)->nap;
@@ -345,15 +417,65 @@ void NaClAppThreadTeardown(struct NaClAppThread *natp) {
    */
   NaClLog(1, "[NaClAppThreadTeardown] cage id: %d\n", nap->cage_id);
 
+  NaClXMutexLock(&nap->threads_mu);
+  NaClXMutexLock(&natp->mu);
+  /*
+   * Remove ourselves from the ldt-indexed global tables.  The ldt
+   * entry is released as part of NaClAppThreadDelete(), and if
+   * another thread is immediately created (from some other running
+   * thread) we want to be sure that any ldt-based lookups will not
+   * reach this dying thread's data.  Fork and exec threads use the
+   * cage id as their index, and the id may be recycled as soon as the
+   * cage has exited and been reaped, which can be before we get to the
+   * end of this function.
+   */
+  thread_idx = NaClGetThreadIdx(natp);
+
+  /*
+   * On x86-64 and ARM, clearing nacl_user entry ensures that we will
+   * fault if another syscall is made with this thread_idx.  In
+   * particular, thread_idx 0 is never used.
+   */
+  nacl_user[thread_idx] = NULL;
+#if NACL_WINDOWS
+  nacl_thread_ids[thread_idx] = 0;
+#elif NACL_OSX
+  NaClClearMachThreadForThreadIndex(thread_idx);
+#endif
+  /*
+   * The last of the cage's threads to get here takes it out of the
+   * sandbox for good, even though the threads may wait below for the
+   * master's other children.
+   */
+  last_out = ++nap->num_exiting_threads == nap->num_threads;
+  NaClXMutexUnlock(&natp->mu);
+  NaClXMutexUnlock(&nap->threads_mu);
+  if (last_out) {
+    /*
+     * However the cage's threads went, whoever is at the other end of its
+     * pipes must see EOF or EPIPE rather than wait for it forever.
+     */
+    NaClDropPipeDescs(nap);
+    NaClCageRelease(nap, NACL_CAGE_EXITED);
+    if (nap_master && nap != nap_master) {
+      NaClReparentChildren(nap, nap_master);
+    }
+  }
+
     /* remove self from parent's list of children */
-  if (nap_master && nap_parent) {
-    struct NaClApp *nap_arr[] = {nap_master, nap_parent};
+  if (nap_master && nap->parent) {
+    struct NaClApp *nap_arr[2];
+
+    /* don't lock master twice */
+    NaClXMutexLock(&nap_master->children_mu);
+    /* read under the master's lock, which NaClReparentChildren holds */
+    nap_parent = nap->parent;
+    nap_arr[0] = nap_master;
+    nap_arr[1] = nap_parent;
     /* avoid incrementing child count twice */
     if (nap_master == nap_parent) {
       nap_arr[0] = NULL;
     }
-    /* don't lock master twice */
-    NaClXMutexLock(&nap_master->children_mu);
     if (nap_parent != nap_master) {
       NaClXMutexLock(&nap_parent->children_mu);
     }
@@ -363,6 +485,24 @@ void NaClAppThreadTeardown(struct NaClAppThread *natp) {
       }
    
       nap_arr[i]->num_children--;
+      /*
+       * the first thread out queues the cage for its parent's waitpid(),
+       * or reaps it if its parent is gone
+       */
+      if (nap_arr[i] == nap_parent && nap->reparented &&
+          DynArrayGet(&nap_parent->children, nap->cage_id) == nap) {
+        reap = 1;
+      } else if (nap_arr[i] == nap_parent &&
+          DynArrayGet(&nap_parent->children, nap->cage_id) == nap) {
+        nap->next_exited_child = NULL;
+        if (nap_parent->exited_children_tail) {
+          nap_parent->exited_children_tail->next_exited_child = nap;
+        } else {
+          nap_parent->exited_children = nap;
+        }
+        nap_parent->exited_children_tail = nap;
+        nap_parent->num_running_children--;
+      }
       NaClLog(1, "[parent %d] new child count: %d\n", nap_arr[i]->cage_id, nap_arr[i]->num_children);
       if (!DynArraySet(&nap_arr[i]->children, nap->cage_id, NULL)) {
         NaClLog(1, "[NaClAppThreadTeardown][parent %d] did not find cage to remove: cage_id = %d\n", nap_arr[i]->cage_id, nap->cage_id);
@@ -379,6 +519,9 @@ void NaClAppThreadTeardown(struct NaClAppThread *natp) {
       NaClXMutexUnlock(&nap_parent->children_mu);
     }
   }
+  if (reap) {
+    NaClCageRelease(nap, NACL_CAGE_REAPED);
+  }
 
   /* wait for master thread */
   if (nap_master && nap != nap_master) {
@@ -407,26 +550,6 @@ void NaClAppThreadTeardown(struct NaClAppThread *natp) {
   NaClLog(3, " getting thread lock\n");
   NaClXMutexLock(&natp->mu);
 
-  /*
-   * Remove ourselves from the ldt-indexed global tables.  The ldt
-   * entry is released as part of NaClAppThreadDelete(), and if
-   * another thread is immediately created (from some other running
-   * thread) we want to be sure that any ldt-based lookups will not
-   * reach this dying thread's data.
-   */
-  thread_idx = NaClGetThreadIdx(natp);
-
-  /*
-   * On x86-64 and ARM, clearing nacl_user entry ensures that we will
-   * fault if another syscall is made with this thread_idx.  In
-   * particular, thread_idx 0 is never used.
-   */
-  nacl_user[thread_idx] = NULL;
-#if NACL_WINDOWS
-  nacl_thread_ids[thread_idx] = 0;
-#elif NACL_OSX
-  NaClClearMachThreadForThreadIndex(thread_idx);
-#endif
   /*
    * Unset the TLS variable so that if a crash occurs during thread
    * teardown, the signal handler does not dereference a dangling
@@ -437,6 +560,9 @@ void NaClAppThreadTeardown(struct NaClAppThread *natp) {
   NaClLog(3, " removing thread from thread table\n");
   /* Deallocate the ID natp->thread_num. */
   NaClRemoveThreadMu(nap, natp->thread_num);
+  --nap->num_exiting_threads;
+  /* no thread can be added to a cage that has exited */
+  gone = 0 == nap->num_threads;
   NaClLog(3, " unlocking thread\n");
   NaClXMutexUnlock(&natp->mu);
   NaClLog(3, " unlocking thread table\n");
@@ -445,6 +571,10 @@ void NaClAppThreadTeardown(struct NaClAppThread *natp) {
   NaClSignalStackUnregister();
   NaClLog(3, " freeing thread object\n");
   NaClAppThreadDelete(natp);
+  if (gone) {
+    /* nap may be freed from here on */
+    NaClCageRelease(nap, NACL_CAGE_GONE);
+  }
   NaClLog(3, " NaClThreadExit\n");
 
   NaClThreadExit();
@@ -518,6 +648,8 @@ struct NaClAppThread *NaClAppThreadMake(struct NaClApp *nap,
   natp->fault_signal = 0;
 
   natp->dynamic_delete_generation = 0;
+  natp->syscall_profile = NULL;
+  natp->vm_io_range = NACL_VM_IO_RANGE_NONE;
   return natp;
 
  cleanup_mu:
@@ -568,6 +700,17 @@ void NaClForkThreadContextSetup(struct NaClAppThread     *natp_parent,
     natp_child->user.rbp = (uintptr_t)stack_ptr_child + base_ptr_offset;
     natp_child->user.sysret = 0;
 
+    /*
+     * The copied cage memory is not rewritten: untrusted code only ever
+     * dereferences the low 32 bits of a value, relative to %r15, so return
+     * addresses and saved frame pointers left on the stack with the
+     * parent's upper bits already resolve into the child.  The only
+     * absolute host addresses are the ones the runtime keeps in the thread
+     * context, and those are rebased here.
+     */
+    natp_child->user.prog_ctr = NaClSandboxCodeAddr(nap_child, parent_ctx.prog_ctr);
+    natp_child->user.new_prog_ctr = NaClSandboxCodeAddr(nap_child, parent_ctx.new_prog_ctr);
+
   /* examine arbitrary stack values */
   #if defined(_DEBUG)
   # define NUM_STACK_VALS 16
@@ -725,6 +868,7 @@ already_running:
  *  * natp must _not_ be running
  */
 void NaClAppThreadDelete(struct NaClAppThread *natp) {
+  NaClSyscallProfileThreadExit(natp);
   if (natp->host_thread_is_defined) {
     NaClThreadDtor(&natp->host_thread);
   }
@@ -24,6 +24,7 @@ EXTERN_C_BEGIN
 
 struct NaClApp;
 struct NaClAppThreadSuspendedRegisters;
+struct NaClSyscallProfile;
 
 /*
  * The thread hosting the NaClAppThread may change suspend_state
@@ -148,8 +149,25 @@ struct NaClAppThread {
    * Protected by mu
    */
   int                       dynamic_delete_generation;
+
+  /*
+   * Counters for syscall profiling; claimed at the first profiled
+   * syscall.  Only this thread touches the pointer.
+   */
+  struct NaClSyscallProfile *syscall_profile;
+
+  /*
+   * The untrusted range this thread's current I/O syscall reads or
+   * writes, first address in the high word and last in the low word, or
+   * NACL_VM_IO_RANGE_NONE.  Published by this thread without locks;
+   * read by NaClVmIoPendingCheck_mu.  See NaClVmIoWillStart.
+   */
+  uint64_t volatile         vm_io_range;
 };
 
+/* first > last, which no tracked range has */
+#define NACL_VM_IO_RANGE_NONE ((uint64_t) 1 << 32)
+
 struct NaClApp *NaClChildNapCtor(struct NaClApp *nap);
 
 void WINAPI NaClAppThreadLauncher(void *state);
@@ -0,0 +1,307 @@
+/*
+ * Copyright (c) 2017 The Native Client Authors. All rights reserved.
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file.
+ */
+
+/*
+ * Per-cage file descriptor table.  See nacl_fd_table.h.
+ */
+
+#include "native_client/src/include/portability.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "native_client/src/include/concurrency_ops.h"
+#include "native_client/src/shared/platform/nacl_check.h"
+#include "native_client/src/trusted/service_runtime/include/sys/errno.h"
+#include "native_client/src/trusted/service_runtime/nacl_fd_table.h"
+
+
+static int const kBitsPerWord = 32;
+static int const kWordIndexShift = 5;  /* 2**kWordIndexShift==kBitsPerWord */
+static uint32_t const kFullWord = ~(uint32_t) 0;
+
+/* Enough for stdio and a typical program's handful of files. */
+static uint32_t const kInitialCapacity = 64;
+
+
+static void FreeLevels(uint32_t **in_use) {
+  int level;
+
+  for (level = 0; level < NACL_FD_TABLE_MAX_LEVELS; ++level) {
+    free(in_use[level]);
+    in_use[level] = NULL;
+  }
+}
+
+/*
+ * Builds the bitmap hierarchy for |capacity| slots of |entries|.  Bits
+ * past the end of the level below are set, so they read as full and are
+ * never descended into.  Returns the number of levels, or 0 if out of
+ * memory.
+ */
+static int BuildLevels(int const *entries, uint32_t capacity,
+                       uint32_t **in_use) {
+  size_t words = capacity >> kWordIndexShift;
+  size_t lower_words = 0;
+  size_t ix;
+  int level;
+
+  memset(in_use, 0, NACL_FD_TABLE_MAX_LEVELS * sizeof *in_use);
+  for (level = 0; ; ++level) {
+    CHECK(level < NACL_FD_TABLE_MAX_LEVELS);
+    in_use[level] = calloc(words, sizeof *in_use[level]);
+    if (NULL == in_use[level]) {
+      FreeLevels(in_use);
+      return 0;
+    }
+    for (ix = 0; ix < words << kWordIndexShift; ++ix) {
+      int used;
+
+      if (0 == level) {
+        used = entries[ix] >= 0;
+      } else {
+        used = ix >= lower_words || kFullWord == in_use[level - 1][ix];
+      }
+      if (used) {
+        in_use[level][ix >> kWordIndexShift] |=
+            1U << (ix & (kBitsPerWord - 1));
+      }
+    }
+    if (1 == words) {
+      return level + 1;
+    }
+    lower_words = words;
+    words = (words + kBitsPerWord - 1) >> kWordIndexShift;
+  }
+}
+
+/*
+ * Returns the lowest free slot at or above |start|, or -1 if there is
+ * none.  Climbs from |start|'s word until some level has a clear bit past
+ * the path taken, then descends from that bit as the lowest free slot
+ * search does.
+ */
+static int FindFree(struct NaClFdTable *self, uint32_t start) {
+  size_t ix = start;
+  size_t words = self->capacity >> kWordIndexShift;
+  int level;
+
+  if (start >= self->capacity) {
+    return -1;
+  }
+  for (level = 0; ; ++level) {
+    uint32_t word = self->in_use[level][ix >> kWordIndexShift];
+    uint32_t avail = ~word & (kFullWord << (ix & (kBitsPerWord - 1)));
+
+    if (0 != avail) {
+      ix = (ix & ~(size_t) (kBitsPerWord - 1)) + (ffs(avail) - 1);
+      break;
+    }
+    /* the next word at this level is the next bit one level up */
+    ix = (ix >> kWordIndexShift) + 1;
+    if (ix >= words || level + 1 == self->levels) {
+      return -1;
+    }
+    words = (words + kBitsPerWord - 1) >> kWordIndexShift;
+  }
+  for (--level; level >= 0; --level) {
+    uint32_t word = self->in_use[level][ix];
+
+    ix = (ix << kWordIndexShift) + (ffs(~word) - 1);
+  }
+  return (int) ix;
+}
+
+static void MarkUsed(struct NaClFdTable *self, size_t ix) {
+  int level;
+
+  for (level = 0; level < self->levels; ++level) {
+    uint32_t *word = &self->in_use[level][ix >> kWordIndexShift];
+
+    *word |= 1U << (ix & (kBitsPerWord - 1));
+    if (kFullWord != *word) {
+      break;
+    }
+    ix >>= kWordIndexShift;
+  }
+}
+
+static void MarkFree(struct NaClFdTable *self, size_t ix) {
+  int level;
+
+  for (level = 0; level < self->levels; ++level) {
+    uint32_t *word = &self->in_use[level][ix >> kWordIndexShift];
+    int was_full = kFullWord == *word;
+
+    *word &= ~(1U << (ix & (kBitsPerWord - 1)));
+    if (!was_full) {
+      break;
+    }
+    ix >>= kWordIndexShift;
+  }
+}
+
+/*
+ * Grows the table to hold at least |min_capacity| slots.  Caller holds
+ * self->mu.  Returns 0 or a negative NaCl errno.
+ */
+static int Grow(struct NaClFdTable *self, uint32_t min_capacity) {
+  uint32_t capacity = self->capacity;
+  uint32_t *in_use[NACL_FD_TABLE_MAX_LEVELS];
+  int *entries;
+  int levels;
+
+  if (min_capacity > NACL_FD_TABLE_MAX) {
+    return -NACL_ABI_EMFILE;
+  }
+  while (capacity < min_capacity) {
+    capacity *= 2;
+  }
+  entries = malloc(capacity * sizeof *entries);
+  if (NULL == entries) {
+    return -NACL_ABI_ENOMEM;
+  }
+  memcpy(entries, self->entries, self->capacity * sizeof *entries);
+  memset(entries + self->capacity, 0xff,
+         (capacity - self->capacity) * sizeof *entries);
+  levels = BuildLevels(entries, capacity, in_use);
+  if (0 == levels) {
+    free(entries);
+    return -NACL_ABI_ENOMEM;
+  }
+
+  FreeLevels(self->in_use);
+  memcpy(self->in_use, in_use, sizeof in_use);
+  self->levels = levels;
+
+  /*
+   * Lock-free readers load capacity and then entries, so publish in the
+   * opposite order; the old array stays valid for anyone still using it.
+   */
+  CHECK(self->num_retired < NACL_FD_TABLE_MAX_RESIZES);
+  self->retired[self->num_retired++] = self->entries;
+  self->entries = entries;
+  NaClWriteMemoryBarrier();
+  self->capacity = capacity;
+  return 0;
+}
+
+int NaClFdTableCtor(struct NaClFdTable *self) {
+  memset(self, 0, sizeof *self);
+  if (!NaClFastMutexCtor(&self->mu)) {
+    return 0;
+  }
+  self->entries = malloc(kInitialCapacity * sizeof *self->entries);
+  if (NULL == self->entries) {
+    goto cleanup_mu;
+  }
+  memset(self->entries, 0xff, kInitialCapacity * sizeof *self->entries);
+  self->levels = BuildLevels(self->entries, kInitialCapacity, self->in_use);
+  if (0 == self->levels) {
+    goto cleanup_entries;
+  }
+  self->capacity = kInitialCapacity;
+  return 1;
+
+ cleanup_entries:
+  free(self->entries);
+ cleanup_mu:
+  NaClFastMutexDtor(&self->mu);
+  return 0;
+}
+
+void NaClFdTableDtor(struct NaClFdTable *self) {
+  int i;
+
+  for (i = 0; i < self->num_retired; ++i) {
+    free(self->retired[i]);
+  }
+  FreeLevels(self->in_use);
+  free(self->entries);
+  NaClFastMutexDtor(&self->mu);
+  memset(self, 0, sizeof *self);
+}
+
+int NaClFdTableGet(struct NaClFdTable *self, int fd) {
+  uint32_t capacity = self->capacity;
+  int *entries = self->entries;
+
+  if (fd < 0 || (uint32_t) fd >= capacity) {
+    return -1;
+  }
+  return entries[fd];
+}
+
+int NaClFdTableAlloc(struct NaClFdTable *self, int value) {
+  return NaClFdTableAllocFrom(self, 0, value);
+}
+
+int NaClFdTableAllocFrom(struct NaClFdTable *self, int min_fd, int value) {
+  uint32_t min_capacity;
+  int fd;
+  int rv;
+
+  CHECK(value >= 0);
+  if (min_fd < 0 || min_fd >= NACL_FD_TABLE_MAX) {
+    return -NACL_ABI_EINVAL;
+  }
+  NaClFastMutexLock(&self->mu);
+  fd = FindFree(self, (uint32_t) min_fd);
+  if (fd < 0) {
+    min_capacity = self->capacity + 1;
+    if (min_capacity < (uint32_t) min_fd + 1) {
+      min_capacity = (uint32_t) min_fd + 1;
+    }
+    rv = Grow(self, min_capacity);
+    if (0 != rv) {
+      NaClFastMutexUnlock(&self->mu);
+      return rv;
+    }
+    fd = FindFree(self, (uint32_t) min_fd);
+    CHECK(fd >= 0);
+  }
+  self->entries[fd] = value;
+  MarkUsed(self, fd);
+  NaClFastMutexUnlock(&self->mu);
+  return fd;
+}
+
+int NaClFdTableSet(struct NaClFdTable *self, int fd, int value) {
+  int old_value;
+  int rv;
+
+  if (fd < 0 || fd >= NACL_FD_TABLE_MAX) {
+    return -NACL_ABI_EBADF;
+  }
+  if (value < 0) {
+    value = -1;
+  }
+  NaClFastMutexLock(&self->mu);
+  if ((uint32_t) fd >= self->capacity) {
+    if (value < 0) {
+      NaClFastMutexUnlock(&self->mu);
+      return -1;
+    }
+    rv = Grow(self, (uint32_t) fd + 1);
+    if (0 != rv) {
+      NaClFastMutexUnlock(&self->mu);
+      return rv;
+    }
+  }
+  old_value = self->entries[fd];
+  self->entries[fd] = value;
+  if (old_value < 0 && value >= 0) {
+    MarkUsed(self, fd);
+  } else if (old_value >= 0 && value < 0) {
+    MarkFree(self, fd);
+  }
+  NaClFastMutexUnlock(&self->mu);
+  return old_value;
+}
+
+int NaClFdTableSize(struct NaClFdTable *self) {
+  return (int) self->capacity;
+}
@@ -0,0 +1,92 @@
+/*
+ * Copyright (c) 2017 The Native Client Authors. All rights reserved.
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file.
+ */
+
+/*
+ * Per-cage file descriptor table.  Maps the fds a cage sees to indices in
+ * the NaClApp's descriptor table (nap->desc_tbl), which are what
+ * NaClGetDesc and NaClSetDesc take.
+ *
+ * New fds are the lowest free number, as POSIX requires.  Slot use is kept
+ * in a hierarchy of bitmaps: a bit at level k > 0 is set when the word
+ * below it at level k - 1 is full, so the lowest free slot is found with
+ * one ffs per level rather than a scan of the table.  The table starts
+ * small and doubles as needed, up to NACL_FD_TABLE_MAX entries.
+ *
+ * Changes are serialized by a lock.  Lookups take no lock: arrays replaced
+ * by a resize are kept until the table is destroyed, so a lookup racing
+ * with a resize sees either the old or the new array, both of which hold
+ * the value the fd had before the resize.
+ */
+
+#ifndef NATIVE_CLIENT_SRC_TRUSTED_SERVICE_RUNTIME_NACL_FD_TABLE_H_
+#define NATIVE_CLIENT_SRC_TRUSTED_SERVICE_RUNTIME_NACL_FD_TABLE_H_
+
+#include "native_client/src/include/portability.h"
+#include "native_client/src/shared/platform/nacl_sync.h"
+
+EXTERN_C_BEGIN
+
+/* Same as the default Linux fs.nr_open. */
+#define NACL_FD_TABLE_MAX           (1 << 20)
+
+/* 32**NACL_FD_TABLE_MAX_LEVELS >= NACL_FD_TABLE_MAX */
+#define NACL_FD_TABLE_MAX_LEVELS    4
+
+/* Each resize at least doubles the table, so this many always suffice. */
+#define NACL_FD_TABLE_MAX_RESIZES   20
+
+struct NaClFdTable {
+  struct NaClFastMutex  mu;
+  /* free slots hold -1; may be read without holding mu */
+  int *volatile         entries;
+  volatile uint32_t     capacity;
+  int                   levels;
+  uint32_t              *in_use[NACL_FD_TABLE_MAX_LEVELS];
+  int                   *retired[NACL_FD_TABLE_MAX_RESIZES];
+  int                   num_retired;
+};
+
+int NaClFdTableCtor(struct NaClFdTable *self) NACL_WUR;
+
+void NaClFdTableDtor(struct NaClFdTable *self);
+
+/*
+ * Returns the value bound to |fd|, or -1 if |fd| is not open.  Any fd
+ * value, including out of range ones, may be passed.
+ */
+int NaClFdTableGet(struct NaClFdTable *self, int fd);
+
+/*
+ * Binds the lowest free fd to |value|, which must not be negative, and
+ * returns it.  Returns -NACL_ABI_EMFILE if every fd is in use, or
+ * -NACL_ABI_ENOMEM if the table cannot grow.
+ */
+int NaClFdTableAlloc(struct NaClFdTable *self, int value);
+
+/*
+ * Like NaClFdTableAlloc, but binds the lowest free fd that is at least
+ * |min_fd|, as fcntl F_DUPFD does.  Returns -NACL_ABI_EINVAL if |min_fd|
+ * is negative or not below NACL_FD_TABLE_MAX.
+ */
+int NaClFdTableAllocFrom(struct NaClFdTable *self, int min_fd, int value);
+
+/*
+ * Binds |fd| to |value|, growing the table if needed; a negative |value|
+ * frees |fd|.  Returns the previous value (-1 if |fd| was free),
+ * -NACL_ABI_EBADF if |fd| is out of range, or -NACL_ABI_ENOMEM if the
+ * table cannot grow.
+ */
+int NaClFdTableSet(struct NaClFdTable *self, int fd, int value);
+
+/*
+ * Returns a bound on the open fds: every open fd is below it.  For walking
+ * the table with NaClFdTableGet.
+ */
+int NaClFdTableSize(struct NaClFdTable *self);
+
+EXTERN_C_END
+
+#endif  /* NATIVE_CLIENT_SRC_TRUSTED_SERVICE_RUNTIME_NACL_FD_TABLE_H_ */
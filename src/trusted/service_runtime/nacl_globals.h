@@ -59,13 +59,7 @@ struct NaClApp;
  */
 extern struct NaClThreadContext *master_ctx;
 
-extern double nacl_syscall_execution_time[NACL_MAX_SYSCALLS];
-extern double lind_syscall_execution_time[NACL_MAX_SYSCALLS];
-extern int nacl_syscall_invoked_times[NACL_MAX_SYSCALLS];
-extern int lind_syscall_invoked_times[NACL_MAX_SYSCALLS];
 extern int nacl_syscall_trace_level_counter;
-extern int nacl_syscall_counter;
-extern int lind_syscall_counter;
 extern double time_counter;
 extern double time_start;
 extern double time_end;
@@ -106,21 +100,6 @@ void  NaClGlobalModuleFini(void);
 /* this is defined in src/trusted/service_runtime/arch/<arch>/ sel_rt.h */
 void NaClInitGlobals(void);
 
-static INLINE void NaClPatchAddr(uintptr_t child_bits, uintptr_t parent_bits, uintptr_t *start, size_t size) {
-  size_t cnt = size / sizeof(uintptr_t);
-  for (size_t i = 0; i < cnt; i++) {
-    if ((start[i] & ~UNTRUSTED_ADDR_MASK) != parent_bits) {
-      continue;
-    }
-    NaClLog(1, "patching %p\n", (void *)start[i]);
-    /* clear upper bits */
-    start[i] &= UNTRUSTED_ADDR_MASK;
-    /* add child prefix */
-    start[i] |= child_bits;
-    NaClLog(1, "new addr %p\n", (void *)start[i]);
-  }
-}
-
 static INLINE struct NaClAppThread *NaClAppThreadGetFromIndex(uint32_t thread_index) {
   DCHECK(thread_index < NACL_THREAD_MAX);
   return NaClAppThreadFromThreadContext(nacl_user[thread_index]);
@@ -0,0 +1,169 @@
+/*
+ * Copyright (c) 2017 The Native Client Authors. All rights reserved.
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "native_client/src/shared/platform/nacl_log.h"
+#include "native_client/src/shared/platform/nacl_sync.h"
+#include "native_client/src/shared/platform/nacl_sync_checked.h"
+#include "native_client/src/trusted/desc/nacl_desc_base.h"
+#include "native_client/src/trusted/service_runtime/include/sys/stat.h"
+#include "native_client/src/trusted/service_runtime/nacl_image_cache.h"
+#include "native_client/src/trusted/service_runtime/sel_ldr.h"
+
+/* A runtime normally loads one or two distinct nexes. */
+#define NACL_IMAGE_CACHE_MAX 8
+
+static struct NaClMutex         g_image_cache_mu;
+static struct NaClStaticImage   *g_image_cache;
+static int                      g_image_cache_count;
+
+static void NaClStaticImageDelete(struct NaClStaticImage *image) {
+  free(image->filename);
+  free(image->text);
+  free(image->data);
+  free(image);
+}
+
+void NaClImageCacheModuleInit(void) {
+  NaClXMutexCtor(&g_image_cache_mu);
+}
+
+void NaClImageCacheModuleFini(void) {
+  struct NaClStaticImage *image;
+
+  while (NULL != (image = g_image_cache)) {
+    g_image_cache = image->next;
+    NaClStaticImageDelete(image);
+  }
+  g_image_cache_count = 0;
+  NaClMutexDtor(&g_image_cache_mu);
+}
+
+static int NaClImageCacheValidates(struct NaClApp *nap) {
+  return !nap->skip_validator && !nap->ignore_validator_result;
+}
+
+static int NaClImageCacheKeyEqual(struct NaClStaticImageKey const *a,
+                                  struct NaClStaticImageKey const *b) {
+  return a->dev == b->dev && a->ino == b->ino && a->size == b->size &&
+         a->mtime == b->mtime && a->mtimensec == b->mtimensec;
+}
+
+int NaClImageCacheKeyFromDesc(struct NaClDesc *nd,
+                              struct NaClStaticImageKey *key) {
+  struct nacl_abi_stat st;
+  int rv;
+
+  rv = (*NACL_VTBL(NaClDesc, nd)->Fstat)(nd, &st);
+  if (0 != rv) {
+    NaClLog(2, "NaClImageCacheKeyFromDesc: fstat failed, error %d\n", rv);
+    return 0;
+  }
+  memset(key, 0, sizeof *key);
+  key->dev = st.nacl_abi_st_dev;
+  key->ino = st.nacl_abi_st_ino;
+  key->size = st.nacl_abi_st_size;
+  key->mtime = st.nacl_abi_st_mtime;
+  key->mtimensec = st.nacl_abi_st_mtimensec;
+  return 1;
+}
+
+struct NaClStaticImage const *NaClImageCacheLookup(
+    struct NaClApp *nap,
+    struct NaClStaticImageKey const *key) {
+  struct NaClStaticImage *image;
+
+  NaClXMutexLock(&g_image_cache_mu);
+  for (image = g_image_cache; NULL != image; image = image->next) {
+    if (!NaClImageCacheKeyEqual(&image->key, key) ||
+        image->validator_stub_out_mode != nap->validator_stub_out_mode) {
+      continue;
+    }
+    /* an image loaded without validation only serves cages that skip it */
+    if (image->validated || !NaClImageCacheValidates(nap)) {
+      break;
+    }
+  }
+  NaClXMutexUnlock(&g_image_cache_mu);
+  return image;
+}
+
+void NaClImageCacheRecord(struct NaClApp *nap,
+                          struct NaClStaticImageKey const *key,
+                          char const *filename) {
+  struct NaClStaticImage *image;
+  uintptr_t data_addr;
+  uintptr_t data_end;
+  int kept = 0;
+
+  if (NULL != NaClImageCacheLookup(nap, key)) {
+    return;
+  }
+  image = calloc(1, sizeof *image);
+  if (NULL == image) {
+    return;
+  }
+  image->key = *key;
+  image->filename = strdup(filename);
+  image->validated = NaClImageCacheValidates(nap);
+  image->validator_stub_out_mode = nap->validator_stub_out_mode;
+  image->static_text_end = nap->static_text_end;
+  image->code_segment_size = nap->code_segment_size;
+  image->rodata_start = nap->rodata_start;
+  image->data_start = nap->data_start;
+  image->data_end = nap->data_end;
+  image->break_addr = nap->break_addr;
+  image->initial_entry_pt = nap->initial_entry_pt;
+  image->bundle_size = nap->bundle_size;
+
+  /* same bounds NaClMemoryProtection makes readable */
+  image->text_size = nap->static_text_end - NACL_TRAMPOLINE_END;
+  image->text = malloc(image->text_size);
+  if (0 != nap->rodata_start) {
+    data_addr = nap->rodata_start;
+  } else if (0 != nap->data_start) {
+    data_addr = NaClTruncAllocPage(nap->data_start);
+  } else {
+    data_addr = 0;
+  }
+  data_end = 0 != data_addr ? NaClRoundAllocPage(nap->data_end) : 0;
+  image->data_addr = data_addr;
+  image->data_size = data_end - data_addr;
+  if (0 != image->data_size) {
+    image->data = malloc(image->data_size);
+  }
+  if (NULL == image->filename || NULL == image->text ||
+      (0 != image->data_size && NULL == image->data)) {
+    NaClStaticImageDelete(image);
+    return;
+  }
+  memcpy(image->text, (void *) NaClUserToSys(nap, NACL_TRAMPOLINE_END),
+         image->text_size);
+  if (0 != image->data_size) {
+    memcpy(image->data, (void *) NaClUserToSys(nap, data_addr),
+           image->data_size);
+  }
+
+  NaClXMutexLock(&g_image_cache_mu);
+  if (g_image_cache_count < NACL_IMAGE_CACHE_MAX) {
+    image->next = g_image_cache;
+    g_image_cache = image;
+    ++g_image_cache_count;
+    kept = 1;
+  }
+  NaClXMutexUnlock(&g_image_cache_mu);
+
+  if (!kept) {
+    NaClLog(2, "NaClImageCacheRecord: cache full, not keeping %s\n", filename);
+    NaClStaticImageDelete(image);
+    return;
+  }
+  NaClLog(2, "NaClImageCacheRecord: cached %s (%"NACL_PRIuS" bytes text,"
+          " %"NACL_PRIuS" bytes data)\n",
+          filename, image->text_size, image->data_size);
+}
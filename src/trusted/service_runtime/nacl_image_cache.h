@@ -0,0 +1,101 @@
+/*
+ * Copyright (c) 2017 The Native Client Authors. All rights reserved.
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file.
+ */
+
+/*
+ * Cache of loaded, validated static images, shared by every cage in the
+ * runtime.  fork and execve build each new cage from the same nexe
+ * (normally runnable-ld.so); once it has been loaded and validated, the
+ * image is kept here so later cages copy it in without parsing the file
+ * or running the validator again.  Images are keyed on the identity and
+ * modification time of the opened file, not its name, so a nexe that is
+ * replaced or rewritten under the same name is loaded afresh.
+ */
+
+#ifndef NATIVE_CLIENT_SRC_TRUSTED_SERVICE_RUNTIME_NACL_IMAGE_CACHE_H_
+#define NATIVE_CLIENT_SRC_TRUSTED_SERVICE_RUNTIME_NACL_IMAGE_CACHE_H_
+
+#include "native_client/src/include/portability.h"
+
+EXTERN_C_BEGIN
+
+struct NaClApp;
+struct NaClDesc;
+
+/* What an opened nexe is known by: fstat's device, inode, size and mtime. */
+struct NaClStaticImageKey {
+  int64_t                 dev;
+  uint64_t                ino;
+  int64_t                 size;
+  int64_t                 mtime;
+  int64_t                 mtimensec;
+};
+
+/*
+ * Snapshot of a static image as NaClAppLoadFile left it, before any
+ * untrusted code ran.  The trampolines are not kept, since every NaClApp
+ * installs its own.  Addresses are untrusted (user) addresses.
+ */
+struct NaClStaticImage {
+  struct NaClStaticImage  *next;
+  struct NaClStaticImageKey key;
+  /* for logging only */
+  char                    *filename;
+  /* the validation policy in force when the image was loaded */
+  int                     validated;
+  int                     validator_stub_out_mode;
+
+  uintptr_t               static_text_end;
+  size_t                  code_segment_size;
+  uintptr_t               rodata_start;
+  uintptr_t               data_start;
+  uintptr_t               data_end;
+  uintptr_t               break_addr;
+  uintptr_t               initial_entry_pt;
+  int                     bundle_size;
+
+  /* [NACL_TRAMPOLINE_END, static_text_end), halt padding included */
+  void                    *text;
+  size_t                  text_size;
+  /* rodata and initialized data, up to NaClRoundAllocPage(data_end) */
+  uintptr_t               data_addr;
+  void                    *data;
+  size_t                  data_size;
+};
+
+void NaClImageCacheModuleInit(void);
+
+void NaClImageCacheModuleFini(void);
+
+/*
+ * Fills in |key| from the opened nexe |nd|.  Returns 0 if it cannot be
+ * stat'ed, in which case the image must not be looked up or recorded.
+ */
+int NaClImageCacheKeyFromDesc(struct NaClDesc *nd,
+                              struct NaClStaticImageKey *key);
+
+/*
+ * Returns the cached image of the file known by |key| if there is one
+ * that |nap| may use without validation, otherwise NULL.  Images are
+ * never evicted, so the result stays valid for the life of the runtime.
+ * The caller still applies |nap|'s own load limits to it.
+ */
+struct NaClStaticImage const *NaClImageCacheLookup(
+    struct NaClApp *nap,
+    struct NaClStaticImageKey const *key);
+
+/*
+ * Records the image that NaClAppLoadFile has just loaded into |nap| from
+ * the file known by |key|, opened as |filename|.  Must be called before
+ * |nap| runs any untrusted code.  Failure to record is not an error; the
+ * next load just misses.
+ */
+void NaClImageCacheRecord(struct NaClApp *nap,
+                          struct NaClStaticImageKey const *key,
+                          char const *filename);
+
+EXTERN_C_END
+
+#endif  /* NATIVE_CLIENT_SRC_TRUSTED_SERVICE_RUNTIME_NACL_IMAGE_CACHE_H_ */
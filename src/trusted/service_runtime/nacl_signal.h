@@ -56,6 +56,9 @@ struct NaClExceptionFrame;
 #define NACL_ABI_WIFSIGNALED(status) ((((status) + 1) & 0x7f) > 1)
 #define NACL_ABI_W_EXITCODE(ret, sig) ((((ret) & 0xff) << 8) + ((sig) & 0x7f))
 
+/* waitpid() options */
+#define NACL_ABI_WNOHANG 1
+
 #if NACL_WINDOWS
 enum PosixSignals {
   SIGINT  = 2,
@@ -0,0 +1,358 @@
+/*
+ * Copyright (c) 2017 The Native Client Authors. All rights reserved.
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file.
+ */
+
+#include <errno.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "native_client/src/shared/platform/nacl_log.h"
+#include "native_client/src/shared/platform/nacl_sync.h"
+#include "native_client/src/shared/platform/nacl_sync_checked.h"
+#include "native_client/src/trusted/service_runtime/nacl_stat_cache.h"
+
+#define NUM_BUCKETS (1 << NACL_STAT_CACHE_BUCKET_BITS)
+
+#define NS_PER_MS 1000000ULL
+
+struct NaClStatCacheEntry {
+  struct NaClStatCacheEntry *next;
+  uint32_t                  hash;
+  uint32_t                  generation;
+  uint64_t                  expires_ns;
+  int32_t                   result;
+  nacl_host_stat_t          st;
+  size_t                    len;
+  char                      path[1];
+};
+
+struct NaClStatCacheBucket {
+  struct NaClMutex          mu;
+  struct NaClStatCacheEntry *head;
+  int                       count;
+  /* flushes is counted in g_flushes instead */
+  struct NaClStatCacheStats stats;
+};
+
+static struct NaClStatCacheBucket g_buckets[NUM_BUCKETS];
+static int g_initialized;
+
+static uint64_t g_ttl_ns = NACL_STAT_CACHE_DEFAULT_TTL_MS * NS_PER_MS;
+static uint64_t g_negative_ttl_ns =
+    NACL_STAT_CACHE_DEFAULT_NEGATIVE_TTL_MS * NS_PER_MS;
+
+/* entries of an older generation were flushed and are freed lazily */
+static uint32_t volatile g_generation;
+/*
+ * Bumped by every invalidation and flush.  A lookup that misses hands
+ * out the value it saw, and the insert that follows the host stat is
+ * refused if it has moved on: the stat may have raced with the change.
+ */
+static uint32_t volatile g_stamp;
+static uint64_t volatile g_flushes;
+
+static uint64_t NowNs(void) {
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t) ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static int NaClStatCacheEnabled(void) {
+  return g_initialized && (0 != g_ttl_ns || 0 != g_negative_ttl_ns);
+}
+
+/* FNV-1a */
+static uint32_t HashPath(char const *path, size_t len) {
+  uint32_t hash = 2166136261U;
+  size_t i;
+
+  for (i = 0; i < len; ++i) {
+    hash ^= (unsigned char) path[i];
+    hash *= 16777619U;
+  }
+  return hash;
+}
+
+/* "/" or "/a/b": no empty, "." or ".." components */
+static int IsCanonical(char const *path, size_t len) {
+  size_t start;
+  size_t end;
+
+  if (0 == len || '/' != path[0]) {
+    return 0;
+  }
+  if (1 == len) {
+    return 1;
+  }
+  for (start = 1; start <= len; start = end + 1) {
+    for (end = start; end < len && '/' != path[end]; ++end) {
+    }
+    if (end == start ||
+        (end - start == 1 && '.' == path[start]) ||
+        (end - start == 2 && '.' == path[start] && '.' == path[start + 1])) {
+      return 0;
+    }
+  }
+  return 1;
+}
+
+static void UnlinkEntry(struct NaClStatCacheBucket *b,
+                        struct NaClStatCacheEntry **link) {
+  struct NaClStatCacheEntry *e = *link;
+
+  *link = e->next;
+  --b->count;
+  free(e);
+}
+
+void NaClStatCacheModuleInit(void) {
+  int i;
+
+  for (i = 0; i < NUM_BUCKETS; ++i) {
+    NaClXMutexCtor(&g_buckets[i].mu);
+  }
+  g_initialized = 1;
+}
+
+void NaClStatCacheModuleFini(void) {
+  int i;
+
+  if (!g_initialized) {
+    return;
+  }
+  g_initialized = 0;
+  for (i = 0; i < NUM_BUCKETS; ++i) {
+    struct NaClStatCacheBucket *b = &g_buckets[i];
+
+    while (NULL != b->head) {
+      UnlinkEntry(b, &b->head);
+    }
+    memset(&b->stats, 0, sizeof b->stats);
+    NaClMutexDtor(&b->mu);
+  }
+  g_flushes = 0;
+}
+
+void NaClStatCacheSetTtl(uint32_t ttl_ms, uint32_t negative_ttl_ms) {
+  g_ttl_ns = ttl_ms * NS_PER_MS;
+  g_negative_ttl_ns = negative_ttl_ms * NS_PER_MS;
+  NaClStatCacheFlush();
+}
+
+int NaClStatCacheParseTtl(char const *spec) {
+  char *end;
+  unsigned long ttl_ms;
+  unsigned long negative_ttl_ms;
+
+  errno = 0;
+  ttl_ms = strtoul(spec, &end, 10);
+  if (end == spec || 0 != errno || ttl_ms > UINT32_MAX) {
+    return 0;
+  }
+  negative_ttl_ms = 0;
+  if (':' == *end) {
+    spec = end + 1;
+    negative_ttl_ms = strtoul(spec, &end, 10);
+    if (end == spec || 0 != errno || negative_ttl_ms > UINT32_MAX) {
+      return 0;
+    }
+  }
+  if ('\0' != *end) {
+    return 0;
+  }
+  NaClStatCacheSetTtl((uint32_t) ttl_ms, (uint32_t) negative_ttl_ms);
+  return 1;
+}
+
+int NaClStatCacheLookup(char const        *path,
+                        nacl_host_stat_t  *st,
+                        int32_t           *result,
+                        uint32_t          *stamp) {
+  struct NaClStatCacheBucket *b;
+  struct NaClStatCacheEntry **link;
+  struct NaClStatCacheEntry *e;
+  size_t len = strlen(path);
+  uint32_t hash;
+  int hit = 0;
+
+  *stamp = g_stamp;
+  if (!NaClStatCacheEnabled() || !IsCanonical(path, len)) {
+    return 0;
+  }
+  hash = HashPath(path, len);
+  b = &g_buckets[hash & (NUM_BUCKETS - 1)];
+
+  NaClXMutexLock(&b->mu);
+  ++b->stats.lookups;
+  for (link = &b->head; NULL != (e = *link); link = &e->next) {
+    if (e->hash != hash || e->len != len || 0 != memcmp(e->path, path, len)) {
+      continue;
+    }
+    if (e->generation != g_generation) {
+      UnlinkEntry(b, link);
+    } else if (NowNs() >= e->expires_ns) {
+      ++b->stats.expired;
+      UnlinkEntry(b, link);
+    } else {
+      *result = e->result;
+      if (0 == e->result) {
+        *st = e->st;
+      } else {
+        ++b->stats.negative_hits;
+      }
+      ++b->stats.hits;
+      hit = 1;
+    }
+    break;
+  }
+  NaClXMutexUnlock(&b->mu);
+  return hit;
+}
+
+void NaClStatCacheInsert(char const             *path,
+                         uint32_t               stamp,
+                         int32_t                result,
+                         nacl_host_stat_t const *st) {
+  struct NaClStatCacheBucket *b;
+  struct NaClStatCacheEntry **link;
+  struct NaClStatCacheEntry **victim = NULL;
+  struct NaClStatCacheEntry *e;
+  struct NaClStatCacheEntry *fresh;
+  size_t len = strlen(path);
+  uint64_t ttl_ns;
+  uint32_t generation;
+
+  if (!NaClStatCacheEnabled()) {
+    return;
+  }
+  if (0 == result) {
+    ttl_ns = g_ttl_ns;
+  } else if (-ENOENT == result) {
+    ttl_ns = g_negative_ttl_ns;
+  } else {
+    return;
+  }
+  if (0 == ttl_ns || !IsCanonical(path, len)) {
+    return;
+  }
+  fresh = malloc(offsetof(struct NaClStatCacheEntry, path) + len + 1);
+  if (NULL == fresh) {
+    return;
+  }
+  fresh->hash = HashPath(path, len);
+  fresh->expires_ns = NowNs() + ttl_ns;
+  fresh->result = result;
+  if (0 == result) {
+    fresh->st = *st;
+  } else {
+    memset(&fresh->st, 0, sizeof fresh->st);
+  }
+  fresh->len = len;
+  memcpy(fresh->path, path, len + 1);
+  b = &g_buckets[fresh->hash & (NUM_BUCKETS - 1)];
+
+  NaClXMutexLock(&b->mu);
+  if (stamp != g_stamp) {
+    NaClXMutexUnlock(&b->mu);
+    free(fresh);
+    return;
+  }
+  generation = g_generation;
+  fresh->generation = generation;
+  link = &b->head;
+  while (NULL != (e = *link)) {
+    if (e->generation != generation ||
+        (e->hash == fresh->hash && e->len == len &&
+         0 == memcmp(e->path, path, len))) {
+      UnlinkEntry(b, link);
+      continue;
+    }
+    if (NULL == victim || e->expires_ns < (*victim)->expires_ns) {
+      victim = link;
+    }
+    link = &e->next;
+  }
+  /* a full bucket gives up the entry closest to expiring */
+  if (b->count >= NACL_STAT_CACHE_BUCKET_ENTRIES) {
+    UnlinkEntry(b, victim);
+  }
+  fresh->next = b->head;
+  b->head = fresh;
+  ++b->count;
+  ++b->stats.inserts;
+  NaClXMutexUnlock(&b->mu);
+}
+
+static void NaClStatCacheDrop(char const *path, size_t len) {
+  struct NaClStatCacheBucket *b;
+  struct NaClStatCacheEntry **link;
+  struct NaClStatCacheEntry *e;
+  uint32_t hash = HashPath(path, len);
+
+  b = &g_buckets[hash & (NUM_BUCKETS - 1)];
+  NaClXMutexLock(&b->mu);
+  for (link = &b->head; NULL != (e = *link); link = &e->next) {
+    if (e->hash == hash && e->len == len && 0 == memcmp(e->path, path, len)) {
+      if (e->generation == g_generation) {
+        ++b->stats.invalidations;
+      }
+      UnlinkEntry(b, link);
+      break;
+    }
+  }
+  /* bumped even if nothing was cached: a lookup may be in flight */
+  __sync_fetch_and_add(&g_stamp, 1);
+  NaClXMutexUnlock(&b->mu);
+}
+
+void NaClStatCacheInvalidate(char const *path, int parent) {
+  size_t len = strlen(path);
+  size_t slash;
+
+  if (!NaClStatCacheEnabled()) {
+    return;
+  }
+  if (!IsCanonical(path, len)) {
+    NaClStatCacheFlush();
+    return;
+  }
+  NaClStatCacheDrop(path, len);
+  if (parent && len > 1) {
+    for (slash = len - 1; '/' != path[slash]; --slash) {
+    }
+    NaClStatCacheDrop(path, 0 == slash ? 1 : slash);
+  }
+}
+
+void NaClStatCacheFlush(void) {
+  __sync_fetch_and_add(&g_generation, 1);
+  __sync_fetch_and_add(&g_stamp, 1);
+  __sync_fetch_and_add(&g_flushes, 1);
+}
+
+void NaClStatCacheGetStats(struct NaClStatCacheStats *stats) {
+  int i;
+
+  memset(stats, 0, sizeof *stats);
+  if (!g_initialized) {
+    return;
+  }
+  for (i = 0; i < NUM_BUCKETS; ++i) {
+    struct NaClStatCacheBucket *b = &g_buckets[i];
+
+    NaClXMutexLock(&b->mu);
+    stats->lookups += b->stats.lookups;
+    stats->hits += b->stats.hits;
+    stats->negative_hits += b->stats.negative_hits;
+    stats->expired += b->stats.expired;
+    stats->inserts += b->stats.inserts;
+    stats->invalidations += b->stats.invalidations;
+    NaClXMutexUnlock(&b->mu);
+  }
+  stats->flushes = g_flushes;
+}
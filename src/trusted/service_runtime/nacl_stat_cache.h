@@ -0,0 +1,112 @@
+/*
+ * Copyright (c) 2017 The Native Client Authors. All rights reserved.
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file.
+ */
+
+/*
+ * Path lookup cache.  Remembers, per sandbox runtime, what a host stat of
+ * a path returned: its attributes, or that it does not exist.  Open, stat
+ * and lstat consult it before going to the host, so the repeated lookups
+ * of the same paths that a loader or a build makes cost one host call per
+ * path per TTL instead of one each.
+ *
+ * Entries are dropped when the runtime itself changes the path: unlink,
+ * mkdir, rmdir, open with O_CREAT or O_TRUNC (which also drop the parent
+ * directory's entry), and writes through a descriptor opened by path.
+ * Lind calls that change the namespace or write a file, whose paths are
+ * not parsed here, flush the whole cache.  Changes made by other
+ * processes, and changes seen through another name for the same file (a
+ * symlink or hard link), are only picked up once the entry expires; the
+ * TTLs bound how stale a result can be.
+ *
+ * The cache is off unless sel_ldr is given -T, since it can hide another
+ * process's changes for up to a TTL.  Remembering nonexistence is riskier
+ * still -- a file some other process creates keeps failing to open with
+ * ENOENT -- so it has to be asked for separately.
+ *
+ * Only absolute paths in canonical form ("/a/b", no "." or ".." parts, no
+ * repeated or trailing '/') are cached, so that every entry names one path
+ * no matter what the cage's working directory is.  Other paths go straight
+ * to the host, and a change made through one flushes the cache.
+ */
+
+#ifndef NATIVE_CLIENT_SRC_TRUSTED_SERVICE_RUNTIME_NACL_STAT_CACHE_H_
+#define NATIVE_CLIENT_SRC_TRUSTED_SERVICE_RUNTIME_NACL_STAT_CACHE_H_
+
+#include "native_client/src/include/portability.h"
+#include "native_client/src/shared/platform/nacl_host_desc.h"
+
+EXTERN_C_BEGIN
+
+#define NACL_STAT_CACHE_DEFAULT_TTL_MS           0
+#define NACL_STAT_CACHE_DEFAULT_NEGATIVE_TTL_MS  0
+
+/* 2**10 buckets of at most 8 entries: 8192 paths at most */
+#define NACL_STAT_CACHE_BUCKET_BITS     10
+#define NACL_STAT_CACHE_BUCKET_ENTRIES  8
+
+struct NaClStatCacheStats {
+  uint64_t  lookups;        /* of cacheable paths, while enabled */
+  uint64_t  hits;           /* including negative_hits */
+  uint64_t  negative_hits;
+  uint64_t  expired;        /* found, but past its TTL */
+  uint64_t  inserts;
+  uint64_t  invalidations;  /* entries dropped for a change to their path */
+  uint64_t  flushes;
+};
+
+void NaClStatCacheModuleInit(void);
+
+void NaClStatCacheModuleFini(void);
+
+/*
+ * Sets how long, in milliseconds, attributes (|ttl_ms|) and nonexistence
+ * (|negative_ttl_ms|) are remembered.  0 turns that kind of entry off.
+ * Call before any other thread is created.
+ */
+void NaClStatCacheSetTtl(uint32_t ttl_ms, uint32_t negative_ttl_ms);
+
+/*
+ * Sets the TTLs from a "<ttl_ms>[:<negative_ttl_ms>]" option string; the
+ * negative TTL is 0 unless given.  Returns 0 if |spec| is malformed.
+ */
+int NaClStatCacheParseTtl(char const *spec);
+
+/*
+ * Looks |path| up.  On a hit, returns 1 with |*result| set to what
+ * NaClHostDescStat returned and, if that was 0, |*st| to the attributes.
+ * On a miss returns 0; |*stamp| is then to be passed to
+ * NaClStatCacheInsert along with the result of the host stat.
+ */
+int NaClStatCacheLookup(char const        *path,
+                        nacl_host_stat_t  *st,
+                        int32_t           *result,
+                        uint32_t          *stamp);
+
+/*
+ * Remembers that NaClHostDescStat(|path|) returned |result|.  Only success
+ * and -ENOENT are remembered.  Nothing is stored if the cache was
+ * invalidated since the lookup that produced |stamp|, since the host stat
+ * may then have seen the path before the change.
+ */
+void NaClStatCacheInsert(char const             *path,
+                         uint32_t               stamp,
+                         int32_t                result,
+                         nacl_host_stat_t const *st);
+
+/*
+ * Drops the entry for |path|, and for its parent directory if |parent|,
+ * after the runtime has changed them.  Flushes the cache if |path| is
+ * not in canonical form.
+ */
+void NaClStatCacheInvalidate(char const *path, int parent);
+
+/* Drops every entry. */
+void NaClStatCacheFlush(void);
+
+void NaClStatCacheGetStats(struct NaClStatCacheStats *stats);
+
+EXTERN_C_END
+
+#endif  /* NATIVE_CLIENT_SRC_TRUSTED_SERVICE_RUNTIME_NACL_STAT_CACHE_H_ */
@@ -0,0 +1,241 @@
+/*
+ * Copyright (c) 2017 The Native Client Authors. All rights reserved.
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file.
+ */
+
+/*
+ * Checks the path lookup cache: the defaults and the -T option string,
+ * positive and negative hits, expiry, invalidation of a path and its
+ * parent, refused racing inserts, which paths are cached, bucket eviction
+ * and the counters.
+ */
+
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include "native_client/src/include/nacl_macros.h"
+#include "native_client/src/include/portability.h"
+#include "native_client/src/include/portability_io.h"
+#include "native_client/src/shared/platform/nacl_check.h"
+#include "native_client/src/shared/platform/nacl_log.h"
+#include "native_client/src/trusted/service_runtime/nacl_stat_cache.h"
+
+#define NUM_SLOTS \
+    (NACL_STAT_CACHE_BUCKET_ENTRIES << NACL_STAT_CACHE_BUCKET_BITS)
+
+#define TEST_TTL_MS 1000
+
+static nacl_host_stat_t StatWithSize(long size) {
+  nacl_host_stat_t st;
+
+  memset(&st, 0, sizeof st);
+  st.st_size = size;
+  return st;
+}
+
+/* looks |path| up and, on a miss, inserts what a host stat returned */
+static int LookupOrInsert(char const *path, int32_t host_result, long size,
+                          int32_t *result, nacl_host_stat_t *st) {
+  uint32_t stamp;
+  nacl_host_stat_t host_st = StatWithSize(size);
+
+  if (NaClStatCacheLookup(path, st, result, &stamp)) {
+    return 1;
+  }
+  NaClStatCacheInsert(path, stamp, host_result, &host_st);
+  *result = host_result;
+  *st = host_st;
+  return 0;
+}
+
+static void SleepMs(long ms) {
+  struct timespec ts;
+
+  ts.tv_sec = ms / 1000;
+  ts.tv_nsec = (ms % 1000) * 1000000;
+  while (0 != nanosleep(&ts, &ts)) {
+  }
+}
+
+static void TestHits(void) {
+  nacl_host_stat_t st;
+  int32_t result;
+
+  CHECK(!LookupOrInsert("/lib/libc.so", 0, 100, &result, &st));
+  CHECK(LookupOrInsert("/lib/libc.so", 0, 999, &result, &st));
+  CHECK(0 == result);
+  CHECK(100 == st.st_size);
+
+  CHECK(!LookupOrInsert("/lib/tls/libc.so", -ENOENT, 0, &result, &st));
+  CHECK(LookupOrInsert("/lib/tls/libc.so", 0, 0, &result, &st));
+  CHECK(-ENOENT == result);
+
+  /* other errors are not remembered */
+  CHECK(!LookupOrInsert("/lib/secret", -EACCES, 0, &result, &st));
+  CHECK(!LookupOrInsert("/lib/secret", -EACCES, 0, &result, &st));
+}
+
+static void TestPaths(void) {
+  static char const *const kUncached[] = {
+    "lib/libc.so", "./libc.so", "/lib/../etc/passwd", "/lib/./libc.so",
+    "/lib//libc.so", "/lib/", "/lib/.", "/lib/..", "",
+  };
+  nacl_host_stat_t st;
+  int32_t result;
+  size_t i;
+
+  for (i = 0; i < NACL_ARRAY_SIZE(kUncached); ++i) {
+    CHECK(!LookupOrInsert(kUncached[i], 0, 1, &result, &st));
+    CHECK(!LookupOrInsert(kUncached[i], 0, 1, &result, &st));
+  }
+  CHECK(!LookupOrInsert("/", 0, 1, &result, &st));
+  CHECK(LookupOrInsert("/", 0, 1, &result, &st));
+  CHECK(!LookupOrInsert("/.lib/..a", 0, 1, &result, &st));
+  CHECK(LookupOrInsert("/.lib/..a", 0, 1, &result, &st));
+}
+
+static void TestInvalidate(void) {
+  nacl_host_stat_t st;
+  int32_t result;
+  uint32_t stamp;
+
+  CHECK(!LookupOrInsert("/tmp", 0, 4096, &result, &st));
+  CHECK(!LookupOrInsert("/tmp/out", -ENOENT, 0, &result, &st));
+  CHECK(!LookupOrInsert("/tmp/other", 0, 7, &result, &st));
+
+  /* creating /tmp/out changes it and the directory, not its siblings */
+  NaClStatCacheInvalidate("/tmp/out", 1);
+  CHECK(!NaClStatCacheLookup("/tmp/out", &st, &result, &stamp));
+  CHECK(!NaClStatCacheLookup("/tmp", &st, &result, &stamp));
+  CHECK(NaClStatCacheLookup("/tmp/other", &st, &result, &stamp));
+
+  /* the parent of a top level path is the root */
+  (void) LookupOrInsert("/", 0, 1, &result, &st);
+  NaClStatCacheInvalidate("/tmp", 1);
+  CHECK(!NaClStatCacheLookup("/", &st, &result, &stamp));
+  CHECK(NaClStatCacheLookup("/tmp/other", &st, &result, &stamp));
+
+  /* a change through a relative path could be to anything */
+  NaClStatCacheInvalidate("other", 0);
+  CHECK(!NaClStatCacheLookup("/tmp/other", &st, &result, &stamp));
+
+  /* an insert racing with an invalidation is dropped */
+  CHECK(!NaClStatCacheLookup("/tmp/race", &st, &result, &stamp));
+  NaClStatCacheInvalidate("/tmp/race", 0);
+  st = StatWithSize(1);
+  NaClStatCacheInsert("/tmp/race", stamp, 0, &st);
+  CHECK(!LookupOrInsert("/tmp/race", 0, 2, &result, &st));
+  CHECK(LookupOrInsert("/tmp/race", 0, 3, &result, &st));
+  CHECK(2 == st.st_size);
+}
+
+static void TestExpiry(void) {
+  nacl_host_stat_t st;
+  int32_t result;
+
+  NaClStatCacheSetTtl(50, 0);
+  CHECK(!LookupOrInsert("/etc/hosts", 0, 1, &result, &st));
+  CHECK(LookupOrInsert("/etc/hosts", 0, 1, &result, &st));
+  CHECK(!LookupOrInsert("/etc/nothing", -ENOENT, 0, &result, &st));
+  CHECK(!LookupOrInsert("/etc/nothing", -ENOENT, 0, &result, &st));
+  SleepMs(100);
+  CHECK(!LookupOrInsert("/etc/hosts", 0, 1, &result, &st));
+
+  NaClStatCacheSetTtl(0, 0);
+  CHECK(!LookupOrInsert("/etc/hosts", 0, 1, &result, &st));
+  CHECK(!LookupOrInsert("/etc/hosts", 0, 1, &result, &st));
+  NaClStatCacheSetTtl(TEST_TTL_MS, TEST_TTL_MS);
+}
+
+static void TestDefaults(void) {
+  nacl_host_stat_t st;
+  int32_t result;
+
+  /* off until asked for */
+  CHECK(!LookupOrInsert("/etc/hosts", 0, 1, &result, &st));
+  CHECK(!LookupOrInsert("/etc/hosts", 0, 1, &result, &st));
+
+  /* a single TTL leaves nonexistence uncached */
+  CHECK(NaClStatCacheParseTtl("1000"));
+  CHECK(!LookupOrInsert("/etc/hosts", 0, 1, &result, &st));
+  CHECK(LookupOrInsert("/etc/hosts", 0, 1, &result, &st));
+  CHECK(!LookupOrInsert("/etc/nothing", -ENOENT, 0, &result, &st));
+  CHECK(!LookupOrInsert("/etc/nothing", -ENOENT, 0, &result, &st));
+
+  CHECK(NaClStatCacheParseTtl("1000:1000"));
+  CHECK(!LookupOrInsert("/etc/nothing", -ENOENT, 0, &result, &st));
+  CHECK(LookupOrInsert("/etc/nothing", -ENOENT, 0, &result, &st));
+
+  CHECK(!NaClStatCacheParseTtl(""));
+  CHECK(!NaClStatCacheParseTtl("1000:"));
+  CHECK(!NaClStatCacheParseTtl("1000x"));
+  NaClStatCacheSetTtl(TEST_TTL_MS, TEST_TTL_MS);
+}
+
+static void TestEviction(void) {
+  nacl_host_stat_t st;
+  int32_t result;
+  char path[32];
+  int i;
+  int cached = 0;
+
+  NaClStatCacheFlush();
+  for (i = 0; i < 4 * NUM_SLOTS; ++i) {
+    SNPRINTF(path, sizeof path, "/f%d", i);
+    (void) LookupOrInsert(path, 0, i, &result, &st);
+  }
+  for (i = 0; i < 4 * NUM_SLOTS; ++i) {
+    uint32_t stamp;
+
+    SNPRINTF(path, sizeof path, "/f%d", i);
+    if (NaClStatCacheLookup(path, &st, &result, &stamp)) {
+      CHECK(i == st.st_size);
+      ++cached;
+    }
+  }
+  CHECK(cached > 0);
+  CHECK(cached <= NUM_SLOTS);
+}
+
+static void TestStats(void) {
+  struct NaClStatCacheStats stats;
+  nacl_host_stat_t st;
+  int32_t result;
+
+  NaClStatCacheModuleFini();
+  NaClStatCacheModuleInit();
+  CHECK(!LookupOrInsert("/a", 0, 1, &result, &st));
+  CHECK(LookupOrInsert("/a", 0, 1, &result, &st));
+  CHECK(!LookupOrInsert("/b", -ENOENT, 0, &result, &st));
+  CHECK(LookupOrInsert("/b", -ENOENT, 0, &result, &st));
+  CHECK(!LookupOrInsert("c", 0, 0, &result, &st));
+  NaClStatCacheInvalidate("/a", 0);
+  NaClStatCacheFlush();
+
+  NaClStatCacheGetStats(&stats);
+  CHECK(4 == stats.lookups);
+  CHECK(2 == stats.hits);
+  CHECK(1 == stats.negative_hits);
+  CHECK(2 == stats.inserts);
+  CHECK(1 == stats.invalidations);
+  CHECK(1 == stats.flushes);
+}
+
+int main(void) {
+  NaClLogModuleInit();
+  NaClStatCacheModuleInit();
+  TestDefaults();
+  TestHits();
+  TestPaths();
+  TestInvalidate();
+  TestExpiry();
+  TestEviction();
+  TestStats();
+  NaClStatCacheModuleFini();
+  NaClLogModuleFini();
+  printf("PASSED\n");
+  return 0;
+}
@@ -15,6 +15,7 @@
 #undef _POSIX_C_SOURCE
 #undef _XOPEN_SOURCE
 
+#include <errno.h>
 #include <stdio.h>
 #include <Python.h>
 #include <string.h>
@@ -32,6 +33,7 @@
 #include "native_client/src/shared/platform/nacl_check.h"
 #include "native_client/src/shared/platform/nacl_clock.h"
 #include "native_client/src/shared/platform/nacl_exit.h"
+#include "native_client/src/shared/platform/nacl_futex.h"
 #include "native_client/src/shared/platform/nacl_host_desc.h"
 #include "native_client/src/shared/platform/nacl_host_dir.h"
 #include "native_client/src/shared/platform/nacl_log.h"
@@ -47,6 +49,7 @@
 #include "native_client/src/trusted/desc/nacl_desc_invalid.h"
 #include "native_client/src/trusted/desc/nacl_desc_io.h"
 #include "native_client/src/trusted/desc/nacl_desc_mutex.h"
+#include "native_client/src/trusted/desc/nacl_desc_pipe.h"
 #include "native_client/src/trusted/desc/nacl_desc_semaphore.h"
 #include "native_client/src/trusted/desc/nrd_xfer.h"
 
@@ -65,6 +68,7 @@
 #include "native_client/src/trusted/service_runtime/nacl_copy.h"
 #include "native_client/src/trusted/service_runtime/nacl_globals.h"
 #include "native_client/src/trusted/service_runtime/nacl_signal.h"
+#include "native_client/src/trusted/service_runtime/nacl_stat_cache.h"
 #include "native_client/src/trusted/service_runtime/nacl_switch_to_app.h"
 #include "native_client/src/trusted/service_runtime/nacl_syscall_handlers.h"
 #include "native_client/src/trusted/service_runtime/nacl_text.h"
@@ -129,6 +133,7 @@ int32_t NaClSysBrk(struct NaClAppThread *natp,
   uintptr_t             last_internal_page;
   uintptr_t             start_new_region;
   uintptr_t             region_size;
+  struct NaClDesc       *anon_desc;
 
   break_addr = nap->break_addr;
 
@@ -218,12 +223,36 @@ int32_t NaClSysBrk(struct NaClAppThread *natp,
               ent->page_num, ent->npages);
       /* go ahead and extend ent to cover, and make pages accessible */
       start_new_region = (ent->page_num + ent->npages) << NACL_PAGESHIFT;
-      ent->npages = (last_internal_page - ent->page_num + 1);
       region_size = (((last_internal_page + 1) << NACL_PAGESHIFT)
                      - start_new_region);
-      if (NaClMprotect((void *) NaClUserToSys(nap, start_new_region),
-                            region_size,
-                            PROT_READ | PROT_WRITE)) {
+      anon_desc = NULL;
+#if NACL_LINUX
+      anon_desc = NaClVmCowAnonMap(nap, start_new_region, region_size,
+                                   NACL_ABI_PROT_READ | NACL_ABI_PROT_WRITE);
+#endif
+      if (NULL != anon_desc &&
+          (ent->desc != anon_desc ||
+           ent->prot != (NACL_ABI_PROT_READ | NACL_ABI_PROT_WRITE))) {
+        /* the new pages are in the anonymous memory object, ent's are not */
+        NaClVmmapAdd(&nap->mem_map,
+                     start_new_region >> NACL_PAGESHIFT,
+                     region_size >> NACL_PAGESHIFT,
+                     NACL_ABI_PROT_READ | NACL_ABI_PROT_WRITE,
+                     (NACL_ABI_MAP_PRIVATE | NACL_ABI_MAP_ANONYMOUS
+                      | NACL_MAP_SHM_ANON),
+                     anon_desc,
+                     start_new_region,
+                     (nacl_off64_t) 1 << nap->addr_bits);
+      } else {
+        /* object offsets are user addresses, so ent simply grows */
+        ent->npages = (last_internal_page - ent->page_num + 1);
+        NaClVmmapEntryResized(&nap->mem_map, ent);
+      }
+      if (NULL != anon_desc) {
+        NaClDescUnref(anon_desc);
+      } else if (NaClMprotect((void *) NaClUserToSys(nap, start_new_region),
+                              region_size,
+                              PROT_READ | PROT_WRITE)) {
         NaClLog(LOG_FATAL,
                 ("Could not mprotect(0x%08"NACL_PRIxPTR", "
                  "0x%08"NACL_PRIxPTR", "
@@ -357,7 +386,8 @@ int32_t NaClSysGetppid(struct NaClAppThread *natp) {
     ppid = 0;
     goto out;
   }
-  ppid = nap->parent->cage_id;
+  /* not parent->cage_id: the parent may exit and be freed meanwhile */
+  ppid = nap->parent_id;
 
 out:
   NaClLog(1, "NaClSysGetpid: returning %d\n", ppid);
@@ -371,6 +401,7 @@ int32_t NaClSysExit(struct NaClAppThread  *natp,
   NaClLog(1, "Exit syscall handler: %d\n", status);
 
   (void) NaClReportExitStatus(nap, NACL_ABI_W_EXITCODE(status, 0));
+  NaClDropPipeDescs(nap);
 
   NaClAppThreadTeardown(natp);
   /* NOTREACHED */
@@ -456,6 +487,40 @@ int32_t NaClSysNameService(struct NaClAppThread *natp,
   return retval;
 }
 
+/*
+ * Closes cage fd |fd|, if open, dropping the cage's reference to its desc.
+ */
+static void NaClReleaseFd(struct NaClApp *nap, int fd) {
+  int d;
+
+  NaClFastMutexLock(&nap->desc_mu);
+  d = NaClFdTableGet(&nap->fd_table, fd);
+  if (d >= 0) {
+    NaClSetDescMu(nap, d, NULL);
+  }
+  NaClFdTableSet(&nap->fd_table, fd, NACL_BAD_FD);
+  NaClFdTableSet(&nap->fd_cloexec, fd, NACL_BAD_FD);
+  NaClFastMutexUnlock(&nap->desc_mu);
+}
+
+static int NaClDescIsPipe(struct NaClDesc *ndp) {
+  return NULL != ndp && NACL_DESC_PIPE == NACL_VTBL(NaClDesc, ndp)->typeTag;
+}
+
+static int NaClFdIsPipe(struct NaClApp *nap, int fd) {
+  struct NaClDesc *ndp;
+  int is_pipe;
+
+  fd = NaClFdTableGet(&nap->fd_table, fd);
+  if (fd < 0) {
+    return 0;
+  }
+  ndp = NaClGetDesc(nap, fd);
+  is_pipe = NaClDescIsPipe(ndp);
+  NaClDescSafeUnref(ndp);
+  return is_pipe;
+}
+
 int32_t NaClSysDup(struct NaClAppThread *natp, int oldfd) {
   struct NaClApp *nap = natp->nap;
   struct NaClDesc *old_nd;
@@ -465,7 +530,7 @@ int32_t NaClSysDup(struct NaClAppThread *natp, int oldfd) {
 
   NaClLog(1, "NaClSysDup(0x%08"NACL_PRIxPTR", %d)\n", (uintptr_t)natp, oldfd);
 
-  old_hostfd = fd_cage_table[nap->cage_id][oldfd];
+  old_hostfd = NaClFdTableGet(&nap->fd_table, oldfd);
 
   if (old_hostfd < 0) {
     ret = -NACL_ABI_EBADF;
@@ -477,6 +542,16 @@ int32_t NaClSysDup(struct NaClAppThread *natp, int oldfd) {
     goto out;
   }
 
+  /* pipe ends are shared, like an open file description, not re-made */
+  if (NaClDescIsPipe(old_nd)) {
+    new_desc = NaClSetAvail(nap, old_nd);
+    ret = NaClFdTableAlloc(&nap->fd_table, new_desc);
+    if (ret < 0) {
+      NaClSetDesc(nap, new_desc, NULL);
+    }
+    goto out;
+  }
+
   /* Translate from NaCl Desc to Host Desc */
   struct NaClDescIoDesc *self = (struct NaClDescIoDesc *) &old_nd->base;
   struct NaClHostDesc *old_hd = self->hd;
@@ -493,14 +568,14 @@ int32_t NaClSysDup(struct NaClAppThread *natp, int oldfd) {
   new_hd->cageid = nap->cage_id;
 
   /* Set new nacl desc as available */
-  int new_hostfd = NaClSetAvail(nap, ((struct NaClDesc *) NaClDescIoDescMake(new_hd)));
+  struct NaClDescIoDesc *new_self = NaClDescIoDescMake(new_hd);
+  NaClDescIoDescSetPath(new_self, self->path);
+  int new_hostfd = NaClSetAvail(nap, (struct NaClDesc *) new_self);
 
   /* We've got to put that old NaClDescriptor back in there... */
   NaClSetDesc(nap, old_hostfd, old_nd);
 
-  ret = NextFd(nap->cage_id);
-
-  fd_cage_table[nap->cage_id][ret] = new_hostfd;
+  ret = NaClFdTableAlloc(&nap->fd_table, new_hostfd);
 
 
 out:
@@ -523,13 +598,18 @@ int32_t NaClSysDup2(struct NaClAppThread  *natp,
   NaClLog(1, "[dup2] oldfd = %d \n", oldfd);
   NaClLog(1, "[dup2] newfd = %d \n", newfd);
 
+  if (newfd < 0 || newfd >= NACL_FD_TABLE_MAX) {
+    ret = -NACL_ABI_EBADF;
+    goto out;
+  }
+
   if (oldfd == newfd) {
     ret = oldfd;
     goto out;
   }
 
   /* Get old host fd from cage table, and use that to get nacl descriptor */
-  old_hostfd = fd_cage_table[nap->cage_id][oldfd];
+  old_hostfd = NaClFdTableGet(&nap->fd_table, oldfd);
 
   if (old_hostfd < 0) {
     ret = -NACL_ABI_EBADF;
@@ -541,6 +621,19 @@ int32_t NaClSysDup2(struct NaClAppThread  *natp,
     goto out;
   }
 
+  /*
+   * A pipe end cannot be dup'ed over through Lind: close newfd here, after
+   * which an I/O desc takes scenario 1 below and a pipe end is shared.
+   */
+  if (NaClDescIsPipe(old_nd) || NaClFdIsPipe(nap, newfd)) {
+    NaClReleaseFd(nap, newfd);
+  }
+  if (NaClDescIsPipe(old_nd)) {
+    NaClFdTableSet(&nap->fd_table, newfd, NaClSetAvail(nap, old_nd));
+    ret = newfd;
+    goto out;
+  }
+
   /* Translate from NaCl Desc to Host Desc */
   struct NaClDescIoDesc *old_self = (struct NaClDescIoDesc *) &old_nd->base;
   struct NaClHostDesc *old_hd = old_self->hd;
@@ -555,7 +648,7 @@ int32_t NaClSysDup2(struct NaClAppThread  *natp,
   
   */
 
-  new_hostfd = fd_cage_table[nap->cage_id][newfd];
+  new_hostfd = NaClFdTableGet(&nap->fd_table, newfd);
 
 
   if (new_hostfd < 0) {
@@ -574,9 +667,11 @@ int32_t NaClSysDup2(struct NaClAppThread  *natp,
     new_hd->cageid = nap->cage_id;
 
     /* Set new nacl desc as available */
-    int new_hostfd = NaClSetAvail(nap, ((struct NaClDesc *) NaClDescIoDescMake(new_hd)));
+    struct NaClDescIoDesc *new_self = NaClDescIoDescMake(new_hd);
+    NaClDescIoDescSetPath(new_self, old_self->path);
+    int new_hostfd = NaClSetAvail(nap, (struct NaClDesc *) new_self);
     /* and add the new hostfd to the cage table */
-    fd_cage_table[nap->cage_id][newfd] = new_hostfd;
+    NaClFdTableSet(&nap->fd_table, newfd, new_hostfd);
 
 
 
@@ -597,6 +692,9 @@ int32_t NaClSysDup2(struct NaClAppThread  *natp,
     new_hd->d = lind_dup2(old_hd->d, new_hd->d, nap->cage_id);
     new_hd->flags = old_hd->flags;
     new_hd->cageid = nap->cage_id;
+    NaClDescIoDescSetPath(new_self, old_self->path);
+    /* its direct socket, if any, is no longer the one hd->d names */
+    new_self->direct_ok = -1;
 
     /* Re-add the nacl desc to the nap */
     NaClSetDesc(nap, new_hostfd, new_nd);
@@ -654,12 +752,42 @@ static uint32_t CopyPathFromUser(struct NaClApp *nap,
   return 0;
 }
 
+/*
+ * NaClHostDescStat through the path lookup cache.  Like it, returns 0 or
+ * a negated host errno.
+ */
+static int32_t CachedHostDescStat(struct NaClApp    *nap,
+                                  char const        *path,
+                                  nacl_host_stat_t  *stbuf) {
+  int32_t  retval;
+  uint32_t stamp;
+
+  if (!NaClStatCacheLookup(path, stbuf, &retval, &stamp)) {
+    retval = NaClHostDescStat(path, stbuf, nap->cage_id);
+    NaClStatCacheInsert(path, stamp, retval, stbuf);
+  }
+  return retval;
+}
+
+/* Called after a successful write through |ndp|. */
+static void InvalidateWrittenPath(struct NaClDesc *ndp) {
+  char const *path;
+
+  if (NACL_DESC_HOST_IO != NACL_VTBL(NaClDesc, ndp)->typeTag) {
+    return;
+  }
+  path = ((struct NaClDescIoDesc *) ndp)->path;
+  if (NULL != path) {
+    NaClStatCacheInvalidate(path, 0);
+  }
+}
+
 int32_t NaClSysOpen(struct NaClAppThread  *natp,
                     char                  *pathname,
                     int                   flags,
                     int                   mode) {
   struct NaClApp       *nap = natp->nap;
-  uint32_t             retval = -NACL_ABI_EINVAL;
+  int32_t              retval = -NACL_ABI_EINVAL;
   char                 path[NACL_CONFIG_PATH_MAX];
   nacl_host_stat_t     stbuf;
   int                  allowed_flags;
@@ -724,7 +852,11 @@ int32_t NaClSysOpen(struct NaClAppThread  *natp,
    * open-as-a-file and open-as-a-dir, the type of the object that the
    * path refers to can change.
    */
-  retval = NaClHostDescStat(path, &stbuf, nap->cage_id);
+  retval = CachedHostDescStat(nap, path, &stbuf);
+  if (-ENOENT == retval && !(flags & NACL_ABI_O_CREAT)) {
+    retval = -NACL_ABI_ENOENT;
+    goto cleanup;
+  }
 
   /* Windows does not have S_ISDIR(m) macro */
   if (!retval && S_IFDIR == (S_IFDIR & stbuf.st_mode)) {
@@ -744,6 +876,8 @@ int32_t NaClSysOpen(struct NaClAppThread  *natp,
     if (!retval) {
       retval = NaClSetAvail(nap, ((struct NaClDesc *) NaClDescDirDescMake(hd)));
       NaClLog(1, "added directory to open file table at %d\n", retval);
+    } else {
+      free(hd);
     }
   } else {
     struct NaClHostDesc  *hd;
@@ -760,8 +894,19 @@ int32_t NaClSysOpen(struct NaClAppThread  *natp,
     NaClLog(1, "Cage %d NaClHostDescOpen(0x%08"NACL_PRIxPTR", %s, 0%o, 0%o) returned %d\n",
             nap->cage_id, (uintptr_t) hd, path, flags, mode, retval);
     if (!retval) {
-      retval = NaClSetAvail(nap, ((struct NaClDesc *) NaClDescIoDescMake(hd)));
+      struct NaClDescIoDesc *iod = NaClDescIoDescMake(hd);
+
+      /* the open may have created or truncated it */
+      if (flags & (NACL_ABI_O_CREAT | NACL_ABI_O_TRUNC)) {
+        NaClStatCacheInvalidate(path, 1);
+      }
+      if (NACL_ABI_O_RDONLY != (flags & NACL_ABI_O_ACCMODE)) {
+        NaClDescIoDescSetPath(iod, path);
+      }
+      retval = NaClSetAvail(nap, (struct NaClDesc *) iod);
       NaClLog(1, "Entered into open file table at %d\n", retval);
+    } else {
+      free(hd);
     }
   }
 
@@ -771,9 +916,10 @@ cleanup:
     Get next available, and set cagetable there to nacl retval
   */
   
-  fd_retval = NextFd(nap->cage_id);
-
-  fd_cage_table[nap->cage_id][fd_retval] = retval;
+  if (retval < 0) {
+    return retval;
+  }
+  fd_retval = NaClFdTableAlloc(&nap->fd_table, retval);
 
 
   NaClLog(1, "[NaClSysOpen] fd = %d, filepath = %s \n", fd_retval, path);
@@ -798,7 +944,7 @@ int32_t NaClSysClose(struct NaClAppThread *natp, int d) {
   NaClFastMutexLock(&nap->desc_mu);
 
   /* Let's find the fd from the cagetable, and then get the NaCl descriptor based on that fd */
-  fd = fd_cage_table[nap->cage_id][d];
+  fd = NaClFdTableGet(&nap->fd_table, d);
   ndp = NaClGetDescMu(nap, fd);
 
   /* If we have an fd and nacl descriptor, lets close it */
@@ -810,7 +956,8 @@ int32_t NaClSysClose(struct NaClAppThread *natp, int d) {
   }
 
   /* mark file descriptor d as invalid (stdin is not a valid file descriptor) */
-  fd_cage_table[nap->cage_id][d] = NACL_BAD_FD;
+  NaClFdTableSet(&nap->fd_table, d, NACL_BAD_FD);
+  NaClFdTableSet(&nap->fd_cloexec, d, NACL_BAD_FD);
 
   NaClFastMutexUnlock(&nap->desc_mu);
   return ret;
@@ -833,7 +980,7 @@ int32_t NaClSysGetdents(struct NaClAppThread *natp,
           " %"NACL_PRIdS"[0x%"NACL_PRIxS"])\n",
           (uintptr_t) natp, d, (uintptr_t) dirp, count, count);
 
-  fd = fd_cage_table[nap->cage_id][d];
+  fd = NaClFdTableGet(&nap->fd_table, d);
   if (fd < 0) {
     retval = -NACL_ABI_EBADF;
     goto cleanup;
@@ -903,7 +1050,7 @@ int32_t NaClSysRead(struct NaClAppThread  *natp,
                     void                  *buf,
                     size_t                count) {
   struct NaClApp  *nap = natp->nap;
-  int             fd = fd_cage_table[nap->cage_id][d];
+  int             fd = NaClFdTableGet(&nap->fd_table, d);
   int32_t         retval = -NACL_ABI_EINVAL;
   ssize_t         read_result = -NACL_ABI_EINVAL;
   uintptr_t       sysaddr;
@@ -945,12 +1092,17 @@ int32_t NaClSysRead(struct NaClAppThread  *natp,
     count = INT32_MAX;
   }
 
-  NaClVmIoWillStart(nap,
+  /*
+   * sysaddr goes all the way down to the host descriptor; a Lind file
+   * backend that can transfer in-process fills untrusted memory directly
+   * instead of going through a trusted bounce buffer.
+   */
+  NaClVmIoWillStart(natp,
                     (uint32_t) (uintptr_t) buf,
                     (uint32_t) (((uintptr_t) buf) + count - 1));
   read_result = ((struct NaClDescVtbl const *)ndp->base.vtbl)->Read(ndp, (void *)sysaddr, count);
 
-  NaClVmIoHasEnded(nap,
+  NaClVmIoHasEnded(natp,
                     (uint32_t) (uintptr_t) buf,
                     (uint32_t) (((uintptr_t) buf) + count - 1));
   if (read_result > 0) {
@@ -984,7 +1136,7 @@ int32_t NaClSysWrite(struct NaClAppThread *natp,
                      void                 *buf,
                      size_t               count) {
   struct NaClApp  *nap = natp->nap;
-  int             fd = fd_cage_table[nap->cage_id][d];
+  int             fd = NaClFdTableGet(&nap->fd_table, d);
   int32_t         retval = -NACL_ABI_EINVAL;
   ssize_t         write_result = -NACL_ABI_EINVAL;
   uintptr_t       sysaddr;
@@ -1036,15 +1188,19 @@ int32_t NaClSysWrite(struct NaClAppThread *natp,
   NaClLog(2, "In NaClSysWrite(%d, %.*s%s, %"NACL_PRIdS")\n",
           d, (int)log_bytes, (char *)sysaddr, ellipsis, count);
 
-  NaClVmIoWillStart(nap,
+  NaClVmIoWillStart(natp,
                     (uint32_t)(uintptr_t)buf,
                     (uint32_t)(((uintptr_t)buf) + count - 1));
   write_result = ((struct NaClDescVtbl const *)ndp->base.vtbl)->Write(ndp, (void *)sysaddr, count);
 
-  NaClVmIoHasEnded(nap,
+  NaClVmIoHasEnded(natp,
                    (uint32_t)(uintptr_t)buf,
                    (uint32_t)(((uintptr_t)buf) + count - 1));
 
+  if (write_result > 0) {
+    InvalidateWrittenPath(ndp);
+  }
+
   NaClDescUnref(ndp);
 
   /* This cast is safe because we clamped count above.*/
@@ -1054,6 +1210,106 @@ out:
   return retval;
 }
 
+/*
+ * Positional read/write.  The 64-bit offset is passed by reference, as
+ * for lseek, so that it fits the 32-bit syscall ABI; unlike lseek it is
+ * only read.  The descriptor's file position is left untouched, so
+ * threads sharing a descriptor do not race on it.
+ */
+static int32_t NaClSysPReadWrite(struct NaClAppThread *natp,
+                                 int                  d,
+                                 void                 *buf,
+                                 size_t               count,
+                                 nacl_abi_off_t       *offp,
+                                 int                  is_write) {
+  struct NaClApp  *nap = natp->nap;
+  int             fd = NaClFdTableGet(&nap->fd_table, d);
+  int32_t         retval = -NACL_ABI_EINVAL;
+  ssize_t         io_result;
+  uintptr_t       sysaddr;
+  nacl_abi_off_t  offset;
+  struct NaClDesc *ndp;
+
+  NaClLog(2, "Cage %d Entered NaClSysP%s(0x%08"NACL_PRIxPTR", "
+          "%d, 0x%08"NACL_PRIxPTR", "
+          "%"NACL_PRIdS"[0x%"NACL_PRIxS"], 0x%08"NACL_PRIxPTR")\n",
+          nap->cage_id, is_write ? "Write" : "Read", (uintptr_t) natp, d,
+          (uintptr_t) buf, count, count, (uintptr_t) offp);
+
+  if (fd < 0) {
+    retval = -NACL_ABI_EBADF;
+    goto out;
+  }
+
+  ndp = NaClGetDesc(nap, fd);
+  if (!ndp) {
+    retval = -NACL_ABI_EBADF;
+    goto out;
+  }
+
+  if (!NaClCopyInFromUser(nap, &offset, (uintptr_t) offp, sizeof(offset))) {
+    retval = -NACL_ABI_EFAULT;
+    goto out_unref;
+  }
+  if (offset < 0) {
+    retval = -NACL_ABI_EINVAL;
+    goto out_unref;
+  }
+
+  sysaddr = NaClUserToSysAddrRange(nap, (uintptr_t) buf, count);
+  if (kNaClBadAddress == sysaddr) {
+    retval = -NACL_ABI_EFAULT;
+    goto out_unref;
+  }
+
+  /* Clamp as for read and write so that the result fits in int32_t. */
+  if (count > INT32_MAX) {
+    count = INT32_MAX;
+  }
+
+  NaClVmIoWillStart(natp,
+                    (uint32_t) (uintptr_t) buf,
+                    (uint32_t) (((uintptr_t) buf) + count - 1));
+  if (is_write) {
+    io_result = (*((struct NaClDescVtbl const *) ndp->base.vtbl)->
+                 PWrite)(ndp, (void *) sysaddr, count, (nacl_off64_t) offset);
+  } else {
+    io_result = (*((struct NaClDescVtbl const *) ndp->base.vtbl)->
+                 PRead)(ndp, (void *) sysaddr, count, (nacl_off64_t) offset);
+  }
+  NaClVmIoHasEnded(natp,
+                   (uint32_t) (uintptr_t) buf,
+                   (uint32_t) (((uintptr_t) buf) + count - 1));
+  NaClLog(4, "p%s returned %"NACL_PRIdS"\n",
+          is_write ? "write" : "read", io_result);
+  if (is_write && io_result > 0) {
+    InvalidateWrittenPath(ndp);
+  }
+
+  /* This cast is safe because we clamped count above.*/
+  retval = (int32_t) io_result;
+out_unref:
+  NaClDescUnref(ndp);
+out:
+  return retval;
+}
+
+int32_t NaClSysPRead(struct NaClAppThread  *natp,
+                     int                   d,
+                     void                  *buf,
+                     size_t                count,
+                     nacl_abi_off_t        *offp) {
+  return NaClSysPReadWrite(natp, d, buf, count, offp, 0);
+}
+
+int32_t NaClSysPWrite(struct NaClAppThread *natp,
+                      int                  d,
+                      void                 *buf,
+                      size_t               count,
+                      nacl_abi_off_t       *offp) {
+  return NaClSysPReadWrite(natp, d, buf, count, offp, 1);
+}
+
 /*
  * This implements 64-bit offsets, so we use |offp| as an in/out
  * address so we can have a 64 bit return value.
@@ -1073,7 +1329,7 @@ int32_t NaClSysLseek(struct NaClAppThread *natp,
            " 0x%08"NACL_PRIxPTR", %d)\n",
           (uintptr_t) natp, d, (uintptr_t) offp, whence);
 
-  fd = fd_cage_table[nap->cage_id][d];
+  fd = NaClFdTableGet(&nap->fd_table, d);
 
   /* check for closed fds */
   if (fd < 0) {
@@ -1140,7 +1396,7 @@ int32_t NaClSysIoctl(struct NaClAppThread *natp,
    ****************************************
    */
 
-  fd = fd_cage_table[nap->cage_id][d];
+  fd = NaClFdTableGet(&nap->fd_table, d);
 
   /* check for closed fds */
   if (fd < 0) {
@@ -1198,7 +1454,7 @@ int32_t NaClSysFstat(struct NaClAppThread *natp,
   NaClLog(2, "sizeof(struct nacl_abi_stat) = %"NACL_PRIdS" (0x%"NACL_PRIxS")\n",
           sizeof(*nasp), sizeof(*nasp));
 
-  fd = fd_cage_table[nap->cage_id][d];
+  fd = NaClFdTableGet(&nap->fd_table, d);
 
   /* check for closed fds */
   if (fd < 0) {
@@ -1252,7 +1508,7 @@ int32_t NaClSysStat(struct NaClAppThread  *natp,
   /*
    * Perform a host stat.
    */
-  retval = NaClHostDescStat(path, &stbuf, nap->cage_id);
+  retval = CachedHostDescStat(nap, path, &stbuf);
   if (!retval) {
     struct nacl_abi_stat abi_stbuf;
 
@@ -1292,7 +1548,7 @@ int32_t NaClSysLStat(struct NaClAppThread  *natp,
   /*
    * Perform a host stat.
    */
-  retval = NaClHostDescStat(path, &stbuf, nap->cage_id);
+  retval = CachedHostDescStat(nap, path, &stbuf);
   if (!retval) {
     struct nacl_abi_stat abi_stbuf;
 
@@ -1325,6 +1581,9 @@ int32_t NaClSysMkdir(struct NaClAppThread *natp,
   }
 
   retval = NaClHostDescMkdir(path, mode);
+  if (!retval) {
+    NaClStatCacheInvalidate(path, 1);
+  }
 cleanup:
   return retval;
 }
@@ -1346,6 +1605,9 @@ int32_t NaClSysRmdir(struct NaClAppThread *natp,
   }
 
   retval = NaClHostDescRmdir(path);
+  if (!retval) {
+    NaClStatCacheInvalidate(path, 1);
+  }
 cleanup:
   return retval;
 }
@@ -1417,6 +1679,9 @@ int32_t NaClSysUnlink(struct NaClAppThread *natp,
   }
 
   retval = NaClHostDescUnlink(path);
+  if (!retval) {
+    NaClStatCacheInvalidate(path, 1);
+  }
 cleanup:
   return retval;
 }
@@ -1527,16 +1792,19 @@ static int32_t MunmapInternal(struct NaClApp *nap, uintptr_t sysaddr, size_t len
    * zero-filled pages, which should be copy-on-write and thus
    * relatively cheap.  Do not open up an address space hole.
    */
-  if (MAP_FAILED == lind_mmap((void *) sysaddr,
-                              length,  
-                              PROT_NONE,  
-                              MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED, 
-                              -1, 
-                              (off_t) 0,
-                              nap->cage_id)) {
+  if (MAP_FAILED == lind_mmap_fixed((void *) sysaddr,
+                                    length,  
+                                    PROT_NONE,  
+                                    MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED, 
+                                    -1, 
+                                    (off_t) 0,
+                                    nap->cage_id)) {
     NaClLog(2, "mmap to put in anonymous memory failed, errno = %d\n", errno);
     return -NaClXlateErrno(errno);
   }
+#if NACL_LINUX
+  NaClVmCowAnonDiscard(nap, NaClSysToUser(nap, sysaddr), length);
+#endif
   NaClVmmapRemove(&nap->mem_map,
                   NaClSysToUser(nap, sysaddr) >> NACL_PAGESHIFT,
                   length >> NACL_PAGESHIFT);
@@ -1567,10 +1835,12 @@ int32_t NaClSysMmapIntern(struct NaClApp        *nap,
   nacl_off64_t                file_bytes;
   nacl_off64_t                host_rounded_file_bytes;
   size_t                      alloc_rounded_file_bytes;
+  struct NaClDesc             *anon_desc;
   int fd;
 
   holding_app_lock = 0;
   ndp = NULL;
+  anon_desc = NULL;
 
   allowed_flags = (NACL_ABI_MAP_FIXED | NACL_ABI_MAP_SHARED
                    | NACL_ABI_MAP_PRIVATE | NACL_ABI_MAP_ANONYMOUS);
@@ -1590,7 +1860,7 @@ int32_t NaClSysMmapIntern(struct NaClApp        *nap,
      */
     ndp = NULL;
   } else {
-    fd = fd_cage_table[nap->cage_id][d];
+    fd = NaClFdTableGet(&nap->fd_table, d);
     if (fd < 0) {
       map_result = -NACL_ABI_EBADF;
       goto cleanup;
@@ -1930,7 +2200,15 @@ int32_t NaClSysMmapIntern(struct NaClApp        *nap,
 
   /* [0, length) */
   if (length > 0) {
-    if (!ndp) {
+#if NACL_LINUX
+    /* private anonymous memory goes where a fork can share it */
+    if (!ndp && 0 != (flags & NACL_ABI_MAP_PRIVATE)) {
+      anon_desc = NaClVmCowAnonMap(nap, usraddr, NaClRoundPage(length), prot);
+    }
+#endif
+    if (anon_desc) {
+      map_result = sysaddr;
+    } else if (!ndp) {
       NaClLog(2, "NaClSysMmap: NaClDescIoDescMap(,,0x%08"NACL_PRIxPTR","
                "0x%08"NACL_PRIxS",0x%x,0x%x,0x%08"NACL_PRIxPTR")\n",
                sysaddr, length, prot, flags, (uintptr_t)offset);
@@ -2198,7 +2476,19 @@ int32_t NaClSysMmapIntern(struct NaClApp        *nap,
     }
   }
 
-  if (alloc_rounded_length > 0) {
+  if (anon_desc) {
+    NaClVmmapAddWithOverwrite(&nap->mem_map,
+                              usraddr >> NACL_PAGESHIFT,
+                              alloc_rounded_length >> NACL_PAGESHIFT,
+                              prot,
+                              flags | NACL_MAP_SHM_ANON,
+                              anon_desc,
+                              usraddr,
+                              (nacl_off64_t) 1 << nap->addr_bits);
+  } else if (alloc_rounded_length > 0) {
+#if NACL_LINUX
+    NaClVmCowAnonDiscard(nap, usraddr, alloc_rounded_length);
+#endif
     NaClVmmapAddWithOverwrite(&nap->mem_map,
                               NaClSysToUser(nap, sysaddr) >> NACL_PAGESHIFT,
                               alloc_rounded_length >> NACL_PAGESHIFT,
@@ -2220,6 +2510,9 @@ int32_t NaClSysMmapIntern(struct NaClApp        *nap,
   if (ndp) {
     NaClDescUnref(ndp);
   }
+  if (anon_desc) {
+    NaClDescUnref(anon_desc);
+  }
 
   /*
    * Check to ensure that map_result will fit into a 32-bit value. This is
@@ -2649,7 +2942,7 @@ int32_t NaClSysImcAccept(struct NaClAppThread  *natp,
   NaClLog(1, "Entered NaClSysImcAccept(0x%08"NACL_PRIxPTR", %d)\n", (uintptr_t)natp, d);
 
   /* Check if fd is valid and if NaCl Desc exists */
-  fd = fd_cage_table[nap->cage_id][d];
+  fd = NaClFdTableGet(&nap->fd_table, d);
   if (fd < 0) {
     retval = -NACL_ABI_EINVAL;
     goto out;
@@ -2678,7 +2971,7 @@ int32_t NaClSysImcConnect(struct NaClAppThread *natp,
   int             fd;
 
   NaClLog(1, "Entered NaClSysImcConnectAddr(0x%08"NACL_PRIxPTR", %d)\n", (uintptr_t)natp, d);
-  fd = fd_cage_table[nap->cage_id][d];
+  fd = NaClFdTableGet(&nap->fd_table, d);
   if (fd < 0) {
     retval = -NACL_ABI_EBADF;
     goto out;
@@ -2777,7 +3070,7 @@ int32_t NaClSysImcSendmsg(struct NaClAppThread         *natp,
     }
   }
 
-  fd = fd_cage_table[nap->cage_id][d];
+  fd = NaClFdTableGet(&nap->fd_table, d);
   if (fd < 0) {
     retval = -NACL_ABI_EBADF;
     goto cleanup_leave;
@@ -2825,14 +3118,14 @@ int32_t NaClSysImcSendmsg(struct NaClAppThread         *natp,
 
   /* lock user memory ranges in kern_naiov */
   for (i = 0; i < kern_nanimh.iov_length; ++i) {
-    NaClVmIoWillStart(nap,
+    NaClVmIoWillStart(natp,
                       kern_naiov[i].base,
                       kern_naiov[i].base + kern_naiov[i].length - 1);
   }
   ssize_retval = NACL_VTBL(NaClDesc, ndp)->SendMsg(ndp, &kern_msg_hdr, flags);
   /* unlock user memory ranges in kern_naiov */
   for (i = 0; i < kern_nanimh.iov_length; ++i) {
-    NaClVmIoHasEnded(nap,
+    NaClVmIoHasEnded(natp,
                      kern_naiov[i].base,
                      kern_naiov[i].base + kern_naiov[i].length - 1);
   }
@@ -2967,7 +3260,7 @@ int32_t NaClSysImcRecvmsg(struct NaClAppThread         *natp,
     }
   }
 
-  fd = fd_cage_table[nap->cage_id][d];
+  fd = NaClFdTableGet(&nap->fd_table, d);
   if (fd < 0) {
     NaClLog(1, "%s\n", "receiving descriptor invalid");
     retval = -NACL_ABI_EBADF;
@@ -2991,7 +3284,7 @@ int32_t NaClSysImcRecvmsg(struct NaClAppThread         *natp,
 
   /* lock user memory ranges in kern_naiov */
   for (i = 0; i < kern_nanimh.iov_length; ++i) {
-    NaClVmIoWillStart(nap,
+    NaClVmIoWillStart(natp,
                       kern_naiov[i].base,
                       kern_naiov[i].base + kern_naiov[i].length - 1);
   }
@@ -2999,7 +3292,7 @@ int32_t NaClSysImcRecvmsg(struct NaClAppThread         *natp,
       (struct NaClDescQuotaInterface *) nap->reverse_quota_interface);
   /* unlock user memory ranges in kern_naiov */
   for (i = 0; i < kern_nanimh.iov_length; ++i) {
-    NaClVmIoHasEnded(nap,
+    NaClVmIoHasEnded(natp,
                      kern_naiov[i].base,
                      kern_naiov[i].base + kern_naiov[i].length - 1);
   }
@@ -3615,6 +3908,117 @@ cleanup:
   return retval;
 }
 
+/*
+ * The futex word of a cage, or NULL if |addr| is misaligned or outside the
+ * sandbox.  The word is used in place, so a futex costs no descriptor and
+ * waiters on different words never share a queue or a lock.
+ */
+static volatile int32_t *NaClFutexWord(struct NaClApp *nap, uint32_t addr) {
+  uintptr_t sysaddr;
+
+  if (0 != (addr & (sizeof(int32_t) - 1))) {
+    return NULL;
+  }
+  sysaddr = NaClUserToSysAddrRange(nap, addr, sizeof(int32_t));
+  if (kNaClBadAddress == sysaddr) {
+    return NULL;
+  }
+  return (volatile int32_t *) sysaddr;
+}
+
+int32_t NaClSysFutexWait(struct NaClAppThread     *natp,
+                         uint32_t                 addr,
+                         int32_t                  value,
+                         struct nacl_abi_timespec *abstime) {
+  struct NaClApp           *nap = natp->nap;
+  volatile int32_t         *word;
+  struct nacl_abi_timespec trusted_ts;
+  struct nacl_abi_timespec rel;
+  struct nacl_abi_timeval  now;
+  int32_t                  retval;
+
+  NaClLog(4, "Entered NaClSysFutexWait(0x%08"NACL_PRIxPTR
+          ", 0x%08"NACL_PRIx32", %d, 0x%08"NACL_PRIxPTR")\n",
+          (uintptr_t) natp, addr, value, (uintptr_t) abstime);
+
+  word = NaClFutexWord(nap, addr);
+  if (NULL == word) {
+    return -NACL_ABI_EFAULT;
+  }
+  if (NULL != abstime) {
+    if (!NaClCopyInFromUser(nap, &trusted_ts,
+                            (uintptr_t) abstime, sizeof(trusted_ts))) {
+      return -NACL_ABI_EFAULT;
+    }
+    if (trusted_ts.tv_nsec < 0 || trusted_ts.tv_nsec >= 1000000000) {
+      return -NACL_ABI_EINVAL;
+    }
+    if (0 != NaClGetTimeOfDay(&now)) {
+      return -NACL_ABI_EINVAL;
+    }
+    rel.tv_sec = trusted_ts.tv_sec - now.nacl_abi_tv_sec;
+    rel.tv_nsec = trusted_ts.tv_nsec - now.nacl_abi_tv_usec * 1000;
+    if (rel.tv_nsec < 0) {
+      rel.tv_nsec += 1000000000;
+      --rel.tv_sec;
+    }
+    /* a deadline already passed still checks the value first */
+    if (rel.tv_sec < 0) {
+      rel.tv_sec = 0;
+      rel.tv_nsec = 0;
+    }
+  }
+  retval = NaClFutexWait(word, value, NULL != abstime ? &rel : NULL);
+  /* a signal, e.g. for thread suspension, is just a spurious wakeup */
+  if (-NACL_ABI_EINTR == retval) {
+    retval = 0;
+  }
+  return retval;
+}
+
+int32_t NaClSysFutexWake(struct NaClAppThread *natp,
+                         uint32_t             addr,
+                         int32_t              nwake) {
+  volatile int32_t *word;
+
+  NaClLog(4, "Entered NaClSysFutexWake(0x%08"NACL_PRIxPTR
+          ", 0x%08"NACL_PRIx32", %d)\n",
+          (uintptr_t) natp, addr, nwake);
+
+  word = NaClFutexWord(natp->nap, addr);
+  if (NULL == word) {
+    return -NACL_ABI_EFAULT;
+  }
+  if (nwake <= 0) {
+    return 0;
+  }
+  return NaClFutexWake(word, nwake);
+}
+
+int32_t NaClSysFutexCmpRequeue(struct NaClAppThread *natp,
+                               uint32_t             addr,
+                               int32_t              nwake,
+                               int32_t              nrequeue,
+                               uint32_t             addr2,
+                               int32_t              value) {
+  volatile int32_t *word;
+  volatile int32_t *word2;
+
+  NaClLog(4, "Entered NaClSysFutexCmpRequeue(0x%08"NACL_PRIxPTR
+          ", 0x%08"NACL_PRIx32", %d, %d, 0x%08"NACL_PRIx32", %d)\n",
+          (uintptr_t) natp, addr, nwake, nrequeue, addr2, value);
+
+  word = NaClFutexWord(natp->nap, addr);
+  word2 = NaClFutexWord(natp->nap, addr2);
+  if (NULL == word || NULL == word2) {
+    return -NACL_ABI_EFAULT;
+  }
+  if (nwake < 0 || nrequeue < 0) {
+    return -NACL_ABI_EINVAL;
+  }
+  return NaClFutexCmpRequeue(word, nwake, nrequeue, word2, value);
+}
+
 int32_t NaClSysNanosleep(struct NaClAppThread     *natp,
                          struct nacl_abi_timespec *req,
                          struct nacl_abi_timespec *rem) {
@@ -3969,82 +4373,91 @@ int32_t NaClSysClockGetTime(struct NaClAppThread  *natp,
 }
 
 int32_t NaClSysPipe(struct NaClAppThread  *natp, uint32_t *pipedes) {
-  struct NaClApp *nap = natp->nap;
-  int32_t ret = 0;
-  int lind_fds[2];
-  int nacl_fds[2];
-  int flags;
-
-  /* Attempt lind pipe RPC. Return lind pipe fds, if not return NaCl Error */
-  
-  ret = lind_pipe(lind_fds, nap->cage_id);
-  if (-1 == ret) {
-    NaClLog(2, "NaClSysPipe: pipe returned -1, errno %d\n", errno);
-    return -NaClXlateErrno(errno);
-  }
-
-   /* Sync NaCl fds with Lind ufds*/
-  for (int i = 0; i < 2; i++) {
-    
-    /* set flags for the read and write ends of the pipe */
-    switch (i) {
-    case 0:
-      flags = NACL_ABI_O_RDONLY;
-      break;
-    case 1:
-      flags = NACL_ABI_O_WRONLY|NACL_ABI_O_APPEND;
-      break;
-    default:
-      /* something went terribly wrong */
-      ret = -NACL_ABI_EFAULT;
-      goto out;
-    }
-
-    /* Attempt to make NaCl fds */
-    struct NaClHostDesc  *hd;
+  return NaClSysPipe2(natp, pipedes, 0);
+}
 
-    hd = malloc(sizeof(*hd));
-    if (!hd) {
-      ret = -NACL_ABI_ENOMEM;
-      goto out;
-    }
-    hd->cageid = nap->cage_id;
+/*
+ * Pipes are kept in the runtime (see nacl_desc_pipe.h) rather than made by
+ * the Lind dispatcher, so that data passed between cages does not go
+ * through it.
+ */
+int32_t NaClSysPipe2(struct NaClAppThread *natp, uint32_t *pipedes, int flags) {
+  struct NaClApp *nap = natp->nap;
+  struct NaClDesc *ends[2];
+  int nacl_fds[2] = { NACL_BAD_FD, NACL_BAD_FD };
+  int32_t ret;
+  int d;
+  int i;
 
-    /* Set up Host Descriptor via Pipe wrapper */
+  NaClLog(2, "Cage %d Entered NaClSysPipe2(0x%08"NACL_PRIxPTR", 0%o)\n",
+          nap->cage_id, (uintptr_t) pipedes, flags);
 
-    int retval = NaClHostDescPipe(hd, lind_fds[i], flags);
-    NaClLog(1, "NaClSysPipeCtor(0x%08"NACL_PRIxPTR", 0%o) returned %d\n",
-            (uintptr_t) hd, flags, retval);
-    /* Then let's make a NaCl descriptor and insert it into NaCls descriptor system */
-    if (!retval) {
-      retval = NaClSetAvail(nap, ((struct NaClDesc *) NaClDescIoDescMake(hd)));
-      NaClLog(1, "Entered into open file descriptor table at %d\n", retval);
+  if (0 != (flags & ~(NACL_ABI_O_NONBLOCK | NACL_ABI_O_CLOEXEC))) {
+    return -NACL_ABI_EINVAL;
+  }
+  ret = NaClDescPipeMake(ends, flags);
+  if (0 != ret) {
+    return ret;
+  }
+  for (i = 0; i < 2; i++) {
+    /* the desc table takes over our reference */
+    d = NaClSetAvail(nap, ends[i]);
+    ends[i] = NULL;
+    nacl_fds[i] = NaClFdTableAlloc(&nap->fd_table, d);
+    if (nacl_fds[i] < 0) {
+      ret = nacl_fds[i];
+      nacl_fds[i] = NACL_BAD_FD;
+      NaClSetDesc(nap, d, NULL);
+      goto cleanup;
     }
-    
-
-    /* Update cage table with our lind fds */
-    int pipe_fd = NextFd(nap->cage_id);
-    if (pipe_fd < 0) {
-      ret = -NACL_ABI_EBADF;
-      goto out;
+    if (0 != (flags & NACL_ABI_O_CLOEXEC)) {
+      NaClFdTableSet(&nap->fd_cloexec, nacl_fds[i], d);
     }
-    fd_cage_table[nap->cage_id][pipe_fd] = retval;
-    nacl_fds[i] = pipe_fd;
-
   }
 
-  /* copy out NaCl fds */
-  if (!NaClCopyOutToUser(nap, (uintptr_t)pipedes, nacl_fds, sizeof(nacl_fds))) {
-      ret = -NACL_ABI_EFAULT;
+  if (!NaClCopyOutToUser(nap, (uintptr_t) pipedes, nacl_fds, sizeof nacl_fds)) {
+    ret = -NACL_ABI_EFAULT;
+    goto cleanup;
   }
+  return 0;
 
-out:
+cleanup:
+  for (i = 0; i < 2; i++) {
+    NaClDescSafeUnref(ends[i]);
+    if (NACL_BAD_FD != nacl_fds[i]) {
+      NaClReleaseFd(nap, nacl_fds[i]);
+    }
+  }
   return ret;
 }
 
-int32_t NaClSysPipe2(struct NaClAppThread *natp, uint32_t *pipedes, int flags) {
-  UNREFERENCED_PARAMETER(flags);
-  return NaClSysPipe(natp, pipedes);
+/*
+ * Unlinks and returns the oldest exited child of |nap| that |pid| selects,
+ * or NULL if there is none.  Caller holds nap->children_mu.
+ */
+static struct NaClApp *NaClTakeExitedChild(struct NaClApp *nap, int pid) {
+  struct NaClApp *prev = NULL;
+  struct NaClApp *child;
+
+  for (child = nap->exited_children; child; child = child->next_exited_child) {
+    if (pid <= 0 || child->cage_id == pid) {
+      break;
+    }
+    prev = child;
+  }
+  if (!child) {
+    return NULL;
+  }
+  if (prev) {
+    prev->next_exited_child = child->next_exited_child;
+  } else {
+    nap->exited_children = child->next_exited_child;
+  }
+  if (nap->exited_children_tail == child) {
+    nap->exited_children_tail = prev;
+  }
+  child->next_exited_child = NULL;
+  return child;
 }
 
 int32_t NaClSysFork(struct NaClAppThread *natp) {
@@ -4059,6 +4472,9 @@ int32_t NaClSysFork(struct NaClAppThread *natp) {
   /* set up new "child" NaClApp */
   NaClLogThreadContext(natp);
   nap_child = NaClChildNapCtor(natp->nap);
+  if (!nap_child) {
+    return -NACL_ABI_EAGAIN;
+  }
   child_argc = nap_child->argc;
   child_argv = nap_child->argv;
   nap_child->running = 0;
@@ -4217,8 +4633,15 @@ int32_t NaClSysExecve(struct NaClAppThread *natp, char const *path, char *const
   /* initialize child from parent state */
   NaClLogThreadContext(natp);
   nap_child = NaClChildNapCtor(nap);
+  if (!nap_child) {
+    ret = -NACL_ABI_EAGAIN;
+    NaClEnvCleanserDtor(&env_cleanser);
+    goto fail;
+  }
   nap_child->running = 0;
   nap_child->in_fork = 0;
+  /* used below after it has exited; see NaClCageHold */
+  NaClCageHold(nap_child);
 
   /* TODO: fix dynamic text validation -jp */
   nap_child->skip_validator = 1;
@@ -4310,7 +4733,6 @@ int32_t NaClSysExecve(struct NaClAppThread *natp, char const *path, char *const
   NaClLoadSpringboard(nap_child);
   /* copy the trampolines from parent */
   memmove((void *)child_start_addr, (void *)parent_start_addr, tramp_size);
-  NaClPatchAddr(nap_child->mem_start, nap->mem_start, (uintptr_t *)child_start_addr, tramp_size);
 
   /*
    * NaClMemoryProtection also initializes the mem_map w/ information
@@ -4348,9 +4770,20 @@ int32_t NaClSysExecve(struct NaClAppThread *natp, char const *path, char *const
   NaClXMutexUnlock(&nap_child->mu);
   NaClXMutexUnlock(&nap->mu);
 
+  /* in-runtime pipes: honour pipe2's O_CLOEXEC, and let go of our ends */
+  for (int fd = 0; fd < NaClFdTableSize(&nap->fd_cloexec); fd++) {
+    if (NaClFdTableGet(&nap->fd_cloexec, fd) >= 0) {
+      NaClReleaseFd(nap_child, fd);
+    }
+  }
+  NaClDropPipeDescs(nap);
+
   /* execute new binary, we pass NULL as parent natp since we're not basing the new thread off of this one. */
   ret = -NACL_ABI_ENOEXEC;
   NaClLog(1, "binary = %s\n", nap->binary);
+#if NACL_LINUX
+  NaClVmCowAnonAdopt(nap_child);
+#endif
   if (!NaClCreateThread(THREAD_LAUNCH_EXEC, NULL, nap_child, child_argc, child_argv, nap_child->clean_environ)) {
     NaClLog(LOG_ERROR, "%s\n", "NaClCreateThread() failed");
     NaClEnvCleanserDtor(&env_cleanser);
@@ -4360,6 +4793,18 @@ int32_t NaClSysExecve(struct NaClAppThread *natp, char const *path, char *const
   /* wait for child to finish before cleaning up */
   NaClWaitForMainThreadToExit(nap_child);
   NaClReportExitStatus(nap, nap_child->exit_status);
+  /*
+   * nobody else waits for the new image; it is reaped here, once its
+   * first thread out has queued it
+   */
+  NaClXMutexLock(&nap->children_mu);
+  while (DynArrayGet(&nap->children, nap_child->cage_id) == nap_child) {
+    NaClXCondVarWait(&nap->children_cv, &nap->children_mu);
+  }
+  (void) NaClTakeExitedChild(nap, nap_child->cage_id);
+  NaClXMutexUnlock(&nap->children_mu);
+  NaClCageRelease(nap_child, NACL_CAGE_REAPED);
+  NaClCageUnhold(nap_child);
   NaClAppThreadTeardown(natp);
 
   /* success */
@@ -4391,99 +4836,81 @@ int32_t NaClSysWaitpid(struct NaClAppThread *natp,
                        int pid,
                        uint32_t *stat_loc,
                        int options) {
-
-  /* seconds between thread switching */
-  NACL_TIMESPEC_T const timeout = {1, 0};
   struct NaClApp *nap = natp->nap;
-  struct NaClApp *nap_child = 0;
+  struct NaClApp *nap_child = NULL;
+  struct NaClApp *descendant = NULL;
   uintptr_t sysaddr = NaClUserToSysAddrRange(nap, (uintptr_t)stat_loc, 4);
   int *stat_loc_ptr = sysaddr == kNaClBadAddress ? NULL : (int *)sysaddr;
-  int pid_max = fork_num;
   int ret = 0;
 
   NaClLog(1, "%s\n", "[NaClSysWaitpid] entered waitpid!");
 
-  CHECK(nap->num_children < NACL_THREAD_MAX);
   if (stat_loc_ptr) {
     *stat_loc_ptr = 0;
   }
 
-  if (!nap->num_children || pid > pid_max) {
-    ret = -NACL_ABI_ECHILD;
-    goto out;
-  }
-
-  /*
-   * WAITPID: explicit child pid given
-   */
-  if (pid > 0 && pid <= pid_max) {
-    int cage_id = pid;
-    /* make sure children exists */
-    NaClXMutexLock(&nap->children_mu);
-    nap_child = DynArrayGet(&nap->children, cage_id);
-    if (!nap_child) {
-      ret = -NACL_ABI_ECHILD;
-      NaClXCondVarBroadcast(&nap->children_cv);
-      NaClXMutexUnlock(&nap->children_mu);
-      goto out;
-    }
-    NaClLog(1, "Thread children count: %d\n", nap->num_children);
-    /* wait for child to finish */
-    while (DynArrayGet(&nap->children, cage_id)) {
-      NaClXCondVarTimedWaitRelative(&nap->children_cv, &nap->children_mu, &timeout);
-    }
-    NaClXCondVarBroadcast(&nap->children_cv);
-    NaClXMutexUnlock(&nap->children_mu);
-    ret = pid;
-    goto out;
-  }
-
   /*
-   * WAIT or WAITPID(-1)
+   * Exiting children queue themselves on exited_children and broadcast
+   * children_cv (see NaClAppThreadTeardown), so each wakeup only has to
+   * look at the queue, never at every cage ever forked.
+   *
    * TODO: implement pid == WAIT_ANY_PG (0), we currently don't deal with process groups
    */
-  if (pid <= 0) {
-    while(1){
-
-      /* Cycle through possible cages up to the fork number (max amount of created cages) */
-      for (int cage_id = 0; cage_id < fork_num; cage_id++) {
-
-        NaClXMutexLock(&nap->children_mu);
-
-        /* make sure children exist, if not send ABI_ECHILD */
-        if (!nap->num_children) {
-          ret = -NACL_ABI_ECHILD;
-          NaClXCondVarBroadcast(&nap->children_cv);
-          NaClXMutexUnlock(&nap->children_mu);
-          goto out;
-        }
-        /* wait for next child to exit */
-        nap_child = DynArrayGet(&nap->children, cage_id);
-        if (nap_child) {
-          NaClLog(1, "Thread children count: %d\n", nap->num_children);
-          NaClXCondVarTimedWaitRelative(&nap->children_cv, &nap->children_mu, &timeout);
-          /* exit if selected child has finished */
-          if (!(nap_child = DynArrayGet(&nap->children, cage_id)) || !nap_child->running) {
-            ret = cage_id;
-            NaClXCondVarBroadcast(&nap->children_cv);
-            NaClXMutexUnlock(&nap->children_mu);
-            goto out;
-          }
-        }
-    
-        NaClXCondVarBroadcast(&nap->children_cv);
+  NaClXMutexLock(&nap->children_mu);
+  for (;;) {
+    nap_child = NaClTakeExitedChild(nap, pid);
+    if (nap_child) {
+      ret = nap_child->cage_id;
+      break;
+    }
 
-        NaClXMutexUnlock(&nap->children_mu);
+    if (pid > 0) {
+      /* WAITPID: explicit child pid given */
+      struct NaClApp *running = DynArrayGet(&nap->children, pid);
+      if (descendant && running != descendant) {
+        /* gone without being queued here: not our child, see below */
+        nap_child = descendant;
+        ret = pid;
+        break;
+      }
+      if (!running) {
+        ret = -NACL_ABI_ECHILD;
+        break;
       }
-      
+      if (running->parent != nap && !descendant) {
+        /*
+         * The master also tracks its children's children, and may wait
+         * for one of those by pid; it exits to its own parent's queue,
+         * and is held so that its exit status can still be read here.
+         */
+        NaClCageHold(running);
+        descendant = running;
+      }
+    } else if (!nap->num_running_children) {
+      /* WAIT or WAITPID(-1) with nothing left to wait for */
+      ret = -NACL_ABI_ECHILD;
+      break;
     }
-    
+
+    if (options & NACL_ABI_WNOHANG) {
+      ret = 0;
+      break;
+    }
+    NaClLog(1, "Thread children count: %d\n", nap->num_children);
+    NaClXCondVarWait(&nap->children_cv, &nap->children_mu);
   }
+  NaClXMutexUnlock(&nap->children_mu);
 
-out:
   if (nap_child && stat_loc_ptr) {
     *stat_loc_ptr = nap_child->exit_status;
   }
+  /* a descendant is left for its own parent to reap */
+  if (nap_child && nap_child != descendant) {
+    NaClCageRelease(nap_child, NACL_CAGE_REAPED);
+  }
+  if (descendant) {
+    NaClCageUnhold(descendant);
+  }
   NaClLog(1, "[NaClSysWaitpid] pid = %d \n", pid);
   NaClLog(1, "[NaClSysWaitpid] status = %d \n", stat_loc_ptr ? *stat_loc_ptr : 0);
   NaClLog(1, "[NaClSysWaitpid] options = %d \n", options);
@@ -4493,18 +4920,13 @@ out:
 }
 
 int32_t NaClSysWait(struct NaClAppThread *natp, uint32_t *stat_loc) {
-  struct NaClApp *nap = natp->nap;
   int ret;
 
   NaClLog(1, "%s\n", "[NaClSysWait] entered wait! \n");
 
-  if (!nap->num_children) {
-    ret = -NACL_ABI_ECHILD;
-    goto out;
-  }
+  /* exited children are no longer in num_children but may still be reaped */
   ret = NaClSysWaitpid(natp, WAIT_ANY, stat_loc, 0);
 
-out:
   NaClLog(1, "[NaClSysWait] ret = %d \n", ret);
   return ret;
 }
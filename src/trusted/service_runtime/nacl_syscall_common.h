@@ -93,6 +93,18 @@ int32_t NaClSysWrite(struct NaClAppThread *natp,
                      void                 *buf,
                      size_t               count);
 
+int32_t NaClSysPRead(struct NaClAppThread  *natp,
+                     int                   d,
+                     void                  *buf,
+                     size_t                count,
+                     nacl_abi_off_t        *offp);
+
+int32_t NaClSysPWrite(struct NaClAppThread *natp,
+                      int                  d,
+                      void                 *buf,
+                      size_t               count,
+                      nacl_abi_off_t       *offp);
+
 int32_t NaClSysLseek(struct NaClAppThread *natp,
                      int                  d,
                      nacl_abi_off_t       *offp,
@@ -292,6 +304,26 @@ int32_t NaClSysSemPost(struct NaClAppThread *natp,
 int32_t NaClSysSemGetValue(struct NaClAppThread *natp,
                            int32_t              sem_handle);
 
+/*
+ * Futexes on cage memory, waited on in place.  |abstime| is against the
+ * wall clock, as for NaClSysCondTimedWaitAbs.
+ */
+int32_t NaClSysFutexWait(struct NaClAppThread     *natp,
+                         uint32_t                 addr,
+                         int32_t                  value,
+                         struct nacl_abi_timespec *abstime);
+
+int32_t NaClSysFutexWake(struct NaClAppThread *natp,
+                         uint32_t             addr,
+                         int32_t              nwake);
+
+int32_t NaClSysFutexCmpRequeue(struct NaClAppThread *natp,
+                               uint32_t             addr,
+                               int32_t              nwake,
+                               int32_t              nrequeue,
+                               uint32_t             addr2,
+                               int32_t              value);
+
 int32_t NaClSysNanosleep(struct NaClAppThread     *natp,
                          struct nacl_abi_timespec *req,
                          struct nacl_abi_timespec *rem);
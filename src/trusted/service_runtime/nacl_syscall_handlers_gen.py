@@ -51,11 +51,6 @@ void NaClSyscallTableInit() {
 IMPLEMENTATION_SKELETON = """\
 /* this function was automagically generated */
 static int32_t %(name)sDecoder(struct NaClAppThread *natp) {
-  #ifdef SYSCALL_TIMING
-  int32_t retval;
-  clock_t nacl_sys_begin;
-  clock_t nacl_sys_finish;
-  #endif
   #ifdef NACL_SYSCALL_TRACE_ENABLED
   struct NaClApp *nap = natp->nap;
   int32_t retval;
@@ -65,15 +60,6 @@ static int32_t %(name)sDecoder(struct NaClAppThread *natp) {
   #endif
   %(members)s\
 
-  #ifdef SYSCALL_TIMING
-  nacl_syscall_counter++;
-  nacl_syscall_invoked_times[%(num)s]++;
-  nacl_sys_begin = clock();
-  retval = %(name)s(natp%(arglist)s);
-  nacl_sys_finish = clock();
-  nacl_syscall_execution_time[%(num)s] += (double)(nacl_sys_finish - nacl_sys_begin) / CLOCKS_PER_SEC;
-  return retval;
-  #endif
   #ifdef NACL_SYSCALL_TRACE_ENABLED
   printf("[NaClSysCallInterface] cage id = %%d, syscall_num = %(num)s [enter][syscall_depth = %%d]\\n", nap->cage_id, nacl_syscall_trace_level_counter);
   printf("==> %(num)s(");
@@ -230,10 +216,19 @@ SYSCALL_LIST = [
     ('NACL_sys_sem_post', 'NaClSysSemPost', ['int32_t sem_handle']),
     ('NACL_sys_sem_get_value', 'NaClSysSemGetValue',
      ['int32_t sem_handle']),
+    ('NACL_sys_futex_wait', 'NaClSysFutexWait',
+     ['uint32_t addr', 'int32_t value', 'struct nacl_abi_timespec *abstime']),
+    ('NACL_sys_futex_wake', 'NaClSysFutexWake',
+     ['uint32_t addr', 'int32_t nwake']),
+    ('NACL_sys_futex_cmp_requeue', 'NaClSysFutexCmpRequeue',
+     ['uint32_t addr', 'int32_t nwake', 'int32_t nrequeue', 'uint32_t addr2',
+      'int32_t value']),
     ('NACL_sys_sched_yield', 'NaClSysSchedYield', []),
     ('NACL_sys_sysconf', 'NaClSysSysconf', ['int32_t name', 'int32_t *result']),
     ('NACL_sys_dyncode_create', 'NaClSysDyncodeCreate',
      ['uint32_t dest', 'uint32_t src', 'uint32_t size']),
+    ('NACL_sys_dyncode_create_batch', 'NaClSysDyncodeCreateBatch',
+     ['uint32_t chunks', 'uint32_t count']),
     ('NACL_sys_dyncode_modify', 'NaClSysDyncodeModify',
      ['uint32_t dest', 'uint32_t src', 'uint32_t size']),
     ('NACL_sys_dyncode_delete', 'NaClSysDyncodeDelete',
@@ -249,6 +244,7 @@ SYSCALL_LIST = [
     ('NACL_sys_test_infoleak', 'NaClSysTestInfoLeak', []),
     ('NACL_sys_test_crash', 'NaClSysTestCrash', ['int crash_type']),
     ('NACL_sys_lind_syscall', 'NaClSysLindSyscall', ['uint32_t callNum', 'uint32_t inNum', 'void *inArgs', 'uint32_t outNum', 'void *outArgs']),
+    ('NACL_sys_lind_ring_enter', 'NaClSysLindRingEnter', ['void *ring', 'uint32_t toSubmit']),
     ('NACL_sys_fork', 'NaClSysFork', []),
     ('NACL_sys_execv', 'NaClSysExecv', ['void *path', 'void *argv']),
     ('NACL_sys_execve', 'NaClSysExecve', ['void *path', 'void *argv', 'void *envp']),
@@ -260,6 +256,10 @@ SYSCALL_LIST = [
     ('NACL_sys_wait4', 'NaClSysWait4', ['int pid', 'uint32_t *stat_loc', 'int options', 'void *rusage']),
     ('NACL_sys_sigprocmask', 'NaClSysSigProcMask', ['int how', 'const void *set', 'void *oldset']),
     ('NACL_sys_lstat', 'NaClSysLStat', ['const char *path', 'struct nacl_abi_stat *nasp']),
+    ('NACL_sys_pread', 'NaClSysPRead',
+     ['int d', 'void *buf', 'size_t count', 'nacl_abi_off_t *offp']),
+    ('NACL_sys_pwrite', 'NaClSysPWrite',
+     ['int d', 'void *buf', 'size_t count', 'nacl_abi_off_t *offp']),
     ]
 
 
@@ -23,6 +23,7 @@
 #include "native_client/src/trusted/service_runtime/nacl_copy.h"
 #include "native_client/src/trusted/service_runtime/nacl_switch_to_app.h"
 #include "native_client/src/trusted/service_runtime/nacl_syscall_handlers.h"
+#include "native_client/src/trusted/service_runtime/nacl_syscall_profile.h"
 #include "native_client/src/trusted/service_runtime/sel_ldr.h"
 #include "native_client/src/trusted/service_runtime/sel_rt.h"
 
@@ -95,6 +96,7 @@ NORETURN void NaClSyscallCSegHook(struct NaClThreadContext *ntcp) {
   size_t                    sysnum;
   uintptr_t                 sp_user;
   uint32_t                  sysret;
+  uint64_t                  profile_begin;
 
   /*
    * Mark the thread as running on a trusted stack as soon as possible
@@ -146,8 +148,13 @@ NORETURN void NaClSyscallCSegHook(struct NaClThreadContext *ntcp) {
     sysret = -NACL_ABI_EINVAL;
     NaClCopyDropLock(nap);
   } else {
+    profile_begin = NaClSyscallProfileBegin();
     sysret = (*(nap->syscall_table[sysnum].handler))(natp);
     /* Implicitly drops lock */
+    if (0 != profile_begin) {
+      NaClSyscallProfileEnd(natp, NACL_SYSCALL_PROFILE_NACL, (uint32_t) sysnum,
+                            profile_begin, (int32_t) sysret);
+    }
   }
   NaClLog(4,
           ("Returning from syscall %"NACL_PRIdS": return value %"NACL_PRId32
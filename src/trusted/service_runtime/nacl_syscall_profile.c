@@ -0,0 +1,489 @@
+/*
+ * Copyright (c) 2017 The Native Client Authors. All rights reserved.
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file.
+ */
+
+#include "native_client/src/include/portability.h"
+
+#include <errno.h>
+#if !NACL_WINDOWS
+# include <pthread.h>
+#endif
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "native_client/src/shared/platform/lind_platform.h"
+#include "native_client/src/shared/platform/nacl_log.h"
+#include "native_client/src/shared/platform/nacl_sync.h"
+#include "native_client/src/shared/platform/nacl_sync_checked.h"
+#include "native_client/src/shared/platform/nacl_threads.h"
+#include "native_client/src/trusted/service_runtime/nacl_app_thread.h"
+#include "native_client/src/trusted/service_runtime/nacl_stat_cache.h"
+#include "native_client/src/trusted/service_runtime/nacl_syscall_profile.h"
+#include "native_client/src/trusted/service_runtime/sel_ldr.h"
+
+#define SUB_BUCKET_BITS NACL_SYSCALL_PROFILE_SUB_BUCKET_BITS
+
+#define DUMP_THREAD_STACK_SIZE (64 << 10)
+
+struct NaClSyscallProfile {
+  struct NaClSyscallProfile         *next;
+  int                               cage_id;
+  /* non-zero while a thread records into this block */
+  int volatile                      in_use;
+  /* written only by the thread holding the block; NULL until first call */
+  struct NaClSyscallProfileCounters *volatile
+      counters[NACL_SYSCALL_PROFILE_NUM_TABLES][NACL_SYSCALL_PROFILE_MAX_CALLS];
+};
+
+int volatile nacl_syscall_profile_enabled;
+
+/* every block ever claimed; blocks are pushed at the head and never freed */
+static struct NaClSyscallProfile *volatile g_profiles;
+
+static char *g_dump_path;
+static struct NaClMutex g_dump_mu;
+#if !NACL_WINDOWS
+static struct NaClThread g_dump_thread;
+#endif
+
+static char const *const kTableNames[NACL_SYSCALL_PROFILE_NUM_TABLES] = {
+  "nacl",
+  "lind",
+};
+
+static uint64_t NowNs(void) {
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static int BucketOf(uint64_t ns) {
+  int msb;
+  int ix;
+
+  if (ns < NACL_SYSCALL_PROFILE_SUB_BUCKETS) {
+    return (int) ns;
+  }
+  msb = 63 - __builtin_clzll(ns);
+  /* the bits just below the top one pick the sub bucket */
+  ix = ((msb - SUB_BUCKET_BITS + 1) << SUB_BUCKET_BITS) +
+      (int) ((ns >> (msb - SUB_BUCKET_BITS)) &
+             (NACL_SYSCALL_PROFILE_SUB_BUCKETS - 1));
+  if (ix >= NACL_SYSCALL_PROFILE_BUCKETS) {
+    ix = NACL_SYSCALL_PROFILE_BUCKETS - 1;
+  }
+  return ix;
+}
+
+/* the largest latency that falls in bucket |ix| */
+static uint64_t BucketMax(int ix) {
+  int shift;
+  uint64_t low;
+
+  if (ix < NACL_SYSCALL_PROFILE_SUB_BUCKETS) {
+    return (uint64_t) ix;
+  }
+  shift = (ix >> SUB_BUCKET_BITS) - 1;
+  low = (uint64_t) (NACL_SYSCALL_PROFILE_SUB_BUCKETS +
+                    (ix & (NACL_SYSCALL_PROFILE_SUB_BUCKETS - 1))) << shift;
+  return low + ((uint64_t) 1 << shift) - 1;
+}
+
+/* the number of bytes a call moved, for calls that move data */
+static uint64_t BytesMoved(enum NaClSyscallProfileTable table, uint32_t num,
+                           int32_t result) {
+  if (result <= 0) {
+    return 0;
+  }
+  if (NACL_SYSCALL_PROFILE_NACL == table) {
+    switch (num) {
+      case NACL_sys_read:
+      case NACL_sys_write:
+      case NACL_sys_pread:
+      case NACL_sys_pwrite:
+      case NACL_sys_getdents:
+      case NACL_sys_imc_sendmsg:
+      case NACL_sys_imc_recvmsg:
+        return (uint64_t) result;
+    }
+  } else {
+    switch (num) {
+      case LIND_safe_fs_read:
+      case LIND_safe_fs_write:
+      case LIND_safe_fs_pread:
+      case LIND_safe_fs_pwrite:
+      case LIND_safe_fs_getdents:
+      case LIND_safe_net_send:
+      case LIND_safe_net_sendto:
+      case LIND_safe_net_recv:
+      case LIND_safe_net_recvfrom:
+        return (uint64_t) result;
+    }
+  }
+  return 0;
+}
+
+struct NaClSyscallProfile *NaClSyscallProfileClaim(int cage_id) {
+  struct NaClSyscallProfile *profile;
+  struct NaClSyscallProfile *head;
+
+  for (profile = g_profiles; NULL != profile; profile = profile->next) {
+    if (profile->cage_id == cage_id && !profile->in_use &&
+        __sync_bool_compare_and_swap(&profile->in_use, 0, 1)) {
+      return profile;
+    }
+  }
+  profile = calloc(1, sizeof *profile);
+  if (NULL == profile) {
+    return NULL;
+  }
+  profile->cage_id = cage_id;
+  profile->in_use = 1;
+  do {
+    head = g_profiles;
+    profile->next = head;
+  } while (!__sync_bool_compare_and_swap(&g_profiles, head, profile));
+  return profile;
+}
+
+void NaClSyscallProfileRelease(struct NaClSyscallProfile *profile) {
+  /* make this thread's last counts visible to the next holder */
+  __sync_synchronize();
+  profile->in_use = 0;
+}
+
+void NaClSyscallProfileRecord(struct NaClSyscallProfile *profile,
+                              enum NaClSyscallProfileTable table,
+                              uint32_t num,
+                              uint64_t ns,
+                              int32_t result) {
+  struct NaClSyscallProfileCounters *c;
+
+  if (num >= NACL_SYSCALL_PROFILE_MAX_CALLS) {
+    num = NACL_SYSCALL_PROFILE_MAX_CALLS - 1;
+  }
+  c = profile->counters[table][num];
+  if (NULL == c) {
+    c = calloc(1, sizeof *c);
+    if (NULL == c) {
+      return;
+    }
+    /* readers must not see the pointer before the zeroed counters */
+    __sync_synchronize();
+    profile->counters[table][num] = c;
+  }
+  c->calls++;
+  c->total_ns += ns;
+  if (ns > c->max_ns) {
+    c->max_ns = ns;
+  }
+  c->bytes += BytesMoved(table, num, result);
+  c->hist[BucketOf(ns)]++;
+}
+
+uint64_t NaClSyscallProfileBegin(void) {
+  if (!nacl_syscall_profile_enabled) {
+    return 0;
+  }
+  return NowNs();
+}
+
+void NaClSyscallProfileEnd(struct NaClAppThread *natp,
+                           enum NaClSyscallProfileTable table,
+                           uint32_t num,
+                           uint64_t begin_ns,
+                           int32_t result) {
+  struct NaClSyscallProfile *profile = natp->syscall_profile;
+  int cage_id = natp->nap->cage_id;
+  uint64_t ns = NowNs() - begin_ns;
+
+  if (NULL == profile || profile->cage_id != cage_id) {
+    if (NULL != profile) {
+      NaClSyscallProfileRelease(profile);
+    }
+    profile = NaClSyscallProfileClaim(cage_id);
+    natp->syscall_profile = profile;
+    if (NULL == profile) {
+      return;
+    }
+  }
+  NaClSyscallProfileRecord(profile, table, num, ns, result);
+}
+
+void NaClSyscallProfileThreadExit(struct NaClAppThread *natp) {
+  if (NULL != natp->syscall_profile) {
+    NaClSyscallProfileRelease(natp->syscall_profile);
+    natp->syscall_profile = NULL;
+  }
+}
+
+int NaClSyscallProfileSum(int cage_id,
+                          enum NaClSyscallProfileTable table,
+                          uint32_t num,
+                          struct NaClSyscallProfileCounters *out) {
+  struct NaClSyscallProfile *profile;
+  struct NaClSyscallProfileCounters *c;
+  int found = 0;
+  int i;
+
+  memset(out, 0, sizeof *out);
+  for (profile = g_profiles; NULL != profile; profile = profile->next) {
+    if (-1 != cage_id && profile->cage_id != cage_id) {
+      continue;
+    }
+    c = profile->counters[table][num];
+    if (NULL == c) {
+      continue;
+    }
+    found = 1;
+    out->calls += c->calls;
+    out->total_ns += c->total_ns;
+    if (c->max_ns > out->max_ns) {
+      out->max_ns = c->max_ns;
+    }
+    out->bytes += c->bytes;
+    for (i = 0; i < NACL_SYSCALL_PROFILE_BUCKETS; ++i) {
+      out->hist[i] += c->hist[i];
+    }
+  }
+  return found;
+}
+
+uint64_t NaClSyscallProfilePercentile(
+    struct NaClSyscallProfileCounters const *c, double q) {
+  uint64_t want;
+  uint64_t seen = 0;
+  uint64_t ns;
+  int i;
+
+  if (0 == c->calls) {
+    return 0;
+  }
+  want = (uint64_t) (q * c->calls);
+  if (want < q * c->calls || 0 == want) {
+    ++want;
+  }
+  for (i = 0; i < NACL_SYSCALL_PROFILE_BUCKETS; ++i) {
+    seen += c->hist[i];
+    if (seen >= want) {
+      break;
+    }
+  }
+  ns = BucketMax(i < NACL_SYSCALL_PROFILE_BUCKETS ?
+                 i : NACL_SYSCALL_PROFILE_BUCKETS - 1);
+  return ns < c->max_ns ? ns : c->max_ns;
+}
+
+/* Writes the calls of |cage_id| (-1 for all) as a JSON object. */
+static int WriteTables(FILE *fp, int cage_id, char const *indent) {
+  struct NaClSyscallProfileCounters sum;
+  int table;
+  uint32_t num;
+  int first;
+
+  if (fprintf(fp, "{\n") < 0) {
+    return 0;
+  }
+  for (table = 0; table < NACL_SYSCALL_PROFILE_NUM_TABLES; ++table) {
+    if (fprintf(fp, "%s  \"%s\": {", indent, kTableNames[table]) < 0) {
+      return 0;
+    }
+    first = 1;
+    for (num = 0; num < NACL_SYSCALL_PROFILE_MAX_CALLS; ++num) {
+      if (!NaClSyscallProfileSum(cage_id, table, num, &sum)) {
+        continue;
+      }
+      if (fprintf(fp,
+                  "%s\n%s    \"%u\": {\"calls\": %"NACL_PRIu64", "
+                  "\"total_ns\": %"NACL_PRIu64", \"max_ns\": %"NACL_PRIu64", "
+                  "\"bytes\": %"NACL_PRIu64", \"p50_ns\": %"NACL_PRIu64", "
+                  "\"p99_ns\": %"NACL_PRIu64", \"p999_ns\": %"NACL_PRIu64"}",
+                  first ? "" : ",", indent, num, sum.calls, sum.total_ns,
+                  sum.max_ns, sum.bytes,
+                  NaClSyscallProfilePercentile(&sum, 0.5),
+                  NaClSyscallProfilePercentile(&sum, 0.99),
+                  NaClSyscallProfilePercentile(&sum, 0.999)) < 0) {
+        return 0;
+      }
+      first = 0;
+    }
+    if (!first && fprintf(fp, "\n%s  ", indent) < 0) {
+      return 0;
+    }
+    if (fprintf(fp, "}%s\n",
+                table + 1 < NACL_SYSCALL_PROFILE_NUM_TABLES ? "," : "") < 0) {
+      return 0;
+    }
+  }
+  return fprintf(fp, "%s}", indent) >= 0;
+}
+
+/* Writes the path lookup cache counters as a JSON object. */
+static int WriteStatCache(FILE *fp) {
+  struct NaClStatCacheStats stats;
+
+  NaClStatCacheGetStats(&stats);
+  return fprintf(fp,
+                 "{\"lookups\": %"NACL_PRIu64", \"hits\": %"NACL_PRIu64", "
+                 "\"negative_hits\": %"NACL_PRIu64", "
+                 "\"expired\": %"NACL_PRIu64", \"inserts\": %"NACL_PRIu64", "
+                 "\"invalidations\": %"NACL_PRIu64", "
+                 "\"flushes\": %"NACL_PRIu64", \"hit_rate\": %.4f}",
+                 stats.lookups, stats.hits, stats.negative_hits,
+                 stats.expired, stats.inserts, stats.invalidations,
+                 stats.flushes,
+                 0 == stats.lookups ?
+                 0.0 : (double) stats.hits / stats.lookups) >= 0;
+}
+
+static int CompareInt(void const *a, void const *b) {
+  int x = *(int const *) a;
+  int y = *(int const *) b;
+  return x < y ? -1 : x > y;
+}
+
+int NaClSyscallProfileWriteJson(FILE *fp) {
+  struct NaClSyscallProfile *profile;
+  int *cages;
+  size_t num_profiles = 0;
+  size_t num_cages = 0;
+  size_t i;
+  int ok = 0;
+
+  for (profile = g_profiles; NULL != profile; profile = profile->next) {
+    ++num_profiles;
+  }
+  cages = malloc((num_profiles + 1) * sizeof *cages);
+  if (NULL == cages) {
+    return 0;
+  }
+  /* blocks pushed after the count was taken are left to the next dump */
+  for (profile = g_profiles; NULL != profile && num_cages < num_profiles;
+       profile = profile->next) {
+    cages[num_cages++] = profile->cage_id;
+  }
+  qsort(cages, num_cages, sizeof *cages, CompareInt);
+
+  if (fprintf(fp, "{\n  \"total\": ") < 0 ||
+      !WriteTables(fp, -1, "  ") ||
+      fprintf(fp, ",\n  \"cages\": {") < 0) {
+    goto done;
+  }
+  for (i = 0; i < num_cages; ++i) {
+    if (i > 0 && cages[i] == cages[i - 1]) {
+      continue;
+    }
+    if (fprintf(fp, "%s\n    \"%d\": ", i > 0 ? "," : "", cages[i]) < 0 ||
+        !WriteTables(fp, cages[i], "    ")) {
+      goto done;
+    }
+  }
+  if (fprintf(fp, "%s},\n  \"stat_cache\": ",
+              num_cages > 0 ? "\n  " : "") < 0 ||
+      !WriteStatCache(fp) ||
+      fprintf(fp, "\n}\n") < 0 ||
+      0 != fflush(fp)) {
+    goto done;
+  }
+  ok = 1;
+ done:
+  free(cages);
+  return ok;
+}
+
+void NaClSyscallProfileDump(void) {
+  char *tmp_path;
+  FILE *fp;
+
+  if (!nacl_syscall_profile_enabled) {
+    return;
+  }
+  NaClXMutexLock(&g_dump_mu);
+  if (NULL == g_dump_path) {
+    if (!NaClSyscallProfileWriteJson(stderr)) {
+      NaClLog(LOG_ERROR, "NaClSyscallProfileDump: write to stderr failed\n");
+    }
+    goto done;
+  }
+  /* write a new file and rename it so readers never see a partial dump */
+  tmp_path = malloc(strlen(g_dump_path) + sizeof ".tmp");
+  if (NULL == tmp_path) {
+    NaClLog(LOG_ERROR, "NaClSyscallProfileDump: out of memory\n");
+    goto done;
+  }
+  strcpy(tmp_path, g_dump_path);
+  strcat(tmp_path, ".tmp");
+  fp = fopen(tmp_path, "w");
+  if (NULL == fp) {
+    NaClLog(LOG_ERROR, "NaClSyscallProfileDump: cannot open %s: errno %d\n",
+            tmp_path, errno);
+  } else if (!NaClSyscallProfileWriteJson(fp)) {
+    NaClLog(LOG_ERROR, "NaClSyscallProfileDump: write to %s failed\n",
+            tmp_path);
+    fclose(fp);
+    remove(tmp_path);
+  } else if (0 != fclose(fp) || 0 != rename(tmp_path, g_dump_path)) {
+    NaClLog(LOG_ERROR, "NaClSyscallProfileDump: cannot write %s: errno %d\n",
+            g_dump_path, errno);
+    remove(tmp_path);
+  }
+  free(tmp_path);
+ done:
+  NaClXMutexUnlock(&g_dump_mu);
+}
+
+#if !NACL_WINDOWS
+static void WINAPI DumpOnSignalThread(void *state) {
+  sigset_t *set = (sigset_t *) state;
+  int sig;
+
+  for (;;) {
+    if (0 == sigwait(set, &sig)) {
+      NaClSyscallProfileDump();
+    }
+  }
+}
+#endif
+
+int NaClSyscallProfileEnable(char const *path) {
+#if !NACL_WINDOWS
+  static sigset_t set;
+#endif
+
+  if (nacl_syscall_profile_enabled) {
+    return 1;
+  }
+  if (NULL != path) {
+    g_dump_path = strdup(path);
+    if (NULL == g_dump_path) {
+      return 0;
+    }
+  }
+  if (!NaClMutexCtor(&g_dump_mu)) {
+    return 0;
+  }
+#if !NACL_WINDOWS
+  /*
+   * SIGUSR2 stays blocked everywhere and is taken with sigwait, so the dump
+   * runs on an ordinary trusted thread rather than in a signal handler
+   * that might interrupt untrusted code.
+   */
+  sigemptyset(&set);
+  sigaddset(&set, SIGUSR2);
+  if (0 != pthread_sigmask(SIG_BLOCK, &set, NULL)) {
+    return 0;
+  }
+  if (!NaClThreadCtor(&g_dump_thread, DumpOnSignalThread, &set,
+                      DUMP_THREAD_STACK_SIZE)) {
+    return 0;
+  }
+#endif
+  nacl_syscall_profile_enabled = 1;
+  return 1;
+}
@@ -0,0 +1,137 @@
+/*
+ * Copyright (c) 2017 The Native Client Authors. All rights reserved.
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file.
+ */
+
+/*
+ * Syscall profiling.  For both the NaCl syscall table and the Lind calls
+ * made through NACL_sys_lind_syscall, records per call number the number
+ * of calls, wall clock latency (CLOCK_MONOTONIC) as a histogram, and the
+ * bytes moved by calls that transfer data.
+ *
+ * Each NaClAppThread records into a block of counters that only it
+ * writes, so recording takes no lock and shares no cache line with other
+ * threads.  Counters for a call number are allocated the first time the
+ * thread makes that call.  Blocks are never freed: a block whose thread
+ * has exited is handed to the next thread of the same cage, so counts
+ * survive thread exit.  Readers sum the blocks without stopping the
+ * writers, so a snapshot taken while the process runs may be off by the
+ * calls in flight.
+ *
+ * Latency buckets are log-linear: NACL_SYSCALL_PROFILE_SUB_BUCKETS per
+ * power of two, so a percentile read off the histogram is within 25% of
+ * the true value.
+ */
+
+#ifndef NATIVE_CLIENT_SRC_TRUSTED_SERVICE_RUNTIME_NACL_SYSCALL_PROFILE_H_
+#define NATIVE_CLIENT_SRC_TRUSTED_SERVICE_RUNTIME_NACL_SYSCALL_PROFILE_H_
+
+#include <stdio.h>
+
+#include "native_client/src/include/portability.h"
+#include "native_client/src/trusted/service_runtime/include/bits/nacl_syscalls.h"
+
+EXTERN_C_BEGIN
+
+struct NaClAppThread;
+
+enum NaClSyscallProfileTable {
+  NACL_SYSCALL_PROFILE_NACL,
+  NACL_SYSCALL_PROFILE_LIND,
+  NACL_SYSCALL_PROFILE_NUM_TABLES
+};
+
+/* Call numbers at or above this are counted in the last slot. */
+#define NACL_SYSCALL_PROFILE_MAX_CALLS    NACL_MAX_SYSCALLS
+
+#define NACL_SYSCALL_PROFILE_SUB_BUCKET_BITS  2
+#define NACL_SYSCALL_PROFILE_SUB_BUCKETS \
+    (1 << NACL_SYSCALL_PROFILE_SUB_BUCKET_BITS)
+/* 2**40 ns is about 18 minutes; longer calls go in the last bucket. */
+#define NACL_SYSCALL_PROFILE_BUCKETS \
+    (40 * NACL_SYSCALL_PROFILE_SUB_BUCKETS)
+
+struct NaClSyscallProfileCounters {
+  uint64_t  calls;
+  uint64_t  total_ns;
+  uint64_t  max_ns;
+  uint64_t  bytes;
+  uint64_t  hist[NACL_SYSCALL_PROFILE_BUCKETS];
+};
+
+/* Set by NaClSyscallProfileEnable; read on every syscall. */
+extern int volatile nacl_syscall_profile_enabled;
+
+/*
+ * Turns profiling on.  |path| names the file NaClSyscallProfileDump writes;
+ * NULL means stderr.  On POSIX hosts this also starts a thread that dumps
+ * whenever the process gets SIGUSR2, which requires that SIGUSR2 be blocked
+ * in every thread: call this before any other thread is created.  Returns
+ * 0 on failure.
+ */
+int NaClSyscallProfileEnable(char const *path) NACL_WUR;
+
+/* Returns the start time to pass to NaClSyscallProfileEnd, or 0 if off. */
+uint64_t NaClSyscallProfileBegin(void);
+
+/*
+ * Records a call made by |natp| that started at |begin_ns| and returned
+ * |result|.  A positive |result| of a read or write style call is counted
+ * as bytes moved.
+ */
+void NaClSyscallProfileEnd(struct NaClAppThread *natp,
+                           enum NaClSyscallProfileTable table,
+                           uint32_t num,
+                           uint64_t begin_ns,
+                           int32_t result);
+
+/* Called when |natp| exits, to hand its counters to a later thread. */
+void NaClSyscallProfileThreadExit(struct NaClAppThread *natp);
+
+/*
+ * Lower level interface, used by the above and by tests: |profile| is a
+ * block claimed for |cage_id| with NaClSyscallProfileClaim.
+ */
+struct NaClSyscallProfile;
+
+struct NaClSyscallProfile *NaClSyscallProfileClaim(int cage_id);
+
+void NaClSyscallProfileRelease(struct NaClSyscallProfile *profile);
+
+void NaClSyscallProfileRecord(struct NaClSyscallProfile *profile,
+                              enum NaClSyscallProfileTable table,
+                              uint32_t num,
+                              uint64_t ns,
+                              int32_t result);
+
+/*
+ * Sums the counters of call |num| in |table| over the threads of cage
+ * |cage_id|, or over all threads if |cage_id| is -1.  Returns 0 if no such
+ * call was recorded.
+ */
+int NaClSyscallProfileSum(int cage_id,
+                          enum NaClSyscallProfileTable table,
+                          uint32_t num,
+                          struct NaClSyscallProfileCounters *out);
+
+/*
+ * Returns the latency, in ns, that a fraction |q| of the calls counted in
+ * |c| did not exceed: the upper bound of the bucket holding that call,
+ * capped at the largest latency seen.
+ */
+uint64_t NaClSyscallProfilePercentile(
+    struct NaClSyscallProfileCounters const *c, double q);
+
+/*
+ * Writes the totals, the per-cage breakdown and the path lookup cache's
+ * hit counts as JSON.  Returns 0 on an output error.
+ */
+int NaClSyscallProfileWriteJson(FILE *fp);
+
+/* Writes the JSON to the file given to NaClSyscallProfileEnable. */
+void NaClSyscallProfileDump(void);
+
+EXTERN_C_END
+
+#endif  /* NATIVE_CLIENT_SRC_TRUSTED_SERVICE_RUNTIME_NACL_SYSCALL_PROFILE_H_ */
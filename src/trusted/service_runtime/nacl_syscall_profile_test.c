@@ -0,0 +1,130 @@
+/*
+ * Copyright (c) 2017 The Native Client Authors. All rights reserved.
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file.
+ */
+
+/*
+ * Checks syscall profile aggregation: per-cage sums, reuse of released
+ * blocks, histogram percentiles, bytes moved and the JSON output.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "native_client/src/include/portability.h"
+#include "native_client/src/shared/platform/lind_platform.h"
+#include "native_client/src/shared/platform/nacl_check.h"
+#include "native_client/src/shared/platform/nacl_log.h"
+#include "native_client/src/trusted/service_runtime/nacl_syscall_profile.h"
+
+static void TestSums(void) {
+  struct NaClSyscallProfile *a = NaClSyscallProfileClaim(1);
+  struct NaClSyscallProfile *b = NaClSyscallProfileClaim(1);
+  struct NaClSyscallProfile *c = NaClSyscallProfileClaim(2);
+  struct NaClSyscallProfileCounters sum;
+
+  CHECK(NULL != a && NULL != b && NULL != c);
+  CHECK(a != b);
+  NaClSyscallProfileRecord(a, NACL_SYSCALL_PROFILE_NACL, NACL_sys_read,
+                           1000, 100);
+  NaClSyscallProfileRecord(b, NACL_SYSCALL_PROFILE_NACL, NACL_sys_read,
+                           3000, 50);
+  NaClSyscallProfileRecord(c, NACL_SYSCALL_PROFILE_NACL, NACL_sys_read,
+                           2000, -9);
+  /* not a data moving call: the result is not counted as bytes */
+  NaClSyscallProfileRecord(c, NACL_SYSCALL_PROFILE_NACL, NACL_sys_open,
+                           500, 3);
+
+  CHECK(NaClSyscallProfileSum(1, NACL_SYSCALL_PROFILE_NACL, NACL_sys_read,
+                              &sum));
+  CHECK(2 == sum.calls);
+  CHECK(4000 == sum.total_ns);
+  CHECK(3000 == sum.max_ns);
+  CHECK(150 == sum.bytes);
+
+  CHECK(NaClSyscallProfileSum(-1, NACL_SYSCALL_PROFILE_NACL, NACL_sys_read,
+                              &sum));
+  CHECK(3 == sum.calls);
+  CHECK(150 == sum.bytes);
+
+  CHECK(NaClSyscallProfileSum(2, NACL_SYSCALL_PROFILE_NACL, NACL_sys_open,
+                              &sum));
+  CHECK(0 == sum.bytes);
+  CHECK(!NaClSyscallProfileSum(1, NACL_SYSCALL_PROFILE_NACL, NACL_sys_open,
+                               &sum));
+  CHECK(!NaClSyscallProfileSum(-1, NACL_SYSCALL_PROFILE_LIND,
+                               LIND_safe_fs_read, &sum));
+
+  /* a released block goes to the next thread of the same cage only */
+  NaClSyscallProfileRelease(b);
+  CHECK(b != NaClSyscallProfileClaim(2));
+  CHECK(b == NaClSyscallProfileClaim(1));
+}
+
+static void TestPercentiles(void) {
+  struct NaClSyscallProfile *p = NaClSyscallProfileClaim(3);
+  struct NaClSyscallProfileCounters sum;
+  uint64_t p50;
+  uint64_t p99;
+  uint64_t p999;
+  int i;
+
+  CHECK(NULL != p);
+  /* 990 fast calls, 9 slow ones and one very slow one */
+  for (i = 0; i < 990; ++i) {
+    NaClSyscallProfileRecord(p, NACL_SYSCALL_PROFILE_LIND, LIND_safe_fs_write,
+                             1000 + i, 10);
+  }
+  for (i = 0; i < 9; ++i) {
+    NaClSyscallProfileRecord(p, NACL_SYSCALL_PROFILE_LIND, LIND_safe_fs_write,
+                             100000, 10);
+  }
+  NaClSyscallProfileRecord(p, NACL_SYSCALL_PROFILE_LIND, LIND_safe_fs_write,
+                           10000000, 10);
+
+  CHECK(NaClSyscallProfileSum(3, NACL_SYSCALL_PROFILE_LIND,
+                              LIND_safe_fs_write, &sum));
+  CHECK(1000 == sum.calls);
+  CHECK(10000 == sum.bytes);
+  p50 = NaClSyscallProfilePercentile(&sum, 0.5);
+  p99 = NaClSyscallProfilePercentile(&sum, 0.99);
+  p999 = NaClSyscallProfilePercentile(&sum, 0.999);
+  printf("p50 %"NACL_PRIu64" p99 %"NACL_PRIu64" p999 %"NACL_PRIu64"\n",
+         p50, p99, p999);
+  /* each bucket is at most a quarter of its lower bound wide */
+  CHECK(p50 >= 1499 && p50 <= 1499 * 5 / 4);
+  CHECK(p99 >= 1989 && p99 <= 1989 * 5 / 4);
+  CHECK(p999 >= 100000 && p999 <= 100000 * 5 / 4);
+  CHECK(10000000 == NaClSyscallProfilePercentile(&sum, 1.0));
+}
+
+static void TestJson(void) {
+  FILE *fp = tmpfile();
+  char buf[8192];
+  size_t n;
+
+  CHECK(NULL != fp);
+  CHECK(NaClSyscallProfileWriteJson(fp));
+  rewind(fp);
+  n = fread(buf, 1, sizeof buf - 1, fp);
+  buf[n] = '\0';
+  fclose(fp);
+  printf("%s", buf);
+  CHECK(NULL != strstr(buf, "\"total\": {"));
+  CHECK(NULL != strstr(buf, "\"cages\": {"));
+  CHECK(NULL != strstr(buf, "\"3\": {"));
+  CHECK(NULL != strstr(buf, "\"calls\": 1000"));
+  CHECK(NULL != strstr(buf, "\"stat_cache\": {\"lookups\": 0"));
+}
+
+int main(void) {
+  NaClLogModuleInit();
+  TestSums();
+  TestPercentiles();
+  TestJson();
+  NaClLogModuleFini();
+  printf("PASSED\n");
+  return 0;
+}
@@ -4,6 +4,7 @@
  * found in the LICENSE file.
  */
 
+#include <stdlib.h>
 #include <string.h>
 
 #include "native_client/src/include/concurrency_ops.h"
@@ -20,8 +21,10 @@
 #include "native_client/src/trusted/perf_counter/nacl_perf_counter.h"
 #include "native_client/src/trusted/service_runtime/arch/sel_ldr_arch.h"
 #include "native_client/src/trusted/service_runtime/include/bits/mman.h"
+#include "native_client/src/trusted/service_runtime/include/sys/dyncode_batch.h"
 #include "native_client/src/trusted/service_runtime/include/sys/errno.h"
 #include "native_client/src/trusted/service_runtime/nacl_app_thread.h"
+#include "native_client/src/trusted/service_runtime/nacl_copy.h"
 #include "native_client/src/trusted/service_runtime/nacl_error_code.h"
 #include "native_client/src/trusted/service_runtime/nacl_text.h"
 #include "native_client/src/trusted/service_runtime/sel_ldr.h"
@@ -473,97 +476,64 @@ static void MakeDynamicCodePagesVisible(struct NaClApp *nap,
 }
 
 /*
- * Maps a writable version of the code at [offset, offset+size) and returns a
- * pointer to the new mapping. Internally caches the last mapping between
- * calls. Pass offset=0,size=0 to clear cache.
+ * Returns a writable view of [offset, offset+size) of text_shm, making
+ * any of its pages not yet in use visible first.  The view is part of a
+ * single writable alias of the whole of text_shm, mapped on first use and
+ * kept until the cage is released, so that installing or patching code
+ * never maps or unmaps anything however scattered the addresses are.
+ * Returns 0 if the alias cannot be mapped.
  * Caller must hold nap->dynamic_load_mutex.
  */
-static uintptr_t CachedMapWritableText(struct NaClApp *nap,
-                                       uint32_t offset,
-                                       uint32_t size) {
-  /*
-   * The nap->* variables used in this function can be in two states:
-   *
-   * 1)
-   * nap->dynamic_mapcache_size == 0
-   * nap->dynamic_mapcache_ret == 0
-   *
-   * Initial state, nothing is cached.
-   *
-   * 2)
-   * nap->dynamic_mapcache_size != 0
-   * nap->dynamic_mapcache_ret != 0
-   *
-   * We have a cached mmap result stored, that must be unmapped.
-   */
+static uintptr_t NaClTextMapWritable(struct NaClApp *nap,
+                                     uint32_t offset,
+                                     uint32_t size) {
   struct NaClDesc            *shm = nap->text_shm;
-
-  if (offset != nap->dynamic_mapcache_offset
-          || size != nap->dynamic_mapcache_size) {
-    /*
-     * cache miss, first clear the old cache if needed
-     */
-    if (nap->dynamic_mapcache_size > 0) {
-      NaClDescUnmapUnsafe(shm, (void *) nap->dynamic_mapcache_ret,
-                          nap->dynamic_mapcache_size);
-      nap->dynamic_mapcache_offset = 0;
-      nap->dynamic_mapcache_size = 0;
-      nap->dynamic_mapcache_ret = 0;
+  uint32_t                   current_page_index;
+  uint32_t                   end_page_index;
+
+  if (0 == nap->dynamic_text_alias) {
+    uintptr_t mapping = (*((struct NaClDescVtbl const *)
+          shm->base.vtbl)->
+            Map)(shm,
+                 NaClDescEffectorTrustedMem(),
+                 NULL,
+                 nap->dynamic_text_end - nap->dynamic_text_start,
+                 NACL_ABI_PROT_READ | NACL_ABI_PROT_WRITE,
+                 NACL_ABI_MAP_SHARED,
+                 0);
+    if (NaClPtrIsNegErrno(&mapping)) {
+      return 0;
     }
+    nap->dynamic_text_alias = mapping;
+  }
 
-    /*
-     * update that cached version
-     */
-    if (size > 0) {
-      uint32_t current_page_index;
-      uint32_t end_page_index;
-
-      uintptr_t mapping = (*((struct NaClDescVtbl const *)
-            shm->base.vtbl)->
-              Map)(shm,
-                   NaClDescEffectorTrustedMem(),
-                   NULL,
-                   size,
-                   NACL_ABI_PROT_READ | NACL_ABI_PROT_WRITE,
-                   NACL_ABI_MAP_SHARED,
-                   offset);
-      if (NaClPtrIsNegErrno(&mapping)) {
-        return 0;
-      }
-
-      /*
-       * To reduce the number of mprotect() system calls, we coalesce
-       * MakeDynamicCodePagesVisible() calls for adjacent pages that
-       * have yet not been allocated.
-       */
-      current_page_index = offset / NACL_MAP_PAGESIZE;
-      end_page_index = (offset + size) / NACL_MAP_PAGESIZE;
-      while (current_page_index < end_page_index) {
-        uint32_t start_page_index = current_page_index;
-        /* Find the end of this block of unallocated pages. */
-        while (current_page_index < end_page_index &&
-               !BitmapIsBitSet(nap->dynamic_page_bitmap, current_page_index)) {
-          current_page_index++;
-        }
-        if (current_page_index > start_page_index) {
-          uintptr_t writable_addr =
-              mapping + (start_page_index * NACL_MAP_PAGESIZE - offset);
-          MakeDynamicCodePagesVisible(nap, start_page_index, current_page_index,
-                                      (uint8_t *) writable_addr);
-        }
-        current_page_index++;
-      }
-
-      nap->dynamic_mapcache_offset = offset;
-      nap->dynamic_mapcache_size = size;
-      nap->dynamic_mapcache_ret = mapping;
+  /*
+   * To reduce the number of mprotect() system calls, we coalesce
+   * MakeDynamicCodePagesVisible() calls for adjacent pages that
+   * have yet not been allocated.
+   */
+  current_page_index = offset / NACL_MAP_PAGESIZE;
+  end_page_index = (offset + size) / NACL_MAP_PAGESIZE;
+  while (current_page_index < end_page_index) {
+    uint32_t start_page_index = current_page_index;
+    /* Find the end of this block of unallocated pages. */
+    while (current_page_index < end_page_index &&
+           !BitmapIsBitSet(nap->dynamic_page_bitmap, current_page_index)) {
+      current_page_index++;
     }
+    if (current_page_index > start_page_index) {
+      uintptr_t writable_addr =
+          nap->dynamic_text_alias + start_page_index * NACL_MAP_PAGESIZE;
+      MakeDynamicCodePagesVisible(nap, start_page_index, current_page_index,
+                                  (uint8_t *) writable_addr);
+    }
+    current_page_index++;
   }
-  return nap->dynamic_mapcache_ret;
+  return nap->dynamic_text_alias + offset;
 }
 
 /*
- * A wrapper around CachedMapWritableText that performs common address
+ * A wrapper around NaClTextMapWritable that performs common address
  * calculations.
  * Outputs *mmapped_addr.
  * Caller must hold nap->dynamic_load_mutex.
@@ -588,9 +558,9 @@ static INLINE int NaClTextMapWrapper(struct NaClApp *nap,
     (shm_offset + size + NACL_MAP_PAGESIZE - 1) & ~(NACL_MAP_PAGESIZE - 1);
   shm_map_size = shm_map_offset_end - shm_map_offset;
 
-  mmap_ret = CachedMapWritableText(nap,
-                                   shm_map_offset,
-                                   shm_map_size);
+  mmap_ret = NaClTextMapWritable(nap,
+                                 shm_map_offset,
+                                 shm_map_size);
   if (0 == mmap_ret) {
     return 0;
   }
@@ -600,39 +570,14 @@ static INLINE int NaClTextMapWrapper(struct NaClApp *nap,
 }
 
 /*
- * Clear the mmap cache if multiple pages were mapped.
- * Caller must hold nap->dynamic_load_mutex.
+ * Checks that [dest, dest+size) may be given to NaClTextDyncodeCreate,
+ * and outputs its sandbox address in *dest_addr.  Returns 0 if so, a
+ * negated NaCl ABI errno otherwise.
  */
-static INLINE void NaClTextMapClearCacheIfNeeded(struct NaClApp *nap,
-                                                 uint32_t dest,
-                                                 uint32_t size) {
-  uint32_t                    shm_offset;
-  uint32_t                    shm_map_offset;
-  uint32_t                    shm_map_offset_end;
-  uint32_t                    shm_map_size;
-  shm_offset = dest - (uint32_t) nap->dynamic_text_start;
-  shm_map_offset = shm_offset & ~(NACL_MAP_PAGESIZE - 1);
-  shm_map_offset_end =
-    (shm_offset + size + NACL_MAP_PAGESIZE - 1) & ~(NACL_MAP_PAGESIZE - 1);
-  shm_map_size = shm_map_offset_end - shm_map_offset;
-  if (shm_map_size > NACL_MAP_PAGESIZE) {
-    /* call with size==offset==0 to clear cache */
-    CachedMapWritableText(nap, 0, 0);
-  }
-}
-
-int32_t NaClTextDyncodeCreate(struct NaClApp *nap,
-                              uint32_t       dest,
-                              void           *code_copy,
-                              uint32_t       size,
-                              const struct NaClValidationMetadata *metadata) {
-  uintptr_t                   dest_addr;
-  uint8_t                     *mapped_addr;
-  int32_t                     retval = -NACL_ABI_EINVAL;
-  int                         validator_result;
-  struct NaClPerfCounter      time_dyncode_create;
-  NaClPerfCounterCtor(&time_dyncode_create, "NaClTextDyncodeCreate");
-
+static int32_t NaClTextDyncodeCheck(struct NaClApp *nap,
+                                    uint32_t       dest,
+                                    uint32_t       size,
+                                    uintptr_t      *dest_addr) {
   if (NULL == nap->text_shm) {
     NaClLog(1, "NaClTextDyncodeCreate: Dynamic loading not enabled\n");
     return -NACL_ABI_EINVAL;
@@ -642,8 +587,8 @@ int32_t NaClTextDyncodeCreate(struct NaClApp *nap,
     NaClLog(1, "NaClTextDyncodeCreate: Non-bundle-aligned address or size\n");
     return -NACL_ABI_EINVAL;
   }
-  dest_addr = NaClUserToSysAddrRange(nap, dest, size);
-  if (kNaClBadAddress == dest_addr) {
+  *dest_addr = NaClUserToSysAddrRange(nap, dest, size);
+  if (kNaClBadAddress == *dest_addr) {
     NaClLog(1, "NaClTextDyncodeCreate: Dest address out of range\n");
     return -NACL_ABI_EFAULT;
   }
@@ -659,12 +604,24 @@ int32_t NaClTextDyncodeCreate(struct NaClApp *nap,
     NaClLog(1, "NaClTextDyncodeCreate: Above dynamic code area\n");
     return -NACL_ABI_EFAULT;
   }
-  if (0 == size) {
-    /* Nothing to load.  Succeed trivially. */
-    return 0;
-  }
+  return 0;
+}
 
-  NaClXMutexLock(&nap->dynamic_load_mutex);
+/*
+ * Validates and installs code that NaClTextDyncodeCheck has accepted.
+ * Caller must hold nap->dynamic_load_mutex.
+ */
+static int32_t NaClTextDyncodeCreateLocked(
+    struct NaClApp                      *nap,
+    uint32_t                            dest,
+    uintptr_t                           dest_addr,
+    void                                *code_copy,
+    uint32_t                            size,
+    const struct NaClValidationMetadata *metadata) {
+  uint8_t                     *mapped_addr;
+  int                         validator_result;
+  struct NaClPerfCounter      time_dyncode_create;
+  NaClPerfCounterCtor(&time_dyncode_create, "NaClTextDyncodeCreate");
 
   /*
    * Validate the code before trying to create the region.  This avoids the need
@@ -692,20 +649,17 @@ int32_t NaClTextDyncodeCreate(struct NaClApp *nap,
   if (validator_result != LOAD_OK) {
     NaClLog(1, "NaClTextDyncodeCreate: "
             "Validation of dynamic code failed\n");
-    retval = -NACL_ABI_EINVAL;
-    goto cleanup_unlock;
+    return -NACL_ABI_EINVAL;
   }
 
   if (NaClDynamicRegionCreate(nap, dest_addr, size, 0) != 1) {
     /* target addr is in use */
     NaClLog(1, "NaClTextDyncodeCreate: Code range already allocated\n");
-    retval = -NACL_ABI_EINVAL;
-    goto cleanup_unlock;
+    return -NACL_ABI_EINVAL;
   }
 
   if (!NaClTextMapWrapper(nap, dest, size, &mapped_addr)) {
-    retval = -NACL_ABI_ENOMEM;
-    goto cleanup_unlock;
+    return -NACL_ABI_ENOMEM;
   }
 
   CopyCodeSafelyInitial(mapped_addr, code_copy, size, nap->bundle_size);
@@ -718,11 +672,29 @@ int32_t NaClTextDyncodeCreate(struct NaClApp *nap,
    */
   NaClFlushCacheForDoublyMappedCode(mapped_addr, (uint8_t *) dest_addr, size);
 
-  retval = 0;
+  return 0;
+}
 
-  NaClTextMapClearCacheIfNeeded(nap, dest, size);
+int32_t NaClTextDyncodeCreate(struct NaClApp *nap,
+                              uint32_t       dest,
+                              void           *code_copy,
+                              uint32_t       size,
+                              const struct NaClValidationMetadata *metadata) {
+  uintptr_t                   dest_addr;
+  int32_t                     retval;
 
- cleanup_unlock:
+  retval = NaClTextDyncodeCheck(nap, dest, size, &dest_addr);
+  if (0 != retval) {
+    return retval;
+  }
+  if (0 == size) {
+    /* Nothing to load.  Succeed trivially. */
+    return 0;
+  }
+
+  NaClXMutexLock(&nap->dynamic_load_mutex);
+  retval = NaClTextDyncodeCreateLocked(nap, dest, dest_addr, code_copy, size,
+                                       metadata);
   NaClXMutexUnlock(&nap->dynamic_load_mutex);
   return retval;
 }
@@ -765,6 +737,118 @@ int32_t NaClSysDyncodeCreate(struct NaClAppThread *natp,
   return retval;
 }
 
+/*
+ * Copies in, checks and makes private copies of the code of up to |count|
+ * chunks at user address |chunks|, then validates and installs them in
+ * order under a single hold of dynamic_load_mutex.  Returns how many were
+ * installed, which is fewer than |count| if one failed or the group's code
+ * would be over NACL_DYNCODE_BATCH_BYTES, or the error of the first chunk
+ * if none was.
+ */
+static int32_t NaClDyncodeCreateGroup(struct NaClApp *nap,
+                                      uint32_t       chunks,
+                                      uint32_t       count) {
+  struct NaClDyncodeChunk     chunk[NACL_DYNCODE_BATCH_GROUP];
+  uintptr_t                   dest_addr[NACL_DYNCODE_BATCH_GROUP];
+  uint32_t                    code_offset[NACL_DYNCODE_BATCH_GROUP];
+  uint32_t                    code_size = 0;
+  uint32_t                    checked;
+  uint32_t                    done;
+  uint8_t                     *code_copy;
+  int32_t                     retval = 0;
+
+  if (!NaClCopyInFromUser(nap, chunk, chunks, count * sizeof chunk[0])) {
+    return -NACL_ABI_EFAULT;
+  }
+  for (checked = 0; checked < count; ++checked) {
+    if (kNaClBadAddress == NaClUserToSysAddrRange(nap, chunk[checked].src,
+                                                  chunk[checked].size)) {
+      NaClLog(1, "NaClSysDyncodeCreateBatch: Source address out of range\n");
+      retval = -NACL_ABI_EFAULT;
+      break;
+    }
+    retval = NaClTextDyncodeCheck(nap, chunk[checked].dest,
+                                  chunk[checked].size, &dest_addr[checked]);
+    if (0 != retval) {
+      break;
+    }
+    /* the rest go in the next group */
+    if (code_size > 0 &&
+        chunk[checked].size > NACL_DYNCODE_BATCH_BYTES - code_size) {
+      break;
+    }
+    code_offset[checked] = code_size;
+    code_size += chunk[checked].size;
+  }
+  if (0 == checked) {
+    return retval;
+  }
+
+  /*
+   * Make a private copy of the code, so that we can validate it
+   * without a TOCTTOU race condition.
+   */
+  code_copy = malloc(code_size > 0 ? code_size : 1);
+  if (NULL == code_copy) {
+    return -NACL_ABI_ENOMEM;
+  }
+  for (done = 0; done < checked; ++done) {
+    memcpy(code_copy + code_offset[done],
+           (uint8_t *) NaClUserToSys(nap, chunk[done].src),
+           chunk[done].size);
+  }
+
+  NaClXMutexLock(&nap->dynamic_load_mutex);
+  for (done = 0; done < checked; ++done) {
+    if (0 == chunk[done].size) {
+      continue;
+    }
+    retval = NaClTextDyncodeCreateLocked(nap, chunk[done].dest,
+                                         dest_addr[done],
+                                         code_copy + code_offset[done],
+                                         chunk[done].size, NULL);
+    if (0 != retval) {
+      break;
+    }
+  }
+  NaClXMutexUnlock(&nap->dynamic_load_mutex);
+
+  free(code_copy);
+  return 0 == done ? retval : (int32_t) done;
+}
+
+int32_t NaClSysDyncodeCreateBatch(struct NaClAppThread *natp,
+                                  uint32_t             chunks,
+                                  uint32_t             count) {
+  struct NaClApp              *nap = natp->nap;
+  uint32_t                    done = 0;
+  int32_t                     retval = 0;
+
+  if (!nap->enable_dyncode_syscalls) {
+    NaClLog(LOG_WARNING,
+            "NaClSysDyncodeCreateBatch: Dynamic code syscalls are disabled\n");
+    return -NACL_ABI_ENOSYS;
+  }
+  if (count > NACL_DYNCODE_BATCH_MAX) {
+    return -NACL_ABI_EINVAL;
+  }
+
+  while (done < count) {
+    uint32_t n = count - done;
+
+    if (n > NACL_DYNCODE_BATCH_GROUP) {
+      n = NACL_DYNCODE_BATCH_GROUP;
+    }
+    retval = NaClDyncodeCreateGroup(
+        nap, chunks + done * sizeof(struct NaClDyncodeChunk), n);
+    if (retval <= 0) {
+      break;
+    }
+    done += retval;
+  }
+  return done > 0 ? (int32_t) done : retval;
+}
+
 int32_t NaClSysDyncodeModify(struct NaClAppThread *natp,
                              uint32_t             dest,
                              uint32_t             src,
@@ -891,8 +975,6 @@ int32_t NaClSysDyncodeModify(struct NaClAppThread *natp,
   }
   retval = 0;
 
-  NaClTextMapClearCacheIfNeeded(nap, dest, size);
-
  cleanup_unlock:
   NaClXMutexUnlock(&nap->dynamic_load_mutex);
 
@@ -984,8 +1066,6 @@ int32_t NaClSysDyncodeDelete(struct NaClAppThread *natp,
      */
     NaClFlushCacheForDoublyMappedCode(mapped_addr, (uint8_t *) dest_addr, size);
 
-    NaClTextMapClearCacheIfNeeded(nap, dest, size);
-
     /* increment and record the generation deletion was requested */
     region->delete_generation = ++nap->dynamic_delete_generation;
   }
@@ -89,6 +89,15 @@ int32_t NaClSysDyncodeCreate(struct NaClAppThread *natp,
                              uint32_t             src,
                              uint32_t             size) NACL_WUR;
 
+/*
+ * Installs an array of |count| struct NaClDyncodeChunk at user address
+ * |chunks| as NaClSysDyncodeCreate would each of them; see
+ * include/sys/dyncode_batch.h.
+ */
+int32_t NaClSysDyncodeCreateBatch(struct NaClAppThread *natp,
+                                  uint32_t             chunks,
+                                  uint32_t             count) NACL_WUR;
+
 int32_t NaClSysDyncodeModify(struct NaClAppThread *natp,
                              uint32_t             dest,
                              uint32_t             src,
@@ -5,6 +5,8 @@
  */
 
 #include <errno.h>
+#include <pthread.h>
+#include <sys/mman.h>
 #include <sys/resource.h>
 #include <string.h>
 
@@ -13,6 +15,14 @@
 
 size_t g_prereserved_sandbox_size = 0;
 
+/* idle regions beyond this many are unmapped */
+#define NACL_ADDRSPACE_POOL_MAX 64
+
+static pthread_mutex_t g_pool_mu = PTHREAD_MUTEX_INITIALIZER;
+static size_t g_pool_region_size;
+static void *g_pool[NACL_ADDRSPACE_POOL_MAX];
+static int g_pool_count;
+
 /*
  * Find sandbox memory prereserved by the nacl_helper in chrome. The
  * nacl_helper, if present, reserves the bottom 1G of the address space
@@ -59,3 +69,55 @@ void NaClAddrSpaceBeforeAlloc(size_t untrusted_size) {
     }
   }
 }
+
+void NaClAddrSpacePoolEnable(size_t region_size) {
+  pthread_mutex_lock(&g_pool_mu);
+  g_pool_region_size = region_size;
+  pthread_mutex_unlock(&g_pool_mu);
+}
+
+int NaClAddrSpacePoolTake(void **region, size_t region_size) {
+  int taken = 0;
+
+  pthread_mutex_lock(&g_pool_mu);
+  if (region_size == g_pool_region_size && g_pool_count > 0) {
+    *region = g_pool[--g_pool_count];
+    taken = 1;
+  }
+  pthread_mutex_unlock(&g_pool_mu);
+  return taken;
+}
+
+int NaClAddrSpacePoolGive(void *region, size_t region_size) {
+  void *wiped;
+
+  pthread_mutex_lock(&g_pool_mu);
+  if (region_size != g_pool_region_size ||
+      g_pool_count == NACL_ADDRSPACE_POOL_MAX) {
+    pthread_mutex_unlock(&g_pool_mu);
+    return 0;
+  }
+  pthread_mutex_unlock(&g_pool_mu);
+
+  /*
+   * One fixed mapping over the whole region throws away every page and
+   * mapping the cage left there, and leaves it as it was first reserved.
+   */
+  wiped = mmap(region, region_size, PROT_NONE,
+               MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE | MAP_FIXED,
+               -1, 0);
+  if (MAP_FAILED == wiped) {
+    NaClLog(LOG_WARNING, "NaClAddrSpacePoolGive: mmap failed: %s\n",
+            strerror(errno));
+    return 0;
+  }
+
+  pthread_mutex_lock(&g_pool_mu);
+  if (g_pool_count == NACL_ADDRSPACE_POOL_MAX) {
+    pthread_mutex_unlock(&g_pool_mu);
+    return 0;
+  }
+  g_pool[g_pool_count++] = region;
+  pthread_mutex_unlock(&g_pool_mu);
+  return 1;
+}
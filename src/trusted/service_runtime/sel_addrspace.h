@@ -89,13 +89,34 @@ NaClErrorCode NaClAllocateSpace(void **mem, size_t addrsp_size) NACL_WUR;
 
 /*
  * NaClAddrSpaceFree() unmaps all of untrusted address space.  This is
- * only safe if no untrusted threads are running.
+ * only safe if no untrusted threads are running.  Where the sandbox
+ * region pool is in use, the region is kept reserved in the pool instead.
  *
  * Note that this does not free any other data structures associated
  * with the NaClApp.  In particular, it does not free mem_map.
  */
 void NaClAddrSpaceFree(struct NaClApp *nap);
 
+#if NACL_LINUX || NACL_OSX
+/*
+ * A pool of whole sandbox regions, guard regions included, so that a new
+ * cage takes a reservation that is already there instead of searching the
+ * address space for one.  Pooled regions are PROT_NONE and hold no pages.
+ * The pool is off until NaClAddrSpacePoolEnable names the region size;
+ * only regions of that size are taken in.
+ */
+void NaClAddrSpacePoolEnable(size_t region_size);
+
+/* Returns non-zero and sets *region if a pooled region was taken. */
+int NaClAddrSpacePoolTake(void **region, size_t region_size);
+
+/*
+ * Wipes |region| and keeps it in the pool.  Returns zero if the pool is
+ * off, full or the region could not be wiped; the caller then unmaps it.
+ */
+int NaClAddrSpacePoolGive(void *region, size_t region_size);
+#endif
+
 EXTERN_C_END
 
 #endif
@@ -15,6 +15,7 @@
 #include "native_client/src/include/nacl_macros.h"
 
 #include "native_client/src/shared/gio/gio.h"
+#include "native_client/src/shared/platform/aligned_malloc.h"
 #include "native_client/src/shared/platform/nacl_check.h"
 #include "native_client/src/shared/platform/nacl_exit.h"
 #include "native_client/src/shared/platform/nacl_log.h"
@@ -66,15 +67,10 @@ double time_counter = 0.0;
 double time_start = 0.0;
 double time_end = 0.0;
 
-/*
- * `fd_cage_table[cage_id][fd] = real fd`
- *
- * The [fd] idx is the virtual fd visible to the cages.
- *
- * -jp
- */
 volatile sig_atomic_t fork_num;
-int fd_cage_table[CAGE_MAX][FILE_DESC_MAX];
+
+/* bit n set while cage id n is in use; updated with atomic operations */
+static uint32_t volatile g_cage_ids[CAGE_MAX / 32];
 
 static int IsEnvironmentVariableSet(char const *env_name) {
   return !!getenv(env_name);
@@ -121,6 +117,7 @@ int NaClAppWithSyscallTableCtor(struct NaClApp               *nap,
 #endif
 
   nap->static_text_end = 0;
+  nap->code_segment_size = 0;
   nap->dynamic_text_start = 0;
   nap->dynamic_text_end = 0;
   nap->rodata_start = 0;
@@ -135,9 +132,15 @@ int NaClAppWithSyscallTableCtor(struct NaClApp               *nap,
   if (!DynArrayCtor(&nap->desc_tbl, 2)) {
     goto cleanup_threads;
   }
-  if (!DynArrayCtor(&nap->children, 2)) {
+  if (!NaClFdTableCtor(&nap->host_fd_tbl)) {
     goto cleanup_desc_tbl;
   }
+  if (!NaClFdTableCtor(&nap->host_fd_owner)) {
+    goto cleanup_host_fd_tbl;
+  }
+  if (!DynArrayCtor(&nap->children, 2)) {
+    goto cleanup_host_fd_owner;
+  }
   if (!NaClVmmapCtor(&nap->mem_map)) {
     goto cleanup_children;
   }
@@ -164,6 +167,7 @@ int NaClAppWithSyscallTableCtor(struct NaClApp               *nap,
   nap->enable_dyncode_syscalls = ShouldEnableDyncodeSyscalls();
   nap->use_shm_for_dynamic_text = ShouldEnableDynamicLoading();
   nap->text_shm = NULL;
+  nap->anon_shm = NULL;
 
   if (!NaClMutexCtor(&nap->dynamic_load_mutex)) {
     goto cleanup_effp_free;
@@ -171,14 +175,15 @@ int NaClAppWithSyscallTableCtor(struct NaClApp               *nap,
   if (!NaClMutexCtor(&nap->children_mu)) {
     goto cleanup_dynamic_load_mutex;
   }
+  if (!NaClCondVarCtor(&nap->children_cv)) {
+    goto cleanup_children_mutex;
+  }
   nap->dynamic_page_bitmap = NULL;
   nap->dynamic_regions = NULL;
   nap->num_dynamic_regions = 0;
   nap->dynamic_regions_allocated = 0;
   nap->dynamic_delete_generation = 0;
-  nap->dynamic_mapcache_offset = 0;
-  nap->dynamic_mapcache_size = 0;
-  nap->dynamic_mapcache_ret = 0;
+  nap->dynamic_text_alias = 0;
   nap->service_port = NULL;
   nap->service_address = NULL;
   nap->secure_service_port = NULL;
@@ -198,7 +203,7 @@ int NaClAppWithSyscallTableCtor(struct NaClApp               *nap,
   nap->reverse_channel_initialization_state =
       NACL_REVERSE_CHANNEL_UNINITIALIZED;
   if (!NaClMutexCtor(&nap->mu)) {
-    goto cleanup_children_mutex;
+    goto cleanup_children_cv;
   }
   if (!NaClCondVarCtor(&nap->cv)) {
     goto cleanup_mu;
@@ -252,12 +257,20 @@ int NaClAppWithSyscallTableCtor(struct NaClApp               *nap,
     goto cleanup_name_service;
   }
   nap->num_threads = 0;
+  nap->num_exiting_threads = 0;
+  nap->vm_io_fence = 0;
   if (!NaClFastMutexCtor(&nap->desc_mu)) {
     goto cleanup_threads_mu;
   }
 
   nap->running = 0;
   nap->exit_status = -1;
+  nap->exited_children = NULL;
+  nap->exited_children_tail = NULL;
+  nap->next_exited_child = NULL;
+  nap->num_running_children = 0;
+  nap->reparented = 0;
+  nap->cage_release = 0;
 
 #if NACL_ARCH(NACL_BUILD_ARCH) == NACL_x86 && NACL_BUILD_SUBARCH == 32
   nap->code_seg_sel = 0;
@@ -308,6 +321,8 @@ int NaClAppWithSyscallTableCtor(struct NaClApp               *nap,
   NaClCondVarDtor(&nap->cv);
  cleanup_mu:
   NaClMutexDtor(&nap->mu);
+ cleanup_children_cv:
+  NaClCondVarDtor(&nap->children_cv);
  cleanup_children_mutex:
   NaClMutexDtor(&nap->children_mu);
  cleanup_dynamic_load_mutex:
@@ -321,6 +336,10 @@ int NaClAppWithSyscallTableCtor(struct NaClApp               *nap,
   NaClVmmapDtor(&nap->mem_map);
  cleanup_children:
   DynArrayDtor(&nap->children);
+ cleanup_host_fd_owner:
+  NaClFdTableDtor(&nap->host_fd_owner);
+ cleanup_host_fd_tbl:
+  NaClFdTableDtor(&nap->host_fd_tbl);
  cleanup_desc_tbl:
   DynArrayDtor(&nap->desc_tbl);
  cleanup_threads:
@@ -591,6 +610,8 @@ void NaClSetDescMu(struct NaClApp   *nap,
                    int              d,
                    struct NaClDesc  *ndp) {
   struct NaClDesc *result;
+  int old_host_fd;
+  int host_fd = -1;
 
   result = (struct NaClDesc *) DynArrayGet(&nap->desc_tbl, d);
   NaClDescSafeUnref(result);
@@ -602,6 +623,76 @@ void NaClSetDescMu(struct NaClApp   *nap,
             d,
             (uintptr_t) ndp);
   }
+
+  if (NULL != ndp && NACL_DESC_HOST_IO == NACL_VTBL(NaClDesc, ndp)->typeTag) {
+    host_fd = ((struct NaClDescIoDesc *) ndp)->hd->d;
+  }
+  old_host_fd = NaClFdTableSet(&nap->host_fd_tbl, d, host_fd);
+  if (old_host_fd >= 0 &&
+      NaClFdTableGet(&nap->host_fd_owner, old_host_fd) == d) {
+    NaClFdTableSet(&nap->host_fd_owner, old_host_fd, -1);
+  }
+  if (host_fd >= 0 &&
+      (old_host_fd < -1 ||
+       NaClFdTableSet(&nap->host_fd_owner, host_fd, d) < -1)) {
+    NaClLog(LOG_FATAL,
+            "NaClSetDesc: could not record host fd %d of descriptor %d\n",
+            host_fd, d);
+  }
+}
+
+static int NaClIsPipeDescMu(struct NaClApp *nap, int d) {
+  struct NaClDesc *ndp;
+
+  if (d < 0) {
+    return 0;
+  }
+  ndp = (struct NaClDesc *) DynArrayGet(&nap->desc_tbl, d);
+  return NULL != ndp && NACL_DESC_PIPE == NACL_VTBL(NaClDesc, ndp)->typeTag;
+}
+
+void NaClDropPipeDescs(struct NaClApp *nap) {
+  struct NaClDesc *ndp;
+  size_t d;
+  int size;
+  int fd;
+
+  NaClFastMutexLock(&nap->desc_mu);
+  /* first the cage fds, while their slots still say what they were */
+  size = NaClFdTableSize(&nap->fd_table);
+  for (fd = 0; fd < size; ++fd) {
+    if (NaClIsPipeDescMu(nap, NaClFdTableGet(&nap->fd_table, fd))) {
+      NaClFdTableSet(&nap->fd_table, fd, NACL_BAD_FD);
+      NaClFdTableSet(&nap->fd_cloexec, fd, NACL_BAD_FD);
+    }
+  }
+  for (d = 0; d < nap->desc_tbl.num_entries; ++d) {
+    ndp = (struct NaClDesc *) DynArrayGet(&nap->desc_tbl, d);
+    if (NULL != ndp && NACL_DESC_PIPE == NACL_VTBL(NaClDesc, ndp)->typeTag) {
+      NaClSetDescMu(nap, (int) d, NULL);
+    }
+  }
+  NaClFastMutexUnlock(&nap->desc_mu);
+}
+
+int NaClDescOfHostFd(struct NaClApp *nap, int host_fd) {
+  int d = NaClFdTableGet(&nap->host_fd_owner, host_fd);
+  int size;
+
+  if (d >= 0 || host_fd < 0) {
+    return d;
+  }
+  /*
+   * The index that last took host_fd has gone, but a dup of it may still
+   * hold it.
+   */
+  size = NaClFdTableSize(&nap->host_fd_tbl);
+  for (d = 0; d < size; ++d) {
+    if (NaClFdTableGet(&nap->host_fd_tbl, d) == host_fd) {
+      return d;
+    }
+  }
+  return -1;
 }
 
 int32_t NaClSetAvailMu(struct NaClApp  *nap,
@@ -844,7 +935,7 @@ void NaClAppInitialDescriptorHookup(struct NaClApp  *nap) {
   for (int fd = 0; fd < 3; fd++) {
 
     /* Retrieve NaCl Descriptor based on fd */
-    int host_fd = fd_cage_table[nap->cage_id][fd];
+    int host_fd = NaClFdTableGet(&nap->fd_table, fd);
 
     struct NaClDesc *nd;
     nd = NaClGetDesc(nap, host_fd);
@@ -1385,13 +1476,41 @@ struct NaClSrpcHandlerDesc const secure_handlers[] = {
   { (char const *) NULL, (NaClSrpcMethod) NULL, },
 };
 
+static uint64_t NaClVmIoRange(uint32_t addr_first_usr,
+                              uint32_t addr_last_usr) {
+  return ((uint64_t) addr_first_usr << 32) | addr_last_usr;
+}
+
 /*
  * It is fine to have multiple I/O operations read from memory in Write
  * or SendMsg like operations.
+ *
+ * The slot is published and then nap->vm_io_fence is read, while
+ * NaClVmIoPendingCheck_mu sets the fence and then reads the slots, with
+ * a full barrier between the store and the load on both sides.  So
+ * either the check sees this range, or this thread sees the fence and
+ * waits on nap->mu for the VM operation to finish before its I/O
+ * starts, as it did when every range was added under nap->mu.
  */
-void NaClVmIoWillStart(struct NaClApp *nap,
+void NaClVmIoWillStart(struct NaClAppThread *natp,
                        uint32_t addr_first_usr,
                        uint32_t addr_last_usr) {
+  struct NaClApp *nap = natp->nap;
+  uint64_t range = NaClVmIoRange(addr_first_usr, addr_last_usr);
+
+  if (__sync_bool_compare_and_swap(&natp->vm_io_range,
+                                   NACL_VM_IO_RANGE_NONE, range)) {
+    if (!nap->vm_io_fence) {
+      return;
+    }
+    natp->vm_io_range = NACL_VM_IO_RANGE_NONE;
+    NaClXMutexLock(&nap->mu);
+    /* no VM operation is between its check and its update now */
+    nap->vm_io_fence = 0;
+    natp->vm_io_range = range;
+    NaClXMutexUnlock(&nap->mu);
+    return;
+  }
   NaClXMutexLock(&nap->mu);
   (*nap->mem_io_regions->vtbl->AddInterval)(nap->mem_io_regions,
                                             addr_first_usr,
@@ -1400,9 +1519,17 @@ void NaClVmIoWillStart(struct NaClApp *nap,
 }
 
 
-void NaClVmIoHasEnded(struct NaClApp *nap,
+void NaClVmIoHasEnded(struct NaClAppThread *natp,
                       uint32_t addr_first_usr,
                       uint32_t addr_last_usr) {
+  struct NaClApp *nap = natp->nap;
+
+  if (__sync_bool_compare_and_swap(&natp->vm_io_range,
+                                   NaClVmIoRange(addr_first_usr,
+                                                 addr_last_usr),
+                                   NACL_VM_IO_RANGE_NONE)) {
+    return;
+  }
   NaClXMutexLock(&nap->mu);
   (*nap->mem_io_regions->vtbl->RemoveInterval)(nap->mem_io_regions,
                                                addr_first_usr,
@@ -1413,9 +1540,35 @@ void NaClVmIoHasEnded(struct NaClApp *nap,
 void NaClVmIoPendingCheck_mu(struct NaClApp *nap,
                              uint32_t addr_first_usr,
                              uint32_t addr_last_usr) {
+  size_t index;
+  int overlaps = 0;
+
+  nap->vm_io_fence = 1;
+  __sync_synchronize();
   if ((*nap->mem_io_regions->vtbl->OverlapsWith)(nap->mem_io_regions,
                                                  addr_first_usr,
                                                  addr_last_usr)) {
+    overlaps = 1;
+  }
+  /* nap->mu is taken before threads_mu, as in NaClVmHoleOpeningMu */
+  NaClXMutexLock(&nap->threads_mu);
+  for (index = 0; !overlaps && index < nap->threads.num_entries; ++index) {
+    struct NaClAppThread *thread = NaClGetThreadMu(nap, (int) index);
+    uint64_t range;
+
+    if (NULL == thread) {
+      continue;
+    }
+    /* an atomic read even where a 64-bit load is not */
+    range = __sync_val_compare_and_swap(&thread->vm_io_range, 0, 0);
+    if (NACL_VM_IO_RANGE_NONE != range &&
+        (uint32_t) (range >> 32) <= addr_last_usr &&
+        addr_first_usr <= (uint32_t) range) {
+      overlaps = 1;
+    }
+  }
+  NaClXMutexUnlock(&nap->threads_mu);
+  if (overlaps) {
     NaClLog(LOG_FATAL,
             "NaClVmIoWillStart: program mem write race detected. ABORTING\n");
   }
@@ -1483,11 +1636,23 @@ static void NaClVmCopyEntry(void *target_state, struct NaClVmmapEntry *entry) {
   uintptr_t page_addr_child = (entry->page_num << NACL_PAGESHIFT) | offset;
   uintptr_t page_addr_parent = (entry->page_num << NACL_PAGESHIFT) | parent_offset;
   size_t copy_size = entry->npages << NACL_PAGESHIFT;
+  struct NaClDesc *desc = entry->desc;
+  int flags = (entry->flags | MAP_ANON_PRIV) & ~NACL_ABI_MAP_SHARED;
 
   /* don't copy pages if nap has no parent */
   if (!parent_offset) {
     return;
   }
+#if NACL_LINUX
+  if (NaClVmCowCopyEntry(parent, target, entry)) {
+    return;
+  }
+#endif
+  /* the child's copy is plain anonymous memory, not the parent's object */
+  if (0 != (flags & (NACL_MAP_COW | NACL_MAP_SHM_ANON))) {
+    desc = NULL;
+    flags &= ~(NACL_MAP_COW | NACL_MAP_SHM_ANON);
+  }
   NaClLog(2, "copying %zu page(s) at %zu [%#lx] from (%p) to (%p)\n",
           entry->npages,
           entry->page_num,
@@ -1498,8 +1663,8 @@ static void NaClVmCopyEntry(void *target_state, struct NaClVmmapEntry *entry) {
                             entry->page_num,
                             entry->npages,
                             entry->prot,
-                            (entry->flags | MAP_ANON_PRIV) & ~NACL_ABI_MAP_SHARED,
-                            entry->desc,
+                            flags,
+                            desc,
                             entry->offset,
                             entry->file_size);
   if (!NaClPageAllocFlags((void **)&page_addr_child, copy_size, 0)) {
@@ -1518,7 +1683,6 @@ static void NaClVmCopyEntry(void *target_state, struct NaClVmmapEntry *entry) {
 
   /* copy data pages point to */
   memcpy((void *)page_addr_child, (void *)page_addr_parent, copy_size);
-  NaClPatchAddr(offset, parent_offset, (uintptr_t *)page_addr_child, copy_size);
 
   /* reset to original page permissions */
   NaClVmmapChangeProt(&target->mem_map, entry->page_num, entry->npages, entry->prot);
@@ -1544,8 +1708,6 @@ static void NaClVmCopyEntry(void *target_state, struct NaClVmmapEntry *entry) {
 static void NaClCopyDynamicRegion(void *target_state, struct NaClDynamicRegion *region) {
   struct NaClApp *target = target_state;
   uintptr_t start = region->start & UNTRUSTED_ADDR_MASK;
-  uintptr_t offset = target->mem_start;
-  uintptr_t parent_offset = region->start - start;
   void *dyncode_addr = (void *)(start | target->mem_start);
   NaClVmmapAddWithOverwrite(&target->mem_map,
                             start >> NACL_PAGESHIFT,
@@ -1563,7 +1725,6 @@ static void NaClCopyDynamicRegion(void *target_state, struct NaClDynamicRegion *
     NaClLog(LOG_FATAL, "%s\n", "cbild dynamic text NaClTextDyncodeCreate failed!");
   }
   memcpy(dyncode_addr, (void *)region->start, region->size);
-  NaClPatchAddr(offset, parent_offset, dyncode_addr, region->size);
   if (NaClMprotect(dyncode_addr, region->size, PROT_RX) == -1) {
     NaClLog(LOG_FATAL, "%s\n", "cbild dynamic text NaClMprotect failed!");
   }
@@ -1596,12 +1757,19 @@ void NaClCopyDynamicText(struct NaClApp *nap_parent, struct NaClApp *nap_child)
   /* copy dynamic text regions */
   NaClXMutexLock(&nap_child->dynamic_load_mutex);
   /* NaClDyncodeVisit() handles parent dynamic_load_mutex lock */
-  nap_child->text_shm = nap_parent->text_shm;
+  NaClDescSafeUnref(nap_child->text_shm);
+  nap_child->text_shm = NULL == nap_parent->text_shm
+                        ? NULL : NaClDescRef(nap_parent->text_shm);
   NaClDyncodeVisit(nap_parent, NaClCopyDynamicRegion, nap_child);
   NaClXMutexUnlock(&nap_child->dynamic_load_mutex);
 
   /* copy page mappings */
   NaClVmmapVisit(&nap_parent->mem_map, NaClVmCopyEntry, nap_child);
+  /* the parent's anonymous memory object is frozen now; see sel_cow_fork.c */
+  if (NULL != nap_parent->anon_shm) {
+    NaClDescUnref(nap_parent->anon_shm);
+    nap_parent->anon_shm = NULL;
+  }
 
   NaClLog(1, "copied page tables from (%p) to (%p)\n", (void *)nap_parent, (void *)nap_child);
   NaClLog(1, "%s\n", "nap_parent_parent address space after copy:");
@@ -1658,14 +1826,11 @@ void NaClCopyExecutionContext(struct NaClApp *nap_parent, struct NaClApp *nap_ch
                             0,
                             0);
 
-  /* copy stack */
-  NaClLog(1, "Copying parent stack (%zu [%#lx] bytes) from (%p) to (%p)\n",
-          stack_size,
-          stack_size,
-          stackaddr_parent,
-          stackaddr_child);
-  memcpy(stackaddr_child, stackaddr_parent, stack_size);
-  NaClPatchAddr(nap_child->mem_start, nap_parent->mem_start, stackaddr_child, stack_size);
+  /*
+   * The stack's contents come over with the other page mappings in
+   * NaClCopyDynamicText, copy-on-write where possible; copying it here
+   * as well would touch every page of it in both cages.
+   */
 
   /* and dynamic text mappings */
   NaClCopyDynamicText(nap_parent, nap_child);
@@ -1733,7 +1898,6 @@ void NaClCopyExecutionContext(struct NaClApp *nap_parent, struct NaClApp *nap_ch
   NaClLoadSpringboard(nap_child);
   /* copy the trampolines from parent */
   memcpy((void *)child_start_addr, (void *)parent_start_addr, tramp_size);
-  NaClPatchAddr(nap_child->mem_start, nap_parent->mem_start, (uintptr_t *)child_start_addr, tramp_size);
 
   /*
    * NaClMemoryProtection also initializes the mem_map w/ information
@@ -1758,27 +1922,146 @@ void NaClCopyExecutionContext(struct NaClApp *nap_parent, struct NaClApp *nap_ch
   }
 }
 
-/* set up the fd table for each cage */
-void InitializeCage(struct NaClApp *nap, int cage_id) {
-  fd_cage_table[cage_id][0] = 0;
-  fd_cage_table[cage_id][1] = 1;
-  fd_cage_table[cage_id][2] = 2;
+static int NaClCageIdClaim(int cage_id) {
+  uint32_t bit = 1U << (cage_id % 32);
 
-  /* Initialize unused fd's to -1 */
-  for (int fd = 3; fd < FILE_DESC_MAX; fd++) fd_cage_table[cage_id][fd] = -1;
+  return !(__sync_fetch_and_or(&g_cage_ids[cage_id / 32], bit) & bit);
+}
 
-  /* set to the next unused (available for dup() etc.) file descriptor */
-  nap->num_children = 0;
-  nap->cage_id = cage_id;
+int NaClCageIdAlloc(void) {
+  int cage_id;
+
+  for (cage_id = 1; cage_id < CAGE_MAX; ++cage_id) {
+    if (g_cage_ids[cage_id / 32] & (1U << (cage_id % 32))) {
+      continue;
+    }
+    if (NaClCageIdClaim(cage_id)) {
+      return cage_id;
+    }
+  }
+  return -1;
 }
 
-/* Find next available fd in cagetable */
+/*
+ * Gives back what a cage holds in the sandbox: its writable text alias,
+ * mappings, region and cage id.
+ */
+static void NaClCageReleaseRegion(struct NaClApp *nap) {
+  int cage_id = nap->cage_id;
+
+  NaClLog(2, "NaClCageRelease: cage %d is gone, releasing it\n", cage_id);
+  /* no thread can install code any more: drop the writable text alias */
+  NaClXMutexLock(&nap->dynamic_load_mutex);
+  if (0 != nap->dynamic_text_alias) {
+    NaClDescUnmapUnsafe(nap->text_shm, (void *) nap->dynamic_text_alias,
+                        nap->dynamic_text_end - nap->dynamic_text_start);
+    nap->dynamic_text_alias = 0;
+  }
+  NaClXMutexUnlock(&nap->dynamic_load_mutex);
+  NaClXMutexLock(&nap->mu);
+  NaClVmmapDtor(&nap->mem_map);
+  if (NULL != nap->anon_shm) {
+    NaClDescUnref(nap->anon_shm);
+    nap->anon_shm = NULL;
+  }
+  if (0 != nap->mem_start) {
+    NaClAddrSpaceFree(nap);
+    nap->mem_start = 0;
+  }
+  NaClXMutexUnlock(&nap->mu);
+  if (cage_id > 0 && cage_id < CAGE_MAX) {
+    __sync_fetch_and_and(&g_cage_ids[cage_id / 32],
+                         ~(1U << (cage_id % 32)));
+  }
+}
 
-int NextFd(int cage_id){
+/*
+ * Undoes NaClAppCtor, InitializeCage and NaClChildNapCtor for a cage no
+ * thread and no table can reach any more.  The service threads started
+ * for it keep references to their own service objects, not to the cage.
+ */
+static void NaClCageDestroy(struct NaClApp *nap) {
+  size_t d;
 
-  for (int fd = 0; fd < FILE_DESC_MAX; fd ++) {
-    if (fd_cage_table[cage_id][fd] == -1) return fd;
+  NaClLog(2, "NaClCageDestroy: freeing NaClApp %p\n", (void *) nap);
+  for (d = 0; d < nap->desc_tbl.num_entries; ++d) {
+    NaClDescSafeUnref((struct NaClDesc *) DynArrayGet(&nap->desc_tbl, d));
   }
+  DynArrayDtor(&nap->desc_tbl);
+  DynArrayDtor(&nap->threads);
+  DynArrayDtor(&nap->children);
+  NaClFdTableDtor(&nap->fd_table);
+  NaClFdTableDtor(&nap->fd_cloexec);
+  NaClFdTableDtor(&nap->host_fd_owner);
+  NaClFdTableDtor(&nap->host_fd_tbl);
+  NaClDescSafeUnref(nap->text_shm);
+  free(nap->dynamic_page_bitmap);
+  free(nap->dynamic_regions);
+  NaClRefCountSafeUnref((struct NaClRefCount *) nap->manifest_proxy);
+  NaClRefCountSafeUnref((struct NaClRefCount *) nap->kernel_service);
+  NaClDescUnref(nap->name_service_conn_cap);
+  NaClRefCountUnref((struct NaClRefCount *) nap->name_service);
+  NaClIntervalMultisetDelete(nap->mem_io_regions);
+  free(nap->effp);
+  free(nap->cpu_features);
+  NaClMutexDtor(&nap->exception_mu);
+  NaClFastMutexDtor(&nap->desc_mu);
+  NaClMutexDtor(&nap->threads_mu);
+  NaClCondVarDtor(&nap->cv);
+  NaClMutexDtor(&nap->mu);
+  NaClCondVarDtor(&nap->children_cv);
+  NaClMutexDtor(&nap->children_mu);
+  NaClMutexDtor(&nap->dynamic_load_mutex);
+  NaClAlignedFree(nap);
+}
+
+#define NACL_CAGE_DEAD  (NACL_CAGE_EXITED | NACL_CAGE_REAPED)
+#define NACL_CAGE_ALL   (NACL_CAGE_DEAD | NACL_CAGE_GONE)
+
+void NaClCageRelease(struct NaClApp *nap, int event) {
+  int old;
+  int new;
+
+  do {
+    old = nap->cage_release;
+    if (old & event) {
+      return;
+    }
+    new = old | event;
+  } while (!__sync_bool_compare_and_swap(&nap->cage_release, old, new));
+  if (NACL_CAGE_DEAD == (new & NACL_CAGE_DEAD) &&
+      NACL_CAGE_DEAD != (old & NACL_CAGE_DEAD)) {
+    NaClCageReleaseRegion(nap);
+  }
+  /* holds count above the event bits, so this also means nobody holds it */
+  if (NACL_CAGE_ALL == new) {
+    NaClCageDestroy(nap);
+  }
+}
+
+void NaClCageHold(struct NaClApp *nap) {
+  __sync_fetch_and_add(&nap->cage_release, NACL_CAGE_HOLD);
+}
+
+void NaClCageUnhold(struct NaClApp *nap) {
+  if (NACL_CAGE_ALL == __sync_sub_and_fetch(&nap->cage_release,
+                                            NACL_CAGE_HOLD)) {
+    NaClCageDestroy(nap);
+  }
+}
 
-  return -NACL_ABI_EBADF;
+/* set up the fd table for each cage */
+void InitializeCage(struct NaClApp *nap, int cage_id) {
+  CHECK(cage_id > 0 && cage_id < CAGE_MAX);
+  NaClCageIdClaim(cage_id);
+  if (!NaClFdTableCtor(&nap->fd_table) ||
+      !NaClFdTableCtor(&nap->fd_cloexec)) {
+    NaClLog(LOG_FATAL, "InitializeCage: could not create fd table\n");
+  }
+  /* stdin, stdout and stderr are the first three NaCl descriptors */
+  for (int fd = 0; fd < 3; fd++) NaClFdTableSet(&nap->fd_table, fd, fd);
+
+  /* set to the next unused (available for dup() etc.) file descriptor */
+  nap->num_children = 0;
+  nap->cage_id = cage_id;
 }
@@ -48,6 +48,7 @@
 
 #include "native_client/src/trusted/service_runtime/dyn_array.h"
 #include "native_client/src/trusted/service_runtime/nacl_error_code.h"
+#include "native_client/src/trusted/service_runtime/nacl_fd_table.h"
 #include "native_client/src/trusted/service_runtime/nacl_kernel_service.h"
 #include "native_client/src/trusted/service_runtime/nacl_resource.h"
 
@@ -78,12 +79,12 @@ struct NaClDynamicRegion;
 struct NaClManifestProxy;
 struct NaClReverseQuotaInterface;
 struct NaClSignalContext;
+struct NaClStaticImage;  /* see nacl_image_cache.h */
 struct NaClThreadInterface;  /* see sel_ldr_thread_interface.h */
 struct NaClValidationCache;
 struct NaClValidationMetadata;
 
 extern volatile sig_atomic_t fork_num;
-extern int fd_cage_table[CAGE_MAX][FILE_DESC_MAX];
 
 struct NaClDebugCallbacks {
   void (*thread_create_hook)(struct NaClAppThread *natp);
@@ -137,7 +138,35 @@ struct NaClApp {
   struct NaClApp            *master;
 
   volatile sig_atomic_t     num_children;
+  /*
+   * Direct children that have exited and not been waited for yet, oldest
+   * first, linked through next_exited_child; and the number of direct
+   * children still running.  Protected by children_mu.
+   */
+  struct NaClApp            *exited_children;
+  struct NaClApp            *exited_children_tail;
+  struct NaClApp            *next_exited_child;
+  int                       num_running_children;
+  /*
+   * Set when the parent exited first and the master took the cage over;
+   * nobody waits for it, so it reaps itself when it exits.  Protected by
+   * the master's children_mu, as is parent.
+   */
+  int                       reparented;
+  /*
+   * The NACL_CAGE_* events as they happen, plus NACL_CAGE_HOLD for each
+   * NaClCageHold; see NaClCageRelease.  Updated atomically.
+   */
+  int volatile              cage_release;
   volatile sig_atomic_t     cage_id;
+  /* cage fd -> index in desc_tbl; see nacl_fd_table.h */
+  struct NaClFdTable        fd_table;
+  /*
+   * cage fd -> the desc_tbl index it had when marked close-on-exec by
+   * pipe2; cleared on close.  Lind fds keep their FD_CLOEXEC in the
+   * dispatcher.
+   */
+  struct NaClFdTable        fd_cloexec;
   volatile sig_atomic_t     parent_id;
   enum NaClThreadLaunchType tl_type;
 
@@ -190,6 +219,11 @@ struct NaClApp {
 
   /* only used for ET_EXEC:  for CS restriction */
   uintptr_t                 static_text_end;
+  /*
+   * Bytes of code in the static text segment, before halt padding; the
+   * size checked against initial_nexe_max_code_bytes.
+   */
+  size_t                    code_segment_size;
   /*
    * relative to mem_start; ro after app starts. memsz from phdr
    */
@@ -347,8 +381,20 @@ struct NaClApp {
    */
   struct NaClVmmap          mem_map;
 
+  /*
+   * In-flight I/O ranges that did not fit in the thread's own
+   * vm_io_range slot (e.g. the second and later iovs of a sendmsg).
+   * Protected by mu.
+   */
   struct NaClIntervalMultiset *mem_io_regions;
 
+  /*
+   * Set by NaClVmIoPendingCheck_mu before it scans the per-thread I/O
+   * slots, so an I/O syscall that publishes its range concurrently sees
+   * it and waits for the VM operation.  Cleared under mu.
+   */
+  int volatile              vm_io_fence;
+
   /*
    * This is the effector interface object that is used to manipulate
    * NaCl apps by the objects in the NaClDesc class hierarchy.  This
@@ -367,6 +413,13 @@ struct NaClApp {
   int                       enable_dyncode_syscalls;
   int                       use_shm_for_dynamic_text;
   struct NaClDesc           *text_shm;
+  /*
+   * Linux only: the shared memory object holding this cage's private
+   * anonymous memory, NACL_MAP_SHM_ANON in the vmmap.  NULL until memory
+   * is first placed in it, and again after each fork, since fork leaves
+   * the object to be shared copy-on-write.  Guarded by mu.
+   */
+  struct NaClDesc           *anon_shm;
   struct NaClMutex          dynamic_load_mutex;
   /*
    * This records which pages in text_shm have been allocated.  When a
@@ -384,13 +437,12 @@ struct NaClApp {
   int                       dynamic_regions_allocated;
 
   /*
-   * These variables are used for caching mapped writable views of the
-   * dynamic text segment.  See CachedMapWritableText in nacl_text.c.
+   * Writable alias of the whole dynamic text segment, mapped on first use
+   * and kept until NaClCageRelease.  See NaClTextMapWritable in
+   * nacl_text.c.
    * Accesses must be protected by dynamic_load_mutex
    */
-  uint32_t                  dynamic_mapcache_offset;
-  uint32_t                  dynamic_mapcache_size;
-  uintptr_t                 dynamic_mapcache_ret;
+  uintptr_t                 dynamic_text_alias;
 
   /*
    * Monotonically increasing generation number used for deletion
@@ -427,9 +479,17 @@ struct NaClApp {
   struct NaClMutex          threads_mu;
   struct DynArray           threads;   /* NaClAppThread pointers */
   int                       num_threads;  /* number actually running */
+  int                       num_exiting_threads;  /* of those, in teardown */
 
   struct NaClFastMutex      desc_mu;
   struct DynArray           desc_tbl;  /* NaClDesc pointers */
+  /*
+   * desc_tbl index -> host fd of the NaClDescIoDesc there, and host fd ->
+   * the desc_tbl index that last took it.  Kept by NaClSetDescMu so that
+   * Lind's select/poll/epoll translate fds without touching desc_tbl.
+   */
+  struct NaClFdTable        host_fd_tbl;
+  struct NaClFdTable        host_fd_owner;
 
   const struct NaClDebugCallbacks *debug_stub_callbacks;
   struct NaClMutex          exception_mu;
@@ -541,6 +601,14 @@ NaClErrorCode NaClAppLoadFileAslr(struct NaClDesc *ndp,
                                   struct NaClApp *nap,
                                   enum NaClAslrMode aslr_mode) NACL_WUR;
 
+/*
+ * Like NaClAppLoadFile, but sets nap up from an image that was already
+ * loaded and validated (see nacl_image_cache.h), without reading the
+ * file or running the validator.
+ */
+NaClErrorCode NaClAppLoadStaticImage(struct NaClStaticImage const *image,
+                                     struct NaClApp *nap) NACL_WUR;
+
 
 NaClErrorCode NaClAppLoadFileDynamically(
     struct NaClApp *nap,
@@ -699,6 +767,20 @@ void NaClSetDescMu(struct NaClApp   *nap,
 int32_t NaClSetAvailMu(struct NaClApp   *nap,
                        struct NaClDesc  *ndp);
 
+/*
+ * Drops the cage's references to in-runtime pipe ends, so that a cage that
+ * exits, execs or loses its last thread does not keep the other end from
+ * seeing EOF or EPIPE.  The cage fds that named them are closed too.
+ * Other descs are left to the Lind dispatcher's own exit and exec cleanup.
+ */
+void NaClDropPipeDescs(struct NaClApp *nap);
+
+/*
+ * Returns a desc_tbl index whose NaClDescIoDesc wraps |host_fd|, or -1.
+ * Takes no lock; see host_fd_owner.
+ */
+int NaClDescOfHostFd(struct NaClApp *nap, int host_fd);
+
 
 int NaClAddThread(struct NaClApp        *nap,
                   struct NaClAppThread  *natp);
@@ -865,8 +947,12 @@ void NaClVmHoleClosingMu(struct NaClApp *nap);
  * handlers implement DMA-style access where the host-OS syscalls
  * directly read/write untrusted memory, so we must record the
  * affected memory ranges as "in use" by I/O operations.
+ *
+ * The first range a thread has in flight goes in its own vm_io_range
+ * slot, published without taking nap->mu; further ranges go in
+ * nap->mem_io_regions under nap->mu.
  */
-void NaClVmIoWillStart(struct NaClApp *nap,
+void NaClVmIoWillStart(struct NaClAppThread *natp,
                        uint32_t addr_first_usr,
                        uint32_t addr_last_usr);
 
@@ -874,9 +960,9 @@ void NaClVmIoWillStart(struct NaClApp *nap,
 /*
  * It is a fatal error to have an invocation of NaClVmIoHasEnded whose
  * arguments do not match those of an earlier, unmatched invocation of
- * NaClVmIoWillStart.
+ * NaClVmIoWillStart by the same thread.
  */
-void NaClVmIoHasEnded(struct NaClApp *nap,
+void NaClVmIoHasEnded(struct NaClAppThread *natp,
                       uint32_t addr_first_usr,
                       uint32_t addr_last_usr);
 
@@ -922,11 +1008,78 @@ void NaClCopyDynamicText(struct NaClApp *nap_parent, struct NaClApp *nap_child);
  */
 void NaClCopyExecutionContext(struct NaClApp *nap_parent, struct NaClApp *nap_child);
 
+#if NACL_LINUX
+/*
+ * Maps the anonymous region described by the parent's |entry| into
+ * |nap_child| copy-on-write, recording it in the child's vmmap.  A
+ * NACL_MAP_SHM_ANON region is remapped MAP_PRIVATE in the parent as well,
+ * which copies nothing since its pages are already in the shared object,
+ * and both entries become NACL_MAP_COW.  Other anonymous regions are
+ * copied into a new object first.  Returns 1 on success, or 0 if the
+ * region is not eligible or could not be shared; the caller must then
+ * copy it eagerly.  Callers hold both nap_parent->mu and nap_child->mu.
+ */
+int NaClVmCowCopyEntry(struct NaClApp *nap_parent,
+                       struct NaClApp *nap_child,
+                       struct NaClVmmapEntry *entry);
+
+/*
+ * Maps |size| bytes of zeroed memory with |prot| at user address
+ * |usraddr| of |nap|, in nap->anon_shm, creating the object if need be.
+ * Returns a new reference to the object for the caller's vmmap entry,
+ * which it flags NACL_MAP_SHM_ANON with offset |usraddr|, or NULL if the
+ * object could not be used; nothing is mapped then.  Callers hold nap->mu.
+ */
+struct NaClDesc *NaClVmCowAnonMap(struct NaClApp *nap, uintptr_t usraddr,
+                                  size_t size, int prot);
+
+/*
+ * Frees whatever nap->anon_shm holds for user addresses [usraddr,
+ * usraddr + size), once they have been mapped over or unmapped.  Callers
+ * hold nap->mu.
+ */
+void NaClVmCowAnonDiscard(struct NaClApp *nap, uintptr_t usraddr,
+                          size_t size);
+
+/*
+ * Moves the anonymous regions of a freshly loaded image, its data and
+ * stack, into nap->anon_shm.  Only called before any of its threads run.
+ */
+void NaClVmCowAnonAdopt(struct NaClApp *nap);
+#endif
+
 /* Set up the fd table for each cage */
 void InitializeCage(struct NaClApp *nap, int cage_id);
 
-/* Find the next usuable fd */
-int NextFd(int cage_id);
+/*
+ * Cage ids are recycled, lowest first, from [1, CAGE_MAX), so that tables
+ * indexed by cage id stay bounded however many cages come and go.
+ * Returns a newly taken id, or -1 if every id is in use.
+ */
+int NaClCageIdAlloc(void);
+
+#define NACL_CAGE_EXITED  1  /* no thread runs in the sandbox any more */
+#define NACL_CAGE_REAPED  2  /* its exit status has been collected */
+#define NACL_CAGE_GONE    4  /* its last thread has finished tearing down */
+#define NACL_CAGE_HOLD    8  /* one NaClCageHold; counts in these units */
+
+/*
+ * Records |event| for |nap|; each event counts once.  Once it has both
+ * exited and been reaped, the cage's mappings and writable text alias are
+ * dropped, its sandbox region goes back to the address-space pool and its
+ * cage id may be handed out again.  Once it is also gone and nobody holds
+ * it, the NaClApp is destroyed and freed: every cage that gets that far
+ * was made by NaClChildNapCtor.
+ */
+void NaClCageRelease(struct NaClApp *nap, int event);
+
+/*
+ * Keeps |nap| allocated, though not its cage id or region, until the
+ * matching NaClCageUnhold.  The caller must know the cage is not gone
+ * yet, e.g. by finding it in a children table under children_mu.
+ */
+void NaClCageHold(struct NaClApp *nap);
+void NaClCageUnhold(struct NaClApp *nap);
 
 static INLINE void NaClLogUserMemoryContent(struct NaClApp *nap, uintptr_t user_addr) {
   char *addr = (char *)NaClUserToSys(nap, user_addr);
@@ -37,6 +37,7 @@
 #include "native_client/src/trusted/service_runtime/arch/sel_ldr_arch.h"
 #include "native_client/src/trusted/service_runtime/elf_util.h"
 #include "native_client/src/trusted/service_runtime/nacl_app_thread.h"
+#include "native_client/src/trusted/service_runtime/nacl_image_cache.h"
 #include "native_client/src/trusted/service_runtime/nacl_kernel_service.h"
 #include "native_client/src/trusted/service_runtime/nacl_signal.h"
 #include "native_client/src/trusted/service_runtime/nacl_switch_to_app.h"
@@ -162,6 +163,19 @@ NaClErrorCode NaClCheckAddressSpaceLayoutSanity(struct NaClApp *nap,
   return LOAD_OK;
 }
 
+static NaClErrorCode NaClCheckCodeSegmentSize(struct NaClApp *nap,
+                                              size_t code_segment_size) {
+  if (nap->initial_nexe_max_code_bytes != 0 &&
+      code_segment_size > nap->initial_nexe_max_code_bytes) {
+    NaClLog(LOG_ERROR, "NaClAppLoadFileAslr: "
+            "Code segment size (%"NACL_PRIdS" bytes) exceeds limit (%"
+            NACL_PRId32" bytes)\n",
+            code_segment_size, nap->initial_nexe_max_code_bytes);
+    return LOAD_CODE_SEGMENT_TOO_LARGE;
+  }
+  return LOAD_OK;
+}
+
 NaClErrorCode NaClAppLoadFileAslr(struct NaClDesc *ndp,
                                   struct NaClApp *nap,
                                   enum NaClAslrMode aslr_mode) {
@@ -199,19 +213,15 @@ NaClErrorCode NaClAppLoadFileAslr(struct NaClDesc *ndp,
     goto done;
   }
 
-  if (nap->initial_nexe_max_code_bytes != 0) {
-    size_t code_segment_size = info.static_text_end - NACL_TRAMPOLINE_END;
-    if (code_segment_size > nap->initial_nexe_max_code_bytes) {
-      NaClLog(LOG_ERROR, "NaClAppLoadFileAslr: "
-              "Code segment size (%"NACL_PRIdS" bytes) exceeds limit (%"
-              NACL_PRId32" bytes)\n",
-              code_segment_size, nap->initial_nexe_max_code_bytes);
-      ret = LOAD_CODE_SEGMENT_TOO_LARGE;
-      goto done;
-    }
+  subret = NaClCheckCodeSegmentSize(nap,
+                                    info.static_text_end - NACL_TRAMPOLINE_END);
+  if (LOAD_OK != subret) {
+    ret = subret;
+    goto done;
   }
 
   nap->static_text_end = info.static_text_end;
+  nap->code_segment_size = info.static_text_end - NACL_TRAMPOLINE_END;
   nap->rodata_start = info.rodata_start;
   rodata_end = info.rodata_end;
   nap->data_start = info.data_start;
@@ -398,6 +408,80 @@ NaClErrorCode NaClAppLoadFile(struct NaClDesc *ndp,
   return NaClAppLoadFileAslr(ndp, nap, NACL_ENABLE_ASLR);
 }
 
+NaClErrorCode NaClAppLoadStaticImage(struct NaClStaticImage const *image,
+                                     struct NaClApp *nap) {
+  NaClErrorCode       ret;
+  struct NaClPerfCounter  time_load_image;
+
+  NaClPerfCounterCtor(&time_load_image, "NaClAppLoadStaticImage");
+
+  if (nap->addr_bits > NACL_MAX_ADDR_BITS) {
+    return LOAD_ADDR_SPACE_TOO_BIG;
+  }
+  nap->stack_size = NaClRoundAllocPage(nap->stack_size);
+
+  /* the limit may differ from the one the image was loaded under */
+  ret = NaClCheckCodeSegmentSize(nap, image->code_segment_size);
+  if (LOAD_OK != ret) {
+    return ret;
+  }
+
+  /* static_text_end already includes the halt padding */
+  nap->static_text_end = image->static_text_end;
+  nap->code_segment_size = image->code_segment_size;
+  nap->rodata_start = image->rodata_start;
+  nap->data_start = image->data_start;
+  nap->data_end = image->data_end;
+  nap->break_addr = image->break_addr;
+  nap->bundle_size = image->bundle_size;
+  nap->initial_entry_pt = image->initial_entry_pt;
+  NaClLogAddressSpaceLayout(nap);
+
+  NaClLog(2, "Allocating address space\n");
+  ret = NaClAllocAddrSpaceAslr(nap, NACL_ENABLE_ASLR);
+  if (LOAD_OK != ret) {
+    return ret;
+  }
+  if (0 != NaClMprotect((void *) (nap->mem_start + NACL_TRAMPOLINE_START),
+                        NaClRoundAllocPage(nap->data_end) - NACL_TRAMPOLINE_START,
+                        PROT_READ | PROT_WRITE)) {
+    NaClLog(LOG_FATAL,
+            "NaClAppLoadStaticImage: Failed to make image pages writable\n");
+  }
+
+  /*
+   * The image was validated when it was first loaded, under the same
+   * validation policy, so it is copied in as is.
+   */
+  NaClLog(2, "Copying cached image into memory\n");
+  memcpy((void *) NaClUserToSys(nap, NACL_TRAMPOLINE_END), image->text,
+         image->text_size);
+  if (0 != image->data_size) {
+    memcpy((void *) NaClUserToSys(nap, image->data_addr), image->data,
+           image->data_size);
+  }
+  NaClPerfCounterMark(&time_load_image,
+                      NACL_PERF_IMPORTANT_PREFIX "CopyImage");
+  NaClPerfCounterIntervalLast(&time_load_image);
+
+  ret = NaClMakeDynamicTextShared(nap);
+  if (LOAD_OK != ret) {
+    return ret;
+  }
+
+  NaClLog(2, "Initializing arch switcher\n");
+  NaClInitSwitchToApp(nap);
+  NaClLog(2, "Installing trampoline\n");
+  NaClLoadTrampoline(nap);
+  NaClLog(2, "Installing springboard\n");
+  NaClLoadSpringboard(nap);
+  NaClLog(2, "Applying memory protection\n");
+  ret = NaClMemoryProtection(nap);
+  NaClPerfCounterMark(&time_load_image, "EndLoadImage");
+  NaClPerfCounterIntervalTotal(&time_load_image);
+  return ret;
+}
+
 NaClErrorCode NaClAppLoadFileDynamically(struct NaClApp *nap,
                                          struct NaClDesc *ndp,
                                          struct NaClValidationMetadata *metadata) {
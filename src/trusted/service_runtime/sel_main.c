@@ -31,6 +31,7 @@
 #include "native_client/src/shared/platform/nacl_check.h"
 #include "native_client/src/shared/platform/nacl_exit.h"
 #include "native_client/src/shared/platform/nacl_log.h"
+#include "native_client/src/shared/platform/nacl_log_binary.h"
 #include "native_client/src/shared/platform/nacl_sync.h"
 #include "native_client/src/shared/platform/nacl_sync_checked.h"
 #include "native_client/src/shared/platform/lind_platform.h"
@@ -43,6 +44,7 @@
 #include "native_client/src/trusted/perf_counter/nacl_perf_counter.h"
 #include "native_client/src/trusted/service_runtime/env_cleanser.h"
 #include "native_client/src/trusted/service_runtime/include/sys/fcntl.h"
+#include "native_client/src/trusted/service_runtime/lind_syscalls.h"
 #include "native_client/src/trusted/service_runtime/load_file.h"
 #include "native_client/src/trusted/service_runtime/nacl_app.h"
 #include "native_client/src/trusted/service_runtime/nacl_all_modules.h"
@@ -52,6 +54,8 @@
 #include "native_client/src/trusted/service_runtime/nacl_globals.h"
 #include "native_client/src/trusted/service_runtime/nacl_signal.h"
 #include "native_client/src/trusted/service_runtime/nacl_syscall_common.h"
+#include "native_client/src/trusted/service_runtime/nacl_stat_cache.h"
+#include "native_client/src/trusted/service_runtime/nacl_syscall_profile.h"
 #include "native_client/src/trusted/service_runtime/nacl_valgrind_hooks.h"
 #include "native_client/src/trusted/service_runtime/osx/mach_exception_handler.h"
 #include "native_client/src/trusted/service_runtime/outer_sandbox.h"
@@ -59,6 +63,7 @@
 #include "native_client/src/trusted/service_runtime/sel_qualify.h"
 #include "native_client/src/trusted/service_runtime/win/exception_patch/ntdll_patch.h"
 #include "native_client/src/trusted/service_runtime/win/debug_exception_handler.h"
+#include "native_client/src/trusted/validator/validation_cache_file.h"
 
 
 #include "native_client/src/trusted/service_runtime/sel_ldr.h"
@@ -121,8 +126,9 @@ static void PrintUsage(void) {
   fprintf(stderr,
           "Usage: sel_ldr [-h d:D] [-r d:D] [-w d:D] [-i d:D]\n"
           "               [-f nacl_file]\n"
-          "               [-l log_file]\n"
-          "               [-X d] [-acFglQRsSQv]\n"
+          "               [-l log_file] [-L lind_fs_backend]\n"
+          "               [-P syscall_profile_file] [-T ttl_ms[:neg_ttl_ms]]\n"
+          "               [-X d] [-acFglNQRsSQv]\n"
           "               -- [nacl_file] [args]\n"
           "\n");
   fprintf(stderr,
@@ -151,18 +157,37 @@ static void PrintUsage(void) {
           " -F fuzz testing; quit after loading NaCl app\n"
           " -g enable gdb debug stub.  Not secure on x86-64 Windows.\n"
           " -l <file>  write log output to the given file\n"
+          " -L <python|native> select the backend for Lind regular-file I/O\n"
+          "    (default python; native serves read/write/lseek/fstat of\n"
+          "    regular files and makes mmaps in-process without entering\n"
+          "    the dispatcher)\n"
+          " -N send and receive on connected Lind sockets directly on the\n"
+          "    host socket; the dispatcher only sees connect and accept\n"
+          " -P <file> profile syscalls: counts, latency percentiles and bytes\n"
+          "    moved per call and per cage, written to <file> as JSON at exit\n"
+          "    and whenever sel_ldr gets SIGUSR2 (\"-\" for stderr)\n"
           " -Q disable platform qualification (dangerous!)\n"
           " -s safely stub out non-validating instructions\n"
           " -S enable signal handling.  Not supported on Windows.\n"
           " -E <name=value>|<name> set an environment variable\n"
           " -Z use fixed feature x86 CPU mode\n"
           " -t toggle runtime statistics\n"
+          " -T <ms>[:<ms>] cache path lookups: attributes for the first <ms>,\n"
+          "    nonexistence for the second (default 0:0, off; 0 turns either\n"
+          "    off).  Only changes made through this sel_ldr are seen sooner\n"
+          " -V <dir> keep a persistent validation cache in <dir>, which must\n"
+          "    be owned by and writable only by the current user\n"
           );  /* easier to add new flags/lines */
 }
 
 static const struct option longopts[] = {
   { "r_debug", required_argument, NULL, 'D' },
   { "reserved_at_zero", required_argument, NULL, 'z' },
+  { "lind_fs", required_argument, NULL, 'L' },
+  { "validation_cache", required_argument, NULL, 'V' },
+  { "syscall_profile", required_argument, NULL, 'P' },
+  { "stat_cache_ttl", required_argument, NULL, 'T' },
+  { "lind_direct_sockets", no_argument, NULL, 'N' },
   { NULL, 0, NULL, 0 }
 };
 
@@ -172,11 +197,11 @@ static int my_getopt(int argc, char *const *argv, const char *shortopts) {
 
 #if NACL_LINUX
 # define getopt my_getopt
-  static const char *const optstring = "+D:z:aB:ceE:f:Fgh:i:l:Qr:RsStvw:X:Z";
+  static const char *const optstring = "+D:z:aB:ceE:f:Fgh:i:l:L:NP:Qr:RsStT:vV:w:X:Z";
 #else
 # define NaClHandleRDebug(A, B) do { /* no-op */ } while (0)
 # define NaClHandleReservedAtZero(A) do { /* no-op */ } while (0)
-  static const char *const optstring = "aB:ceE:f:Fgh:i:l:Qr:RsStvw:X:Z";
+  static const char *const optstring = "aB:ceE:f:Fgh:i:l:L:NP:Qr:RsStT:vV:w:X:Z";
 #endif
 
 int NaClSelLdrMain(int argc, char **argv) {
@@ -204,6 +229,7 @@ int NaClSelLdrMain(int argc, char **argv) {
   int                           handle_signals = 0;
   int                           enable_debug_stub = 0;
   char                          *blob_library_file = NULL;
+  char                          *validation_cache_dir = NULL;
   char                          *log_file = NULL;
   const char                    **envp;
   clock_t                       nacl_main_begin;
@@ -215,10 +241,7 @@ int NaClSelLdrMain(int argc, char **argv) {
   clock_t                       nacl_user_program_finish;
   double                        nacl_user_program_spent;
   int                           toggle_time_info = 0;
-  #ifdef SYSCALL_TIMING
-  double                        nacl_syscall_total_time;
-  double                        lind_syscall_total_time;
-  #endif
+  char                          *syscall_profile_file = NULL;
 
 #if NACL_OSX
   /* Mac dynamic libraries cannot access the environ variable directly. */
@@ -230,8 +253,6 @@ int NaClSelLdrMain(int argc, char **argv) {
   envp = (const char **)environ;
 #endif
 
-  nacl_syscall_counter = 0;
-  lind_syscall_counter = 0;
   nacl_syscall_trace_level_counter = 0;
   ret_code = 1;
   redir_queue = NULL;
@@ -359,6 +380,20 @@ int NaClSelLdrMain(int argc, char **argv) {
       case 'l':
         log_file = optarg;
         break;
+      case 'L':
+        if (!LindFsSetBackend(optarg)) {
+          NaClLog(LOG_ERROR, "ERROR: unknown Lind file I/O backend: %s\n\n",
+                  optarg);
+          PrintUsage();
+          exit(EXIT_FAILURE);
+        }
+        break;
+      case 'N':
+        lind_direct_sockets = 1;
+        break;
+      case 'P':
+        syscall_profile_file = optarg;
+        break;
       case 'Q':
         NaClLog(1, "%s\n",
                  "PLATFORM QUALIFICATION DISABLED BY -Q - "
@@ -382,10 +417,21 @@ int NaClSelLdrMain(int argc, char **argv) {
       case 't':
         toggle_time_info = 1;
         break;
+      case 'T':
+        if (!NaClStatCacheParseTtl(optarg)) {
+          NaClLog(LOG_ERROR, "ERROR: bad path lookup cache TTL: %s\n\n",
+                  optarg);
+          PrintUsage();
+          exit(EXIT_FAILURE);
+        }
+        break;
       case 'v':
         ++verbosity;
         NaClLogIncrVerbosity();
         break;
+      case 'V':
+        validation_cache_dir = optarg;
+        break;
       /* case 'w':  with 'h' and 'r' above */
       case 'X':
         export_addr_to = strtol(optarg, NULL, 0);
@@ -414,11 +460,25 @@ int NaClSelLdrMain(int argc, char **argv) {
     }
   }
 
+  /* before LindPythonInit, which may start threads */
+  if (NULL != syscall_profile_file &&
+      !NaClSyscallProfileEnable(strcmp(syscall_profile_file, "-") ?
+                                syscall_profile_file : NULL)) {
+    NaClLog(LOG_ERROR, "ERROR: cannot enable syscall profiling\n");
+    exit(EXIT_FAILURE);
+  }
+
   if (!LindPythonInit()) {
       fflush(NULL);
       exit(EXIT_FAILURE);
   }
 
+  if (validation_cache_dir) {
+    /* an unusable cache is logged and ignored: everything still validates */
+    nap->validation_cache = NaClValidationCacheFileCreate(
+        validation_cache_dir, NACL_VALIDATION_CACHE_FILE_DEFAULT_ENTRIES);
+  }
+
   if (debug_mode_ignore_validator == 1) {
     NaClLog(1, "%s\n", "DEBUG MODE ENABLED (ignore validator)");
   } else if (debug_mode_ignore_validator > 1) {
@@ -849,6 +909,9 @@ int NaClSelLdrMain(int argc, char **argv) {
   NaClLog(1, "%s\n\n", "[NaCl Main Loader] before creation of the cage to run user program!");
   nap->clean_environ = NaClEnvCleanserEnvironment(&env_cleanser);
   nacl_initialization_finish = clock();
+#if NACL_LINUX
+  NaClVmCowAnonAdopt(nap);
+#endif
   if (!NaClCreateThread(THREAD_LAUNCH_MAIN,
                         NULL,
                         nap,
@@ -899,32 +962,13 @@ int NaClSelLdrMain(int argc, char **argv) {
   }
 
 
-#ifdef SYSCALL_TIMING
-  NaClLog(1, "%s\n", "[NaClMain] NaCl system call timing enabled! ");
-  NaClLog(1, "%s\n", "[NaClMain] Start printing out results now: ");
-  NaClLog(1, "[NaClMain] NaCl global system call counter = %d \n", nacl_syscall_counter);
-  NaClLog(1, "%s\n", "[NaClMain] Print out system call timing table: ");
-  nacl_syscall_total_time = 0.0;
-  for (size_t i = 0; i < NACL_MAX_SYSCALLS; i++) {
-    NaClLog(1, "sys_num: %d, invoked times: %d, execution time: %f \n", i, nacl_syscall_invoked_times[i], nacl_syscall_execution_time[i]);
-    nacl_syscall_total_time +=  nacl_syscall_execution_time[i];
-  }
-
-  NaClLog(1, "[NaClMain] NaCl system call total time: %f \n\n", nacl_syscall_total_time);
-  NaClLog(1, "[NaClMain] Lind system call counter = %d \n", lind_syscall_counter);
-  NaClLog(1, "%s\n", "[NaClMain] Print out Lind system call timing table: ");
-  lind_syscall_total_time = 0.0;
-  for (size_t i = 0; i < LIND_MAX_SYSCALLS; i++) {
-    NaClLog(1, "sys_num: %d, invoked times: %d, execution time: %f \n", i, lind_syscall_invoked_times[i], lind_syscall_execution_time[i]);
-    lind_syscall_total_time +=  lind_syscall_execution_time[i];
-  }
-
-  NaClLog(1, "[NaClMain] Lind system call total time: %f \n", lind_syscall_total_time);
-  NaClLog(1, "%s\n", "[NaClMain] Results printing out: done! ");
-#endif
+  NaClSyscallProfileDump();
 
   NaClLog(1, "[Performance results] LindPythonInit(): %f \n", time_counter);
   LindPythonFinalize();
+#if NACL_LINUX || NACL_OSX
+  NaClLogBinaryFlush();
+#endif
   NaClExit(ret_code);
 
 done:
@@ -30,15 +30,11 @@
 #include "native_client/src/trusted/service_runtime/include/sys/fcntl.h"
 #include "native_client/src/trusted/service_runtime/include/sys/mman.h"
 
-#define START_ENTRIES   5   /* tramp+text, rodata, data, bss, stack */
-#define REMOVE_MARKED_DEBUG 0
-
-
 /*
- * The memory map structure is a simple array of memory regions which
- * may have different access protections.  We do not yet merge regions
- * with the same access protections together to reduce the region
- * number, but may do so in the future.
+ * The memory map structure is a treap of memory regions which may have
+ * different access protections, ordered by page number.  We do not yet
+ * merge regions with the same access protections together to reduce the
+ * region number, but may do so in the future.
  *
  * Regions are described by (relative) starting page number, the
  * number of pages, and the protection that the pages should have.
@@ -65,13 +61,20 @@ struct NaClVmmapEntry *NaClVmmapEntryMake(uintptr_t         page_num,
   entry->npages = npages;
   entry->prot = prot;
   entry->flags = flags;
-  entry->removed = 0;
   entry->desc = desc;
   if (desc != NULL) {
     NaClDescRef(desc);
   }
   entry->offset = offset;
   entry->file_size = file_size;
+  entry->left = NULL;
+  entry->right = NULL;
+  entry->parent = NULL;
+  entry->priority = 0;
+  entry->gap = 0;
+  entry->map_gap = 0;
+  entry->max_gap = 0;
+  entry->max_map_gap = 0;
   return entry;
 }
 
@@ -115,154 +118,294 @@ void NaClVmmapDebug(struct NaClVmmap *self,
 }
 
 
-int NaClVmmapCtor(struct NaClVmmap *self) {
-  self->size = START_ENTRIES;
-  if (SIZE_T_MAX / sizeof *self->vmentry < self->size) {
-    return 0;
+/*
+ * Treap maintenance.  The tree is ordered by page_num and heap ordered
+ * by priority.  Every entry's gap and map_gap describe the hole between
+ * it and its in-order predecessor (0 for the first entry), and max_gap
+ * and max_map_gap are the largest of those in the entry's subtree, so
+ * anything that moves an entry's bounds or changes its predecessor must
+ * recompute them up to the root.
+ */
+
+static uint32_t NaClVmmapRandom(struct NaClVmmap *self) {
+  /* xorshift32; priorities only need to look random to the tree */
+  uint32_t x = self->rand_state;
+
+  x ^= x << 13;
+  x ^= x >> 17;
+  x ^= x << 5;
+  self->rand_state = x;
+  return x;
+}
+
+static struct NaClVmmapEntry *NaClVmmapFirst(struct NaClVmmap *self) {
+  struct NaClVmmapEntry *ent = self->root;
+
+  if (NULL != ent) {
+    while (NULL != ent->left) {
+      ent = ent->left;
+    }
   }
-  self->vmentry = calloc(self->size, sizeof *self->vmentry);
-  if (!self->vmentry) {
-    return 0;
+  return ent;
+}
+
+static struct NaClVmmapEntry *NaClVmmapNext(struct NaClVmmapEntry *ent) {
+  if (NULL != ent->right) {
+    ent = ent->right;
+    while (NULL != ent->left) {
+      ent = ent->left;
+    }
+    return ent;
   }
-  self->nvalid = 0;
-  self->is_sorted = 1;
-  return 1;
+  while (NULL != ent->parent && ent == ent->parent->right) {
+    ent = ent->parent;
+  }
+  return ent->parent;
+}
+
+static struct NaClVmmapEntry *NaClVmmapPrev(struct NaClVmmapEntry *ent) {
+  if (NULL != ent->left) {
+    ent = ent->left;
+    while (NULL != ent->right) {
+      ent = ent->right;
+    }
+    return ent;
+  }
+  while (NULL != ent->parent && ent == ent->parent->left) {
+    ent = ent->parent;
+  }
+  return ent->parent;
 }
 
+static uintptr_t NaClVmmapMapStartPage(uintptr_t page_num) {
+  if (NACL_MAP_PAGESHIFT > NACL_PAGESHIFT) {
+    page_num = NaClTruncPageNumDownToMapMultiple(page_num);
+  }
+  return page_num;
+}
 
-void NaClVmmapDtor(struct NaClVmmap *self) {
-  size_t i;
+/* Recomputes the subtree maxima of ent from its own gap and children. */
+static void NaClVmmapPull(struct NaClVmmapEntry *ent) {
+  ent->max_gap = ent->gap;
+  ent->max_map_gap = ent->map_gap;
+  if (NULL != ent->left) {
+    if (ent->left->max_gap > ent->max_gap) {
+      ent->max_gap = ent->left->max_gap;
+    }
+    if (ent->left->max_map_gap > ent->max_map_gap) {
+      ent->max_map_gap = ent->left->max_map_gap;
+    }
+  }
+  if (NULL != ent->right) {
+    if (ent->right->max_gap > ent->max_gap) {
+      ent->max_gap = ent->right->max_gap;
+    }
+    if (ent->right->max_map_gap > ent->max_map_gap) {
+      ent->max_map_gap = ent->right->max_map_gap;
+    }
+  }
+}
 
-  for (i = 0; i < self->nvalid; ++i) {
-    NaClVmmapEntryFree(self->vmentry[i]);
+static void NaClVmmapPullToRoot(struct NaClVmmapEntry *ent) {
+  for (; NULL != ent; ent = ent->parent) {
+    NaClVmmapPull(ent);
   }
-  free(self->vmentry);
-  self->vmentry = 0;
 }
 
-/*
- * Comparison function for qsort.  Should never encounter a
- * removed/invalid entry.
- */
+/* Recomputes the hole before ent, and the maxima above it. */
+static void NaClVmmapSetGap(struct NaClVmmapEntry *ent) {
+  struct NaClVmmapEntry *prev = NaClVmmapPrev(ent);
+  uintptr_t             end_page;
+  uintptr_t             start_page;
+
+  ent->gap = 0;
+  ent->map_gap = 0;
+  if (NULL != prev) {
+    end_page = prev->page_num + prev->npages;
+    start_page = ent->page_num;
+    if (start_page > end_page) {
+      ent->gap = start_page - end_page;
+    }
+    end_page = NaClRoundPageNumUpToMapMultiple(end_page);
+    start_page = NaClVmmapMapStartPage(start_page);
+    if (start_page > end_page) {
+      ent->map_gap = start_page - end_page;
+    }
+  }
+  NaClVmmapPullToRoot(ent);
+}
 
-static int NaClVmmapCmpEntries(void const  *vleft,
-                               void const  *vright) {
-  struct NaClVmmapEntry const *const *left =
-      (struct NaClVmmapEntry const *const *) vleft;
-  struct NaClVmmapEntry const *const *right =
-      (struct NaClVmmapEntry const *const *) vright;
+/* For an entry whose bounds changed: fixes its hole and the next one. */
+static void NaClVmmapRefresh(struct NaClVmmapEntry *ent) {
+  struct NaClVmmapEntry *next = NaClVmmapNext(ent);
 
-  return (int) ((*left)->page_num - (*right)->page_num);
+  NaClVmmapSetGap(ent);
+  if (NULL != next) {
+    NaClVmmapSetGap(next);
+  }
 }
 
+/* Puts child in old's place under parent, or at the root. */
+static void NaClVmmapReplaceChild(struct NaClVmmap      *self,
+                                  struct NaClVmmapEntry *parent,
+                                  struct NaClVmmapEntry *old,
+                                  struct NaClVmmapEntry *child) {
+  if (NULL == parent) {
+    self->root = child;
+  } else if (parent->left == old) {
+    parent->left = child;
+  } else {
+    parent->right = child;
+  }
+  if (NULL != child) {
+    child->parent = parent;
+  }
+}
 
-static void NaClVmmapRemoveMarked(struct NaClVmmap *self) {
-  size_t  i;
-  size_t  last;
+/* Rotates ent up over its parent. */
+static void NaClVmmapRotateUp(struct NaClVmmap      *self,
+                              struct NaClVmmapEntry *ent) {
+  struct NaClVmmapEntry *parent = ent->parent;
 
-  if (0 == self->nvalid)
-    return;
+  if (parent->left == ent) {
+    parent->left = ent->right;
+    if (NULL != ent->right) {
+      ent->right->parent = parent;
+    }
+    ent->right = parent;
+  } else {
+    parent->right = ent->left;
+    if (NULL != ent->left) {
+      ent->left->parent = parent;
+    }
+    ent->left = parent;
+  }
+  NaClVmmapReplaceChild(self, parent->parent, parent, ent);
+  parent->parent = ent;
+  NaClVmmapPull(parent);
+  NaClVmmapPull(ent);
+}
 
-#if REMOVE_MARKED_DEBUG
-  NaClVmmapDebug(self, "Before RemoveMarked");
-#endif
-  /*
-   * Linearly scan with a move-end-to-front strategy to get rid of
-   * marked-to-be-removed entries.
-   */
+static void NaClVmmapInsert(struct NaClVmmap      *self,
+                            struct NaClVmmapEntry *entry) {
+  struct NaClVmmapEntry **link = &self->root;
+  struct NaClVmmapEntry *parent = NULL;
 
-  /*
-   * Invariant:
-   *
-   * forall j in [0, self->nvalid): NULL != self->vmentry[j]
-   */
-  for (last = self->nvalid; last > 0 && self->vmentry[--last]->removed; ) {
-    NaClVmmapEntryFree(self->vmentry[last]);
-    self->vmentry[last] = NULL;
+  while (NULL != *link) {
+    parent = *link;
+    link = entry->page_num < parent->page_num ? &parent->left : &parent->right;
   }
-  if (last == 0 && self->vmentry[0]->removed) {
-    NaClLog(LOG_FATAL, "No valid entries in VM map\n");
-    return;
+  entry->left = NULL;
+  entry->right = NULL;
+  entry->parent = parent;
+  entry->priority = NaClVmmapRandom(self);
+  entry->gap = 0;
+  entry->map_gap = 0;
+  entry->max_gap = 0;
+  entry->max_map_gap = 0;
+  *link = entry;
+  while (NULL != entry->parent && entry->parent->priority < entry->priority) {
+    NaClVmmapRotateUp(self, entry);
   }
+  ++self->nvalid;
+  NaClVmmapRefresh(entry);
+}
 
-  /*
-   * Post condition of above loop:
-   *
-   * forall j in [0, last]: NULL != self->vmentry[j]
-   *
-   * 0 <= last < self->nvalid && !self->vmentry[last]->removed
-   */
-  CHECK(last < self->nvalid);
-  CHECK(!self->vmentry[last]->removed);
-  /*
-   * and,
-   *
-   * forall j in (last, self->nvalid): NULL == self->vmentry[j]
-   */
+/* Takes entry out of the tree without freeing it. */
+static void NaClVmmapUnlink(struct NaClVmmap      *self,
+                            struct NaClVmmapEntry *entry) {
+  struct NaClVmmapEntry *next = NaClVmmapNext(entry);
+  struct NaClVmmapEntry *parent;
+  struct NaClVmmapEntry *child;
+
+  /* Rotate it down until it has at most one child, then splice it out. */
+  while (NULL != entry->left && NULL != entry->right) {
+    child = (entry->left->priority > entry->right->priority ?
+             entry->left : entry->right);
+    NaClVmmapRotateUp(self, child);
+  }
+  child = NULL != entry->left ? entry->left : entry->right;
+  parent = entry->parent;
+  NaClVmmapReplaceChild(self, parent, entry, child);
+  entry->left = NULL;
+  entry->right = NULL;
+  entry->parent = NULL;
+  --self->nvalid;
+  NaClVmmapPullToRoot(parent);
+  if (NULL != next) {
+    NaClVmmapSetGap(next);
+  }
+}
 
-  /*
-   * Loop invariant: forall j in [0, i):  !self->vmentry[j]->removed
-   */
-  for (i = 0; i < last; ++i) {
-    if (!self->vmentry[i]->removed) {
-      continue;
-    }
-    /*
-     * post condition: self->vmentry[i]->removed
-     *
-     * swap with entry at self->vmentry[last].
-     */
-
-    NaClVmmapEntryFree(self->vmentry[i]);
-    self->vmentry[i] = self->vmentry[last];
-    self->vmentry[last] = NULL;
-
-    /*
-     * Invariants here:
-     *
-     * forall j in [last, self->nvalid): NULL == self->vmentry[j]
-     *
-     * forall j in [0, i]: !self->vmentry[j]->removed
-     */
-
-    while (--last > i && self->vmentry[last]->removed) {
-      NaClVmmapEntryFree(self->vmentry[last]);
-      self->vmentry[last] = NULL;
+/*
+ * Returns the entry containing pnum, or else the first entry above it,
+ * or NULL if there is none.
+ */
+static struct NaClVmmapEntry *NaClVmmapLowerBound(struct NaClVmmap *self,
+                                                  uintptr_t        pnum) {
+  struct NaClVmmapEntry *ent = self->root;
+  struct NaClVmmapEntry *found = NULL;
+
+  while (NULL != ent) {
+    if (pnum < ent->page_num + ent->npages) {
+      found = ent;
+      ent = ent->left;
+    } else {
+      ent = ent->right;
     }
-    /*
-     * since !self->vmentry[i]->removed, we are guaranteed that
-     * !self->vmentry[last]->removed when the while loop terminates.
-     *
-     * forall j in (last, self->nvalid):
-     *  NULL == self->vmentry[j]->removed
-     */
   }
-  /* i == last */
-  /* forall j in [0, last]: !self->vmentry[j]->removed */
-  /* forall j in (last, self->nvalid): NULL == self->vmentry[j] */
-  self->nvalid = last + 1;
+  return found;
+}
+
 
-  self->is_sorted = 0;
-#if REMOVE_MARKED_DEBUG
-  NaClVmmapDebug(self, "After RemoveMarked");
-#endif
+int NaClVmmapCtor(struct NaClVmmap *self) {
+  self->root = NULL;
+  self->nvalid = 0;
+  self->rand_state = (uint32_t) (uintptr_t) self ^ 0x9e3779b9;
+  if (0 == self->rand_state) {
+    self->rand_state = 1;
+  }
+  return 1;
+}
+
+
+void NaClVmmapDtor(struct NaClVmmap *self) {
+  struct NaClVmmapEntry *ent = self->root;
+  struct NaClVmmapEntry *parent;
+
+  /* Free leaves first, so no recursion and no extra memory is needed. */
+  while (NULL != ent) {
+    if (NULL != ent->left) {
+      ent = ent->left;
+    } else if (NULL != ent->right) {
+      ent = ent->right;
+    } else {
+      parent = ent->parent;
+      if (NULL != parent) {
+        if (parent->left == ent) {
+          parent->left = NULL;
+        } else {
+          parent->right = NULL;
+        }
+      }
+      NaClVmmapEntryFree(ent);
+      ent = parent;
+    }
+  }
+  self->root = NULL;
+  self->nvalid = 0;
 }
 
 
 void NaClVmmapMakeSorted(struct NaClVmmap  *self) {
-  if (self->is_sorted)
-    return;
+  UNREFERENCED_PARAMETER(self);
+}
 
-  NaClVmmapRemoveMarked(self);
 
-  qsort(self->vmentry,
-        self->nvalid,
-        sizeof *self->vmentry,
-        NaClVmmapCmpEntries);
-  self->is_sorted = 1;
-#if REMOVE_MARKED_DEBUG
-  NaClVmmapDebug(self, "After Sort");
-#endif
+void NaClVmmapEntryResized(struct NaClVmmap       *self,
+                           struct NaClVmmapEntry  *entry) {
+  UNREFERENCED_PARAMETER(self);
+  NaClVmmapRefresh(entry);
 }
 
 void NaClVmmapAdd(struct NaClVmmap  *self,
@@ -281,31 +424,25 @@ void NaClVmmapAdd(struct NaClVmmap  *self,
            "0x%"NACL_PRIx64")\n"),
           (uintptr_t) self, page_num, npages, prot, flags,
           (uintptr_t) desc, offset);
-  if (self->nvalid == self->size) {
-    size_t                    new_size = 2 * self->size;
-    struct NaClVmmapEntry     **new_map;
-
-    new_map = realloc(self->vmentry, new_size * sizeof *new_map);
-    if (NULL == new_map) {
-      NaClLog(LOG_FATAL, "NaClVmmapAdd: could not allocate memory\n");
-      return;
-    }
-    self->vmentry = new_map;
-    self->size = new_size;
-  }
-  /* self->nvalid < self->size */
   entry = NaClVmmapEntryMake(page_num, npages, prot, flags,
       desc, offset, file_size);
-
-  self->vmentry[self->nvalid] = entry;
-  self->is_sorted = 0;
-  ++self->nvalid;
+  if (NULL == entry) {
+    NaClLog(LOG_FATAL, "NaClVmmapAdd: could not allocate memory\n");
+    return;
+  }
+  NaClVmmapInsert(self, entry);
 }
 
 /*
  * Update the virtual memory map.  Deletion is handled by a remove
  * flag, since a NULL desc just means that the memory is backed by the
  * system paging file.
+ *
+ * Only the entries overlapping the new region are visited, starting
+ * from the first one that ends above page_num.  Existing entries are
+ * trimmed before any piece is added, so entries never overlap, and the
+ * next entry is looked up before anything is added, so new pieces are
+ * not visited.
  */
 static void NaClVmmapUpdate(struct NaClVmmap  *self,
                             uintptr_t         page_num,
@@ -317,7 +454,8 @@ static void NaClVmmapUpdate(struct NaClVmmap  *self,
                             nacl_off64_t      offset,
                             nacl_off64_t      file_size) {
   /* update existing entries or create new entry as needed */
-  size_t                i;
+  struct NaClVmmapEntry *ent;
+  struct NaClVmmapEntry *next;
   uintptr_t             new_region_end_page = page_num + npages;
 
   NaClLog(2,
@@ -326,22 +464,25 @@ static void NaClVmmapUpdate(struct NaClVmmap  *self,
            "0x%"NACL_PRIx64")\n"),
           (uintptr_t) self, page_num, npages, prot, flags,
           remove, (uintptr_t) desc, offset);
-  NaClVmmapMakeSorted(self);
 
   CHECK(npages > 0);
 
-  for (i = 0; i < self->nvalid; i++) {
-    struct NaClVmmapEntry *ent = self->vmentry[i];
+  for (ent = NaClVmmapLowerBound(self, page_num);
+       NULL != ent && ent->page_num < new_region_end_page;
+       ent = next) {
     uintptr_t             ent_end_page = ent->page_num + ent->npages;
     nacl_off64_t          additional_offset =
         (new_region_end_page - ent->page_num) << NACL_PAGESHIFT;
 
+    next = NaClVmmapNext(ent);
 
     if (ent->page_num < page_num && new_region_end_page < ent_end_page) {
       /*
        * Split existing mapping into two parts, with new mapping in
        * the middle.
        */
+      ent->npages = page_num - ent->page_num;
+      NaClVmmapRefresh(ent);
       NaClVmmapAdd(self,
                    new_region_end_page,
                    ent_end_page - new_region_end_page,
@@ -350,22 +491,24 @@ static void NaClVmmapUpdate(struct NaClVmmap  *self,
                    ent->desc,
                    ent->offset + additional_offset,
                    ent->file_size);
-      ent->npages = page_num - ent->page_num;
       break;
     } else if (ent->page_num < page_num && page_num < ent_end_page) {
       /* New mapping overlaps end of existing mapping. */
       ent->npages = page_num - ent->page_num;
+      NaClVmmapRefresh(ent);
     } else if (ent->page_num < new_region_end_page &&
                new_region_end_page < ent_end_page) {
       /* New mapping overlaps start of existing mapping. */
       ent->page_num = new_region_end_page;
       ent->npages = ent_end_page - new_region_end_page;
       ent->offset += additional_offset;
+      NaClVmmapRefresh(ent);
       break;
     } else if (page_num <= ent->page_num &&
                ent_end_page <= new_region_end_page) {
       /* New mapping covers all of the existing mapping. */
-      ent->removed = 1;
+      NaClVmmapUnlink(self, ent);
+      NaClVmmapEntryFree(ent);
     } else {
       /* No overlap */
       assert(new_region_end_page <= ent->page_num || ent_end_page <= page_num);
@@ -375,8 +518,6 @@ static void NaClVmmapUpdate(struct NaClVmmap  *self,
   if (!remove) {
     NaClVmmapAdd(self, page_num, npages, prot, flags, desc, offset, file_size);
   }
-
-  NaClVmmapRemoveMarked(self);
 }
 
 void NaClVmmapAddWithOverwrite(struct NaClVmmap   *self,
@@ -416,9 +557,9 @@ int NaClVmmapChangeProt(struct NaClVmmap   *self,
                         uintptr_t          page_num,
                         size_t             npages,
                         int                prot) {
-  size_t      i;
-  size_t      nvalid;
-  uintptr_t   new_region_end_page = page_num + npages;
+  struct NaClVmmapEntry *ent;
+  struct NaClVmmapEntry *next;
+  uintptr_t             new_region_end_page = page_num + npages;
 
   /*
    * NaClVmmapCheckExistingMapping should be always called before
@@ -433,23 +574,26 @@ int NaClVmmapChangeProt(struct NaClVmmap   *self,
           ("NaClVmmapChangeProt(0x%08"NACL_PRIxPTR", 0x%"NACL_PRIxPTR
            ", 0x%"NACL_PRIxS", 0x%x)\n"),
           (uintptr_t) self, page_num, npages, prot);
-  NaClVmmapMakeSorted(self);
 
   /*
    * This loop & interval boundary tests closely follow those in
    * NaClVmmapUpdate. When updating those, do not forget to update them
    * at both places where appropriate.
-   * TODO(phosek): use better data structure which will support intervals
    */
 
-  for (i = 0, nvalid = self->nvalid; i < nvalid && npages > 0; i++) {
-    struct NaClVmmapEntry *ent = self->vmentry[i];
+  for (ent = NaClVmmapLowerBound(self, page_num);
+       NULL != ent && npages > 0 && ent->page_num < new_region_end_page;
+       ent = next) {
     uintptr_t             ent_end_page = ent->page_num + ent->npages;
     nacl_off64_t          additional_offset =
         (new_region_end_page - ent->page_num) << NACL_PAGESHIFT;
 
+    next = NaClVmmapNext(ent);
+
     if (ent->page_num < page_num && new_region_end_page < ent_end_page) {
       /* Split existing mapping into two parts */
+      ent->npages = page_num - ent->page_num;
+      NaClVmmapRefresh(ent);
       NaClVmmapAdd(self,
                    new_region_end_page,
                    ent_end_page - new_region_end_page,
@@ -458,7 +602,6 @@ int NaClVmmapChangeProt(struct NaClVmmap   *self,
                    ent->desc,
                    ent->offset + additional_offset,
                    ent->file_size);
-      ent->npages = page_num - ent->page_num;
       /* Add the new mapping into the middle. */
       NaClVmmapAdd(self,
                    page_num,
@@ -466,12 +609,13 @@ int NaClVmmapChangeProt(struct NaClVmmap   *self,
                    prot,
                    ent->flags,
                    ent->desc,
-                   ent->offset + (page_num - ent->page_num),
+                   ent->offset + ((page_num - ent->page_num) << NACL_PAGESHIFT),
                    ent->file_size);
       break;
     } else if (ent->page_num < page_num && page_num < ent_end_page) {
       /* New mapping overlaps end of existing mapping. */
       ent->npages = page_num - ent->page_num;
+      NaClVmmapRefresh(ent);
       /* Add the overlapping part of the mapping. */
       NaClVmmapAdd(self,
                    page_num,
@@ -479,7 +623,7 @@ int NaClVmmapChangeProt(struct NaClVmmap   *self,
                    prot,
                    ent->flags,
                    ent->desc,
-                   ent->offset + (page_num - ent->page_num),
+                   ent->offset + ((page_num - ent->page_num) << NACL_PAGESHIFT),
                    ent->file_size);
       /* The remaining part (if any) will be added in other iteration. */
       page_num = ent_end_page;
@@ -487,17 +631,20 @@ int NaClVmmapChangeProt(struct NaClVmmap   *self,
     } else if (ent->page_num < new_region_end_page &&
                new_region_end_page < ent_end_page) {
       /* New mapping overlaps start of existing mapping, split it. */
+      nacl_off64_t offset = ent->offset;
+
+      ent->page_num = new_region_end_page;
+      ent->npages = ent_end_page - new_region_end_page;
+      ent->offset += additional_offset;
+      NaClVmmapRefresh(ent);
       NaClVmmapAdd(self,
                    page_num,
                    npages,
                    prot,
                    ent->flags,
                    ent->desc,
-                   ent->offset,
+                   offset,
                    ent->file_size);
-      ent->page_num = new_region_end_page;
-      ent->npages = ent_end_page - new_region_end_page;
-      ent->offset += additional_offset;
       break;
     } else if (page_num <= ent->page_num &&
                ent_end_page <= new_region_end_page) {
@@ -543,8 +690,8 @@ int NaClVmmapCheckExistingMapping(struct NaClVmmap  *self,
                                   uintptr_t         page_num,
                                   size_t            npages,
                                   int               prot) {
-  size_t      i;
-  uintptr_t   region_end_page = page_num + npages;
+  struct NaClVmmapEntry *ent;
+  uintptr_t             region_end_page = page_num + npages;
 
   NaClLog(2,
           ("NaClVmmapCheckExistingMapping(0x%08"NACL_PRIxPTR", 0x%"NACL_PRIxPTR
@@ -554,10 +701,10 @@ int NaClVmmapCheckExistingMapping(struct NaClVmmap  *self,
   if (0 == self->nvalid) {
     return 0;
   }
-  NaClVmmapMakeSorted(self);
 
-  for (i = 0; i < self->nvalid; ++i) {
-    struct NaClVmmapEntry   *ent = self->vmentry[i];
+  for (ent = NaClVmmapLowerBound(self, page_num);
+       NULL != ent;
+       ent = NaClVmmapNext(ent)) {
     uintptr_t               ent_end_page = ent->page_num + ent->npages;
     int                     flags = NaClVmmapEntryMaxProt(ent);
 
@@ -579,70 +726,28 @@ int NaClVmmapCheckExistingMapping(struct NaClVmmap  *self,
   return 0;
 }
 
-static int NaClVmmapContainCmpEntries(void const *vkey,
-                                      void const *vent) {
-  struct NaClVmmapEntry const *const *key =
-      (struct NaClVmmapEntry const *const *) vkey;
-  struct NaClVmmapEntry const *const *ent =
-      (struct NaClVmmapEntry const *const *) vent;
-
-  NaClLog(5, "key->page_num   = 0x%05"NACL_PRIxPTR"\n", (*key)->page_num);
-
-  NaClLog(5, "entry->page_num = 0x%05"NACL_PRIxPTR"\n", (*ent)->page_num);
-  NaClLog(5, "entry->npages   = 0x%"NACL_PRIxS"\n", (*ent)->npages);
-
-  if ((*key)->page_num < (*ent)->page_num) return -1;
-  if ((*key)->page_num < (*ent)->page_num + (*ent)->npages) return 0;
-  return 1;
-}
-
 struct NaClVmmapEntry const *NaClVmmapFindPage(struct NaClVmmap *self,
                                                uintptr_t        pnum) {
-  struct NaClVmmapEntry key;
-  struct NaClVmmapEntry *kptr;
-  struct NaClVmmapEntry *const *result_ptr;
+  struct NaClVmmapEntry *ent = NaClVmmapLowerBound(self, pnum);
 
-  NaClVmmapMakeSorted(self);
-  key.page_num = pnum;
-  kptr = &key;
-  result_ptr = ((struct NaClVmmapEntry *const *)
-                bsearch(&kptr,
-                        self->vmentry,
-                        self->nvalid,
-                        sizeof self->vmentry[0],
-                        NaClVmmapContainCmpEntries));
-  return result_ptr ? *result_ptr : NULL;
+  if (NULL != ent && ent->page_num <= pnum) {
+    return ent;
+  }
+  return NULL;
 }
 
 
 struct NaClVmmapIter *NaClVmmapFindPageIter(struct NaClVmmap      *self,
                                             uintptr_t             pnum,
                                             struct NaClVmmapIter  *space) {
-  struct NaClVmmapEntry key;
-  struct NaClVmmapEntry *kptr;
-  struct NaClVmmapEntry **result_ptr;
-
-  NaClVmmapMakeSorted(self);
-  key.page_num = pnum;
-  kptr = &key;
-  result_ptr = ((struct NaClVmmapEntry **)
-                bsearch(&kptr,
-                        self->vmentry,
-                        self->nvalid,
-                        sizeof self->vmentry[0],
-                        NaClVmmapContainCmpEntries));
   space->vmmap = self;
-  if (NULL == result_ptr) {
-    space->entry_ix = self->nvalid;
-  } else {
-    space->entry_ix = result_ptr - self->vmentry;
-  }
+  space->entry = (struct NaClVmmapEntry *) NaClVmmapFindPage(self, pnum);
   return space;
 }
 
 
 int NaClVmmapIterAtEnd(struct NaClVmmapIter *nvip) {
-  return nvip->entry_ix >= nvip->vmmap->nvalid;
+  return NULL == nvip->entry;
 }
 
 
@@ -650,27 +755,24 @@ int NaClVmmapIterAtEnd(struct NaClVmmapIter *nvip) {
  * IterStar only permissible if not AtEnd
  */
 struct NaClVmmapEntry *NaClVmmapIterStar(struct NaClVmmapIter *nvip) {
-  return nvip->vmmap->vmentry[nvip->entry_ix];
+  return nvip->entry;
 }
 
 
 void NaClVmmapIterIncr(struct NaClVmmapIter *nvip) {
-  ++nvip->entry_ix;
+  nvip->entry = NaClVmmapNext(nvip->entry);
 }
 
 
 /*
  * Iterator becomes invalid after Erase.  We could have a version that
- * keep the iterator valid by copying forward, but it is unclear
+ * keep the iterator valid by moving to the next entry, but it is unclear
  * whether that is needed.
  */
 void NaClVmmapIterErase(struct NaClVmmapIter *nvip) {
-  struct NaClVmmap  *nvp;
-
-  nvp = nvip->vmmap;
-  free(nvp->vmentry[nvip->entry_ix]);
-  nvp->vmentry[nvip->entry_ix] = nvp->vmentry[--nvp->nvalid];
-  nvp->is_sorted = 0;
+  NaClVmmapUnlink(nvip->vmmap, nvip->entry);
+  NaClVmmapEntryFree(nvip->entry);
+  nvip->entry = NULL;
 }
 
 
@@ -678,36 +780,82 @@ void  NaClVmmapVisit(struct NaClVmmap *self,
                      void             (*fn)(void                  *state,
                                             struct NaClVmmapEntry *entry),
                      void             *state) {
-  size_t i;
-  size_t nentries;
+  struct NaClVmmapEntry *ent;
+  struct NaClVmmapEntry *next;
 
-  NaClVmmapMakeSorted(self);
-  for (i = 0, nentries = self->nvalid; i < nentries; ++i) {
-    (*fn)(state, self->vmentry[i]);
+  for (ent = NaClVmmapFirst(self); NULL != ent; ent = next) {
+    next = NaClVmmapNext(ent);
+    (*fn)(state, ent);
   }
 }
 
 
 /*
- * Linear search, from high addresses down.
+ * Returns the highest entry in the subtree at ent whose preceding hole
+ * (map_gap if map_aligned, else gap) is at least num_pages.  The subtree
+ * maxima say which way to go, so this is a single walk down.
+ */
+static struct NaClVmmapEntry *NaClVmmapLastGap(
+    struct NaClVmmapEntry *ent,
+    size_t                num_pages,
+    int                   map_aligned) {
+  while (NULL != ent) {
+    if (NULL != ent->right &&
+        (map_aligned ? ent->right->max_map_gap : ent->right->max_gap)
+        >= num_pages) {
+      ent = ent->right;
+    } else if ((map_aligned ? ent->map_gap : ent->gap) >= num_pages) {
+      return ent;
+    } else if (NULL != ent->left &&
+               (map_aligned ? ent->left->max_map_gap : ent->left->max_gap)
+               >= num_pages) {
+      ent = ent->left;
+    } else {
+      return NULL;
+    }
+  }
+  return NULL;
+}
+
+
+/*
+ * Returns the lowest entry above page_num in the subtree at ent whose
+ * map_gap is at least num_pages.
+ */
+static struct NaClVmmapEntry *NaClVmmapFirstMapGapAbove(
+    struct NaClVmmapEntry *ent,
+    uintptr_t             page_num,
+    size_t                num_pages) {
+  struct NaClVmmapEntry *found;
+
+  if (NULL == ent || ent->max_map_gap < num_pages) {
+    return NULL;
+  }
+  if (ent->page_num > page_num) {
+    found = NaClVmmapFirstMapGapAbove(ent->left, page_num, num_pages);
+    if (NULL != found) {
+      return found;
+    }
+    if (ent->map_gap >= num_pages) {
+      return ent;
+    }
+  }
+  return NaClVmmapFirstMapGapAbove(ent->right, page_num, num_pages);
+}
+
+
+/*
+ * Finds the highest hole that fits, from high addresses down.
  */
 uintptr_t NaClVmmapFindSpace(struct NaClVmmap *self,
                              size_t           num_pages) {
-  size_t                i;
   struct NaClVmmapEntry *vmep;
-  uintptr_t             end_page;
-  uintptr_t             start_page;
 
-  if (0 == self->nvalid)
+  if (self->nvalid < 2)
     return 0;
-  NaClVmmapMakeSorted(self);
-  for (i = self->nvalid; --i > 0; ) {
-    vmep = self->vmentry[i-1];
-    end_page = vmep->page_num + vmep->npages;  /* end page from previous */
-    start_page = self->vmentry[i]->page_num;  /* start page from current */
-    if (start_page - end_page >= num_pages) {
-      return start_page - num_pages;
-    }
+  vmep = NaClVmmapLastGap(self->root, num_pages, 0);
+  if (NULL != vmep) {
+    return vmep->page_num - num_pages;
   }
   return 0;
   /*
@@ -720,8 +868,9 @@ uintptr_t NaClVmmapFindSpace(struct NaClVmmap *self,
 
 
 /*
- * Linear search, from high addresses down.  For mmap, so the starting
- * address of the region found must be NACL_MAP_PAGESIZE aligned.
+ * Finds the highest hole that fits, from high addresses down.  For
+ * mmap, so the starting address of the region found must be
+ * NACL_MAP_PAGESIZE aligned.
  *
  * For general mmap it is better to use as high an address as
  * possible, since the stack size for the main thread is currently
@@ -729,33 +878,15 @@ uintptr_t NaClVmmapFindSpace(struct NaClVmmap *self,
  */
 uintptr_t NaClVmmapFindMapSpace(struct NaClVmmap *self,
                                 size_t           num_pages) {
-  size_t                i;
   struct NaClVmmapEntry *vmep;
-  uintptr_t             end_page;
-  uintptr_t             start_page;
 
-  if (0 == self->nvalid)
+  if (self->nvalid < 2)
     return 0;
-  NaClVmmapMakeSorted(self);
   num_pages = NaClRoundPageNumUpToMapMultiple(num_pages);
 
-  for (i = self->nvalid; --i > 0; ) {
-    vmep = self->vmentry[i-1];
-    end_page = vmep->page_num + vmep->npages;  /* end page from previous */
-    end_page = NaClRoundPageNumUpToMapMultiple(end_page);
-
-    start_page = self->vmentry[i]->page_num;  /* start page from current */
-    if (NACL_MAP_PAGESHIFT > NACL_PAGESHIFT) {
-
-      start_page = NaClTruncPageNumDownToMapMultiple(start_page);
-
-      if (start_page <= end_page) {
-        continue;
-      }
-    }
-    if (start_page - end_page >= num_pages) {
-      return start_page - num_pages;
-    }
+  vmep = NaClVmmapLastGap(self->root, num_pages, 1);
+  if (NULL != vmep) {
+    return NaClVmmapMapStartPage(vmep->page_num) - num_pages;
   }
   return 0;
   /*
@@ -768,46 +899,53 @@ uintptr_t NaClVmmapFindMapSpace(struct NaClVmmap *self,
 
 
 /*
- * Linear search, from uaddr up.
+ * Finds the lowest hole that fits, from uaddr up.  Only the hole
+ * holding uaddr needs clipping; every hole after it is used whole.
  */
 uintptr_t NaClVmmapFindMapSpaceAboveHint(struct NaClVmmap *self,
                                          uintptr_t        uaddr,
                                          size_t           num_pages) {
-  size_t                nvalid;
-  size_t                i;
+  struct NaClVmmapEntry *ent;
+  struct NaClVmmapEntry *prev;
   struct NaClVmmapEntry *vmep;
   uintptr_t             usr_page;
   uintptr_t             start_page;
   uintptr_t             end_page;
 
-  NaClVmmapMakeSorted(self);
-
   usr_page = uaddr >> NACL_PAGESHIFT;
   num_pages = NaClRoundPageNumUpToMapMultiple(num_pages);
 
-  nvalid = self->nvalid;
-
-  for (i = 1; i < nvalid; ++i) {
-    vmep = self->vmentry[i-1];
-    end_page = vmep->page_num + vmep->npages;
-    end_page = NaClRoundPageNumUpToMapMultiple(end_page);
-
-    start_page = self->vmentry[i]->page_num;
-    if (NACL_MAP_PAGESHIFT > NACL_PAGESHIFT) {
-
-      start_page = NaClTruncPageNumDownToMapMultiple(start_page);
-
-      if (start_page <= end_page) {
-        continue;
-      }
+  /* The first entry whose (aligned) start is above usr_page. */
+  ent = NULL;
+  for (vmep = self->root; NULL != vmep; ) {
+    if (NaClVmmapMapStartPage(vmep->page_num) > usr_page) {
+      ent = vmep;
+      vmep = vmep->left;
+    } else {
+      vmep = vmep->right;
     }
-    if (end_page <= usr_page && usr_page < start_page) {
+  }
+  if (NULL == ent) {
+    return 0;
+  }
+
+  prev = NaClVmmapPrev(ent);
+  if (NULL != prev) {
+    end_page = NaClRoundPageNumUpToMapMultiple(prev->page_num + prev->npages);
+    start_page = NaClVmmapMapStartPage(ent->page_num);
+    if (end_page <= usr_page) {
       end_page = usr_page;
     }
-    if (usr_page <= end_page && (start_page - end_page) >= num_pages) {
+    if (start_page > end_page && start_page - end_page >= num_pages) {
       /* found a gap at or after uaddr that's big enough */
       return end_page;
     }
   }
+
+  vmep = NaClVmmapFirstMapGapAbove(self->root, ent->page_num, num_pages);
+  if (NULL != vmep) {
+    prev = NaClVmmapPrev(vmep);
+    return NaClRoundPageNumUpToMapMultiple(prev->page_num + prev->npages);
+  }
   return 0;
 }
@@ -21,6 +21,18 @@ EXTERN_C_BEGIN
 struct NaClDesc;
 
 #define NACL_MAP_COPY   0x100
+/*
+ * Anonymous memory shared copy-on-write with other cages by a fork: desc
+ * is a shared memory object that nothing writes any more, mapped
+ * MAP_PRIVATE.
+ */
+#define NACL_MAP_COW    0x200
+/*
+ * Anonymous memory kept in the cage's own shared memory object (its
+ * anon_shm), mapped MAP_SHARED at the offset equal to its user address.
+ * The next fork turns it into NACL_MAP_COW memory without copying.
+ */
+#define NACL_MAP_SHM_ANON 0x400
 
 /*
  * Interface is based on setting properties and query properties by
@@ -34,8 +46,12 @@ struct NaClDesc;
  * looking at the first memory hole that fits, starting down from the
  * stack.
  *
- * The simple data structure that we use is a sorted array of valid
- * memory regions.
+ * The regions are kept in a treap -- a binary search tree balanced by
+ * random priorities -- ordered by page number, so lookups, inserts and
+ * removals take O(log n).  Each entry also records the hole between it
+ * and the entry before it, and each subtree the largest such hole, so
+ * the searches for free space go straight to a hole that fits rather
+ * than scanning every region.
  */
 
 struct NaClVmmapEntry {
@@ -43,16 +59,25 @@ struct NaClVmmapEntry {
   size_t            npages;     /* number of pages */
   int               prot;       /* mprotect attribute */
   int               flags;      /* mapping flags */
-  int               removed;    /* flag set in NaClVmmapUpdate */
   struct NaClDesc   *desc;      /* the backing store, if any */
   nacl_off64_t      offset;     /* offset into desc */
   nacl_off64_t      file_size;  /* backing store size */
+
+  /* The rest is private to the NaClVmmap holding the entry. */
+  struct NaClVmmapEntry *left;
+  struct NaClVmmapEntry *right;
+  struct NaClVmmapEntry *parent;
+  uint32_t          priority;   /* heap ordered: parents are higher */
+  size_t            gap;        /* free pages since the previous entry */
+  size_t            map_gap;    /* same, NACL_MAP_PAGESIZE aligned */
+  size_t            max_gap;    /* largest gap in this subtree */
+  size_t            max_map_gap;  /* largest map_gap in this subtree */
 };
 
 struct NaClVmmap {
-  struct NaClVmmapEntry **vmentry;       /* must not overlap */
-  size_t                nvalid, size;
-  int                   is_sorted;
+  struct NaClVmmapEntry *root;           /* entries must not overlap */
+  size_t                nvalid;          /* number of entries */
+  uint32_t              rand_state;      /* for entry priorities */
 };
 
 void NaClVmmapDebug(struct NaClVmmap  *self,
@@ -63,7 +88,7 @@ void NaClVmmapDebug(struct NaClVmmap  *self,
  */
 struct NaClVmmapIter {
   struct NaClVmmap      *vmmap;
-  size_t                 entry_ix;
+  struct NaClVmmapEntry *entry;  /* NULL at end */
 };
 
 int                   NaClVmmapIterAtEnd(struct NaClVmmapIter *nvip);
@@ -148,7 +173,7 @@ void  NaClVmmapVisit(struct NaClVmmap   *self,
 
 /*
  * Returns page number starting at which there is a hole of at least
- * num_pages in size.  Linear search from high addresses on down.
+ * num_pages in size.  Picks the highest such hole.
  */
 uintptr_t NaClVmmapFindSpace(struct NaClVmmap *self,
                              size_t           num_pages);
@@ -161,12 +186,27 @@ uintptr_t NaClVmmapFindSpace(struct NaClVmmap *self,
 uintptr_t NaClVmmapFindMapSpace(struct NaClVmmap *self,
                                 size_t           num_pages);
 
+/*
+ * Returns the lowest NACL_MAP_PAGESIZE aligned page number at or above
+ * uaddr's page that starts a hole of at least num_pages, or 0 if none.
+ */
 uintptr_t NaClVmmapFindMapSpaceAboveHint(struct NaClVmmap *self,
                                          uintptr_t        uaddr,
                                          size_t           num_pages);
 
+/*
+ * The map is always sorted now; kept for existing callers.
+ */
 void NaClVmmapMakeSorted(struct NaClVmmap  *self);
 
+/*
+ * Must be called after changing the page_num or npages of an entry in
+ * place, e.g. through NaClVmmapIterStar.  The entry must still not
+ * overlap its neighbours.
+ */
+void NaClVmmapEntryResized(struct NaClVmmap       *self,
+                           struct NaClVmmapEntry  *entry);
+
 int NaClVmmapEntryMaxProt(struct NaClVmmapEntry *entry);
 
 EXTERN_C_END
@@ -0,0 +1,267 @@
+/*
+ * Copyright (c) 2017 The Native Client Authors. All rights reserved.
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file.
+ */
+
+/*
+ * Replays a trace of mmap/munmap/mprotect calls against a NaClVmmap and
+ * reports the time per call, which is what the memory map costs each of
+ * those syscalls.
+ *
+ * A trace file has one call per line, with page numbers and counts in
+ * hex as NaClLog prints them:
+ *
+ *   mmap <page_num> <npages> <prot>      address picked by the map
+ *   mmap_fixed <page_num> <npages> <prot>
+ *   munmap <page_num> <npages>
+ *   mprotect <page_num> <npages> <prot>
+ *
+ * For mmap, the replay looks for space with NaClVmmapFindMapSpace just as
+ * NaClSysMmap does, then maps the recorded page_num so later munmaps still
+ * line up.  Without a trace file, one is recorded from a synthetic
+ * allocator-like workload for several numbers of live mappings.
+ */
+
+#include "native_client/src/include/portability.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "native_client/src/include/nacl_macros.h"
+#include "native_client/src/shared/platform/nacl_check.h"
+#include "native_client/src/shared/platform/nacl_log.h"
+#include "native_client/src/trusted/service_runtime/include/bits/mman.h"
+#include "native_client/src/trusted/service_runtime/nacl_config.h"
+#include "native_client/src/trusted/service_runtime/sel_mem.h"
+#include "native_client/src/trusted/service_runtime/sel_util.h"
+
+enum TraceOpKind {
+  kTraceMmap,
+  kTraceMmapFixed,
+  kTraceMunmap,
+  kTraceMprotect
+};
+
+struct TraceOp {
+  enum TraceOpKind  kind;
+  uintptr_t         page_num;
+  size_t            npages;
+  int               prot;
+};
+
+struct Trace {
+  struct TraceOp  *ops;
+  size_t          num_ops;
+  size_t          size;
+};
+
+struct LiveMapping {
+  uintptr_t page_num;
+  size_t    npages;
+};
+
+/* The low pages (zero page, text, data) and the top (stack) are fixed. */
+static uintptr_t const kLowEndPage = 0x1000;
+static uintptr_t const kStackPage = 0xff000;
+static size_t const kStackPages = 0x1000;
+
+static size_t const kLiveMappings[] = { 1000, 10000, 30000 };
+static size_t const kOpsPerLiveMapping = 4;
+
+static double Now(void) {
+  struct timespec ts;
+  CHECK(0 == clock_gettime(CLOCK_MONOTONIC, &ts));
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void TraceAppend(struct Trace *trace, enum TraceOpKind kind,
+                        uintptr_t page_num, size_t npages, int prot) {
+  struct TraceOp *op;
+
+  if (trace->num_ops == trace->size) {
+    trace->size = trace->size ? 2 * trace->size : 1024;
+    trace->ops = realloc(trace->ops, trace->size * sizeof *trace->ops);
+    CHECK(NULL != trace->ops);
+  }
+  op = &trace->ops[trace->num_ops++];
+  op->kind = kind;
+  op->page_num = page_num;
+  op->npages = npages;
+  op->prot = prot;
+}
+
+static void AddFixedMappings(struct NaClVmmap *map) {
+  NaClVmmapAdd(map, 0, 1, NACL_ABI_PROT_NONE, NACL_ABI_MAP_PRIVATE,
+               NULL, 0, 0);
+  NaClVmmapAdd(map, 1, kLowEndPage - 1,
+               NACL_ABI_PROT_READ | NACL_ABI_PROT_WRITE,
+               NACL_ABI_MAP_PRIVATE, NULL, 0, 0);
+  NaClVmmapAdd(map, kStackPage, kStackPages,
+               NACL_ABI_PROT_READ | NACL_ABI_PROT_WRITE,
+               NACL_ABI_MAP_PRIVATE, NULL, 0, 0);
+}
+
+/*
+ * Records a malloc-like workload: mostly small anonymous mappings placed
+ * top down by the map, freed in random order, some of them partially,
+ * with the odd mprotect, while about |live| mappings stay mapped.
+ */
+static void RecordSyntheticTrace(struct Trace *trace, size_t live) {
+  struct NaClVmmap map;
+  struct LiveMapping *mappings;
+  size_t num_live = 0;
+  size_t num_ops = live * kOpsPerLiveMapping;
+  size_t i;
+  unsigned int seed = 1;
+
+  CHECK(NaClVmmapCtor(&map));
+  AddFixedMappings(&map);
+  mappings = malloc(live * sizeof *mappings);
+  CHECK(NULL != mappings);
+
+  for (i = 0; i < num_ops; ++i) {
+    unsigned int r = rand_r(&seed);
+
+    if (num_live < live && (i < live || r % 2 == 0)) {
+      size_t npages = NaClRoundPageNumUpToMapMultiple(
+          r % 8 == 0 ? 1 + r % 64 : 1 + r % 4);
+      uintptr_t page_num = NaClVmmapFindMapSpace(&map, npages);
+
+      CHECK(0 != page_num);
+      NaClVmmapAddWithOverwrite(&map, page_num, npages,
+                                NACL_ABI_PROT_READ | NACL_ABI_PROT_WRITE,
+                                NACL_ABI_MAP_PRIVATE, NULL, 0, 0);
+      TraceAppend(trace, kTraceMmap, page_num, npages,
+                  NACL_ABI_PROT_READ | NACL_ABI_PROT_WRITE);
+      mappings[num_live].page_num = page_num;
+      mappings[num_live].npages = npages;
+      ++num_live;
+    } else if (num_live > 0) {
+      size_t ix = (r >> 4) % num_live;
+      struct LiveMapping *m = &mappings[ix];
+      size_t half = NaClRoundPageNumUpToMapMultiple(m->npages / 2);
+
+      if (r % 16 == 1 && half < m->npages) {
+        /* guard page style mprotect of the first half */
+        CHECK(NaClVmmapChangeProt(&map, m->page_num, half,
+                                  NACL_ABI_PROT_NONE));
+        TraceAppend(trace, kTraceMprotect, m->page_num, half,
+                    NACL_ABI_PROT_NONE);
+      } else if (r % 16 == 2 && half < m->npages) {
+        /* realloc style shrink: unmap the tail */
+        NaClVmmapRemove(&map, m->page_num + half, m->npages - half);
+        TraceAppend(trace, kTraceMunmap, m->page_num + half,
+                    m->npages - half, 0);
+        m->npages = half;
+      } else {
+        NaClVmmapRemove(&map, m->page_num, m->npages);
+        TraceAppend(trace, kTraceMunmap, m->page_num, m->npages, 0);
+        *m = mappings[--num_live];
+      }
+    }
+  }
+  free(mappings);
+  NaClVmmapDtor(&map);
+}
+
+static int ReadTrace(struct Trace *trace, char const *path) {
+  FILE *f = fopen(path, "r");
+  char line[256];
+  char kind[32];
+  unsigned long page_num;
+  unsigned long npages;
+  int prot;
+  int n;
+
+  if (NULL == f) {
+    perror(path);
+    return 0;
+  }
+  while (NULL != fgets(line, sizeof line, f)) {
+    prot = 0;
+    n = sscanf(line, "%31s %lx %lx %x", kind, &page_num, &npages, &prot);
+    if (n < 3 || '#' == kind[0]) {
+      continue;
+    }
+    if (0 == strcmp(kind, "mmap")) {
+      TraceAppend(trace, kTraceMmap, page_num, npages, prot);
+    } else if (0 == strcmp(kind, "mmap_fixed")) {
+      TraceAppend(trace, kTraceMmapFixed, page_num, npages, prot);
+    } else if (0 == strcmp(kind, "munmap")) {
+      TraceAppend(trace, kTraceMunmap, page_num, npages, 0);
+    } else if (0 == strcmp(kind, "mprotect")) {
+      TraceAppend(trace, kTraceMprotect, page_num, npages, prot);
+    } else {
+      fprintf(stderr, "%s: unknown call: %s", path, line);
+      fclose(f);
+      return 0;
+    }
+  }
+  fclose(f);
+  return 1;
+}
+
+/* Returns the time per call. */
+static double ReplayTrace(struct Trace const *trace) {
+  struct NaClVmmap map;
+  double start;
+  double elapsed;
+  size_t i;
+
+  CHECK(NaClVmmapCtor(&map));
+  AddFixedMappings(&map);
+  start = Now();
+  for (i = 0; i < trace->num_ops; ++i) {
+    struct TraceOp const *op = &trace->ops[i];
+
+    switch (op->kind) {
+      case kTraceMmap:
+        CHECK(0 != NaClVmmapFindMapSpace(&map, op->npages));
+        /* fall through */
+      case kTraceMmapFixed:
+        NaClVmmapAddWithOverwrite(&map, op->page_num, op->npages, op->prot,
+                                  NACL_ABI_MAP_PRIVATE, NULL, 0, 0);
+        break;
+      case kTraceMunmap:
+        NaClVmmapRemove(&map, op->page_num, op->npages);
+        break;
+      case kTraceMprotect:
+        NaClVmmapChangeProt(&map, op->page_num, op->npages, op->prot);
+        break;
+    }
+  }
+  elapsed = Now() - start;
+  NaClVmmapDtor(&map);
+  return elapsed / trace->num_ops;
+}
+
+int main(int argc, char **argv) {
+  struct Trace trace;
+  size_t i;
+
+  NaClLogModuleInit();
+  memset(&trace, 0, sizeof trace);
+
+  if (argc > 1) {
+    if (!ReadTrace(&trace, argv[1]) || 0 == trace.num_ops) {
+      fprintf(stderr, "no calls to replay in %s\n", argv[1]);
+      return 1;
+    }
+    printf("RESULT VmmapTraceReplay: %s= %.3f microseconds\n",
+           argv[1], ReplayTrace(&trace) * 1e6);
+  } else {
+    for (i = 0; i < NACL_ARRAY_SIZE(kLiveMappings); ++i) {
+      trace.num_ops = 0;
+      RecordSyntheticTrace(&trace, kLiveMappings[i]);
+      printf("RESULT VmmapTraceReplay_%"NACL_PRIuS"Mappings: "
+             "time= %.3f microseconds\n",
+             kLiveMappings[i], ReplayTrace(&trace) * 1e6);
+    }
+  }
+  free(trace.ops);
+  NaClLogModuleFini();
+  return 0;
+}
@@ -5,6 +5,7 @@
  */
 
 #include "native_client/src/include/nacl_platform.h"
+#include "native_client/src/trusted/service_runtime/nacl_config.h"
 #include "native_client/src/trusted/service_runtime/sel_mem.h"
 #include "native_client/src/shared/platform/nacl_log.h"
 #include "gtest/gtest.h"
@@ -43,7 +44,6 @@ TEST_F(SelMemTest, AddTest) {
                  0,
                  0);
     EXPECT_EQ(i, static_cast<int>(mem_map.nvalid));
-    EXPECT_EQ(5, static_cast<int>(mem_map.size));
   }
 
   // no checks for start_page_num ..
@@ -56,7 +56,6 @@ TEST_F(SelMemTest, AddTest) {
                0,
                0);
   EXPECT_EQ(6, static_cast<int>(mem_map.nvalid));
-  EXPECT_EQ(10, static_cast<int>(mem_map.size));
 
   NaClVmmapDtor(&mem_map);
 }
@@ -234,3 +233,80 @@ TEST_F(SelMemTest, FindSpaceTest) {
 
   NaClVmmapDtor(&mem_map);
 }
+
+static void CheckSorted(void *state, struct NaClVmmapEntry *entry) {
+  uintptr_t *last_end_page = reinterpret_cast<uintptr_t *>(state);
+
+  EXPECT_LE(*last_end_page, entry->page_num);
+  *last_end_page = entry->page_num + entry->npages;
+}
+
+TEST_F(SelMemTest, ManyMappingsTest) {
+  struct NaClVmmap mem_map;
+  // Multiples of 16 pages, so every hole is NACL_MAP_PAGESIZE aligned.
+  const uintptr_t kStride = 64;
+  const int kNumEntries = 4096;
+
+  EXPECT_EQ(1, NaClVmmapCtor(&mem_map));
+
+  // [16, 48], [80, 112], ... in random-looking order
+  for (int i = 0; i < kNumEntries; ++i) {
+    uintptr_t ix = (i * 2654435761U) % kNumEntries;
+    NaClVmmapAddWithOverwrite(&mem_map,
+                              16 + ix * kStride,
+                              32,
+                              NACL_ABI_PROT_READ | NACL_ABI_PROT_WRITE,
+                              NACL_ABI_MAP_PRIVATE,
+                              NULL,
+                              0,
+                              0);
+  }
+  EXPECT_EQ(static_cast<size_t>(kNumEntries), mem_map.nvalid);
+
+  uintptr_t last_end_page = 0;
+  NaClVmmapVisit(&mem_map, CheckSorted, &last_end_page);
+
+  for (uintptr_t ix = 0; ix < static_cast<uintptr_t>(kNumEntries); ++ix) {
+    EXPECT_TRUE(NULL != NaClVmmapFindPage(&mem_map, 16 + ix * kStride));
+    EXPECT_TRUE(NULL != NaClVmmapFindPage(&mem_map, 47 + ix * kStride));
+    EXPECT_TRUE(NULL == NaClVmmapFindPage(&mem_map, 48 + ix * kStride));
+  }
+
+  // Every hole is 32 pages; open a 96 page one low and one high.
+  NaClVmmapRemove(&mem_map, 16 + 100 * kStride, 32);
+  NaClVmmapRemove(&mem_map, 16 + 3000 * kStride, 32);
+  EXPECT_EQ(static_cast<size_t>(kNumEntries - 2), mem_map.nvalid);
+
+  EXPECT_EQ(16 + 3001 * kStride - 96, NaClVmmapFindSpace(&mem_map, 96));
+  EXPECT_EQ(16 + 3001 * kStride - 96, NaClVmmapFindMapSpace(&mem_map, 96));
+  EXPECT_EQ(0U, NaClVmmapFindSpace(&mem_map, 97));
+  EXPECT_EQ(16 + (kNumEntries - 1) * kStride - 32,
+            NaClVmmapFindMapSpace(&mem_map, 32));
+
+  // From a hint: the hole holding the hint, else the lowest one above.
+  EXPECT_EQ(48 + 99 * kStride,
+            NaClVmmapFindMapSpaceAboveHint(&mem_map, 0, 96));
+  EXPECT_EQ(48 + 2999 * kStride,
+            NaClVmmapFindMapSpaceAboveHint(
+                &mem_map, (48 + 100 * kStride) << NACL_PAGESHIFT, 96));
+  EXPECT_EQ(48 + 500 * kStride + 16,
+            NaClVmmapFindMapSpaceAboveHint(
+                &mem_map, (48 + 500 * kStride + 16) << NACL_PAGESHIFT, 16));
+
+  // Splitting entries in the middle keeps the map ordered.
+  NaClVmmapRemove(&mem_map, 24 + 10 * kStride, 8);
+  EXPECT_EQ(1, NaClVmmapChangeProt(&mem_map, 24 + 20 * kStride, 8,
+                                   NACL_ABI_PROT_READ));
+  EXPECT_EQ(static_cast<size_t>(kNumEntries + 1), mem_map.nvalid);
+  last_end_page = 0;
+  NaClVmmapVisit(&mem_map, CheckSorted, &last_end_page);
+  EXPECT_TRUE(NULL != NaClVmmapFindPage(&mem_map, 23 + 10 * kStride));
+  EXPECT_TRUE(NULL == NaClVmmapFindPage(&mem_map, 24 + 10 * kStride));
+  EXPECT_TRUE(NULL != NaClVmmapFindPage(&mem_map, 32 + 10 * kStride));
+  EXPECT_EQ(NACL_ABI_PROT_READ,
+            NaClVmmapFindPage(&mem_map, 24 + 20 * kStride)->prot);
+  EXPECT_EQ(NACL_ABI_PROT_READ | NACL_ABI_PROT_WRITE,
+            NaClVmmapFindPage(&mem_map, 32 + 20 * kStride)->prot);
+
+  NaClVmmapDtor(&mem_map);
+}
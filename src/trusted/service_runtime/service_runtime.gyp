@@ -45,15 +45,19 @@
           'nacl_desc_postmessage.c',
           'nacl_error_gio.c',
           'nacl_error_log_hook.c',
+          'nacl_fd_table.c',
           'nacl_globals.c',
+          'nacl_image_cache.c',
           'nacl_kernel_service.c',
           'nacl_resource.c',
           'nacl_reverse_quota_interface.c',
           'nacl_secure_service.c',
           'nacl_signal_common.c',
           'nacl_stack_safety.c',
+          'nacl_stat_cache.c',
           'nacl_syscall_common.c',
           'nacl_syscall_hook.c',
+          'nacl_syscall_profile.c',
           'nacl_text.c',
           'nacl_valgrind_hooks.c',
           'name_service/default_name_service.c',
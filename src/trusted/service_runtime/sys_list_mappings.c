@@ -105,7 +105,8 @@ static void NaClSysListMappingsVisit(void *statev,
       /* size= */ size,
       /* prot= */ vmep->prot,
       /* max_prot= */ max_prot,
-      /* vmmap_type= */ vmep->desc != NULL);
+      /* vmmap_type= */ vmep->desc != NULL &&
+          0 == (vmep->flags & (NACL_MAP_COW | NACL_MAP_SHM_ANON)));
 }
 
 static void NaClSysListMappingsDyncodeVisit(void *statev,
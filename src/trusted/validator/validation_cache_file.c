@@ -0,0 +1,505 @@
+/*
+ * Copyright (c) 2017 The Native Client Authors. All rights reserved.
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file.
+ */
+
+#include "native_client/src/trusted/validator/validation_cache_file.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "native_client/src/shared/platform/nacl_check.h"
+#include "native_client/src/shared/platform/nacl_log.h"
+#include "native_client/src/trusted/validator/validation_cache.h"
+#include "native_client/src/trusted/validator/validation_cache_internal.h"
+
+/*
+ * SHA-256, FIPS 180-4.
+ */
+
+static const uint32_t kSha256K[64] = {
+  0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5,
+  0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+  0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3,
+  0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+  0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc,
+  0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+  0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7,
+  0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+  0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13,
+  0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+  0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3,
+  0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+  0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5,
+  0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+  0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208,
+  0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+};
+
+#define ROTR32(x, n) (((x) >> (n)) | ((x) << (32 - (n))))
+
+static void NaClSha256Block(uint32_t state[8], const uint8_t block[64]) {
+  uint32_t w[64];
+  uint32_t a, b, c, d, e, f, g, h;
+  int i;
+
+  for (i = 0; i < 16; ++i) {
+    w[i] = ((uint32_t) block[4 * i] << 24) |
+           ((uint32_t) block[4 * i + 1] << 16) |
+           ((uint32_t) block[4 * i + 2] << 8) |
+           (uint32_t) block[4 * i + 3];
+  }
+  for (i = 16; i < 64; ++i) {
+    uint32_t s0 = ROTR32(w[i - 15], 7) ^ ROTR32(w[i - 15], 18) ^
+                  (w[i - 15] >> 3);
+    uint32_t s1 = ROTR32(w[i - 2], 17) ^ ROTR32(w[i - 2], 19) ^
+                  (w[i - 2] >> 10);
+    w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+  }
+  a = state[0];
+  b = state[1];
+  c = state[2];
+  d = state[3];
+  e = state[4];
+  f = state[5];
+  g = state[6];
+  h = state[7];
+  for (i = 0; i < 64; ++i) {
+    uint32_t s1 = ROTR32(e, 6) ^ ROTR32(e, 11) ^ ROTR32(e, 25);
+    uint32_t ch = (e & f) ^ (~e & g);
+    uint32_t t1 = h + s1 + ch + kSha256K[i] + w[i];
+    uint32_t s0 = ROTR32(a, 2) ^ ROTR32(a, 13) ^ ROTR32(a, 22);
+    uint32_t maj = (a & b) ^ (a & c) ^ (b & c);
+    uint32_t t2 = s0 + maj;
+    h = g;
+    g = f;
+    f = e;
+    e = d + t1;
+    d = c;
+    c = b;
+    b = a;
+    a = t1 + t2;
+  }
+  state[0] += a;
+  state[1] += b;
+  state[2] += c;
+  state[3] += d;
+  state[4] += e;
+  state[5] += f;
+  state[6] += g;
+  state[7] += h;
+}
+
+void NaClSha256Init(struct NaClSha256Context *ctx) {
+  static const uint32_t kInitialState[8] = {
+    0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a,
+    0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19
+  };
+  memcpy(ctx->state, kInitialState, sizeof ctx->state);
+  ctx->length = 0;
+}
+
+void NaClSha256Update(struct NaClSha256Context *ctx,
+                      const uint8_t *data,
+                      size_t length) {
+  size_t used = (size_t) (ctx->length & 63);
+
+  ctx->length += length;
+  if (used != 0) {
+    size_t take = 64 - used < length ? 64 - used : length;
+    memcpy(ctx->buffer + used, data, take);
+    data += take;
+    length -= take;
+    if (used + take < 64) {
+      return;
+    }
+    NaClSha256Block(ctx->state, ctx->buffer);
+  }
+  for (; length >= 64; data += 64, length -= 64) {
+    NaClSha256Block(ctx->state, data);
+  }
+  memcpy(ctx->buffer, data, length);
+}
+
+void NaClSha256Final(struct NaClSha256Context *ctx,
+                     uint8_t digest[NACL_SHA256_DIGEST_SIZE]) {
+  uint64_t bits = ctx->length * 8;
+  size_t used = (size_t) (ctx->length & 63);
+  int i;
+
+  ctx->buffer[used++] = 0x80;
+  if (used > 56) {
+    memset(ctx->buffer + used, 0, 64 - used);
+    NaClSha256Block(ctx->state, ctx->buffer);
+    used = 0;
+  }
+  memset(ctx->buffer + used, 0, 56 - used);
+  for (i = 0; i < 8; ++i) {
+    ctx->buffer[56 + i] = (uint8_t) (bits >> (56 - 8 * i));
+  }
+  NaClSha256Block(ctx->state, ctx->buffer);
+  for (i = 0; i < 8; ++i) {
+    digest[4 * i] = (uint8_t) (ctx->state[i] >> 24);
+    digest[4 * i + 1] = (uint8_t) (ctx->state[i] >> 16);
+    digest[4 * i + 2] = (uint8_t) (ctx->state[i] >> 8);
+    digest[4 * i + 3] = (uint8_t) ctx->state[i];
+  }
+}
+
+/*
+ * File layout: one header followed by |entries| slots.  A slot is empty
+ * unless its check matches its contents.
+ */
+
+#define NACL_VCACHE_MAGIC     "NaClVCch"
+#define NACL_VCACHE_VERSION   1
+#define NACL_VCACHE_PROBE     8
+
+struct NaClVCacheHeader {
+  char      magic[8];
+  uint32_t  version;
+  uint32_t  entries;
+  uint32_t  slot_size;
+  uint32_t  check;
+  uint64_t  next_seq;   /* shared by every mapping of the file */
+  uint8_t   reserved[32];
+};
+
+struct NaClVCacheSlot {
+  uint8_t   key[NACL_SHA256_DIGEST_SIZE];
+  uint64_t  seq;        /* insertion order, for eviction */
+  uint32_t  check;
+  uint32_t  reserved;
+};
+
+struct NaClVCacheFile {
+  struct NaClValidationCache    base;
+  int                           fd;
+  struct NaClVCacheHeader       *header;
+  struct NaClVCacheSlot         *slots;
+  size_t                        map_size;
+};
+
+struct NaClVCacheQuery {
+  struct NaClVCacheFile     *cache;
+  struct NaClSha256Context  sha;
+  uint8_t                   key[NACL_SHA256_DIGEST_SIZE];
+  int                       finished;
+};
+
+/* FNV-1a, forced nonzero so that a zero-filled slot never checks out. */
+static uint32_t NaClVCacheCheck(const void *data, size_t size) {
+  const uint8_t *p = data;
+  uint32_t h = 2166136261u;
+  size_t i;
+
+  for (i = 0; i < size; ++i) {
+    h = (h ^ p[i]) * 16777619u;
+  }
+  return h | 1;
+}
+
+static uint32_t NaClVCacheHeaderCheck(const struct NaClVCacheHeader *h) {
+  return NaClVCacheCheck(h, offsetof(struct NaClVCacheHeader, check));
+}
+
+static uint32_t NaClVCacheSlotCheck(const struct NaClVCacheSlot *slot) {
+  return NaClVCacheCheck(slot, offsetof(struct NaClVCacheSlot, check));
+}
+
+static size_t NaClVCacheFileSize(uint32_t entries) {
+  return sizeof(struct NaClVCacheHeader) +
+      (size_t) entries * sizeof(struct NaClVCacheSlot);
+}
+
+/* Only the effective user may be able to change what the cache says. */
+static int NaClVCacheTrusted(const struct stat *st, const char *path) {
+  if (st->st_uid != geteuid() || 0 != (st->st_mode & (S_IWGRP | S_IWOTH))) {
+    NaClLog(LOG_WARNING, "validation cache %s is writable by other users;"
+            " not using it\n", path);
+    return 0;
+  }
+  return 1;
+}
+
+/*
+ * Writes an empty cache under a temporary name and links it into place,
+ * replacing an unusable file if |replace|.  Losing a race to another
+ * creator is not an error.
+ */
+static int NaClVCacheCreateFile(const char *path, uint32_t entries,
+                                int replace) {
+  struct NaClVCacheHeader header;
+  char tmp[PATH_MAX];
+  int fd;
+  int ok = 0;
+
+  if (snprintf(tmp, sizeof tmp, "%s.tmp.%d", path, (int) getpid()) >=
+      (int) sizeof tmp) {
+    return 0;
+  }
+  fd = open(tmp, O_RDWR | O_CREAT | O_EXCL | O_CLOEXEC, 0600);
+  if (fd < 0) {
+    return 0;
+  }
+  memset(&header, 0, sizeof header);
+  memcpy(header.magic, NACL_VCACHE_MAGIC, sizeof header.magic);
+  header.version = NACL_VCACHE_VERSION;
+  header.entries = entries;
+  header.slot_size = sizeof(struct NaClVCacheSlot);
+  header.check = NaClVCacheHeaderCheck(&header);
+  if (0 == ftruncate(fd, (off_t) NaClVCacheFileSize(entries)) &&
+      pwrite(fd, &header, sizeof header, 0) == (ssize_t) sizeof header &&
+      0 == fsync(fd)) {
+    if (replace) {
+      ok = 0 == rename(tmp, path);
+    } else {
+      ok = 0 == link(tmp, path) || EEXIST == errno;
+    }
+  }
+  close(fd);
+  (void) unlink(tmp);
+  return ok;
+}
+
+/*
+ * Returns 1 if |fd| holds a cache this build can use, 0 if it holds
+ * something else, and -1 if it must not be trusted at all.
+ */
+static int NaClVCacheMap(struct NaClVCacheFile *cache, int fd,
+                         const char *path) {
+  struct NaClVCacheHeader header;
+  struct stat st;
+  void *map;
+
+  if (0 != fstat(fd, &st) || !S_ISREG(st.st_mode) ||
+      !NaClVCacheTrusted(&st, path)) {
+    return -1;
+  }
+  if (pread(fd, &header, sizeof header, 0) != (ssize_t) sizeof header ||
+      0 != memcmp(header.magic, NACL_VCACHE_MAGIC, sizeof header.magic) ||
+      header.version != NACL_VCACHE_VERSION ||
+      header.slot_size != sizeof(struct NaClVCacheSlot) ||
+      header.check != NaClVCacheHeaderCheck(&header) ||
+      header.entries < NACL_VCACHE_PROBE ||
+      0 != (header.entries & (header.entries - 1)) ||
+      (uint64_t) st.st_size != NaClVCacheFileSize(header.entries)) {
+    return 0;
+  }
+  map = mmap(NULL, (size_t) st.st_size, PROT_READ | PROT_WRITE, MAP_SHARED,
+             fd, 0);
+  if (MAP_FAILED == map) {
+    return 0;
+  }
+  cache->fd = fd;
+  cache->map_size = (size_t) st.st_size;
+  cache->header = map;
+  cache->slots = (struct NaClVCacheSlot *) (cache->header + 1);
+  return 1;
+}
+
+static int NaClVCacheOpen(struct NaClVCacheFile *cache, const char *path,
+                          uint32_t entries) {
+  int attempt;
+
+  for (attempt = 0; attempt < 2; ++attempt) {
+    int status;
+    int fd = open(path, O_RDWR | O_CLOEXEC | O_NOFOLLOW);
+    if (fd < 0) {
+      if (ENOENT != errno || !NaClVCacheCreateFile(path, entries, 0)) {
+        return 0;
+      }
+      continue;
+    }
+    status = NaClVCacheMap(cache, fd, path);
+    if (status > 0) {
+      return 1;
+    }
+    close(fd);
+    /* stale format or damaged header: start over with an empty cache */
+    if (status < 0 || 0 != attempt ||
+        !NaClVCacheCreateFile(path, entries, 1)) {
+      return 0;
+    }
+  }
+  return 0;
+}
+
+static struct NaClVCacheSlot *NaClVCacheWindow(struct NaClVCacheFile *cache,
+                                               const uint8_t *key,
+                                               uint32_t *index) {
+  uint32_t h;
+  memcpy(&h, key, sizeof h);
+  *index = h & (cache->header->entries - 1) & ~(NACL_VCACHE_PROBE - 1);
+  return cache->slots;
+}
+
+static int NaClVCacheSlotHolds(const struct NaClVCacheSlot *shared,
+                               const uint8_t *key) {
+  struct NaClVCacheSlot slot;
+
+  /* copy first: another process may be rewriting the slot */
+  memcpy(&slot, (const void *) shared, sizeof slot);
+  return slot.check == NaClVCacheSlotCheck(&slot) &&
+      0 == memcmp(slot.key, key, sizeof slot.key);
+}
+
+static void *NaClVCacheCreateQuery(void *handle) {
+  struct NaClVCacheQuery *query = malloc(sizeof *query);
+
+  if (NULL == query) {
+    return NULL;
+  }
+  query->cache = handle;
+  query->finished = 0;
+  NaClSha256Init(&query->sha);
+  return query;
+}
+
+static void NaClVCacheAddData(void *handle, const unsigned char *data,
+                              size_t length) {
+  struct NaClVCacheQuery *query = handle;
+
+  CHECK(!query->finished);
+  NaClSha256Update(&query->sha, data, length);
+}
+
+static int NaClVCacheQueryKnownToValidate(void *handle) {
+  struct NaClVCacheQuery *query = handle;
+  struct NaClVCacheSlot *slots;
+  uint32_t base;
+  uint32_t i;
+
+  CHECK(!query->finished);
+  NaClSha256Final(&query->sha, query->key);
+  query->finished = 1;
+  slots = NaClVCacheWindow(query->cache, query->key, &base);
+  for (i = 0; i < NACL_VCACHE_PROBE; ++i) {
+    if (NaClVCacheSlotHolds(&slots[base + i], query->key)) {
+      return 1;
+    }
+  }
+  return 0;
+}
+
+static void NaClVCacheSetKnownToValidate(void *handle) {
+  struct NaClVCacheQuery *query = handle;
+  struct NaClVCacheSlot *slots;
+  struct NaClVCacheSlot slot;
+  uint32_t base;
+  uint32_t victim = 0;
+  uint64_t oldest = ~(uint64_t) 0;
+  uint32_t i;
+
+  CHECK(query->finished);
+  slots = NaClVCacheWindow(query->cache, query->key, &base);
+  for (i = 0; i < NACL_VCACHE_PROBE; ++i) {
+    memcpy(&slot, &slots[base + i], sizeof slot);
+    if (slot.check != NaClVCacheSlotCheck(&slot)) {
+      /* empty or torn: take it */
+      victim = i;
+      break;
+    }
+    if (0 == memcmp(slot.key, query->key, sizeof slot.key)) {
+      return;
+    }
+    if (slot.seq < oldest) {
+      oldest = slot.seq;
+      victim = i;
+    }
+  }
+
+  memcpy(slot.key, query->key, sizeof slot.key);
+  slot.seq = __sync_add_and_fetch(&query->cache->header->next_seq, 1);
+  slot.reserved = 0;
+  slot.check = NaClVCacheSlotCheck(&slot);
+  /*
+   * One pwrite per slot: readers that see it half written fail the check
+   * and treat it as a miss.
+   */
+  if (pwrite(query->cache->fd, &slot, sizeof slot,
+             (off_t) ((uint8_t *) &slots[base + victim] -
+                      (uint8_t *) query->cache->header)) !=
+      (ssize_t) sizeof slot) {
+    NaClLog(LOG_WARNING, "NaClVCacheSetKnownToValidate: write failed,"
+            " errno %d\n", errno);
+  }
+}
+
+static void NaClVCacheDestroyQuery(void *handle) {
+  free(handle);
+}
+
+/* Hashing the code is far cheaper than validating it. */
+static int NaClVCacheCachingIsInexpensive(
+    const struct NaClValidationMetadata *metadata) {
+  UNREFERENCED_PARAMETER(metadata);
+  return 1;
+}
+
+struct NaClValidationCache *NaClValidationCacheFileCreate(const char *dir,
+                                                          uint32_t entries) {
+  struct NaClVCacheFile *cache;
+  char path[PATH_MAX];
+  struct stat st;
+  uint32_t rounded = NACL_VCACHE_PROBE;
+
+  if (0 != mkdir(dir, 0700) && EEXIST != errno) {
+    NaClLog(LOG_WARNING, "validation cache: cannot create %s, errno %d\n",
+            dir, errno);
+    return NULL;
+  }
+  if (0 != stat(dir, &st) || !S_ISDIR(st.st_mode) ||
+      !NaClVCacheTrusted(&st, dir)) {
+    return NULL;
+  }
+  if (snprintf(path, sizeof path, "%s/%s", dir,
+               NACL_VALIDATION_CACHE_FILE_NAME) >= (int) sizeof path) {
+    return NULL;
+  }
+  while (rounded < entries && rounded < (1u << 30)) {
+    rounded <<= 1;
+  }
+
+  cache = calloc(1, sizeof *cache);
+  if (NULL == cache) {
+    return NULL;
+  }
+  if (!NaClVCacheOpen(cache, path, rounded)) {
+    NaClLog(LOG_WARNING, "validation cache: cannot use %s, errno %d\n",
+            path, errno);
+    free(cache);
+    return NULL;
+  }
+  cache->base.handle = cache;
+  cache->base.CreateQuery = NaClVCacheCreateQuery;
+  cache->base.AddData = NaClVCacheAddData;
+  cache->base.QueryKnownToValidate = NaClVCacheQueryKnownToValidate;
+  cache->base.SetKnownToValidate = NaClVCacheSetKnownToValidate;
+  cache->base.DestroyQuery = NaClVCacheDestroyQuery;
+  cache->base.CachingIsInexpensive = NaClVCacheCachingIsInexpensive;
+  cache->base.ResolveFileToken = NULL;
+  NaClLog(2, "validation cache: using %s (%u entries)\n", path,
+          cache->header->entries);
+  return &cache->base;
+}
+
+void NaClValidationCacheFileDelete(struct NaClValidationCache *base) {
+  struct NaClVCacheFile *cache = (struct NaClVCacheFile *) base;
+
+  if (NULL == cache) {
+    return;
+  }
+  munmap(cache->header, cache->map_size);
+  close(cache->fd);
+  free(cache);
+}
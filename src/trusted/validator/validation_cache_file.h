@@ -0,0 +1,50 @@
+/*
+ * Copyright (c) 2017 The Native Client Authors. All rights reserved.
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file.
+ */
+
+#ifndef NATIVE_CLIENT_SRC_TRUSTED_VALIDATOR_VALIDATION_CACHE_FILE_H_
+#define NATIVE_CLIENT_SRC_TRUSTED_VALIDATOR_VALIDATION_CACHE_FILE_H_
+
+#include "native_client/src/include/nacl_base.h"
+#include "native_client/src/include/portability.h"
+
+EXTERN_C_BEGIN
+
+struct NaClValidationCache;
+
+/*
+ * A NaClValidationCache kept in a file, for standalone sel_ldr.
+ *
+ * Keys are the SHA-256 of everything the validator adds to a query
+ * (validator id, CPU features, and the code bytes or file identity).  The
+ * index is a fixed-capacity hash table that every sel_ldr using the same
+ * directory maps shared; a full probe window evicts its oldest entry, so
+ * the file never grows.  Each slot carries a checksum and is written with
+ * a single pwrite, so a crash or a concurrent writer can lose an entry but
+ * never make a torn one look valid.  The file is written under a temporary
+ * name and linked into place, so no reader sees a half-made one.
+ *
+ * Anyone who can write the cache can make sel_ldr skip validation, so the
+ * directory and file must be owned by the effective user and writable by
+ * nobody else; otherwise no cache is used.
+ */
+
+#define NACL_VALIDATION_CACHE_FILE_NAME "validation_cache.v1"
+#define NACL_VALIDATION_CACHE_FILE_DEFAULT_ENTRIES (1 << 16)
+
+/*
+ * Opens (creating if needed) the cache in directory |dir|, holding at most
+ * |entries| results; entries is rounded up to a power of two and only
+ * applies when the file is created.  Returns NULL, after logging why, if
+ * the cache cannot be used.
+ */
+struct NaClValidationCache *NaClValidationCacheFileCreate(const char *dir,
+                                                          uint32_t entries);
+
+void NaClValidationCacheFileDelete(struct NaClValidationCache *cache);
+
+EXTERN_C_END
+
+#endif /* NATIVE_CLIENT_SRC_TRUSTED_VALIDATOR_VALIDATION_CACHE_FILE_H_ */
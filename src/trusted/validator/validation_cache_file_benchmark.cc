@@ -0,0 +1,105 @@
+/*
+ * Copyright (c) 2017 The Native Client Authors. All rights reserved.
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file.
+ */
+
+// Times validating a nexe's text segment with no validation cache, with an
+// empty on-disk cache (the first sel_ldr run) and with a populated one
+// reopened from disk (every later run).
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <string>
+
+#include "native_client/src/shared/platform/nacl_check.h"
+#include "native_client/src/shared/platform/nacl_log.h"
+#include "native_client/src/shared/utils/types.h"
+#include "native_client/src/trusted/validator/driver/elf_load.h"
+#include "native_client/src/trusted/validator/ncvalidate.h"
+#include "native_client/src/trusted/validator/validation_cache.h"
+#include "native_client/src/trusted/validator/validation_cache_file.h"
+
+
+static double Now() {
+  struct timespec ts;
+  CHECK(0 == clock_gettime(CLOCK_MONOTONIC, &ts));
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static double TimeValidation(const struct NaClValidatorInterface *validator,
+                             const NaClCPUFeatures *cpu_features,
+                             const elf_load::Segment &segment,
+                             struct NaClValidationCache *cache) {
+  double start = Now();
+  NaClValidationStatus status = validator->Validate(
+      segment.vaddr, const_cast<uint8_t *>(segment.data), segment.size,
+      FALSE,  /* stubout_mode */
+      FALSE,  /* readonly_test */
+      cpu_features,
+      NULL,  /* metadata */
+      cache);
+  double elapsed = Now() - start;
+  if (status != NaClValidationSucceeded) {
+    printf("Validation failed.\n");
+    exit(1);
+  }
+  return elapsed;
+}
+
+static void Report(const char *name, double seconds) {
+  printf("RESULT ValidationCache%s: time= %.3f milliseconds\n",
+         name, seconds * 1e3);
+}
+
+int main(int argc, char *argv[]) {
+  if (argc != 2) {
+    printf("Usage:\n");
+    printf("    validation_cache_file_benchmark <nexe>\n");
+    exit(1);
+  }
+  NaClLogModuleInit();
+
+  elf_load::Image image;
+  elf_load::ReadImage(argv[1], &image);
+  elf_load::Segment segment = elf_load::GetElfTextSegment(image);
+  printf("Validating %" NACL_PRIu32 " bytes of text from %s\n",
+         segment.size, argv[1]);
+
+  const struct NaClValidatorInterface *validator = NaClCreateValidator();
+  NaClCPUFeatures *cpu_features =
+      (NaClCPUFeatures *) malloc(validator->CPUFeatureSize);
+  CHECK(cpu_features != NULL);
+  validator->GetCurrentCPUFeatures(cpu_features);
+
+  char tmpl[] = "/tmp/validation_cache_file_benchmark.XXXXXX";
+  CHECK(mkdtemp(tmpl) != NULL);
+  std::string file = std::string(tmpl) + "/" + NACL_VALIDATION_CACHE_FILE_NAME;
+
+  Report("None", TimeValidation(validator, cpu_features, segment, NULL));
+
+  struct NaClValidationCache *cache = NaClValidationCacheFileCreate(
+      tmpl, NACL_VALIDATION_CACHE_FILE_DEFAULT_ENTRIES);
+  CHECK(cache != NULL);
+  Report("Cold", TimeValidation(validator, cpu_features, segment, cache));
+  NaClValidationCacheFileDelete(cache);
+
+  // Reopen, as the next sel_ldr would.
+  double start = Now();
+  cache = NaClValidationCacheFileCreate(
+      tmpl, NACL_VALIDATION_CACHE_FILE_DEFAULT_ENTRIES);
+  CHECK(cache != NULL);
+  double open_time = Now() - start;
+  Report("Warm", TimeValidation(validator, cpu_features, segment, cache));
+  Report("Open", open_time);
+  NaClValidationCacheFileDelete(cache);
+
+  unlink(file.c_str());
+  rmdir(tmpl);
+  free(cpu_features);
+  return 0;
+}
@@ -0,0 +1,214 @@
+/*
+ * Copyright (c) 2017 The Native Client Authors. All rights reserved.
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file.
+ */
+
+#include "gtest/gtest.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <string>
+
+#include "native_client/src/shared/platform/nacl_log.h"
+#include "native_client/src/shared/utils/types.h"
+#include "native_client/src/trusted/validator/ncvalidate.h"
+#include "native_client/src/trusted/validator/validation_cache.h"
+#include "native_client/src/trusted/validator/validation_cache_file.h"
+#include "native_client/src/trusted/validator/validation_cache_internal.h"
+
+static std::string HexDigest(const char *data, size_t length, int repeat) {
+  struct NaClSha256Context ctx;
+  uint8_t digest[NACL_SHA256_DIGEST_SIZE];
+  char hex[2 * NACL_SHA256_DIGEST_SIZE + 1];
+
+  NaClSha256Init(&ctx);
+  for (int i = 0; i < repeat; ++i) {
+    NaClSha256Update(&ctx, (const uint8_t *) data, length);
+  }
+  NaClSha256Final(&ctx, digest);
+  for (int i = 0; i < NACL_SHA256_DIGEST_SIZE; ++i) {
+    snprintf(hex + 2 * i, 3, "%02x", digest[i]);
+  }
+  return std::string(hex);
+}
+
+TEST(ValidationCacheSha256Tests, KnownAnswers) {
+  EXPECT_EQ("e3b0c44298fc1c149afbf4c8996fb92427ae41e4649b934ca495991b7852b855",
+            HexDigest("", 0, 1));
+  EXPECT_EQ("ba7816bf8f01cfea414140de5dae2223b00361a396177a9cb410ff61f20015ad",
+            HexDigest("abc", 3, 1));
+  const char *two_blocks =
+      "abcdbcdecdefdefgefghfghighijhijkijkljklmklmnlmnomnopnopq";
+  EXPECT_EQ("248d6a61d20638b8e5c026930c3e6039a33ce45964ff2167f6ecedd419db06c1",
+            HexDigest(two_blocks, strlen(two_blocks), 1));
+  // A million 'a's, fed in pieces that straddle block boundaries.
+  EXPECT_EQ("cdc76e5c9914fb9281a1c7e284d73e67f1809a48a497200e046d39ccc7112cd0",
+            HexDigest("aaaaaaaaaaaaaaaaaaaaaaaaa", 25, 40000));
+}
+
+class ValidationCacheFileTests : public ::testing::Test {
+ protected:
+  std::string dir;
+
+  void SetUp() {
+    char tmpl[] = "/tmp/validation_cache_file_test.XXXXXX";
+    ASSERT_TRUE(NULL != mkdtemp(tmpl));
+    dir = tmpl;
+  }
+
+  void TearDown() {
+    std::string file = dir + "/" + NACL_VALIDATION_CACHE_FILE_NAME;
+    unlink(file.c_str());
+    rmdir(dir.c_str());
+  }
+
+  // Looks |data| up, recording it as validated on a miss if |set|.
+  static int Query(struct NaClValidationCache *cache, const char *data,
+                   bool set) {
+    void *query = cache->CreateQuery(cache->handle);
+    cache->AddData(query, (const unsigned char *) data, strlen(data));
+    int known = cache->QueryKnownToValidate(query);
+    if (set && !known) {
+      cache->SetKnownToValidate(query);
+    }
+    cache->DestroyQuery(query);
+    return known;
+  }
+};
+
+TEST_F(ValidationCacheFileTests, MissThenHit) {
+  struct NaClValidationCache *cache =
+      NaClValidationCacheFileCreate(dir.c_str(), 64);
+  ASSERT_TRUE(NULL != cache);
+  EXPECT_EQ(1, cache->CachingIsInexpensive(NULL));
+  EXPECT_EQ(0, Query(cache, "some code", true));
+  EXPECT_EQ(1, Query(cache, "some code", false));
+  EXPECT_EQ(0, Query(cache, "other code", false));
+  NaClValidationCacheFileDelete(cache);
+}
+
+TEST_F(ValidationCacheFileTests, PersistsAcrossOpens) {
+  struct NaClValidationCache *cache =
+      NaClValidationCacheFileCreate(dir.c_str(), 64);
+  ASSERT_TRUE(NULL != cache);
+  EXPECT_EQ(0, Query(cache, "some code", true));
+  NaClValidationCacheFileDelete(cache);
+
+  cache = NaClValidationCacheFileCreate(dir.c_str(), 64);
+  ASSERT_TRUE(NULL != cache);
+  EXPECT_EQ(1, Query(cache, "some code", false));
+  NaClValidationCacheFileDelete(cache);
+}
+
+TEST_F(ValidationCacheFileTests, SharedBetweenOpens) {
+  struct NaClValidationCache *a =
+      NaClValidationCacheFileCreate(dir.c_str(), 64);
+  struct NaClValidationCache *b =
+      NaClValidationCacheFileCreate(dir.c_str(), 64);
+  ASSERT_TRUE(NULL != a);
+  ASSERT_TRUE(NULL != b);
+  EXPECT_EQ(0, Query(a, "some code", true));
+  EXPECT_EQ(1, Query(b, "some code", false));
+  NaClValidationCacheFileDelete(a);
+  NaClValidationCacheFileDelete(b);
+}
+
+TEST_F(ValidationCacheFileTests, CapacityIsBounded) {
+  struct NaClValidationCache *cache =
+      NaClValidationCacheFileCreate(dir.c_str(), 16);
+  ASSERT_TRUE(NULL != cache);
+  char key[32];
+  for (int i = 0; i < 1000; ++i) {
+    snprintf(key, sizeof key, "code %d", i);
+    Query(cache, key, true);
+  }
+  int hits = 0;
+  for (int i = 0; i < 1000; ++i) {
+    snprintf(key, sizeof key, "code %d", i);
+    hits += Query(cache, key, false);
+  }
+  EXPECT_LE(hits, 16);
+  NaClValidationCacheFileDelete(cache);
+
+  struct stat st;
+  std::string file = dir + "/" + NACL_VALIDATION_CACHE_FILE_NAME;
+  ASSERT_EQ(0, stat(file.c_str(), &st));
+  EXPECT_GT((off_t) 4096, st.st_size);
+}
+
+TEST_F(ValidationCacheFileTests, DamagedFileIsReplaced) {
+  std::string file = dir + "/" + NACL_VALIDATION_CACHE_FILE_NAME;
+  FILE *fp = fopen(file.c_str(), "w");
+  ASSERT_TRUE(NULL != fp);
+  fputs("not a validation cache", fp);
+  fclose(fp);
+  chmod(file.c_str(), 0600);
+
+  struct NaClValidationCache *cache =
+      NaClValidationCacheFileCreate(dir.c_str(), 64);
+  ASSERT_TRUE(NULL != cache);
+  EXPECT_EQ(0, Query(cache, "some code", false));
+  NaClValidationCacheFileDelete(cache);
+}
+
+TEST_F(ValidationCacheFileTests, RejectsSharedDirectory) {
+  ASSERT_EQ(0, chmod(dir.c_str(), 0777));
+  EXPECT_TRUE(NULL == NaClValidationCacheFileCreate(dir.c_str(), 64));
+}
+
+TEST_F(ValidationCacheFileTests, RejectsSharedFile) {
+  struct NaClValidationCache *cache =
+      NaClValidationCacheFileCreate(dir.c_str(), 64);
+  ASSERT_TRUE(NULL != cache);
+  NaClValidationCacheFileDelete(cache);
+  std::string file = dir + "/" + NACL_VALIDATION_CACHE_FILE_NAME;
+  ASSERT_EQ(0, chmod(file.c_str(), 0666));
+  EXPECT_TRUE(NULL == NaClValidationCacheFileCreate(dir.c_str(), 64));
+}
+
+TEST_F(ValidationCacheFileTests, ValidatorUsesCache) {
+  struct NaClValidationCache *cache =
+      NaClValidationCacheFileCreate(dir.c_str(), 64);
+  ASSERT_TRUE(NULL != cache);
+  const struct NaClValidatorInterface *validator = NaClCreateValidator();
+  NaClCPUFeatures *cpu_features =
+      (NaClCPUFeatures *) malloc(validator->CPUFeatureSize);
+  validator->SetAllCPUFeatures(cpu_features);
+  unsigned char code[32];
+  memset(code, 0x90, sizeof code);
+
+  // Cold, then warm: both must agree with the validator.
+  for (int i = 0; i < 2; ++i) {
+    EXPECT_EQ(NaClValidationSucceeded,
+              validator->Validate(0, code, sizeof code,
+                                  FALSE,  /* stubout_mode */
+                                  FALSE,  /* readonly_test */
+                                  cpu_features,
+                                  NULL,  /* metadata */
+                                  cache));
+  }
+  // Invalid code (a bare ret) is never recorded.
+  code[0] = 0xc3;
+  for (int i = 0; i < 2; ++i) {
+    EXPECT_EQ(NaClValidationFailed,
+              validator->Validate(0, code, sizeof code,
+                                  FALSE,  /* stubout_mode */
+                                  FALSE,  /* readonly_test */
+                                  cpu_features,
+                                  NULL,  /* metadata */
+                                  cache));
+  }
+  free(cpu_features);
+  NaClValidationCacheFileDelete(cache);
+}
+
+int main(int argc, char *argv[]) {
+  NaClLogModuleInit();
+  testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
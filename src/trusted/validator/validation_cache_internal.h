@@ -10,6 +10,7 @@
  * included by relying code.
  */
 #ifndef NATIVE_CLIENT_SRC_TRUSTED_VALIDATOR_VALIDATION_CACHE_INTERNAL_H__
+#define NATIVE_CLIENT_SRC_TRUSTED_VALIDATOR_VALIDATION_CACHE_INTERNAL_H__
 
 #include "native_client/src/include/nacl_base.h"
 #include "native_client/src/include/portability.h"
@@ -28,6 +29,24 @@ int NaClDeserializeNaClDescMetadata(
     uint32_t buffer_length,
     struct NaClRichFileInfo *info);
 
+/* SHA-256, used to key the file-backed validation cache. */
+#define NACL_SHA256_DIGEST_SIZE 32
+
+struct NaClSha256Context {
+  uint32_t state[8];
+  uint64_t length;  /* bytes hashed so far */
+  uint8_t buffer[64];
+};
+
+void NaClSha256Init(struct NaClSha256Context *ctx);
+
+void NaClSha256Update(struct NaClSha256Context *ctx,
+                      const uint8_t *data,
+                      size_t length);
+
+void NaClSha256Final(struct NaClSha256Context *ctx,
+                     uint8_t digest[NACL_SHA256_DIGEST_SIZE]);
+
 EXTERN_C_END
 
 #endif
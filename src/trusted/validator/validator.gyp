@@ -28,6 +28,13 @@
       'sources' : [
         'validation_cache.c',
       ],
+      'conditions': [
+        ['OS!="win"', {
+          'sources': [
+            'validation_cache_file.c',
+          ],
+        }],
+      ],
       'dependencies': [
         '<(DEPTH)/native_client/src/shared/platform/platform.gyp:platform',
       ],
@@ -13,6 +13,7 @@
 #include "native_client/src/trusted/validator_ragel/bitmap.h"
 #include "native_client/src/trusted/validator_ragel/dfa_validate_common.h"
 #include "native_client/src/trusted/validator_ragel/validator.h"
+#include "native_client/src/trusted/validator_ragel/validator_parallel.h"
 
 /*
  * Be sure the correct compile flags are defined for this.
@@ -65,14 +66,16 @@ NaClValidationStatus ApplyDfaValidator_x86_32(
   }
 
   if (readonly_text) {
-    if (ValidateChunkIA32(data, size, 0 /*options*/, cpu_features,
-                          NaClDfaProcessValidationError,
-                          NULL))
+    if (ValidateChunkIA32Parallel(data, size, 0 /*options*/, cpu_features,
+                                  NaClDfaValidationThreads(),
+                                  NaClDfaProcessValidationError,
+                                  NULL))
       status = NaClValidationSucceeded;
   } else {
-    if (ValidateChunkIA32(data, size, 0 /*options*/, cpu_features,
-                          NaClDfaStubOutCPUUnsupportedInstruction,
-                          &did_stubout))
+    if (ValidateChunkIA32Parallel(data, size, 0 /*options*/, cpu_features,
+                                  NaClDfaValidationThreads(),
+                                  NaClDfaStubOutCPUUnsupportedInstruction,
+                                  &did_stubout))
       status = NaClValidationSucceeded;
   }
   if (status != NaClValidationSucceeded && errno == ENOMEM)
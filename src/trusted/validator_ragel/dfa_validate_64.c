@@ -12,6 +12,7 @@
 #include "native_client/src/trusted/validator/validation_cache.h"
 #include "native_client/src/trusted/validator_ragel/dfa_validate_common.h"
 #include "native_client/src/trusted/validator_ragel/validator.h"
+#include "native_client/src/trusted/validator_ragel/validator_parallel.h"
 
 /*
  * Be sure the correct compile flags are defined for this.
@@ -65,14 +66,16 @@ static NaClValidationStatus ApplyDfaValidator_x86_64(
   }
 
   if (readonly_text) {
-    if (ValidateChunkAMD64(data, size, 0 /*options*/, cpu_features,
-                           NaClDfaProcessValidationError,
-                           NULL))
+    if (ValidateChunkAMD64Parallel(data, size, 0 /*options*/, cpu_features,
+                                   NaClDfaValidationThreads(),
+                                   NaClDfaProcessValidationError,
+                                   NULL))
       status = NaClValidationSucceeded;
   } else {
-    if (ValidateChunkAMD64(data, size, 0 /*options*/, cpu_features,
-                           NaClDfaStubOutCPUUnsupportedInstruction,
-                           &did_stubout))
+    if (ValidateChunkAMD64Parallel(data, size, 0 /*options*/, cpu_features,
+                                   NaClDfaValidationThreads(),
+                                   NaClDfaStubOutCPUUnsupportedInstruction,
+                                   &did_stubout))
       status = NaClValidationSucceeded;
   }
 
@@ -7,11 +7,13 @@
 /* Implement the functions common for ia32 and x86-64 architectures.  */
 #include "native_client/src/trusted/validator_ragel/dfa_validate_common.h"
 
+#include <stdlib.h>
 #include <string.h>
 
 #include "native_client/src/shared/platform/nacl_check.h"
 #include "native_client/src/trusted/service_runtime/nacl_config.h"
 #include "native_client/src/trusted/validator_ragel/validator.h"
+#include "native_client/src/trusted/validator_ragel/validator_parallel.h"
 
 /* Used as an argument to copy_func when unsupported instruction must be
    replaced with HLTs.  */
@@ -75,3 +77,19 @@ Bool NaClDfaCodeReplacementIsStubouted(const uint8_t *begin_existing,
   else
     return FALSE;
 }
+
+int NaClDfaValidationThreads(void) {
+  /* Racy but idempotent: every thread computes the same value.  */
+  static int threads = 0;
+
+  if (threads == 0) {
+    const char *env = getenv("NACL_VALIDATION_THREADS");
+    long value = env != NULL ? strtol(env, NULL, 10) : 1;
+    if (value < 1)
+      value = 1;
+    if (value > kParallelValidationMaxThreads)
+      value = kParallelValidationMaxThreads;
+    threads = (int) value;
+  }
+  return threads;
+}
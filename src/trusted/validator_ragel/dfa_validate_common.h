@@ -46,6 +46,13 @@ Bool NaClDfaProcessCodeCopyInstruction(const uint8_t *begin_new,
                                        uint32_t info,
                                        void *callback_data);
 
+/*
+ * Number of threads used to validate one chunk of code (see
+ * validator_parallel.h).  Taken from the NACL_VALIDATION_THREADS environment
+ * variable; 1, i.e. no extra threads, if it is unset or not a number.
+ */
+int NaClDfaValidationThreads(void);
+
 /* Check whether instruction is stubouted because it is not supported by current
    CPU.  */
 Bool NaClDfaCodeReplacementIsStubouted(const uint8_t *begin_existing,
@@ -17,6 +17,7 @@
           'sources' : [
             'dfa_validate_32.c',
             'dfa_validate_common.c',
+            'validator_parallel.c',
             'validator_features_validator.c',
             'gen/validator_x86_32.c',
           ],
@@ -26,6 +26,7 @@
           'sources' : [
             'dfa_validate_64.c',
             'dfa_validate_common.c',
+            'validator_parallel.c',
             'validator_features_validator.c',
             'gen/validator_x86_64.c',
           ],
@@ -266,40 +266,26 @@ static const uint16_t _dfa_transitions[][256][2] = {
   {{33, 0}, {33, 0}, {33, 0}, {33, 0}, {59, 0}, {132, 0}, {0, 0}, {0, 0}, {33, 0}, {33, 0}, {33, 0}, {33, 0}, {59, 0}, {132, 0}, {0, 0}, {187, 0}, {33, 0}, {33, 0}, {33, 0}, {33, 0}, {59, 0}, {132, 0}, {0, 0}, {0, 0}, {33, 0}, {33, 0}, {33, 0}, {33, 0}, {59, 0}, {132, 0}, {0, 0}, {0, 0}, {33, 0}, {33, 0}, {33, 0}, {33, 0}, {59, 0}, {132, 0}, {0, 0}, {0, 0}, {33, 0}, {33, 0}, {33, 0}, {33, 0}, {59, 0}, {132, 0}, {188, 0}, {0, 0}, {33, 0}, {33, 0}, {33, 0}, {33, 0}, {59, 0}, {132, 0}, {0, 0}, {0, 0}, {33, 0}, {33, 0}, {33, 0}, {33, 0}, {59, 0}, {132, 0}, {188, 0}, {0, 0}, {1, 1}, {1, 1}, {1, 1}, {1, 1}, {1, 1}, {1, 1}, {1, 1}, {1, 1}, {1, 1}, {1, 1}, {1, 1}, {1, 1}, {1, 1}, {1, 1}, {1, 1}, {1, 1}, {1, 1}, {1, 1}, {1, 1}, {1, 1}, {1, 1}, {1, 1}, {1, 1}, {1, 1}, {1, 1}, {1, 1}, {1, 1}, {1, 1}, {1, 1}, {1, 1}, {1, 1}, {1, 1}, {0, 0}, {0, 0}, {0, 0}, {0, 0}, {0, 0}, {189, 0}, {190, 0}, {0, 0}, {132, 0}, {191, 0}, {59, 0}, {32, 0}, {0, 0}, {0, 0}, {0, 0}, {0, 0}, {71, 0}, {71, 0}, {71, 0}, {71, 0}, {71, 0}, {71, 0}, {71, 0}, {71, 0}, {71, 0}, {71, 0}, {71, 0}, {71, 0}, {71, 0}, {71, 0}, {71, 0}, {71, 0}, {32, 0}, {191, 0}, {0, 0}, {192, 0}, {33, 0}, {33, 0}, {33, 0}, {33, 0}, {33, 0}, {33, 0}, {33, 0}, {33, 0}, {0, 0}, {83, 0}, {0, 0}, {193, 0}, {1, 1}, {1, 1}, {1, 1}, {1, 1}, {1, 1}, {1, 1}, {1, 1}, {1, 1}, {1, 1}, {1, 1}, {0, 0}, {169, 9}, {0, 0}, {0, 0}, {1, 1}, {1, 1}, {3, 0}, {3, 0}, {3, 0}, {3, 0}, {1, 1}, {1, 1}, {1, 1}, {1, 1}, {59, 0}, {132, 0}, {1, 1}, {1, 1}, {0, 0}, {0, 0}, {1, 1}, {1, 1}, {59, 0}, {59, 0}, {59, 0}, {59, 0}, {59, 0}, {59, 0}, {59, 0}, {59, 0}, {132, 0}, {132, 0}, {132, 0}, {132, 0}, {132, 0}, {132, 0}, {132, 0}, {132, 0}, {84, 0}, {84, 0}, {0, 0}, {0, 0}, {194, 0}, {0, 0}, {195, 0}, {196, 0}, {0, 0}, {1, 1}, {0, 0}, {0, 0}, {0, 0}, {0, 0}, {0, 0}, {0, 0}, {86, 0}, {86, 0}, {86, 0}, {86, 0}, {0, 0}, {0, 0}, {0, 0}, {0, 0}, {197, 0}, {198, 0}, {199, 0}, {200, 0}, {201, 0}, {202, 0}, {203, 0}, {204, 0}, {0, 0}, {0, 0}, {0, 0}, {0, 0}, {0, 0}, {0, 0}, {0, 0}, {0, 0}, {205, 0}, {31, 0}, {0, 0}, {71, 0}, {0, 0}, {0, 0}, {0, 0}, {0, 0}, {206, 0}, {0, 0}, {207, 0}, {208, 0}, {1, 1}, {1, 1}, {209, 0}, {210, 0}, {1, 1}, {1, 1}, {0, 0}, {0, 0}, {1, 1}, {1, 1}, {211, 0}, {219, 0}}
 };
 
-Bool ValidateChunkIA32(const uint8_t codeblock[],
-                       size_t size,
-                       uint32_t options,
-                       const NaClCPUFeaturesX86 *cpu_features,
-                       ValidationCallbackFunc user_callback,
-                       void *callback_data) {
-  bitmap_word valid_targets_small;
-  bitmap_word jump_dests_small;
-  bitmap_word *valid_targets;
-  bitmap_word *jump_dests;
+/*
+ * Runs the DFA over every bundle of the chunk, marking valid jump targets
+ * and direct jump destinations in the given bitmaps (of size bits)
+ * without checking one against the other.  ValidateChunkIA32 and the
+ * parallel driver in validator_parallel.c do that afterwards.
+ */
+Bool ValidateChunkBundlesIA32(const uint8_t codeblock[],
+                              size_t size,
+                              uint32_t options,
+                              const NaClCPUFeaturesX86 *cpu_features,
+                              bitmap_word *valid_targets,
+                              bitmap_word *jump_dests,
+                              ValidationCallbackFunc user_callback,
+                              void *callback_data) {
   const uint8_t *current_position;
   const uint8_t *end_position;
   int result = TRUE;
 
-  CHECK(sizeof valid_targets_small == sizeof jump_dests_small);
   CHECK(size % kBundleSize == 0);
 
-  /* For a very small sequences (one bundle) malloc is too expensive.  */
-  if (size <= (sizeof valid_targets_small * 8)) {
-    valid_targets_small = 0;
-    valid_targets = &valid_targets_small;
-    jump_dests_small = 0;
-    jump_dests = &jump_dests_small;
-  } else {
-    valid_targets = BitmapAllocate(size);
-    jump_dests = BitmapAllocate(size);
-    if (!valid_targets || !jump_dests) {
-      free(jump_dests);
-      free(valid_targets);
-      errno = ENOMEM;
-      return FALSE;
-    }
-  }
-
   /*
    * This option is usually used in tests: we will process the whole chunk
    * in one pass. Usually each bundle is processed separately which means
@@ -1562,6 +1548,45 @@ current_state = 188; current_position++; goto _again;
 _done: ;
   }
 
+  return result;
+}
+
+Bool ValidateChunkIA32(const uint8_t codeblock[],
+                       size_t size,
+                       uint32_t options,
+                       const NaClCPUFeaturesX86 *cpu_features,
+                       ValidationCallbackFunc user_callback,
+                       void *callback_data) {
+  bitmap_word valid_targets_small;
+  bitmap_word jump_dests_small;
+  bitmap_word *valid_targets;
+  bitmap_word *jump_dests;
+  int result;
+
+  CHECK(sizeof valid_targets_small == sizeof jump_dests_small);
+  CHECK(size % kBundleSize == 0);
+
+  /* For a very small sequences (one bundle) malloc is too expensive.  */
+  if (size <= (sizeof valid_targets_small * 8)) {
+    valid_targets_small = 0;
+    valid_targets = &valid_targets_small;
+    jump_dests_small = 0;
+    jump_dests = &jump_dests_small;
+  } else {
+    valid_targets = BitmapAllocate(size);
+    jump_dests = BitmapAllocate(size);
+    if (!valid_targets || !jump_dests) {
+      free(jump_dests);
+      free(valid_targets);
+      errno = ENOMEM;
+      return FALSE;
+    }
+  }
+
+  result = ValidateChunkBundlesIA32(codeblock, size, options, cpu_features,
+                                    valid_targets, jump_dests,
+                                    user_callback, callback_data);
+
   /*
    * Check the direct jumps.  All the targets from jump_dests must be in
    * valid_targets.
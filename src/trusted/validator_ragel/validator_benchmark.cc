@@ -15,6 +15,7 @@
 #include "native_client/src/shared/utils/types.h"
 #include "native_client/src/trusted/validator/driver/elf_load.h"
 #include "native_client/src/trusted/validator_ragel/validator.h"
+#include "native_client/src/trusted/validator_ragel/validator_parallel.h"
 
 
 Bool ProcessError(
@@ -30,15 +31,77 @@ Bool ProcessError(
 }
 
 
+static Bool Validate(elf_load::Architecture architecture,
+                     const elf_load::Segment &segment,
+                     int threads) {
+  switch (architecture) {
+    case elf_load::X86_32:
+      return ValidateChunkIA32Parallel(
+          segment.data, segment.size,
+          0, &kFullCPUIDFeatures, threads,
+          ProcessError, NULL);
+    case elf_load::X86_64:
+      return ValidateChunkAMD64Parallel(
+          segment.data, segment.size,
+          0, &kFullCPUIDFeatures, threads,
+          ProcessError, NULL);
+    case elf_load::ARM:
+      CHECK(false);
+  }
+  return FALSE;
+}
+
+
+static double Seconds(const struct timespec &start,
+                      const struct timespec &end) {
+  return (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+}
+
+
+/*
+ * Wall-clock time (clock() would add up the CPU time of all the threads)
+ * for 1, 2, 4, ... up to max_threads threads.
+ */
+static void ReportScaling(elf_load::Architecture architecture,
+                          const elf_load::Segment &segment,
+                          int repetitions,
+                          int max_threads,
+                          Bool serial_result) {
+  double single_thread_seconds = 0;
+
+  for (int threads = 1; threads <= max_threads; threads *= 2) {
+    Bool result = FALSE;
+    struct timespec start, end;
+    CHECK(clock_gettime(CLOCK_MONOTONIC, &start) == 0);
+    for (int i = 0; i < repetitions; i++)
+      result = Validate(architecture, segment, threads);
+    CHECK(clock_gettime(CLOCK_MONOTONIC, &end) == 0);
+    CHECK(result == serial_result);
+
+    double seconds = Seconds(start, end);
+    if (threads == 1)
+      single_thread_seconds = seconds;
+    printf("%d thread(s): %.3fs", threads, seconds);
+    if (seconds > 1e-6)
+      printf(" (%.3f MB/s, %.2fx)",
+             segment.size / seconds * repetitions / (1<<20),
+             single_thread_seconds / seconds);
+    printf("\n");
+  }
+}
+
+
 int main(int argc, char *argv[]) {
-  if (argc != 3) {
+  if (argc != 3 && argc != 4) {
     printf("Usage:\n");
-    printf("    validator_benchmark <nexe> <number of repetitions>\n");
+    printf("    validator_benchmark <nexe> <number of repetitions>"
+           " [<max threads>]\n");
     exit(1);
   }
   const char *input_file = argv[1];
   int repetitions = atoi(argv[2]);
   CHECK(repetitions > 0);
+  int max_threads = argc == 4 ? atoi(argv[3]) : 0;
 
   printf("Validating %s %d times ...\n", input_file, repetitions);
 
@@ -90,5 +153,8 @@ int main(int argc, char *argv[]) {
 
   printf("\n");
 
+  if (max_threads > 0)
+    ReportScaling(architecture, segment, repetitions, max_threads, result);
+
   return result ? 0 : 1;
 }
@@ -265,4 +265,26 @@ static FORCEINLINE void Rel32Operand(const uint8_t *rip,
     *instruction_info_collected |= RELATIVE_32BIT | DIRECT_JUMP_OUT_OF_RANGE;
 }
 
+/*
+ * The DFA pass of ValidateChunkAMD64/ValidateChunkIA32, without the final
+ * jump target check, for the parallel driver in validator_parallel.c.
+ */
+Bool ValidateChunkBundlesAMD64(const uint8_t codeblock[],
+                               size_t size,
+                               uint32_t options,
+                               const NaClCPUFeaturesX86 *cpu_features,
+                               bitmap_word *valid_targets,
+                               bitmap_word *jump_dests,
+                               ValidationCallbackFunc user_callback,
+                               void *callback_data);
+
+Bool ValidateChunkBundlesIA32(const uint8_t codeblock[],
+                              size_t size,
+                              uint32_t options,
+                              const NaClCPUFeaturesX86 *cpu_features,
+                              bitmap_word *valid_targets,
+                              bitmap_word *jump_dests,
+                              ValidationCallbackFunc user_callback,
+                              void *callback_data);
+
 #endif  /* NATIVE_CLIENT_SRC_TRUSTED_VALIDATOR_RAGEL_VALIDATOR_INTERNAL_H_ */
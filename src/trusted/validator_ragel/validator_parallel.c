@@ -0,0 +1,290 @@
+/*
+ * Copyright (c) 2017 The Native Client Authors. All rights reserved.
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file.
+ */
+
+/*
+ * Parallel driver for the DFA validators.  See validator_parallel.h.
+ */
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "native_client/src/shared/platform/nacl_check.h"
+#include "native_client/src/shared/platform/nacl_sync.h"
+#include "native_client/src/shared/platform/nacl_sync_checked.h"
+#include "native_client/src/shared/platform/nacl_threads.h"
+#include "native_client/src/trusted/validator_ragel/bitmap.h"
+#include "native_client/src/trusted/validator_ragel/validator_internal.h"
+#include "native_client/src/trusted/validator_ragel/validator_parallel.h"
+
+/* The DFA runs in a small, fixed amount of stack.  */
+#define kParallelValidationStackSize (256 << 10)
+
+typedef Bool (*ValidateChunkFunc)(const uint8_t codeblock[],
+                                  size_t size,
+                                  uint32_t options,
+                                  const NaClCPUFeaturesX86 *cpu_features,
+                                  ValidationCallbackFunc user_callback,
+                                  void *callback_data);
+
+typedef Bool (*ValidateChunkBundlesFunc)(const uint8_t codeblock[],
+                                         size_t size,
+                                         uint32_t options,
+                                         const NaClCPUFeaturesX86 *cpu_features,
+                                         bitmap_word *valid_targets,
+                                         bitmap_word *jump_dests,
+                                         ValidationCallbackFunc user_callback,
+                                         void *callback_data);
+
+struct ParallelValidation {
+  const uint8_t *codeblock;
+  size_t size;
+  uint32_t options;
+  const NaClCPUFeaturesX86 *cpu_features;
+  ValidateChunkBundlesFunc validate_bundles;
+  ValidationCallbackFunc user_callback;
+  void *callback_data;
+  /* Serializes user_callback.  */
+  struct NaClMutex callback_mu;
+};
+
+struct ValidationPiece {
+  struct ParallelValidation *validation;
+  struct NaClThread thread;
+  int thread_started;
+  const uint8_t *begin;
+  size_t size;
+  bitmap_word *valid_targets;
+  bitmap_word *jump_dests;
+  /* Offsets (from codeblock) of jumps into other pieces.  */
+  size_t *remote_jump_dests;
+  size_t remote_jump_dests_count;
+  size_t remote_jump_dests_capacity;
+  Bool out_of_memory;
+  Bool result;
+};
+
+static Bool AddRemoteJumpDest(struct ValidationPiece *piece, size_t jump_dest) {
+  if (piece->remote_jump_dests_count == piece->remote_jump_dests_capacity) {
+    size_t capacity = piece->remote_jump_dests_capacity * 2 + 16;
+    size_t *grown = realloc(piece->remote_jump_dests,
+                            capacity * sizeof *grown);
+    if (grown == NULL)
+      return FALSE;
+    piece->remote_jump_dests = grown;
+    piece->remote_jump_dests_capacity = capacity;
+  }
+  piece->remote_jump_dests[piece->remote_jump_dests_count++] = jump_dest;
+  return TRUE;
+}
+
+/*
+ * Within a piece, a direct jump to an unaligned address outside of it is
+ * reported as DIRECT_JUMP_OUT_OF_RANGE.  If the address is in another piece
+ * of the chunk, the serial validator would have recorded it in jump_dests
+ * instead: do the same and hide the error, forwarding the callback only if
+ * the instruction has other errors.
+ */
+static Bool ParallelValidationCallback(const uint8_t *instruction_begin,
+                                       const uint8_t *instruction_end,
+                                       uint32_t validation_info,
+                                       void *callback_data) {
+  struct ValidationPiece *piece = callback_data;
+  struct ParallelValidation *validation = piece->validation;
+  Bool result;
+
+  if (validation_info & DIRECT_JUMP_OUT_OF_RANGE) {
+    const uint8_t *rip = instruction_end;
+    int32_t offset;
+    size_t jump_dest;
+    int known_size = TRUE;
+
+    /* Relative fields always come last: see Rel8Operand/Rel32Operand.  */
+    switch (INFO_RELATIVE_SIZE(validation_info)) {
+      case 1:
+        offset = (int8_t) rip[-1];
+        break;
+      case 4:
+        offset = rip[-4] + 256U * (rip[-3] + 256U * (rip[-2] + 256U * rip[-1]));
+        break;
+      default:
+        offset = 0;
+        known_size = FALSE;
+        break;
+    }
+    jump_dest = offset + (rip - validation->codeblock);
+    if (known_size && jump_dest < validation->size) {
+      if (!AddRemoteJumpDest(piece, jump_dest)) {
+        piece->out_of_memory = TRUE;
+        return FALSE;
+      }
+      validation_info &= ~DIRECT_JUMP_OUT_OF_RANGE;
+      if ((validation_info & VALIDATION_ERRORS_MASK) == 0)
+        return TRUE;
+    }
+  }
+
+  NaClXMutexLock(&validation->callback_mu);
+  result = validation->user_callback(instruction_begin, instruction_end,
+                                     validation_info,
+                                     validation->callback_data);
+  NaClXMutexUnlock(&validation->callback_mu);
+  return result;
+}
+
+static void ValidatePiece(struct ValidationPiece *piece) {
+  struct ParallelValidation *validation = piece->validation;
+
+  piece->result = validation->validate_bundles(piece->begin,
+                                               piece->size,
+                                               validation->options,
+                                               validation->cpu_features,
+                                               piece->valid_targets,
+                                               piece->jump_dests,
+                                               ParallelValidationCallback,
+                                               piece);
+}
+
+static void WINAPI ValidatePieceThread(void *state) {
+  ValidatePiece((struct ValidationPiece *) state);
+}
+
+static Bool ValidateChunkParallel(const uint8_t codeblock[],
+                                  size_t size,
+                                  uint32_t options,
+                                  const NaClCPUFeaturesX86 *cpu_features,
+                                  int threads,
+                                  ValidateChunkFunc validate_chunk,
+                                  ValidateChunkBundlesFunc validate_bundles,
+                                  ValidationCallbackFunc user_callback,
+                                  void *callback_data) {
+  struct ParallelValidation validation;
+  struct ValidationPiece *pieces;
+  size_t piece_size;
+  size_t pieces_count;
+  size_t i, j;
+  Bool out_of_memory = FALSE;
+  int result = TRUE;
+
+  CHECK(size % kBundleSize == 0);
+
+  if (threads > kParallelValidationMaxThreads)
+    threads = kParallelValidationMaxThreads;
+  if (threads > 1 && size / threads < kParallelValidationMinPieceSize)
+    threads = (int) (size / kParallelValidationMinPieceSize);
+  if (threads < 2 ||
+      (options & (CALL_USER_CALLBACK_ON_EACH_INSTRUCTION |
+                  PROCESS_CHUNK_AS_A_CONTIGUOUS_STREAM)))
+    return validate_chunk(codeblock, size, options, cpu_features,
+                          user_callback, callback_data);
+
+  piece_size = (size / threads + kBundleMask) & ~(size_t) kBundleMask;
+  pieces_count = (size + piece_size - 1) / piece_size;
+  pieces = calloc(pieces_count, sizeof *pieces);
+  if (pieces == NULL) {
+    errno = ENOMEM;
+    return FALSE;
+  }
+
+  validation.codeblock = codeblock;
+  validation.size = size;
+  validation.options = options;
+  validation.cpu_features = cpu_features;
+  validation.validate_bundles = validate_bundles;
+  validation.user_callback = user_callback;
+  validation.callback_data = callback_data;
+  NaClXMutexCtor(&validation.callback_mu);
+
+  for (i = 0; i < pieces_count; i++) {
+    struct ValidationPiece *piece = &pieces[i];
+    piece->validation = &validation;
+    piece->begin = codeblock + i * piece_size;
+    piece->size = i + 1 < pieces_count ? piece_size : size - i * piece_size;
+    /* One extra bit: x86-64 marks the end of the piece as a valid target.  */
+    piece->valid_targets = BitmapAllocate(piece->size + 1);
+    piece->jump_dests = BitmapAllocate(piece->size + 1);
+    if (piece->valid_targets == NULL || piece->jump_dests == NULL)
+      out_of_memory = TRUE;
+  }
+
+  if (!out_of_memory) {
+    /* The calling thread takes the first piece itself.  */
+    for (i = 1; i < pieces_count; i++)
+      pieces[i].thread_started = NaClThreadCreateJoinable(
+          &pieces[i].thread, ValidatePieceThread, &pieces[i],
+          kParallelValidationStackSize);
+    ValidatePiece(&pieces[0]);
+    for (i = 1; i < pieces_count; i++) {
+      if (pieces[i].thread_started)
+        NaClThreadJoin(&pieces[i].thread);
+      else
+        ValidatePiece(&pieces[i]);
+    }
+
+    for (i = 0; i < pieces_count; i++) {
+      result &= pieces[i].result;
+      out_of_memory |= pieces[i].out_of_memory;
+    }
+  }
+
+  if (!out_of_memory) {
+    /* Hand every cross-piece jump to the piece that holds its target.  */
+    for (i = 0; i < pieces_count; i++) {
+      for (j = 0; j < pieces[i].remote_jump_dests_count; j++) {
+        size_t jump_dest = pieces[i].remote_jump_dests[j];
+        struct ValidationPiece *target = &pieces[jump_dest / piece_size];
+        BitmapSetBit(target->jump_dests, jump_dest % piece_size);
+      }
+    }
+    /* Reports bad targets in address order, just like the serial pass.  */
+    for (i = 0; i < pieces_count; i++)
+      result &= ProcessInvalidJumpTargets(pieces[i].begin,
+                                          pieces[i].size,
+                                          pieces[i].valid_targets,
+                                          pieces[i].jump_dests,
+                                          user_callback,
+                                          callback_data);
+  }
+
+  for (i = 0; i < pieces_count; i++) {
+    free(pieces[i].remote_jump_dests);
+    free(pieces[i].jump_dests);
+    free(pieces[i].valid_targets);
+  }
+  free(pieces);
+  NaClMutexDtor(&validation.callback_mu);
+
+  if (out_of_memory) {
+    errno = ENOMEM;
+    return FALSE;
+  }
+  if (!result) errno = EINVAL;
+  return result;
+}
+
+Bool ValidateChunkAMD64Parallel(const uint8_t codeblock[],
+                                size_t size,
+                                uint32_t options,
+                                const NaClCPUFeaturesX86 *cpu_features,
+                                int threads,
+                                ValidationCallbackFunc user_callback,
+                                void *callback_data) {
+  return ValidateChunkParallel(codeblock, size, options, cpu_features, threads,
+                               ValidateChunkAMD64, ValidateChunkBundlesAMD64,
+                               user_callback, callback_data);
+}
+
+Bool ValidateChunkIA32Parallel(const uint8_t codeblock[],
+                               size_t size,
+                               uint32_t options,
+                               const NaClCPUFeaturesX86 *cpu_features,
+                               int threads,
+                               ValidationCallbackFunc user_callback,
+                               void *callback_data) {
+  return ValidateChunkParallel(codeblock, size, options, cpu_features, threads,
+                               ValidateChunkIA32, ValidateChunkBundlesIA32,
+                               user_callback, callback_data);
+}
@@ -0,0 +1,62 @@
+/*
+ * Copyright (c) 2017 The Native Client Authors. All rights reserved.
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file.
+ */
+
+/*
+ * Multi-threaded validation of large code chunks.
+ *
+ * Bundles are validated independently of each other; only direct jumps tie
+ * them together, through the valid_targets and jump_dests bitmaps.  So the
+ * chunk is cut into bundle-aligned pieces which are run through the DFA on
+ * separate threads, each with its own bitmaps.  Jumps into another piece are
+ * collected on the way and checked against that piece's valid_targets once
+ * every thread is done, which gives the same result and the same set of
+ * callback invocations as ValidateChunkAMD64/ValidateChunkIA32.
+ */
+
+#ifndef NATIVE_CLIENT_SRC_TRUSTED_VALIDATOR_RAGEL_VALIDATOR_PARALLEL_H_
+#define NATIVE_CLIENT_SRC_TRUSTED_VALIDATOR_RAGEL_VALIDATOR_PARALLEL_H_
+
+#include "native_client/src/trusted/validator_ragel/validator.h"
+
+EXTERN_C_BEGIN
+
+/* Pieces smaller than this are not worth a thread.  */
+#define kParallelValidationMinPieceSize (64 << 10)
+
+/* Upper limit on the number of threads used for one chunk.  */
+#define kParallelValidationMaxThreads 32
+
+/*
+ * Same as ValidateChunkAMD64, but uses up to |threads| threads.
+ *
+ * user_callback may be called from any of the threads, though never from
+ * two at once, and calls for different pieces may interleave.  With fewer
+ * than two threads, a chunk too small to split, or options that make the
+ * DFA call back for every instruction or look across bundles, this simply
+ * calls ValidateChunkAMD64.
+ */
+Bool ValidateChunkAMD64Parallel(const uint8_t codeblock[],
+                                size_t size,
+                                uint32_t options,
+                                const NaClCPUFeaturesX86 *cpu_features,
+                                int threads,
+                                ValidationCallbackFunc user_callback,
+                                void *callback_data);
+
+/*
+ * See ValidateChunkAMD64Parallel.
+ */
+Bool ValidateChunkIA32Parallel(const uint8_t codeblock[],
+                               size_t size,
+                               uint32_t options,
+                               const NaClCPUFeaturesX86 *cpu_features,
+                               int threads,
+                               ValidationCallbackFunc user_callback,
+                               void *callback_data);
+
+EXTERN_C_END
+
+#endif  /* NATIVE_CLIENT_SRC_TRUSTED_VALIDATOR_RAGEL_VALIDATOR_PARALLEL_H_ */
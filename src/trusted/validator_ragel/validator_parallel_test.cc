@@ -0,0 +1,185 @@
+/*
+ * Copyright (c) 2017 The Native Client Authors. All rights reserved.
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file.
+ */
+
+/*
+ * Checks that the multi-threaded validator agrees with the serial one: the
+ * same result and the same callback invocations, on the text segment of a
+ * nexe as it is and with random bytes overwritten.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <algorithm>
+#include <vector>
+
+#include "native_client/src/include/elf.h"
+#include "native_client/src/include/elf_constants.h"
+#include "native_client/src/include/nacl_macros.h"
+#include "native_client/src/shared/platform/nacl_check.h"
+#include "native_client/src/shared/utils/types.h"
+#include "native_client/src/trusted/validator/driver/elf_load.h"
+#include "native_client/src/trusted/validator_ragel/validator.h"
+#include "native_client/src/trusted/validator_ragel/validator_parallel.h"
+
+namespace {
+
+struct Callback {
+  uint32_t begin;
+  uint32_t end;
+  uint32_t info;
+
+  bool operator<(const Callback &other) const {
+    if (begin != other.begin)
+      return begin < other.begin;
+    if (end != other.end)
+      return end < other.end;
+    return info < other.info;
+  }
+
+  bool operator==(const Callback &other) const {
+    return begin == other.begin && end == other.end && info == other.info;
+  }
+};
+
+struct Run {
+  const uint8_t *code;
+  std::vector<Callback> callbacks;
+};
+
+Bool RecordCallback(
+    const uint8_t *begin, const uint8_t *end,
+    uint32_t validation_info, void *user_data_ptr) {
+  Run *run = static_cast<Run *>(user_data_ptr);
+  Callback callback;
+  callback.begin = static_cast<uint32_t>(begin - run->code);
+  callback.end = static_cast<uint32_t>(end - run->code);
+  callback.info = validation_info;
+  run->callbacks.push_back(callback);
+  if (validation_info & (VALIDATION_ERRORS_MASK | BAD_JUMP_TARGET))
+    return FALSE;
+  else
+    return TRUE;
+}
+
+Bool Validate(elf_load::Architecture architecture,
+              const std::vector<uint8_t> &code,
+              int threads,
+              Run *run) {
+  run->code = &code[0];
+  run->callbacks.clear();
+  Bool result = FALSE;
+  switch (architecture) {
+    case elf_load::X86_32:
+      if (threads == 0)
+        result = ValidateChunkIA32(
+            &code[0], code.size(),
+            0, &kFullCPUIDFeatures,
+            RecordCallback, run);
+      else
+        result = ValidateChunkIA32Parallel(
+            &code[0], code.size(),
+            0, &kFullCPUIDFeatures, threads,
+            RecordCallback, run);
+      break;
+    case elf_load::X86_64:
+      if (threads == 0)
+        result = ValidateChunkAMD64(
+            &code[0], code.size(),
+            0, &kFullCPUIDFeatures,
+            RecordCallback, run);
+      else
+        result = ValidateChunkAMD64Parallel(
+            &code[0], code.size(),
+            0, &kFullCPUIDFeatures, threads,
+            RecordCallback, run);
+      break;
+    case elf_load::ARM:
+      CHECK(false);
+  }
+  /* Pieces call back in no particular order relative to each other.  */
+  std::sort(run->callbacks.begin(), run->callbacks.end());
+  return result;
+}
+
+/* Returns the number of thread counts that disagreed with the serial run. */
+int Compare(elf_load::Architecture architecture,
+            const std::vector<uint8_t> &code,
+            const char *what) {
+  static const int kThreads[] = { 2, 3, 4, 8 };
+  Run serial;
+  Bool serial_result = Validate(architecture, code, 0, &serial);
+  int failures = 0;
+
+  for (size_t i = 0; i < NACL_ARRAY_SIZE(kThreads); i++) {
+    Run parallel;
+    Bool parallel_result = Validate(architecture, code, kThreads[i],
+                                    &parallel);
+    if (parallel_result != serial_result ||
+        parallel.callbacks != serial.callbacks) {
+      printf("%s, %d threads: result %d, %d callback(s);"
+             " serially result %d, %d callback(s)\n",
+             what, kThreads[i],
+             parallel_result, static_cast<int>(parallel.callbacks.size()),
+             serial_result, static_cast<int>(serial.callbacks.size()));
+      failures++;
+    }
+  }
+  return failures;
+}
+
+}  // namespace
+
+int main(int argc, char *argv[]) {
+  if (argc != 3) {
+    printf("Usage:\n");
+    printf("    validator_parallel_test <nexe> <number of mutated copies>\n");
+    exit(1);
+  }
+  const char *input_file = argv[1];
+  int mutations = atoi(argv[2]);
+  CHECK(mutations >= 0);
+
+  elf_load::Image image;
+  elf_load::ReadImage(input_file, &image);
+
+  elf_load::Architecture architecture = elf_load::GetElfArch(image);
+  elf_load::Segment segment = elf_load::GetElfTextSegment(image);
+  CHECK(segment.size % kBundleSize == 0);
+
+  /*
+   * Pieces are at least kParallelValidationMinPieceSize long, so a text
+   * segment shorter than two of them would only test the fallback.
+   */
+  if (segment.size < 2 * kParallelValidationMinPieceSize) {
+    printf("Text segment of %s is too small to be split.\n", input_file);
+    exit(1);
+  }
+
+  std::vector<uint8_t> original(segment.data, segment.data + segment.size);
+  int failures = Compare(architecture, original, "original");
+
+  /* A fixed seed, so that a failure can be reproduced.  */
+  srand(1);
+  for (int i = 0; i < mutations; i++) {
+    std::vector<uint8_t> code(original);
+    int bytes = 1 + rand() % 16;
+    for (int j = 0; j < bytes; j++)
+      code[rand() % code.size()] = static_cast<uint8_t>(rand());
+
+    char what[32];
+    snprintf(what, sizeof what, "mutation %d", i);
+    failures += Compare(architecture, code, what);
+  }
+
+  if (failures != 0) {
+    printf("FAIL: %d mismatch(es)\n", failures);
+    return 1;
+  }
+  printf("PASS\n");
+  return 0;
+}
@@ -163,40 +163,26 @@
  */
 %% write data;
 
-Bool ValidateChunkIA32(const uint8_t codeblock[],
-                       size_t size,
-                       uint32_t options,
-                       const NaClCPUFeaturesX86 *cpu_features,
-                       ValidationCallbackFunc user_callback,
-                       void *callback_data) {
-  bitmap_word valid_targets_small;
-  bitmap_word jump_dests_small;
-  bitmap_word *valid_targets;
-  bitmap_word *jump_dests;
+/*
+ * Runs the DFA over every bundle of the chunk, marking valid jump targets
+ * and direct jump destinations in the given bitmaps (of size bits)
+ * without checking one against the other.  ValidateChunkIA32 and the
+ * parallel driver in validator_parallel.c do that afterwards.
+ */
+Bool ValidateChunkBundlesIA32(const uint8_t codeblock[],
+                              size_t size,
+                              uint32_t options,
+                              const NaClCPUFeaturesX86 *cpu_features,
+                              bitmap_word *valid_targets,
+                              bitmap_word *jump_dests,
+                              ValidationCallbackFunc user_callback,
+                              void *callback_data) {
   const uint8_t *current_position;
   const uint8_t *end_position;
   int result = TRUE;
 
-  CHECK(sizeof valid_targets_small == sizeof jump_dests_small);
   CHECK(size % kBundleSize == 0);
 
-  /* For a very small sequences (one bundle) malloc is too expensive.  */
-  if (size <= (sizeof valid_targets_small * 8)) {
-    valid_targets_small = 0;
-    valid_targets = &valid_targets_small;
-    jump_dests_small = 0;
-    jump_dests = &jump_dests_small;
-  } else {
-    valid_targets = BitmapAllocate(size);
-    jump_dests = BitmapAllocate(size);
-    if (!valid_targets || !jump_dests) {
-      free(jump_dests);
-      free(valid_targets);
-      errno = ENOMEM;
-      return FALSE;
-    }
-  }
-
   /*
    * This option is usually used in tests: we will process the whole chunk
    * in one pass. Usually each bundle is processed separately which means
@@ -236,6 +222,45 @@ Bool ValidateChunkIA32(const uint8_t codeblock[],
     %% write exec;
   }
 
+  return result;
+}
+
+Bool ValidateChunkIA32(const uint8_t codeblock[],
+                       size_t size,
+                       uint32_t options,
+                       const NaClCPUFeaturesX86 *cpu_features,
+                       ValidationCallbackFunc user_callback,
+                       void *callback_data) {
+  bitmap_word valid_targets_small;
+  bitmap_word jump_dests_small;
+  bitmap_word *valid_targets;
+  bitmap_word *jump_dests;
+  int result;
+
+  CHECK(sizeof valid_targets_small == sizeof jump_dests_small);
+  CHECK(size % kBundleSize == 0);
+
+  /* For a very small sequences (one bundle) malloc is too expensive.  */
+  if (size <= (sizeof valid_targets_small * 8)) {
+    valid_targets_small = 0;
+    valid_targets = &valid_targets_small;
+    jump_dests_small = 0;
+    jump_dests = &jump_dests_small;
+  } else {
+    valid_targets = BitmapAllocate(size);
+    jump_dests = BitmapAllocate(size);
+    if (!valid_targets || !jump_dests) {
+      free(jump_dests);
+      free(valid_targets);
+      errno = ENOMEM;
+      return FALSE;
+    }
+  }
+
+  result = ValidateChunkBundlesIA32(codeblock, size, options, cpu_features,
+                                    valid_targets, jump_dests,
+                                    user_callback, callback_data);
+
   /*
    * Check the direct jumps.  All the targets from jump_dests must be in
    * valid_targets.
@@ -15,14 +15,17 @@
 extern "C" {
 #endif
 
+#include <stdint.h>
 #include <sys/types.h>
 #include <time.h>
 
 #include "native_client/src/trusted/service_runtime/include/bits/nacl_syscalls.h"
 #include "native_client/src/trusted/service_runtime/nacl_config.h"
 
+struct NaClDyncodeChunk;
 struct NaClExceptionContext;
 struct NaClAbiNaClImcMsgHdr;
+struct NaClLindRing;
 struct NaClMemMappingInfo;
 struct stat;
 struct timespec;
@@ -74,6 +77,12 @@ typedef int (*TYPE_nacl_lseek) (int desc,
                                 off_t *offset, /* 64 bit value */
                                 int whence);
 
+typedef int (*TYPE_nacl_pread) (int desc, void *buf, size_t count,
+                                off_t const *offset); /* 64 bit value */
+
+typedef int (*TYPE_nacl_pwrite) (int desc, void const *buf, size_t count,
+                                 off_t const *offset); /* 64 bit value */
+
 typedef int (*TYPE_nacl_stat) (const char *file, struct stat *st);
 
 /* ============================================================ */
@@ -154,6 +163,17 @@ typedef int (*TYPE_nacl_sem_create) (int32_t value);
 typedef int (*TYPE_nacl_sem_wait) (int sem);
 typedef int (*TYPE_nacl_sem_post) (int sem);
 
+/* ============================================================ */
+/* futex */
+/* ============================================================ */
+
+typedef int (*TYPE_nacl_futex_wait) (volatile int *addr, int value,
+                                     const struct timespec *abstime);
+typedef int (*TYPE_nacl_futex_wake) (volatile int *addr, int nwake);
+typedef int (*TYPE_nacl_futex_cmp_requeue) (volatile int *addr, int nwake,
+                                            int nrequeue,
+                                            volatile int *addr2, int value);
+
 /* ============================================================ */
 /* misc */
 /* ============================================================ */
@@ -210,6 +230,9 @@ typedef void *(*TYPE_nacl_second_tls_get) (void);
 typedef int (*TYPE_nacl_dyncode_create) (void *dest, const void *src,
                                        size_t size);
 
+typedef int (*TYPE_nacl_dyncode_create_batch) (
+    const struct NaClDyncodeChunk *chunks, uint32_t count);
+
 typedef int (*TYPE_nacl_dyncode_modify) (void *dest, const void *src,
                                        size_t size);
 
@@ -227,6 +250,13 @@ typedef int (*TYPE_nacl_test_infoleak) (void);
 
 typedef int (*TYPE_nacl_test_crash) (int crash_type);
 
+typedef int (*TYPE_nacl_lind_syscall) (uint32_t call_num,
+                                       uint32_t in_num, void *in_args,
+                                       uint32_t out_num, void *out_args);
+
+typedef int (*TYPE_nacl_lind_ring_enter) (struct NaClLindRing *ring,
+                                          uint32_t to_submit);
+
 #if defined(__cplusplus)
 }
 #endif
@@ -18,11 +18,11 @@ void __nc_initialize_interfaces(struct nacl_irt_thread *irt_thread) {
 }
 
 /*
- * In libpthread_private, there are real versions of __nc_futex_init()
- * and __nc_futex_thread_exit() implemented by irt_futex.c, called by
- * nc_thread.c.  When we are using the IRT's futex interface, however,
- * the IRT takes care of this initialization and cleanup for us.  We
- * provide no-op implementations for nc_thread.c to call.
+ * In libpthread_private, __nc_futex_init() and __nc_futex_thread_exit()
+ * come from irt_futex.c, called by nc_thread.c.  When we are using the
+ * IRT's futex interface, the IRT takes care of any initialization and
+ * cleanup for us.  We provide no-op implementations for nc_thread.c to
+ * call.
  */
 void __nc_futex_init() {
 }
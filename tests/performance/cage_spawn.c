@@ -0,0 +1,82 @@
+/*
+ * Copyright (c) 2017 The Native Client Authors. All rights reserved.
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file.
+ */
+
+/*
+ * Spawns and reaps 100000 short-lived cages, one at a time, as a
+ * supervisor that runs many small jobs would.  This is far more than
+ * there are cage ids or room for sandboxes in the address space, so it
+ * only completes if both are recycled.  The first and last thousand cages
+ * are timed separately to show that creation does not slow down.
+ */
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#define NUM_CAGES 100000
+#define SAMPLE_CAGES 1000
+
+static double Now(void) {
+  struct timespec ts;
+  if (clock_gettime(CLOCK_MONOTONIC, &ts) != 0) {
+    perror("clock_gettime");
+    exit(1);
+  }
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void SpawnAndReap(int i) {
+  int status;
+  pid_t pid = fork();
+
+  if (pid < 0) {
+    fprintf(stderr, "fork %d failed, errno %d\n", i, errno);
+    exit(1);
+  }
+  if (0 == pid) {
+    _exit(i & 0x7f);
+  }
+  if (waitpid(pid, &status, 0) != pid) {
+    fprintf(stderr, "waitpid %d failed, errno %d\n", i, errno);
+    exit(1);
+  }
+  if (!WIFEXITED(status) || WEXITSTATUS(status) != (i & 0x7f)) {
+    fprintf(stderr, "cage %d: bad exit status %#x\n", i, status);
+    exit(1);
+  }
+}
+
+int main(int argc, char **argv) {
+  const char *description = argc >= 2 ? argv[1] : "time";
+  double start = Now();
+  double first = 0;
+  double last_start = 0;
+  double end;
+  int i;
+
+  setvbuf(stdout, NULL, _IONBF, 0);
+  for (i = 0; i < NUM_CAGES; ++i) {
+    if (NUM_CAGES - SAMPLE_CAGES == i) {
+      last_start = Now();
+    }
+    SpawnAndReap(i);
+    if (SAMPLE_CAGES - 1 == i) {
+      first = Now() - start;
+    }
+  }
+  end = Now();
+  printf("RESULT CageSpawnReap: %s= %.1f microseconds\n",
+         description, (end - start) / NUM_CAGES * 1e6);
+  printf("RESULT CageSpawnReapFirst%d: %s= %.1f microseconds\n",
+         SAMPLE_CAGES, description, first / SAMPLE_CAGES * 1e6);
+  printf("RESULT CageSpawnReapLast%d: %s= %.1f microseconds\n",
+         SAMPLE_CAGES, description,
+         (end - last_start) / SAMPLE_CAGES * 1e6);
+  return 0;
+}
@@ -0,0 +1,112 @@
+/*
+ * Copyright (c) 2017 The Native Client Authors. All rights reserved.
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file.
+ */
+
+/*
+ * Measures the cost of descriptor churn (open/close and dup/close) as the
+ * number of descriptors a cage holds open grows, which is the pattern of a
+ * server accepting and closing connections.  Each new descriptor takes the
+ * lowest free number, so every iteration allocates just above the held set.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+#define CHURN_ITERATIONS 10000
+
+static const int kHeldFds[] = { 0, 256, 1024, 4096 };
+
+static double Now(void) {
+  struct timespec ts;
+  if (clock_gettime(CLOCK_MONOTONIC, &ts) != 0) {
+    perror("clock_gettime");
+    exit(1);
+  }
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static double TimeOpenClose(const char *path) {
+  double start = Now();
+  int i;
+
+  for (i = 0; i < CHURN_ITERATIONS; ++i) {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+      fprintf(stderr, "open failed, errno %d\n", errno);
+      exit(1);
+    }
+    close(fd);
+  }
+  return (Now() - start) / CHURN_ITERATIONS;
+}
+
+static double TimeDupClose(int fd) {
+  double start = Now();
+  int i;
+
+  for (i = 0; i < CHURN_ITERATIONS; ++i) {
+    int new_fd = dup(fd);
+    if (new_fd < 0) {
+      fprintf(stderr, "dup failed, errno %d\n", errno);
+      exit(1);
+    }
+    close(new_fd);
+  }
+  return (Now() - start) / CHURN_ITERATIONS;
+}
+
+int main(int argc, char **argv) {
+  const char *description = argc >= 2 ? argv[1] : "time";
+  const char *path = "fd_churn.tmp";
+  int *held;
+  int num_held = 0;
+  int fd;
+  size_t i;
+
+  setvbuf(stdout, NULL, _IONBF, 0);
+  fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0600);
+  if (fd < 0) {
+    fprintf(stderr, "could not create %s, errno %d\n", path, errno);
+    return 1;
+  }
+  held = malloc(kHeldFds[sizeof kHeldFds / sizeof kHeldFds[0] - 1] *
+                sizeof *held);
+  if (NULL == held) {
+    fprintf(stderr, "out of memory\n");
+    return 1;
+  }
+
+  for (i = 0; i < sizeof kHeldFds / sizeof kHeldFds[0]; ++i) {
+    while (num_held < kHeldFds[i]) {
+      held[num_held] = dup(fd);
+      if (held[num_held] < 0) {
+        break;
+      }
+      ++num_held;
+    }
+    if (num_held < kHeldFds[i]) {
+      printf("skipping %d held fds: dup failed at %d, errno %d\n",
+             kHeldFds[i], num_held, errno);
+      break;
+    }
+
+    printf("RESULT FdChurnOpenClose_%dfds: %s= %.3f microseconds\n",
+           kHeldFds[i], description, TimeOpenClose(path) * 1e6);
+    printf("RESULT FdChurnDupClose_%dfds: %s= %.3f microseconds\n",
+           kHeldFds[i], description, TimeDupClose(fd) * 1e6);
+  }
+
+  while (num_held > 0) {
+    close(held[--num_held]);
+  }
+  free(held);
+  close(fd);
+  unlink(path);
+  return 0;
+}
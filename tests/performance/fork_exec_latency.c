@@ -0,0 +1,112 @@
+/*
+ * Copyright (c) 2017 The Native Client Authors. All rights reserved.
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file.
+ */
+
+/*
+ * Measures the shell-style fork/exec/exit loop.  Each iteration forks a
+ * cage that re-executes this program with "--exit", which returns at once,
+ * and waits for it.  A fork/exit loop without the exec is reported too, so
+ * the cost of setting up a new cage can be told apart from the cost of
+ * loading the new program.  The first iteration is reported separately,
+ * since it is the one that loads runnable-ld.so before it is cached.
+ */
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#define DEFAULT_ITERATIONS 200
+
+static double Now(void) {
+  struct timespec ts;
+  if (clock_gettime(CLOCK_MONOTONIC, &ts) != 0) {
+    perror("clock_gettime");
+    exit(1);
+  }
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static double TimeSpawn(const char *exec_path) {
+  double start = Now();
+  int status;
+  pid_t pid = fork();
+
+  if (pid < 0) {
+    fprintf(stderr, "fork failed, errno %d\n", errno);
+    exit(1);
+  }
+  if (0 == pid) {
+    if (NULL != exec_path) {
+      char *child_argv[] = { (char *) exec_path, "--exit", NULL };
+      execv(exec_path, child_argv);
+      fprintf(stderr, "execv(%s) failed, errno %d\n", exec_path, errno);
+      _exit(1);
+    }
+    _exit(0);
+  }
+  if (waitpid(pid, &status, 0) != pid || !WIFEXITED(status) ||
+      WEXITSTATUS(status) != 0) {
+    fprintf(stderr, "child did not exit cleanly\n");
+    exit(1);
+  }
+  return Now() - start;
+}
+
+static void Report(const char *name, const char *description,
+                   const char *exec_path, int iterations) {
+  double first = TimeSpawn(exec_path);
+  double total = 0;
+  int i;
+
+  for (i = 0; i < iterations; ++i) {
+    total += TimeSpawn(exec_path);
+  }
+  printf("RESULT %sFirst: %s= %.3f milliseconds\n",
+         name, description, first * 1e3);
+  printf("RESULT %s: %s= %.3f milliseconds\n",
+         name, description, total / iterations * 1e3);
+}
+
+int main(int argc, char **argv) {
+  const char *description = "time";
+  const char *exec_path = argv[0];
+  int iterations = DEFAULT_ITERATIONS;
+  int opt;
+
+  if (argc >= 2 && 0 == strcmp(argv[1], "--exit")) {
+    return 0;
+  }
+  while ((opt = getopt(argc, argv, "d:e:n:")) != -1) {
+    switch (opt) {
+      case 'd':
+        description = optarg;
+        break;
+      case 'e':
+        exec_path = optarg;
+        break;
+      case 'n':
+        iterations = atoi(optarg);
+        break;
+      default:
+        fprintf(stderr,
+                "Usage: fork_exec_latency [-d description] [-e exec_path]"
+                " [-n iterations]\n");
+        return 1;
+    }
+  }
+  if (iterations < 1) {
+    fprintf(stderr, "iterations must be positive\n");
+    return 1;
+  }
+
+  setvbuf(stdout, NULL, _IONBF, 0);
+  Report("ForkExit", description, NULL, iterations);
+  Report("ForkExecExit", description, exec_path, iterations);
+  return 0;
+}
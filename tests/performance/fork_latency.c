@@ -0,0 +1,94 @@
+/*
+ * Copyright (c) 2017 The Native Client Authors. All rights reserved.
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file.
+ */
+
+/*
+ * Measures cage fork latency as a function of how much memory the parent
+ * has touched.  For each heap size the parent maps and dirties an
+ * anonymous region, then times fork() of a child that exits at once,
+ * through to waitpid().  The first fork after dirtying the heap is
+ * reported separately from later ones: the first only remaps the heap,
+ * while later ones also copy the pages the parent has written since then.
+ */
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#define REPEAT_FORKS 10
+
+static const size_t kHeapSizesMB[] = { 1, 16, 64, 256, 1024 };
+
+static double Now(void) {
+  struct timespec ts;
+  if (clock_gettime(CLOCK_MONOTONIC, &ts) != 0) {
+    perror("clock_gettime");
+    exit(1);
+  }
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static double TimeFork(void) {
+  double start = Now();
+  int status;
+  pid_t pid = fork();
+
+  if (pid < 0) {
+    fprintf(stderr, "fork failed, errno %d\n", errno);
+    exit(1);
+  }
+  if (0 == pid) {
+    _exit(0);
+  }
+  if (waitpid(pid, &status, 0) != pid || !WIFEXITED(status) ||
+      WEXITSTATUS(status) != 0) {
+    fprintf(stderr, "child did not exit cleanly\n");
+    exit(1);
+  }
+  return Now() - start;
+}
+
+int main(int argc, char **argv) {
+  const char *description = argc >= 2 ? argv[1] : "time";
+  size_t i;
+  int j;
+
+  setvbuf(stdout, NULL, _IONBF, 0);
+  for (i = 0; i < sizeof kHeapSizesMB / sizeof kHeapSizesMB[0]; ++i) {
+    size_t size = kHeapSizesMB[i] << 20;
+    double first;
+    double repeat = 0;
+    char *heap = mmap(NULL, size, PROT_READ | PROT_WRITE,
+                      MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+    if (MAP_FAILED == heap) {
+      /* large sizes may not fit the sandbox on every configuration */
+      printf("skipping %zu MB heap: mmap failed, errno %d\n",
+             kHeapSizesMB[i], errno);
+      continue;
+    }
+    memset(heap, 0x5a, size);
+
+    first = TimeFork();
+    for (j = 0; j < REPEAT_FORKS; ++j) {
+      /* dirty one page per iteration, as a running program would */
+      heap[(j * 4096) % size] ^= 1;
+      repeat += TimeFork();
+    }
+    repeat /= REPEAT_FORKS;
+
+    printf("RESULT ForkLatencyFirst_%zuMB: %s= %.3f milliseconds\n",
+           kHeapSizesMB[i], description, first * 1e3);
+    printf("RESULT ForkLatency_%zuMB: %s= %.3f milliseconds\n",
+           kHeapSizesMB[i], description, repeat * 1e3);
+    munmap(heap, size);
+  }
+  return 0;
+}
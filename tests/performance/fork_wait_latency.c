@@ -0,0 +1,168 @@
+/*
+ * Copyright (c) 2017 The Native Client Authors. All rights reserved.
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file.
+ */
+
+/*
+ * Measures how quickly a parent cage reaps its children.  Each round forks
+ * children that exit at once and reaps them with wait() or waitpid(), and
+ * rounds are repeated as the number of cages ever forked grows, which must
+ * not slow reaping down.  Also times a WNOHANG poll while a child is still
+ * running.
+ */
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#define FORKS_PER_ROUND 100
+#define ROUNDS 10
+#define NOHANG_POLLS 10000
+
+static double Now(void) {
+  struct timespec ts;
+  if (clock_gettime(CLOCK_MONOTONIC, &ts) != 0) {
+    perror("clock_gettime");
+    exit(1);
+  }
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static pid_t ForkExiting(int code) {
+  pid_t pid = fork();
+
+  if (pid < 0) {
+    fprintf(stderr, "fork failed, errno %d\n", errno);
+    exit(1);
+  }
+  if (0 == pid) {
+    _exit(code);
+  }
+  return pid;
+}
+
+static void CheckStatus(pid_t got, pid_t want, int status, int code) {
+  if (got < 0 || (want > 0 && got != want)) {
+    fprintf(stderr, "wait returned %d (wanted %d), errno %d\n",
+            (int) got, (int) want, errno);
+    exit(1);
+  }
+  if (!WIFEXITED(status) || WEXITSTATUS(status) != code) {
+    fprintf(stderr, "child %d: bad status 0x%x\n", (int) got, status);
+    exit(1);
+  }
+}
+
+/* fork, then wait() for the child: the round trip a shell makes */
+static double TimeForkWait(void) {
+  double start = Now();
+  int status;
+  pid_t got;
+  int i;
+
+  for (i = 0; i < FORKS_PER_ROUND; ++i) {
+    int code = i & 0x7f;
+    ForkExiting(code);
+    got = wait(&status);
+    CheckStatus(got, -1, status, code);
+  }
+  return (Now() - start) / FORKS_PER_ROUND;
+}
+
+/* fork every child first, then reap each by pid in reverse order */
+static double TimeWaitpidBatch(void) {
+  pid_t pids[FORKS_PER_ROUND];
+  double start;
+  int status;
+  pid_t got;
+  int i;
+
+  for (i = 0; i < FORKS_PER_ROUND; ++i) {
+    pids[i] = ForkExiting(i & 0x7f);
+  }
+  start = Now();
+  for (i = FORKS_PER_ROUND - 1; i >= 0; --i) {
+    got = waitpid(pids[i], &status, 0);
+    CheckStatus(got, pids[i], status, i & 0x7f);
+  }
+  return (Now() - start) / FORKS_PER_ROUND;
+}
+
+static double TimeNoHangPoll(void) {
+  int fds[2];
+  char c = 0;
+  double start;
+  double elapsed;
+  int status;
+  pid_t pid;
+  pid_t got;
+  int i;
+
+  if (pipe(fds) != 0) {
+    fprintf(stderr, "pipe failed, errno %d\n", errno);
+    exit(1);
+  }
+  pid = fork();
+  if (pid < 0) {
+    fprintf(stderr, "fork failed, errno %d\n", errno);
+    exit(1);
+  }
+  if (0 == pid) {
+    /* stay alive until the parent is done polling */
+    close(fds[1]);
+    read(fds[0], &c, 1);
+    _exit(0);
+  }
+  close(fds[0]);
+
+  start = Now();
+  for (i = 0; i < NOHANG_POLLS; ++i) {
+    if (waitpid(-1, &status, WNOHANG) != 0) {
+      fprintf(stderr, "WNOHANG poll did not return 0\n");
+      exit(1);
+    }
+  }
+  elapsed = Now() - start;
+
+  write(fds[1], &c, 1);
+  close(fds[1]);
+  got = waitpid(pid, &status, 0);
+  CheckStatus(got, pid, status, 0);
+  return elapsed / NOHANG_POLLS;
+}
+
+int main(int argc, char **argv) {
+  const char *description = argc >= 2 ? argv[1] : "time";
+  double first_round = 0;
+  double fork_wait = 0;
+  double waitpid_batch = 0;
+  int round;
+
+  setvbuf(stdout, NULL, _IONBF, 0);
+  for (round = 0; round < ROUNDS; ++round) {
+    double t = TimeForkWait();
+    if (0 == round) {
+      first_round = t;
+    }
+    fork_wait = t;
+    waitpid_batch = TimeWaitpidBatch();
+  }
+  if (wait(NULL) != -1 || errno != ECHILD) {
+    fprintf(stderr, "wait() with no children did not fail with ECHILD\n");
+    return 1;
+  }
+
+  printf("RESULT ForkWaitFirstRound: %s= %.3f microseconds\n",
+         description, first_round * 1e6);
+  printf("RESULT ForkWait_%dForks: %s= %.3f microseconds\n",
+         2 * ROUNDS * FORKS_PER_ROUND, description, fork_wait * 1e6);
+  printf("RESULT WaitpidExited_%dForks: %s= %.3f microseconds\n",
+         2 * ROUNDS * FORKS_PER_ROUND, description, waitpid_batch * 1e6);
+  printf("RESULT WaitNoHang: %s= %.3f microseconds\n",
+         description, TimeNoHangPoll() * 1e6);
+  return 0;
+}
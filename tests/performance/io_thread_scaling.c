@@ -0,0 +1,94 @@
+/*
+ * Copyright (c) 2017 The Native Client Authors. All rights reserved.
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file.
+ */
+
+/*
+ * Measures how small read/write syscalls scale with the number of
+ * threads in one cage.  Each thread writes into and reads back from its
+ * own pipe, so the threads share no descriptor and any slowdown as
+ * threads are added comes from state the runtime shares across the
+ * cage, such as the bookkeeping for in-flight I/O ranges.
+ */
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+#define MAX_THREADS 8
+#define ITERATIONS 100000
+#define MSG_SIZE 64
+
+static double Now(void) {
+  struct timespec ts;
+  if (clock_gettime(CLOCK_MONOTONIC, &ts) != 0) {
+    perror("clock_gettime");
+    exit(1);
+  }
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void *Worker(void *arg) {
+  int *fds = (int *) arg;
+  char buf[MSG_SIZE] = { 0 };
+  int i;
+
+  for (i = 0; i < ITERATIONS; ++i) {
+    if (write(fds[1], buf, sizeof(buf)) != sizeof(buf) ||
+        read(fds[0], buf, sizeof(buf)) != sizeof(buf)) {
+      fprintf(stderr, "pipe I/O failed, errno %d\n", errno);
+      exit(1);
+    }
+  }
+  return NULL;
+}
+
+/* Returns the number of read and write calls completed per second. */
+static double TimeThreads(int num_threads) {
+  pthread_t tids[MAX_THREADS];
+  int fds[MAX_THREADS][2];
+  double start;
+  double elapsed;
+  int i;
+
+  for (i = 0; i < num_threads; ++i) {
+    if (pipe(fds[i]) != 0) {
+      fprintf(stderr, "pipe failed, errno %d\n", errno);
+      exit(1);
+    }
+  }
+  start = Now();
+  for (i = 0; i < num_threads; ++i) {
+    if (pthread_create(&tids[i], NULL, Worker, fds[i]) != 0) {
+      fprintf(stderr, "pthread_create failed\n");
+      exit(1);
+    }
+  }
+  for (i = 0; i < num_threads; ++i) {
+    pthread_join(tids[i], NULL);
+  }
+  elapsed = Now() - start;
+  for (i = 0; i < num_threads; ++i) {
+    close(fds[i][0]);
+    close(fds[i][1]);
+  }
+  return 2.0 * ITERATIONS * num_threads / elapsed;
+}
+
+int main(int argc, char **argv) {
+  const char *description = argc >= 2 ? argv[1] : "time";
+  int num_threads;
+
+  setvbuf(stdout, NULL, _IONBF, 0);
+  /* with fewer CPUs than threads, lock contention barely shows */
+  printf("%ld CPUs online\n", sysconf(_SC_NPROCESSORS_ONLN));
+  for (num_threads = 1; num_threads <= MAX_THREADS; num_threads *= 2) {
+    printf("RESULT IoThreadScaling%d: %s= %.0f calls/s\n",
+           num_threads, description, TimeThreads(num_threads));
+  }
+  return 0;
+}
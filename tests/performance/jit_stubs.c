@@ -0,0 +1,143 @@
+/*
+ * Copyright (c) 2017 The Native Client Authors. All rights reserved.
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file.
+ */
+
+/*
+ * Synthetic JIT: installs many small stubs in the dynamic code area the
+ * way a JavaScript or Lua JIT emits them, scattered over several code
+ * pages rather than one after the other.  The stubs are installed once
+ * with one dyncode_create per stub and once with dyncode_create_batch,
+ * BATCH_SIZE stubs per call, each at fresh addresses.
+ */
+
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "native_client/src/trusted/service_runtime/include/sys/dyncode_batch.h"
+#include "native_client/src/untrusted/nacl/syscall_bindings_trampoline.h"
+#include "native_client/tests/dynamic_code_loading/dynamic_segment.h"
+
+#define STUB_SIZE 64
+/* stubs are spread round robin over this many 64k code pages */
+#define STUB_PAGES 16
+#define STUBS_PER_ROUND (STUB_PAGES * 64)
+#define ROUNDS 16
+#define BATCH_SIZE 64
+
+static uint8_t g_stub[STUB_SIZE];
+static struct NaClDyncodeChunk g_chunks[BATCH_SIZE];
+static uintptr_t g_next_area;
+
+static double Now(void) {
+  struct timespec ts;
+  if (clock_gettime(CLOCK_MONOTONIC, &ts) != 0) {
+    perror("clock_gettime");
+    exit(1);
+  }
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void FillNops(uint8_t *data, size_t size) {
+#if defined(__i386__) || defined(__x86_64__)
+  memset(data, 0x90, size);
+#elif defined(__arm__)
+  size_t i;
+  for (i = 0; i < size / 4; i++)
+    ((uint32_t *) data)[i] = 0xe1a00000;  /* NOP (MOV r0, r0) */
+#else
+# error "Unknown arch"
+#endif
+}
+
+/* Returns a fresh area of STUB_PAGES code pages. */
+static uintptr_t AllocateArea(void) {
+  uintptr_t area;
+
+  if (0 == g_next_area) {
+    g_next_area = DYNAMIC_CODE_SEGMENT_START;
+  }
+  area = g_next_area;
+  g_next_area += STUB_PAGES * DYNAMIC_CODE_PAGE_SIZE;
+  if (g_next_area > DYNAMIC_CODE_SEGMENT_END) {
+    fprintf(stderr, "out of dynamic code space\n");
+    exit(1);
+  }
+  return area;
+}
+
+/* Where stub |i| of a round goes: page i % STUB_PAGES, slot i / STUB_PAGES. */
+static uint32_t StubAddr(uintptr_t area, int i) {
+  return (uint32_t) (area + (i % STUB_PAGES) * DYNAMIC_CODE_PAGE_SIZE +
+                     (i / STUB_PAGES) * STUB_SIZE);
+}
+
+static double InstallSingly(void) {
+  double start = Now();
+  int round;
+  int i;
+
+  for (round = 0; round < ROUNDS; round++) {
+    uintptr_t area = AllocateArea();
+
+    for (i = 0; i < STUBS_PER_ROUND; i++) {
+      int rc = NACL_SYSCALL(dyncode_create)(
+          (void *) (uintptr_t) StubAddr(area, i), g_stub, sizeof g_stub);
+      if (rc != 0) {
+        fprintf(stderr, "dyncode_create failed: %d\n", rc);
+        exit(1);
+      }
+    }
+  }
+  return Now() - start;
+}
+
+static double InstallBatched(void) {
+  double start = Now();
+  int round;
+  int i;
+  int j;
+
+  for (round = 0; round < ROUNDS; round++) {
+    uintptr_t area = AllocateArea();
+
+    for (i = 0; i < STUBS_PER_ROUND; i += BATCH_SIZE) {
+      int rc;
+
+      for (j = 0; j < BATCH_SIZE; j++) {
+        g_chunks[j].dest = StubAddr(area, i + j);
+        g_chunks[j].src = (uint32_t) (uintptr_t) g_stub;
+        g_chunks[j].size = sizeof g_stub;
+      }
+      rc = NACL_SYSCALL(dyncode_create_batch)(g_chunks, BATCH_SIZE);
+      if (rc != BATCH_SIZE) {
+        fprintf(stderr, "dyncode_create_batch returned %d\n", rc);
+        exit(1);
+      }
+    }
+  }
+  return Now() - start;
+}
+
+int main(int argc, char **argv) {
+  const char *description = argc >= 2 ? argv[1] : "time";
+  double single;
+  double batched;
+
+  setvbuf(stdout, NULL, _IONBF, 0);
+  FillNops(g_stub, sizeof g_stub);
+
+  single = InstallSingly();
+  batched = InstallBatched();
+
+  printf("RESULT JitStubsSingle: %s= %.0f stubs/sec\n",
+         description, ROUNDS * STUBS_PER_ROUND / single);
+  printf("RESULT JitStubsBatched: %s= %.0f stubs/sec\n",
+         description, ROUNDS * STUBS_PER_ROUND / batched);
+  return 0;
+}
@@ -0,0 +1,165 @@
+/*
+ * Copyright (c) 2017 The Native Client Authors. All rights reserved.
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file.
+ */
+
+/*
+ * Measures how Lind calls scale with the number of cages.  For each cage
+ * count from 1 to the maximum, that many cages are forked and each runs a
+ * fixed loop of getpid (through NACL_sys_lind_syscall) or of 64-byte reads
+ * from its own regular file.  The aggregate rate is reported in the same
+ * RESULT format as perf_test_runner, so with perfect scaling ops/sec grows
+ * linearly with the cage count.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "native_client/src/untrusted/nacl/syscall_bindings_trampoline.h"
+
+/* Keep in sync with LIND_sys_getpid in lind_platform.h. */
+#define LIND_SYS_GETPID 31
+
+#define DEFAULT_MAX_CAGES 8
+#define OPS_PER_CAGE      100000
+#define READ_SIZE         64
+
+enum Workload {
+  WORKLOAD_GETPID,
+  WORKLOAD_READ
+};
+
+static double Now(void) {
+  struct timespec ts;
+  if (clock_gettime(CLOCK_MONOTONIC, &ts) != 0) {
+    perror("clock_gettime");
+    exit(1);
+  }
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int RunGetpid(void) {
+  int i;
+  for (i = 0; i < OPS_PER_CAGE; ++i) {
+    if (NACL_SYSCALL(lind_syscall)(LIND_SYS_GETPID, 0, NULL, 0, NULL) <= 0) {
+      fprintf(stderr, "lind getpid failed\n");
+      return 1;
+    }
+  }
+  return 0;
+}
+
+static int RunRead(const char *dir, int cage) {
+  char path[256];
+  char buf[READ_SIZE];
+  int fd;
+  int i;
+  int rc = 0;
+
+  snprintf(path, sizeof path, "%s/lind_cage_scaling.%d", dir, cage);
+  fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0600);
+  if (fd < 0) {
+    fprintf(stderr, "open(%s) failed, errno %d\n", path, errno);
+    return 1;
+  }
+  memset(buf, 'x', sizeof buf);
+  if (write(fd, buf, sizeof buf) != (ssize_t) sizeof buf) {
+    fprintf(stderr, "write(%s) failed, errno %d\n", path, errno);
+    rc = 1;
+  }
+  for (i = 0; 0 == rc && i < OPS_PER_CAGE; ++i) {
+    if (lseek(fd, 0, SEEK_SET) != 0 ||
+        read(fd, buf, sizeof buf) != (ssize_t) sizeof buf) {
+      fprintf(stderr, "read(%s) failed, errno %d\n", path, errno);
+      rc = 1;
+    }
+  }
+  close(fd);
+  unlink(path);
+  return rc;
+}
+
+static int RunCages(const char *description, const char *dir,
+                    enum Workload workload, int cages) {
+  const char *name = WORKLOAD_GETPID == workload ? "getpid" : "read";
+  pid_t pids[64];
+  double start;
+  double elapsed;
+  int status;
+  int failed = 0;
+  int i;
+
+  start = Now();
+  for (i = 0; i < cages; ++i) {
+    pids[i] = fork();
+    if (pids[i] < 0) {
+      fprintf(stderr, "fork failed, errno %d\n", errno);
+      return 1;
+    }
+    if (0 == pids[i]) {
+      _exit(WORKLOAD_GETPID == workload ? RunGetpid() : RunRead(dir, i));
+    }
+  }
+  for (i = 0; i < cages; ++i) {
+    if (waitpid(pids[i], &status, 0) != pids[i] ||
+        !WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+      failed = 1;
+    }
+  }
+  elapsed = Now() - start;
+  if (failed) {
+    fprintf(stderr, "%s with %d cages: a cage failed\n", name, cages);
+    return 1;
+  }
+  printf("RESULT LindCageScaling_%s_%d: %s= %.0f ops/sec\n",
+         name, cages, description, (double) cages * OPS_PER_CAGE / elapsed);
+  return 0;
+}
+
+int main(int argc, char **argv) {
+  const char *description = "time";
+  const char *dir = ".";
+  int max_cages = DEFAULT_MAX_CAGES;
+  int opt;
+  int cages;
+
+  while ((opt = getopt(argc, argv, "d:n:t:")) != -1) {
+    switch (opt) {
+      case 'd':
+        description = optarg;
+        break;
+      case 'n':
+        max_cages = atoi(optarg);
+        break;
+      case 't':
+        dir = optarg;
+        break;
+      default:
+        fprintf(stderr,
+                "Usage: lind_cage_scaling [-d description] [-n max_cages]"
+                " [-t temp_dir]\n");
+        return 1;
+    }
+  }
+  if (max_cages < 1 || max_cages > 64) {
+    fprintf(stderr, "max_cages must be between 1 and 64\n");
+    return 1;
+  }
+
+  setvbuf(stdout, NULL, _IONBF, 0);
+  for (cages = 1; cages <= max_cages; ++cages) {
+    if (RunCages(description, dir, WORKLOAD_GETPID, cages) != 0 ||
+        RunCages(description, dir, WORKLOAD_READ, cages) != 0) {
+      return 1;
+    }
+  }
+  return 0;
+}
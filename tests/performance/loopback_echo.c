@@ -0,0 +1,195 @@
+/*
+ * Copyright (c) 2017 The Native Client Authors. All rights reserved.
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file.
+ */
+
+/*
+ * Measures request/response round trips over a loopback TCP connection:
+ * a client thread sends a small request and waits for it to be echoed by
+ * a server thread of the same cage.  Each round trip is four Lind calls,
+ * a send and a recv on either side, so this is what the per-packet cost
+ * of the socket calls comes to for a proxy.  Run with sel_ldr -N to have
+ * send and recv made directly on the host sockets.
+ */
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+#define WARMUP_REQUESTS 1000
+#define REQUESTS 20000
+#define MSG_SIZE 64
+#define FIRST_PORT 47000
+#define NUM_PORTS 100
+
+static double g_latency[REQUESTS];
+
+static double Now(void) {
+  struct timespec ts;
+  if (clock_gettime(CLOCK_MONOTONIC, &ts) != 0) {
+    perror("clock_gettime");
+    exit(1);
+  }
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* Receives exactly |len| bytes; returns 0 if the peer closed first. */
+static int RecvAll(int fd, char *buf, size_t len) {
+  while (len > 0) {
+    ssize_t n = recv(fd, buf, len, 0);
+    if (n < 0 && errno == EINTR) {
+      continue;
+    }
+    if (n < 0) {
+      fprintf(stderr, "recv failed, errno %d\n", errno);
+      exit(1);
+    }
+    if (n == 0) {
+      return 0;
+    }
+    buf += n;
+    len -= n;
+  }
+  return 1;
+}
+
+static void SendAll(int fd, char const *buf, size_t len) {
+  while (len > 0) {
+    ssize_t n = send(fd, buf, len, 0);
+    if (n < 0 && errno == EINTR) {
+      continue;
+    }
+    if (n <= 0) {
+      fprintf(stderr, "send failed, errno %d\n", errno);
+      exit(1);
+    }
+    buf += n;
+    len -= n;
+  }
+}
+
+static void NoDelay(int fd) {
+  int one = 1;
+  /* not fatal: the echo still works, with Nagle's delays */
+  if (setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof one) != 0) {
+    fprintf(stderr, "setsockopt(TCP_NODELAY) failed, errno %d\n", errno);
+  }
+}
+
+static void *Server(void *arg) {
+  int listen_fd = *(int *) arg;
+  char buf[MSG_SIZE];
+  int fd;
+
+  fd = accept(listen_fd, NULL, NULL);
+  if (fd < 0) {
+    fprintf(stderr, "accept failed, errno %d\n", errno);
+    exit(1);
+  }
+  NoDelay(fd);
+  while (RecvAll(fd, buf, sizeof buf)) {
+    SendAll(fd, buf, sizeof buf);
+  }
+  close(fd);
+  return NULL;
+}
+
+/* Binds to the first free port from FIRST_PORT on and returns it. */
+static int Listen(int fd, struct sockaddr_in *addr) {
+  int port;
+
+  memset(addr, 0, sizeof *addr);
+  addr->sin_family = AF_INET;
+  addr->sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  for (port = FIRST_PORT; port < FIRST_PORT + NUM_PORTS; ++port) {
+    addr->sin_port = htons(port);
+    if (bind(fd, (struct sockaddr *) addr, sizeof *addr) == 0) {
+      if (listen(fd, 1) != 0) {
+        fprintf(stderr, "listen failed, errno %d\n", errno);
+        exit(1);
+      }
+      return port;
+    }
+  }
+  fprintf(stderr, "no free port from %d, errno %d\n", FIRST_PORT, errno);
+  exit(1);
+}
+
+static int CompareDouble(const void *a, const void *b) {
+  double x = *(const double *) a;
+  double y = *(const double *) b;
+  return x < y ? -1 : x > y;
+}
+
+int main(int argc, char **argv) {
+  const char *description = argc >= 2 ? argv[1] : "time";
+  struct sockaddr_in addr;
+  char buf[MSG_SIZE];
+  pthread_t server;
+  int listen_fd;
+  int fd;
+  double start;
+  double elapsed;
+  int i;
+
+  setvbuf(stdout, NULL, _IONBF, 0);
+  listen_fd = socket(AF_INET, SOCK_STREAM, 0);
+  fd = socket(AF_INET, SOCK_STREAM, 0);
+  if (listen_fd < 0 || fd < 0) {
+    fprintf(stderr, "socket failed, errno %d\n", errno);
+    return 1;
+  }
+  Listen(listen_fd, &addr);
+  if (pthread_create(&server, NULL, Server, &listen_fd) != 0) {
+    fprintf(stderr, "pthread_create failed\n");
+    return 1;
+  }
+  if (connect(fd, (struct sockaddr *) &addr, sizeof addr) != 0) {
+    fprintf(stderr, "connect failed, errno %d\n", errno);
+    return 1;
+  }
+  NoDelay(fd);
+  memset(buf, 'x', sizeof buf);
+
+  for (i = 0; i < WARMUP_REQUESTS; ++i) {
+    SendAll(fd, buf, sizeof buf);
+    if (!RecvAll(fd, buf, sizeof buf)) {
+      fprintf(stderr, "server closed the connection\n");
+      return 1;
+    }
+  }
+  start = Now();
+  for (i = 0; i < REQUESTS; ++i) {
+    double t = Now();
+    SendAll(fd, buf, sizeof buf);
+    if (!RecvAll(fd, buf, sizeof buf)) {
+      fprintf(stderr, "server closed the connection\n");
+      return 1;
+    }
+    g_latency[i] = Now() - t;
+  }
+  elapsed = Now() - start;
+
+  shutdown(fd, SHUT_WR);
+  pthread_join(server, NULL);
+  close(fd);
+  close(listen_fd);
+
+  qsort(g_latency, REQUESTS, sizeof g_latency[0], CompareDouble);
+  printf("RESULT LoopbackEchoRequests: %s= %.0f requests/sec\n",
+         description, REQUESTS / elapsed);
+  printf("RESULT LoopbackEchoP50: %s= %.3f microseconds\n",
+         description, g_latency[REQUESTS / 2] * 1e6);
+  printf("RESULT LoopbackEchoP99: %s= %.3f microseconds\n",
+         description, g_latency[REQUESTS * 99 / 100] * 1e6);
+  return 0;
+}
@@ -0,0 +1,86 @@
+/*
+ * Copyright (c) 2017 The Native Client Authors. All rights reserved.
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file.
+ */
+
+/*
+ * Measures mmap/munmap throughput for the patterns a cage's malloc and
+ * stdio produce: small and large anonymous mappings, and private mappings
+ * of a file.  Run once with the default Lind backend and once with
+ * "-L native" to compare the dispatcher's mapping path with the native
+ * one.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <time.h>
+#include <unistd.h>
+
+#define MAP_ITERATIONS 5000
+#define FILE_SIZE (1 << 20)
+
+static double Now(void) {
+  struct timespec ts;
+  if (clock_gettime(CLOCK_MONOTONIC, &ts) != 0) {
+    perror("clock_gettime");
+    exit(1);
+  }
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* mmap, touch the first page, munmap */
+static double TimeMapUnmap(size_t size, int fd) {
+  int flags = fd < 0 ? MAP_PRIVATE | MAP_ANONYMOUS : MAP_PRIVATE;
+  double start = Now();
+  int i;
+
+  for (i = 0; i < MAP_ITERATIONS; ++i) {
+    char *p = mmap(NULL, size, PROT_READ | PROT_WRITE, flags, fd, 0);
+    if (MAP_FAILED == p) {
+      fprintf(stderr, "mmap of %u bytes failed, errno %d\n",
+              (unsigned) size, errno);
+      exit(1);
+    }
+    p[0] = 1;
+    if (munmap(p, size) != 0) {
+      fprintf(stderr, "munmap failed, errno %d\n", errno);
+      exit(1);
+    }
+  }
+  return (Now() - start) / MAP_ITERATIONS;
+}
+
+int main(int argc, char **argv) {
+  const char *description = argc >= 2 ? argv[1] : "time";
+  const char *path = "mmap_throughput.tmp";
+  char *buf;
+  int fd;
+
+  setvbuf(stdout, NULL, _IONBF, 0);
+  printf("RESULT MmapMunmapAnon64K: %s= %.3f microseconds\n",
+         description, TimeMapUnmap(64 << 10, -1) * 1e6);
+  printf("RESULT MmapMunmapAnon1M: %s= %.3f microseconds\n",
+         description, TimeMapUnmap(1 << 20, -1) * 1e6);
+
+  fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0600);
+  if (fd < 0) {
+    fprintf(stderr, "could not create %s, errno %d\n", path, errno);
+    return 1;
+  }
+  buf = calloc(1, FILE_SIZE);
+  if (NULL == buf || write(fd, buf, FILE_SIZE) != FILE_SIZE) {
+    fprintf(stderr, "could not fill %s, errno %d\n", path, errno);
+    return 1;
+  }
+  free(buf);
+  printf("RESULT MmapMunmapFile64K: %s= %.3f microseconds\n",
+         description, TimeMapUnmap(64 << 10, fd) * 1e6);
+  close(fd);
+  unlink(path);
+  return 0;
+}
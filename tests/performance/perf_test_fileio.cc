@@ -0,0 +1,108 @@
+/*
+ * Copyright (c) 2017 The Native Client Authors. All rights reserved.
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file.
+ */
+
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "native_client/src/include/nacl_assert.h"
+#include "native_client/tests/performance/perf_test_runner.h"
+
+
+// These measure small regular-file operations, which is where the cost
+// of the Lind dispatcher dominates.  Run the test once with
+// "sel_ldr -L python" and once with "sel_ldr -L native" to compare the
+// two file I/O backends.
+
+static const char kFileName[] = "perf_test_fileio.tmp";
+static const size_t kFileSize = 4096;
+
+class FileTestBase : public PerfTest {
+ public:
+  explicit FileTestBase(size_t file_size = kFileSize) {
+    fd_ = open(kFileName, O_RDWR | O_CREAT | O_TRUNC, 0600);
+    ASSERT_GE(fd_, 0);
+    char *buf = (char *) malloc(file_size);
+    ASSERT_NE(buf, NULL);
+    memset(buf, 'x', file_size);
+    ASSERT_EQ(write(fd_, buf, file_size), (ssize_t) file_size);
+    free(buf);
+  }
+
+  ~FileTestBase() {
+    ASSERT_EQ(close(fd_), 0);
+    ASSERT_EQ(unlink(kFileName), 0);
+  }
+
+ protected:
+  int fd_;
+};
+
+class TestFileRead : public FileTestBase {
+ public:
+  virtual void run() {
+    char buf[64];
+    ASSERT_EQ(lseek(fd_, 0, SEEK_SET), 0);
+    ASSERT_EQ(read(fd_, buf, sizeof(buf)), (ssize_t) sizeof(buf));
+  }
+};
+PERF_TEST_DECLARE(TestFileRead)
+
+class TestFileWrite : public FileTestBase {
+ public:
+  virtual void run() {
+    char buf[64] = { 0 };
+    ASSERT_EQ(lseek(fd_, 0, SEEK_SET), 0);
+    ASSERT_EQ(write(fd_, buf, sizeof(buf)), (ssize_t) sizeof(buf));
+  }
+};
+PERF_TEST_DECLARE(TestFileWrite)
+
+class TestFileFstat : public FileTestBase {
+ public:
+  virtual void run() {
+    struct stat st;
+    ASSERT_EQ(fstat(fd_, &st), 0);
+    ASSERT_EQ(st.st_size, (off_t) kFileSize);
+  }
+};
+PERF_TEST_DECLARE(TestFileFstat)
+
+// Sequential read throughput at a fixed request size.  The reported time
+// per iteration is for one read of |kSize| bytes, so throughput is
+// kSize / time.  With the native Lind backend the data goes straight
+// from the host file into the untrusted buffer.
+template <size_t kSize>
+class FileReadThroughput : public FileTestBase {
+ public:
+  FileReadThroughput() : FileTestBase(kSize) {
+    buf_ = (char *) malloc(kSize);
+    ASSERT_NE(buf_, NULL);
+  }
+
+  ~FileReadThroughput() {
+    free(buf_);
+  }
+
+  virtual void run() {
+    ASSERT_EQ(lseek(fd_, 0, SEEK_SET), 0);
+    ASSERT_EQ(read(fd_, buf_, kSize), (ssize_t) kSize);
+  }
+
+ private:
+  char *buf_;
+};
+
+class TestFileRead4K : public FileReadThroughput<4 << 10> {};
+PERF_TEST_DECLARE(TestFileRead4K)
+
+class TestFileRead64K : public FileReadThroughput<64 << 10> {};
+PERF_TEST_DECLARE(TestFileRead64K)
+
+class TestFileRead1M : public FileReadThroughput<1 << 20> {};
+PERF_TEST_DECLARE(TestFileRead1M)
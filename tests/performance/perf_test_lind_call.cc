@@ -0,0 +1,31 @@
+/*
+ * Copyright (c) 2017 The Native Client Authors. All rights reserved.
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file.
+ */
+
+#include <stdint.h>
+
+#include "native_client/src/include/nacl_assert.h"
+#include "native_client/src/untrusted/nacl/syscall_bindings_trampoline.h"
+#include "native_client/tests/performance/perf_test_runner.h"
+
+
+// Measure what the Repy dispatcher costs per Lind call.  LIND_debug_noop
+// does no work of its own, so this is the price of marshaling the call
+// and its response and of the GIL.  Compare with TestLindSyscallPerCall,
+// whose getpid calls the runtime answers without reaching the dispatcher.
+// No backend call hook answers it, so it goes through the call buffer
+// only if the dispatcher has LindSyscallBuf and through LindSyscall's
+// objects otherwise: run it against each dispatcher to compare the two.
+
+// Keep in sync with LIND_debug_noop in lind_platform.h.
+static const uint32_t kLindNoop = 1;
+
+class TestLindNullCall : public PerfTest {
+ public:
+  virtual void run() {
+    ASSERT_GE(NACL_SYSCALL(lind_syscall)(kLindNoop, 0, NULL, 0, NULL), 0);
+  }
+};
+PERF_TEST_DECLARE(TestLindNullCall)
@@ -0,0 +1,71 @@
+/*
+ * Copyright (c) 2017 The Native Client Authors. All rights reserved.
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file.
+ */
+
+#include <stdint.h>
+#include <string.h>
+
+#include "native_client/src/include/nacl_assert.h"
+#include "native_client/src/trusted/service_runtime/include/sys/lind_ring.h"
+#include "native_client/src/untrusted/nacl/syscall_bindings_trampoline.h"
+#include "native_client/tests/performance/perf_test_runner.h"
+
+
+// Compare issuing Lind calls one at a time through NACL_sys_lind_syscall
+// with submitting them in batches through the Lind submission ring.  Each
+// iteration performs kBatchSize getpid calls either way, so the two
+// results are directly comparable as ops/sec.
+
+// Keep in sync with LIND_sys_getpid in lind_platform.h.
+static const uint32_t kLindGetpid = 31;
+static const uint32_t kBatchSize = 32;
+static const uint32_t kRingEntries = 64;
+
+class TestLindSyscallPerCall : public PerfTest {
+ public:
+  virtual void run() {
+    for (uint32_t i = 0; i < kBatchSize; ++i) {
+      ASSERT_GT(NACL_SYSCALL(lind_syscall)(kLindGetpid, 0, NULL, 0, NULL), 0);
+    }
+  }
+};
+PERF_TEST_DECLARE(TestLindSyscallPerCall)
+
+class TestLindSyscallRing : public PerfTest {
+ public:
+  TestLindSyscallRing() {
+    memset(&ring_, 0, sizeof(ring_));
+    memset(sqes_, 0, sizeof(sqes_));
+    ring_.entries = kRingEntries;
+    ring_.sqes = (uint32_t) (uintptr_t) sqes_;
+    ring_.cqes = (uint32_t) (uintptr_t) cqes_;
+  }
+
+  virtual void run() {
+    for (uint32_t i = 0; i < kBatchSize; ++i) {
+      struct NaClLindRingSqe *sqe =
+          &sqes_[(ring_.sq_tail + i) & (kRingEntries - 1)];
+      sqe->call_num = kLindGetpid;
+      sqe->user_data = i;
+    }
+    ring_.sq_tail += kBatchSize;
+    ASSERT_EQ(NACL_SYSCALL(lind_ring_enter)(&ring_, kBatchSize),
+              (int) kBatchSize);
+    ASSERT_EQ(ring_.sq_head, ring_.sq_tail);
+    for (uint32_t i = 0; i < kBatchSize; ++i) {
+      struct NaClLindRingCqe *cqe =
+          &cqes_[(ring_.cq_head + i) & (kRingEntries - 1)];
+      ASSERT_EQ(cqe->user_data, i);
+      ASSERT_GT(cqe->result, 0);
+    }
+    ring_.cq_head += kBatchSize;
+  }
+
+ private:
+  struct NaClLindRing ring_;
+  struct NaClLindRingSqe sqes_[kRingEntries];
+  struct NaClLindRingCqe cqes_[kRingEntries];
+};
+PERF_TEST_DECLARE(TestLindSyscallRing)
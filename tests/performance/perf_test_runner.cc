@@ -198,9 +198,21 @@ int main(int argc, char **argv) {
   RUN_TEST(TestMmapAnonymous);
   RUN_TEST(TestAtomicIncrement);
   RUN_TEST(TestUncontendedMutexLock);
+  RUN_TEST(TestContendedMutexLock);
   RUN_TEST(TestCondvarSignalNoOp);
   RUN_TEST(TestThreadCreateAndJoin);
   RUN_TEST(TestThreadWakeup);
+  RUN_TEST(TestFileRead);
+  RUN_TEST(TestFileWrite);
+  RUN_TEST(TestFileFstat);
+  RUN_TEST(TestFileRead4K);
+  RUN_TEST(TestFileRead64K);
+  RUN_TEST(TestFileRead1M);
+#if defined(__native_client__)
+  RUN_TEST(TestLindNullCall);
+  RUN_TEST(TestLindSyscallPerCall);
+  RUN_TEST(TestLindSyscallRing);
+#endif
 
 #if defined(__native_client__)
   // Test untrusted fault handling.  This should come last because, on
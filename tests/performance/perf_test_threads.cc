@@ -49,6 +49,48 @@ class TestUncontendedMutexLock : public PerfTest {
 };
 PERF_TEST_DECLARE(TestUncontendedMutexLock)
 
+// Lock and unlock a mutex that kNumThreads other threads are also
+// hammering, so that most lock calls wait in the futex and most unlock
+// calls have to wake a waiter.
+class TestContendedMutexLock : public PerfTest {
+ public:
+  TestContendedMutexLock() {
+    ASSERT_EQ(pthread_mutex_init(&mutex_, NULL), 0);
+    exit_ = false;
+    for (int i = 0; i < kNumThreads; ++i)
+      ASSERT_EQ(pthread_create(&tids_[i], NULL, Thread, this), 0);
+  }
+
+  ~TestContendedMutexLock() {
+    exit_ = true;
+    for (int i = 0; i < kNumThreads; ++i)
+      ASSERT_EQ(pthread_join(tids_[i], NULL), 0);
+    ASSERT_EQ(pthread_mutex_destroy(&mutex_), 0);
+  }
+
+  virtual void run() {
+    ASSERT_EQ(pthread_mutex_lock(&mutex_), 0);
+    ASSERT_EQ(pthread_mutex_unlock(&mutex_), 0);
+  }
+
+ private:
+  static const int kNumThreads = 4;
+
+  static void *Thread(void *thread_arg) {
+    TestContendedMutexLock *obj = (TestContendedMutexLock *) thread_arg;
+    while (!obj->exit_) {
+      ASSERT_EQ(pthread_mutex_lock(&obj->mutex_), 0);
+      ASSERT_EQ(pthread_mutex_unlock(&obj->mutex_), 0);
+    }
+    return NULL;
+  }
+
+  pthread_t tids_[kNumThreads];
+  pthread_mutex_t mutex_;
+  volatile bool exit_;
+};
+PERF_TEST_DECLARE(TestContendedMutexLock)
+
 // Test the overhead of pthread_cond_signal() on a condvar that no
 // thread is waiting on.
 class TestCondvarSignalNoOp : public PerfTest {
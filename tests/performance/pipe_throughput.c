@@ -0,0 +1,114 @@
+/*
+ * Copyright (c) 2017 The Native Client Authors. All rights reserved.
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file.
+ */
+
+/*
+ * Measures pipe throughput between two cages, the path a shell pipeline
+ * takes: a forked child writes 1 GB into a pipe and the parent reads it.
+ * Run with large and with small chunks, to show both the copy cost and
+ * the per-call cost.
+ */
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#define TOTAL_BYTES (1LL << 30)
+
+static double Now(void) {
+  struct timespec ts;
+  if (clock_gettime(CLOCK_MONOTONIC, &ts) != 0) {
+    perror("clock_gettime");
+    exit(1);
+  }
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void Writer(int fd, size_t chunk, long long total) {
+  char *buf = malloc(chunk);
+  long long done = 0;
+
+  if (NULL == buf) {
+    _exit(1);
+  }
+  memset(buf, 'x', chunk);
+  while (done < total) {
+    size_t n = total - done < (long long) chunk ? total - done : chunk;
+    ssize_t written = write(fd, buf, n);
+    if (written <= 0) {
+      fprintf(stderr, "write failed, errno %d\n", errno);
+      _exit(1);
+    }
+    done += written;
+  }
+  close(fd);
+  _exit(0);
+}
+
+/* Returns the throughput in MB/s. */
+static double TimeTransfer(size_t chunk, long long total) {
+  char *buf = malloc(chunk);
+  long long got = 0;
+  double start;
+  double elapsed;
+  int fds[2];
+  int status;
+  pid_t pid;
+
+  if (NULL == buf || pipe(fds) != 0) {
+    fprintf(stderr, "pipe failed, errno %d\n", errno);
+    exit(1);
+  }
+  start = Now();
+  pid = fork();
+  if (pid < 0) {
+    fprintf(stderr, "fork failed, errno %d\n", errno);
+    exit(1);
+  }
+  if (0 == pid) {
+    close(fds[0]);
+    Writer(fds[1], chunk, total);
+  }
+  close(fds[1]);
+  for (;;) {
+    ssize_t n = read(fds[0], buf, chunk);
+    if (n < 0) {
+      fprintf(stderr, "read failed, errno %d\n", errno);
+      exit(1);
+    }
+    if (0 == n) {
+      break;
+    }
+    got += n;
+  }
+  elapsed = Now() - start;
+  close(fds[0]);
+  if (waitpid(pid, &status, 0) != pid || !WIFEXITED(status) ||
+      WEXITSTATUS(status) != 0) {
+    fprintf(stderr, "writer failed\n");
+    exit(1);
+  }
+  if (got != total) {
+    fprintf(stderr, "read %lld bytes, expected %lld\n", got, total);
+    exit(1);
+  }
+  free(buf);
+  return total / elapsed / (1 << 20);
+}
+
+int main(int argc, char **argv) {
+  const char *description = argc >= 2 ? argv[1] : "time";
+
+  setvbuf(stdout, NULL, _IONBF, 0);
+  printf("RESULT PipeThroughput64K: %s= %.1f MB/s\n",
+         description, TimeTransfer(64 << 10, TOTAL_BYTES));
+  printf("RESULT PipeThroughput4K: %s= %.1f MB/s\n",
+         description, TimeTransfer(4 << 10, TOTAL_BYTES / 4));
+  return 0;
+}
@@ -0,0 +1,194 @@
+/*
+ * Copyright (c) 2017 The Native Client Authors. All rights reserved.
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file.
+ */
+
+/*
+ * Measures readiness polling over a server-sized descriptor set: 10000 idle
+ * sockets and 100 with data waiting.  poll and epoll_wait are given the
+ * whole set; select, which is limited to FD_SETSIZE, is given the active
+ * sockets and as many idle ones as fit.  Every call has a zero timeout, so
+ * the time is the cost of translating descriptors and scanning the set.
+ */
+
+#include <errno.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/epoll.h>
+#include <sys/resource.h>
+#include <sys/select.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+#define IDLE_SOCKETS 10000
+#define ACTIVE_SOCKETS 100
+#define POLL_ITERATIONS 1000
+
+static int g_active[ACTIVE_SOCKETS];
+static int g_idle[IDLE_SOCKETS];
+
+static double Now(void) {
+  struct timespec ts;
+  if (clock_gettime(CLOCK_MONOTONIC, &ts) != 0) {
+    perror("clock_gettime");
+    exit(1);
+  }
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void CheckReady(const char *call, int ready) {
+  if (ready != ACTIVE_SOCKETS) {
+    fprintf(stderr, "%s reported %d ready, expected %d, errno %d\n",
+            call, ready, ACTIVE_SOCKETS, errno);
+    exit(1);
+  }
+}
+
+/*
+ * Active sockets are made first so that they get the lowest numbers and
+ * fit in an fd_set.  Each is the read end of a pair with a byte written to
+ * the other end; idle sockets come in pairs with nothing written.
+ */
+static void MakeSockets(void) {
+  struct rlimit rl;
+  int sv[2];
+  int i;
+
+  if (getrlimit(RLIMIT_NOFILE, &rl) == 0 &&
+      rl.rlim_cur < IDLE_SOCKETS + 2 * ACTIVE_SOCKETS + 64) {
+    rl.rlim_cur = IDLE_SOCKETS + 2 * ACTIVE_SOCKETS + 64;
+    if (rl.rlim_max < rl.rlim_cur) {
+      rl.rlim_max = rl.rlim_cur;
+    }
+    setrlimit(RLIMIT_NOFILE, &rl);
+  }
+  for (i = 0; i < ACTIVE_SOCKETS; ++i) {
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, sv) != 0 ||
+        write(sv[1], "x", 1) != 1) {
+      fprintf(stderr, "could not make active socket %d, errno %d\n", i, errno);
+      exit(1);
+    }
+    g_active[i] = sv[0];
+  }
+  for (i = 0; i < IDLE_SOCKETS; i += 2) {
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, sv) != 0) {
+      fprintf(stderr, "could not make idle socket %d, errno %d\n", i, errno);
+      exit(1);
+    }
+    g_idle[i] = sv[0];
+    g_idle[i + 1] = sv[1];
+  }
+}
+
+static double TimeSelect(int *nfds_out) {
+  fd_set rfds;
+  int max_fd = -1;
+  int nfds = 0;
+  double start;
+  int i;
+  int j;
+
+  for (i = 0; i < ACTIVE_SOCKETS; ++i) {
+    if (g_active[i] > max_fd) {
+      max_fd = g_active[i];
+    }
+  }
+  for (j = 0; j < IDLE_SOCKETS && g_idle[j] < FD_SETSIZE; ++j) {
+    if (g_idle[j] > max_fd) {
+      max_fd = g_idle[j];
+    }
+  }
+  nfds = ACTIVE_SOCKETS + j;
+  *nfds_out = nfds;
+  start = Now();
+  for (i = 0; i < POLL_ITERATIONS; ++i) {
+    struct timeval tv = { 0, 0 };
+    int k;
+    FD_ZERO(&rfds);
+    for (k = 0; k < ACTIVE_SOCKETS; ++k) {
+      FD_SET(g_active[k], &rfds);
+    }
+    for (k = 0; k < j; ++k) {
+      FD_SET(g_idle[k], &rfds);
+    }
+    CheckReady("select", select(max_fd + 1, &rfds, NULL, NULL, &tv));
+  }
+  return (Now() - start) / POLL_ITERATIONS;
+}
+
+static double TimePoll(void) {
+  struct pollfd *pfds = calloc(IDLE_SOCKETS + ACTIVE_SOCKETS, sizeof *pfds);
+  double start;
+  int i;
+
+  if (NULL == pfds) {
+    perror("calloc");
+    exit(1);
+  }
+  /* one active socket, then IDLE_SOCKETS / ACTIVE_SOCKETS idle ones */
+  for (i = 0; i < IDLE_SOCKETS + ACTIVE_SOCKETS; ++i) {
+    int group = i / (IDLE_SOCKETS / ACTIVE_SOCKETS + 1);
+    if (i % (IDLE_SOCKETS / ACTIVE_SOCKETS + 1) == 0) {
+      pfds[i].fd = g_active[group];
+    } else {
+      pfds[i].fd = g_idle[i - group - 1];
+    }
+    pfds[i].events = POLLIN;
+  }
+  start = Now();
+  for (i = 0; i < POLL_ITERATIONS; ++i) {
+    CheckReady("poll", poll(pfds, IDLE_SOCKETS + ACTIVE_SOCKETS, 0));
+  }
+  start = (Now() - start) / POLL_ITERATIONS;
+  free(pfds);
+  return start;
+}
+
+static double TimeEpollWait(void) {
+  struct epoll_event events[ACTIVE_SOCKETS];
+  struct epoll_event ev;
+  double start;
+  int epfd;
+  int i;
+
+  epfd = epoll_create(IDLE_SOCKETS + ACTIVE_SOCKETS);
+  if (epfd < 0) {
+    fprintf(stderr, "epoll_create failed, errno %d\n", errno);
+    exit(1);
+  }
+  ev.events = EPOLLIN;
+  for (i = 0; i < IDLE_SOCKETS + ACTIVE_SOCKETS; ++i) {
+    ev.data.fd = i < ACTIVE_SOCKETS ? g_active[i] : g_idle[i - ACTIVE_SOCKETS];
+    if (epoll_ctl(epfd, EPOLL_CTL_ADD, ev.data.fd, &ev) != 0) {
+      fprintf(stderr, "epoll_ctl of %d failed, errno %d\n", ev.data.fd, errno);
+      exit(1);
+    }
+  }
+  start = Now();
+  for (i = 0; i < POLL_ITERATIONS; ++i) {
+    CheckReady("epoll_wait", epoll_wait(epfd, events, ACTIVE_SOCKETS, 0));
+  }
+  start = (Now() - start) / POLL_ITERATIONS;
+  close(epfd);
+  return start;
+}
+
+int main(int argc, char **argv) {
+  const char *description = argc >= 2 ? argv[1] : "time";
+  double t;
+  int nfds;
+
+  setvbuf(stdout, NULL, _IONBF, 0);
+  MakeSockets();
+  t = TimeSelect(&nfds);
+  printf("RESULT Select%dFds: %s= %.3f microseconds\n",
+         nfds, description, t * 1e6);
+  printf("RESULT Poll%dFds: %s= %.3f microseconds\n",
+         IDLE_SOCKETS + ACTIVE_SOCKETS, description, TimePoll() * 1e6);
+  printf("RESULT EpollWait%dFds: %s= %.3f microseconds\n",
+         IDLE_SOCKETS + ACTIVE_SOCKETS, description, TimeEpollWait() * 1e6);
+  return 0;
+}
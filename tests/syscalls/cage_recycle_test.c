@@ -0,0 +1,70 @@
+/*
+ * Copyright (c) 2017 The Native Client Authors. All rights reserved.
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file.
+ */
+
+/*
+ * Forks and reaps several times more cages than there are cage ids, one
+ * at a time, half of them after starting and joining a second thread.  A
+ * cage's id and sandbox are only given back once all of its threads are
+ * gone and it has been reaped, so this fails with EAGAIN from fork if
+ * that ever does not happen.
+ */
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+/* CAGE_MAX in nacl_globals.h is 1024 */
+#define NUM_CAGES (3 * 1024 + 17)
+
+static void *ThreadMain(void *arg) {
+  return arg;
+}
+
+static int ForkAndReap(int i) {
+  int status;
+  pid_t pid = fork();
+
+  if (pid < 0) {
+    fprintf(stderr, "fork %d failed, errno %d\n", i, errno);
+    return 0;
+  }
+  if (0 == pid) {
+    if (i & 1) {
+      pthread_t thread;
+
+      if (0 != pthread_create(&thread, NULL, ThreadMain, NULL) ||
+          0 != pthread_join(thread, NULL)) {
+        _exit(126);
+      }
+    }
+    _exit(i & 0x7f);
+  }
+  if (waitpid(pid, &status, 0) != pid) {
+    fprintf(stderr, "waitpid %d failed, errno %d\n", i, errno);
+    return 0;
+  }
+  if (!WIFEXITED(status) || WEXITSTATUS(status) != (i & 0x7f)) {
+    fprintf(stderr, "cage %d: bad exit status %#x\n", i, status);
+    return 0;
+  }
+  return 1;
+}
+
+int main(void) {
+  int i;
+
+  for (i = 0; i < NUM_CAGES; ++i) {
+    if (!ForkAndReap(i)) {
+      printf("cage recycling: FAIL after %d cages\n", i);
+      return 1;
+    }
+  }
+  printf("cage recycling: PASS\n");
+  return 0;
+}
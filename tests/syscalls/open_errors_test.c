@@ -0,0 +1,99 @@
+/*
+ * Copyright (c) 2017 The Native Client Authors. All rights reserved.
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file.
+ */
+
+/*
+ * Checks that a failed open returns its error to the cage and leaves the
+ * fd table as it was: the open syscall itself must return -ENOENT rather
+ * than binding an fd to the error, and no fd may be used up by any number
+ * of failed opens.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "native_client/src/untrusted/nacl/syscall_bindings_trampoline.h"
+
+#define NUM_FAILED_OPENS 2000
+
+static int g_errors;
+
+static void ExpectOpenError(char const *path, int flags, int expected) {
+  int rc = NACL_SYSCALL(open)(path, flags, 0600);
+
+  if (-expected != rc) {
+    fprintf(stderr, "open(%s, 0x%x) returned %d, expected %d\n",
+            path, flags, rc, -expected);
+    if (rc >= 0) {
+      close(rc);
+    }
+    ++g_errors;
+  }
+}
+
+int main(int ac, char **av) {
+  char const *test_file_dir = "/tmp/open_errors_test";
+  char file_name[PATH_MAX];
+  char missing_name[PATH_MAX];
+  int first_fd;
+  int fd;
+  int opt;
+  int i;
+
+  while (EOF != (opt = getopt(ac, av, "t:"))) {
+    switch (opt) {
+      case 't':
+        test_file_dir = optarg;
+        break;
+      default:
+        fprintf(stderr, "Usage: open_errors_test [-t test_temporary_dir]\n");
+        return 1;
+    }
+  }
+  snprintf(file_name, sizeof file_name, "%s/open_errors.dat", test_file_dir);
+  snprintf(missing_name, sizeof missing_name, "%s/no_such_file",
+           test_file_dir);
+
+  first_fd = open(file_name, O_RDWR | O_CREAT | O_TRUNC, 0600);
+  if (-1 == first_fd) {
+    fprintf(stderr, "open(%s) failed, errno %d\n", file_name, errno);
+    return 1;
+  }
+  close(first_fd);
+
+  for (i = 0; i < NUM_FAILED_OPENS; ++i) {
+    ExpectOpenError(missing_name, O_RDONLY, ENOENT);
+    ExpectOpenError(missing_name, O_WRONLY, ENOENT);
+    if (0 != g_errors) {
+      break;
+    }
+  }
+
+  /* through libc too */
+  errno = 0;
+  if (-1 != open(missing_name, O_RDONLY) || ENOENT != errno) {
+    fprintf(stderr, "libc open(%s) did not fail with ENOENT\n", missing_name);
+    ++g_errors;
+  }
+
+  /* the failed opens must not have used up the lowest free fd */
+  fd = open(file_name, O_RDONLY);
+  if (first_fd != fd) {
+    fprintf(stderr, "open after failed opens returned fd %d, expected %d\n",
+            fd, first_fd);
+    ++g_errors;
+  }
+  if (fd >= 0) {
+    close(fd);
+  }
+
+  unlink(file_name);
+  printf("open errors: %s\n", 0 == g_errors ? "PASS" : "FAIL");
+  return 0 == g_errors ? 0 : 1;
+}
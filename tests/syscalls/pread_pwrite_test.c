@@ -0,0 +1,176 @@
+/*
+ * Copyright (c) 2017 The Native Client Authors. All rights reserved.
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file.
+ */
+
+/*
+ * Stress test for the pread/pwrite syscalls.  Several threads share one
+ * descriptor and hammer disjoint records of a file with positional writes
+ * and read-backs while another thread watches the shared file position.
+ * Positional I/O must neither move that position nor land at the wrong
+ * offset.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "native_client/src/untrusted/nacl/syscall_bindings_trampoline.h"
+
+#define NUM_THREADS     8
+#define NUM_RECORDS     64   /* per thread */
+#define RECORD_SIZE     256
+#define NUM_ITERATIONS  50
+
+static const off_t kSentinelPos = 12345;
+
+static int g_fd;
+static volatile int g_done;
+static volatile int g_errors;
+
+static void RecordError(void) {
+  __sync_fetch_and_add(&g_errors, 1);
+}
+
+static off_t RecordOffset(int thread, int record) {
+  return ((off_t) thread * NUM_RECORDS + record) * RECORD_SIZE;
+}
+
+static void FillRecord(char *buf, int thread, int record, int iteration) {
+  int i;
+  for (i = 0; i < RECORD_SIZE; ++i) {
+    buf[i] = (char) (thread * 31 + record * 7 + iteration + i);
+  }
+}
+
+static void *WriterThread(void *arg) {
+  int thread = (int) (intptr_t) arg;
+  char expected[RECORD_SIZE];
+  char got[RECORD_SIZE];
+  int iteration;
+  int record;
+  int rc;
+
+  for (iteration = 0; iteration < NUM_ITERATIONS; ++iteration) {
+    for (record = 0; record < NUM_RECORDS; ++record) {
+      off_t offset = RecordOffset(thread, record);
+      FillRecord(expected, thread, record, iteration);
+      rc = NACL_SYSCALL(pwrite)(g_fd, expected, RECORD_SIZE, &offset);
+      if (RECORD_SIZE != rc) {
+        fprintf(stderr, "pwrite(thread %d, record %d) returned %d\n",
+                thread, record, rc);
+        RecordError();
+        return NULL;
+      }
+      rc = NACL_SYSCALL(pread)(g_fd, got, RECORD_SIZE, &offset);
+      if (RECORD_SIZE != rc) {
+        fprintf(stderr, "pread(thread %d, record %d) returned %d\n",
+                thread, record, rc);
+        RecordError();
+        return NULL;
+      }
+      if (0 != memcmp(expected, got, RECORD_SIZE)) {
+        fprintf(stderr, "record (thread %d, record %d, iteration %d)"
+                " read back wrong data\n", thread, record, iteration);
+        RecordError();
+      }
+    }
+  }
+  return NULL;
+}
+
+static void *PositionWatcherThread(void *arg) {
+  off_t pos;
+  (void) arg;
+  while (!g_done) {
+    pos = lseek(g_fd, 0, SEEK_CUR);
+    if (kSentinelPos != pos) {
+      fprintf(stderr, "file position moved to %lld\n", (long long) pos);
+      RecordError();
+      return NULL;
+    }
+  }
+  return NULL;
+}
+
+int main(int ac, char **av) {
+  char const *test_file_dir = "/tmp/pread_pwrite_test";
+  char test_file_name[PATH_MAX];
+  pthread_t writers[NUM_THREADS];
+  pthread_t watcher;
+  char expected[RECORD_SIZE];
+  char got[RECORD_SIZE];
+  int opt;
+  int thread;
+  int record;
+
+  while (EOF != (opt = getopt(ac, av, "t:"))) {
+    switch (opt) {
+      case 't':
+        test_file_dir = optarg;
+        break;
+      default:
+        fprintf(stderr, "Usage: pread_pwrite_test [-t test_temporary_dir]\n");
+        return 1;
+    }
+  }
+
+  snprintf(test_file_name, sizeof test_file_name, "%s/pread_pwrite.dat",
+           test_file_dir);
+  g_fd = open(test_file_name, O_RDWR | O_CREAT | O_TRUNC, 0600);
+  if (-1 == g_fd) {
+    fprintf(stderr, "open(%s) failed, errno %d\n", test_file_name, errno);
+    return 1;
+  }
+  if (kSentinelPos != lseek(g_fd, kSentinelPos, SEEK_SET)) {
+    fprintf(stderr, "lseek to sentinel failed, errno %d\n", errno);
+    return 1;
+  }
+
+  if (0 != pthread_create(&watcher, NULL, PositionWatcherThread, NULL)) {
+    fprintf(stderr, "pthread_create(watcher) failed\n");
+    return 1;
+  }
+  for (thread = 0; thread < NUM_THREADS; ++thread) {
+    if (0 != pthread_create(&writers[thread], NULL, WriterThread,
+                            (void *) (intptr_t) thread)) {
+      fprintf(stderr, "pthread_create(writer %d) failed\n", thread);
+      return 1;
+    }
+  }
+  for (thread = 0; thread < NUM_THREADS; ++thread) {
+    pthread_join(writers[thread], NULL);
+  }
+  g_done = 1;
+  pthread_join(watcher, NULL);
+
+  /* Every record must hold its owner's final pattern. */
+  for (thread = 0; thread < NUM_THREADS; ++thread) {
+    for (record = 0; record < NUM_RECORDS; ++record) {
+      off_t offset = RecordOffset(thread, record);
+      FillRecord(expected, thread, record, NUM_ITERATIONS - 1);
+      if (RECORD_SIZE != NACL_SYSCALL(pread)(g_fd, got, RECORD_SIZE, &offset)
+          || 0 != memcmp(expected, got, RECORD_SIZE)) {
+        fprintf(stderr, "final contents wrong at thread %d, record %d\n",
+                thread, record);
+        RecordError();
+      }
+    }
+  }
+  if (kSentinelPos != lseek(g_fd, 0, SEEK_CUR)) {
+    fprintf(stderr, "final file position is wrong\n");
+    RecordError();
+  }
+
+  close(g_fd);
+  unlink(test_file_name);
+  printf("pread/pwrite stress: %s\n", 0 == g_errors ? "PASS" : "FAIL");
+  return g_errors > 255 ? 255 : g_errors;
+}